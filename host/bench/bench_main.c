@@ -0,0 +1,144 @@
+/*
+ * Host runner for the kernel microbenchmarks.
+ *
+ *   kernel_bench [--samples N] [--runs N] [--baseline FILE [--update]]
+ *
+ * Every kernel is run --runs times and the fastest run is kept, which filters out
+ * scheduler noise. Without --baseline the results are only printed. With it they are
+ * compared with that file (ns/sample per kernel) and a kernel more than
+ * BENCH_REGRESSION_PERCENT slower fails the run; --update writes the file instead.
+ * Baselines are machine specific, keep one per machine and compare on that machine only.
+ */
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "kernel_bench.h"
+
+#define BENCH_DEFAULT_SAMPLES (1u << 20)
+#define BENCH_DEFAULT_RUNS 5
+#define BENCH_REGRESSION_PERCENT 20.0
+
+static uint32_t clock_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)(ts.tv_sec * 1000000000ull + ts.tv_nsec);
+}
+
+static double baseline_lookup(const char *path, const char *name)
+{
+    FILE *f = fopen(path, "r");
+    if (f == NULL)
+        return 0.0;
+
+    char line[128];
+    double value = 0.0;
+    while (fgets(line, sizeof(line), f))
+    {
+        char key[64];
+        double ns;
+        if (line[0] != '#' && sscanf(line, "%63s %lf", key, &ns) == 2 && strcmp(key, name) == 0)
+        {
+            value = ns;
+            break;
+        }
+    }
+    fclose(f);
+    return value;
+}
+
+static int baseline_write(const char *path, const kernel_bench_result_t *results, size_t count)
+{
+    FILE *f = fopen(path, "w");
+    if (f == NULL)
+        return -1;
+    fprintf(f, "# kernel ns/sample (host/bench, fastest of several runs)\n");
+    for (size_t i = 0; i < count; i++)
+        fprintf(f, "%s %.2f\n", results[i].name, kernel_bench_per_sample(&results[i]));
+    fclose(f);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t samples = BENCH_DEFAULT_SAMPLES;
+    int runs = BENCH_DEFAULT_RUNS;
+    const char *baseline = NULL;
+    int update = 0;
+    int usage = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--samples") == 0 && i + 1 < argc)
+            samples = strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc)
+            runs = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc)
+            baseline = argv[++i];
+        else if (strcmp(argv[i], "--update") == 0)
+            update = 1;
+        else
+            usage = 1;
+    }
+    if (usage || (update && baseline == NULL))
+    {
+        fprintf(stderr, "usage: %s [--samples N] [--runs N] [--baseline FILE [--update]]\n", argv[0]);
+        return 2;
+    }
+
+    kernel_bench_result_t best[KERNEL_BENCH_MAX_KERNELS];
+    size_t count = 0;
+    for (int run = 0; run < runs; run++)
+    {
+        kernel_bench_result_t results[KERNEL_BENCH_MAX_KERNELS];
+        size_t n = kernel_bench_run(results, KERNEL_BENCH_MAX_KERNELS, samples, clock_ns);
+        if (n == 0)
+        {
+            fprintf(stderr, "Cannot allocate %lu samples\n", (unsigned long)samples);
+            return 1;
+        }
+        for (size_t i = 0; i < n; i++)
+        {
+            if (run == 0 || results[i].ticks < best[i].ticks)
+                best[i] = results[i];
+        }
+        count = n;
+    }
+
+    if (baseline == NULL)
+    {
+        kernel_bench_print(best, count, "ns");
+        return 0;
+    }
+    if (update)
+    {
+        if (baseline_write(baseline, best, count) != 0)
+        {
+            fprintf(stderr, "Cannot write %s\n", baseline);
+            return 1;
+        }
+        kernel_bench_print(best, count, "ns");
+        printf("Baseline written to %s\n", baseline);
+        return 0;
+    }
+
+    int regressions = 0;
+    printf("%-22s %12s %12s %9s\n", "kernel", "ns/sample", "baseline", "change");
+    for (size_t i = 0; i < count; i++)
+    {
+        double now = kernel_bench_per_sample(&best[i]);
+        double base = baseline_lookup(baseline, best[i].name);
+        if (base <= 0.0)
+        {
+            printf("%-22s %12.2f %12s %9s\n", best[i].name, now, "-", "-");
+            continue;
+        }
+        double change = (now - base) / base * 100.0;
+        bool slower = change > BENCH_REGRESSION_PERCENT;
+        printf("%-22s %12.2f %12.2f %+8.1f%%%s\n", best[i].name, now, base, change, slower ? "  REGRESSION" : "");
+        regressions += slower;
+    }
+    return regressions ? 1 : 0;
+}
@@ -0,0 +1,231 @@
+/*
+ * Runs the sensor -> storage -> upload pipeline on the host without hardware.
+ *
+ * The drivers are the ones built for the target, only the sensor_hal backend differs:
+ * - SENSOR_TRACE=<file>: replay the exact register traffic (calibration included) of a trace
+ *   recorded on the device. Replay is unthrottled: the loop never sleeps and the recorded
+ *   timestamps drive the virtual clock, so a one hour trace finishes in well under a second.
+ * - otherwise: run SENSOR_EMU_ROUNDS rounds (default 20) against the register-level emulators,
+ *   paced like the sensor tasks at their fastest, and report how many bus transactions each sample
+ *   costs. The run fails when a device goes over its transaction or stale read budget.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "sensor_hal.h"
+#include "bmp280.h"
+#include "adxl345.h"
+#include "veml7700.h"
+#include "max6675.h"
+#include "project_config.h"
+#include "storage_manager.h"
+#include "upload_batch.h"
+#include "bus_stats.h"
+#include "i2c_master_bus.h"
+
+static const char *TAG = "REPLAY";
+
+typedef struct
+{
+    uint32_t samples;
+    uint32_t stored;
+    uint32_t failed;
+    uint32_t uploaded; // samples in frames
+    uint32_t frames;
+    size_t payload_bytes;
+} replay_counters_t;
+
+static replay_counters_t s_counters;
+
+#define EMU_DEFAULT_ROUNDS 20
+// The slowest converters: MAX6675 (220 ms) and VEML7700 (100 ms integration) at their minimum interval
+#define EMU_ROUND_INTERVAL_MS MAX6675_MIN_INTERVAL_MS
+
+// What the drivers may cost per sample on the bus, every result read has to see a new conversion
+static const struct
+{
+    float trans_per_sample;
+    uint32_t stale_reads;
+} s_emu_budget[SENSOR_HAL_DEV_COUNT] = {
+    [SENSOR_HAL_DEV_BMP280] = {8.0f, 0},   // forced mode trigger, 'measuring' polls, one burst read
+    [SENSOR_HAL_DEV_ADXL345] = {1.0f, 0},  // one 6-byte burst
+    [SENSOR_HAL_DEV_VEML7700] = {1.0f, 0}, // ALS register only
+    [SENSOR_HAL_DEV_MAX6675] = {1.0f, 0},  // one frame, read after the conversion
+    [SENSOR_HAL_DEV_HCSR04] = {0.0f, 0},   // not sampled here
+};
+
+// Prints the table, false if any device went over its budget
+static bool print_emulator_stats(uint32_t rounds)
+{
+    static const char *names[SENSOR_HAL_DEV_COUNT] = {"bmp280", "adxl345", "veml7700", "max6675", "hcsr04"};
+    bool ok = true;
+    printf("%-10s %8s %8s %8s %10s %8s %12s\n", "device", "trans", "writes", "reads", "bytes", "stale", "trans/sample");
+    for (int i = 0; i < SENSOR_HAL_DEV_COUNT; i++)
+    {
+        sensor_hal_emu_stats_t stats;
+        sensor_hal_emu_get_stats(i, &stats);
+        if (stats.transactions == 0)
+            continue;
+        double per_sample = rounds ? (double)stats.transactions / rounds : 0.0;
+        bool over = per_sample > s_emu_budget[i].trans_per_sample || stats.stale_reads > s_emu_budget[i].stale_reads;
+        printf("%-10s %8lu %8lu %8lu %10lu %8lu %12.1f%s\n", names[i], (unsigned long)stats.transactions,
+               (unsigned long)stats.writes, (unsigned long)stats.reads, (unsigned long)stats.bytes,
+               (unsigned long)stats.stale_reads, per_sample, over ? "  OVER BUDGET" : "");
+        if (over)
+        {
+            ESP_LOGE(TAG, "%s over budget: %.1f transactions per sample (max %.1f), %lu stale reads (max %lu)",
+                     names[i], per_sample, s_emu_budget[i].trans_per_sample, (unsigned long)stats.stale_reads,
+                     (unsigned long)s_emu_budget[i].stale_reads);
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+static void store_sample(const char *name, float value, bool valid)
+{
+    s_counters.samples++;
+    if (!valid)
+    {
+        s_counters.failed++;
+        return;
+    }
+
+    char line[128];
+    snprintf(line, sizeof(line), "%s;%lu;%.3f", name, (unsigned long)(sensor_hal_time_us() / 1000000), value);
+    if (storage_write_line(line))
+        s_counters.stored++;
+}
+
+// upload_batch transport standing in for the broker: frames are counted, acknowledged at once
+static bool count_frame(const char *topic, const uint8_t *frame, size_t len, uint16_t count,
+                        storage_cursor_t first, void *ctx)
+{
+    s_counters.frames++;
+    s_counters.uploaded += count;
+    s_counters.payload_bytes += len;
+    return true;
+}
+
+// Same segment draining and frame encoding as publish_storage_via_mqtt, with the broker left out
+static void upload_stored(void)
+{
+    storage_seal();
+    upload_batch_begin("user/host", count_frame, NULL);
+
+    static char buf[STORAGE_READER_BUF_SIZE];
+    storage_segment_t seg;
+    while (storage_segment_next_pending(&seg))
+    {
+        storage_reader_t reader;
+        storage_reader_open(&reader, buf, sizeof(buf), (storage_cursor_t){.segment = seg.id}, seg.id, false);
+        char *line;
+        size_t len;
+        storage_cursor_t at = storage_reader_tell(&reader);
+        while (storage_reader_next(&reader, &line, &len))
+        {
+            upload_batch_add(line, len, at);
+            at = storage_reader_tell(&reader);
+        }
+        storage_reader_close(&reader);
+        if (reader.error)
+            break;
+        upload_batch_flush_all();
+        storage_segment_mark_uploaded(seg.id);
+    }
+}
+
+void app_main(void)
+{
+    const char *path = getenv("SENSOR_TRACE");
+    const char *rounds_env = getenv("SENSOR_EMU_ROUNDS");
+    bool emulate = path == NULL;
+    uint32_t max_rounds = rounds_env != NULL ? strtoul(rounds_env, NULL, 10) : EMU_DEFAULT_ROUNDS;
+
+    if (emulate)
+        sensor_hal_emu_start(NULL);
+    else if (sensor_hal_replay_open(path, false) != ESP_OK)
+        exit(1);
+
+    storage_init();
+    storage_clear_all();
+    i2c_bus_manager_init();
+
+    // Buses do not exist on the host, the replay backend ignores the handle
+    bool bmp280 = bmp280_init(NULL, BMP280_ADDR) == ESP_OK || bmp280_init(NULL, BMP280_ADDR_ALT) == ESP_OK;
+    bool adxl345 = adxl345_init(NULL) == ESP_OK;
+    bool veml7700 = veml7700_init(NULL) == ESP_OK;
+    bool max6675 = max6675_init() == ESP_OK;
+    if (bmp280)
+        bmp280_configure();
+    if (adxl345)
+        adxl345_configure();
+    if (veml7700)
+        veml7700_wake_up();
+
+    // Count only the sampling loop, not probing and calibration
+    if (emulate)
+        sensor_hal_emu_reset_stats();
+
+    int64_t wall_start = esp_timer_get_time();
+    uint32_t rounds = 0;
+    while (emulate ? rounds < max_rounds : !sensor_hal_replay_finished())
+    {
+        // Before every round, the first one included: right after init no conversion has finished yet
+        if (emulate)
+            vTaskDelay(pdMS_TO_TICKS(EMU_ROUND_INTERVAL_MS));
+        if (bmp280)
+        {
+            bmp280_trigger_forced_mode();
+            float temp = bmp280_read_temp();
+            store_sample("BMP280", temp, temp != -100.0f);
+        }
+        if (veml7700)
+        {
+            float lux = veml7700_read_lux();
+            store_sample("VEML7700", lux, lux >= 0.0f);
+        }
+        if (max6675)
+        {
+            float engine = max6675_read_celsius();
+            store_sample("MAX6675_NORMAL", engine, engine != -1.0f);
+        }
+        if (adxl345)
+        {
+            float accel = adxl345_read_data();
+            store_sample("ADXL345", accel, accel != -1.0f);
+        }
+
+        // Upload in batches like the MQTT task does after reconnecting
+        if (++rounds % 100 == 0)
+            upload_stored();
+
+        if (!bmp280 && !veml7700 && !max6675 && !adxl345)
+            break;
+    }
+    upload_stored();
+    int64_t wall_us = esp_timer_get_time() - wall_start;
+
+    if (emulate)
+    {
+        ESP_LOGI(TAG, "%lu rounds against the emulators in %.3f s", (unsigned long)rounds, wall_us / 1e6);
+        bool within_budget = print_emulator_stats(rounds);
+        exit(s_counters.stored > 0 && within_budget ? 0 : 1);
+    }
+
+    int64_t virtual_us = sensor_hal_replay_duration_us();
+    ESP_LOGI(TAG, "%lu samples (%lu stored, %lu failed), %lu uploaded in %lu frames, %zu payload bytes",
+             (unsigned long)s_counters.samples, (unsigned long)s_counters.stored, (unsigned long)s_counters.failed,
+             (unsigned long)s_counters.uploaded, (unsigned long)s_counters.frames, s_counters.payload_bytes);
+    ESP_LOGI(TAG, "Recorded %.1f s replayed in %.3f s (x%.0f)", virtual_us / 1e6, wall_us / 1e6,
+             wall_us > 0 ? (double)virtual_us / wall_us : 0.0);
+    bus_stats_print();
+
+    sensor_hal_replay_close();
+    exit(s_counters.stored > 0 ? 0 : 1);
+}
@@ -0,0 +1,132 @@
+/*
+ * Runs storage_bench against the linux build of storage_manager: same writer task, segments,
+ * compression and rollups as on the device, with a directory standing in for the card.
+ *
+ * - STORAGE_BENCH="RECORDS SIZE RATE_HZ SYNC_EVERY": one run
+ * - otherwise a matrix of record sizes and sync policies, unpaced
+ * - STORAGE_BENCH_BASELINE=<file>: compare records/s and p99 with a stored baseline, a run more
+ *   than BENCH_REGRESSION_PERCENT slower (or with a p99 more than twice the baseline) fails;
+ *   STORAGE_BENCH_UPDATE=1 rewrites the baseline instead. Baselines are machine specific.
+ */
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "storage_manager.h"
+#include "storage_bench.h"
+
+#define BENCH_RECORDS 20000
+#define BENCH_REGRESSION_PERCENT 20.0
+#define BENCH_MAX_RUNS 8
+
+static const uint32_t s_sizes[] = {32, 128, 400};
+static const uint32_t s_syncs[] = {0, 100};
+
+// Key of a run in the baseline file: SIZE/RATE/SYNC
+static void run_key(const storage_bench_result_t *r, char *key, size_t len)
+{
+    snprintf(key, len, "%lu/%lu/%lu", (unsigned long)r->config.record_size, (unsigned long)r->config.rate_hz,
+             (unsigned long)r->config.sync_every);
+}
+
+static bool baseline_lookup(const char *path, const char *key, double *rate, double *p99)
+{
+    FILE *f = fopen(path, "r");
+    if (f == NULL)
+        return false;
+
+    char line[128];
+    bool found = false;
+    while (!found && fgets(line, sizeof(line), f))
+    {
+        char name[64];
+        if (line[0] != '#' && sscanf(line, "%63s %lf %lf", name, rate, p99) == 3 && strcmp(name, key) == 0)
+            found = true;
+    }
+    fclose(f);
+    return found;
+}
+
+static int baseline_write(const char *path, const storage_bench_result_t *results, size_t count)
+{
+    FILE *f = fopen(path, "w");
+    if (f == NULL)
+        return -1;
+    fprintf(f, "# size/rate/sync records/s p99_us (host/storage_bench)\n");
+    for (size_t i = 0; i < count; i++)
+    {
+        char key[48];
+        run_key(&results[i], key, sizeof(key));
+        fprintf(f, "%s %.0f %lu\n", key, storage_bench_rate(&results[i]), (unsigned long)results[i].p99_us);
+    }
+    fclose(f);
+    return 0;
+}
+
+void app_main(void)
+{
+    storage_init();
+    storage_clear_all();
+
+    storage_bench_config_t configs[BENCH_MAX_RUNS];
+    size_t count = 0;
+    const char *single = getenv("STORAGE_BENCH");
+    if (single != NULL)
+    {
+        unsigned long records, size, rate, sync_every;
+        if (sscanf(single, "%lu %lu %lu %lu", &records, &size, &rate, &sync_every) != 4)
+        {
+            fprintf(stderr, "STORAGE_BENCH=\"RECORDS SIZE RATE_HZ SYNC_EVERY\"\n");
+            exit(2);
+        }
+        configs[count++] = (storage_bench_config_t){records, size, rate, sync_every};
+    }
+    else
+    {
+        for (size_t i = 0; i < sizeof(s_sizes) / sizeof(s_sizes[0]); i++)
+            for (size_t j = 0; j < sizeof(s_syncs) / sizeof(s_syncs[0]); j++)
+                configs[count++] = (storage_bench_config_t){BENCH_RECORDS, s_sizes[i], 0, s_syncs[j]};
+    }
+
+    storage_bench_result_t results[BENCH_MAX_RUNS];
+    for (size_t i = 0; i < count; i++)
+    {
+        if (!storage_bench_run(&configs[i], &results[i]))
+        {
+            fprintf(stderr, "Record size out of range (%d..%d)\n", STORAGE_BENCH_MIN_RECORD, STORAGE_BENCH_MAX_RECORD);
+            exit(2);
+        }
+        storage_clear_all(); // every run starts on an empty card
+    }
+    storage_bench_print(results, count);
+
+    const char *baseline = getenv("STORAGE_BENCH_BASELINE");
+    if (baseline == NULL)
+        exit(0);
+    if (getenv("STORAGE_BENCH_UPDATE") != NULL)
+    {
+        if (baseline_write(baseline, results, count) != 0)
+        {
+            fprintf(stderr, "Cannot write %s\n", baseline);
+            exit(1);
+        }
+        printf("Baseline written to %s\n", baseline);
+        exit(0);
+    }
+
+    int regressions = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        char key[48];
+        double base_rate, base_p99;
+        run_key(&results[i], key, sizeof(key));
+        if (!baseline_lookup(baseline, key, &base_rate, &base_p99) || base_rate <= 0.0)
+            continue;
+        double change = (storage_bench_rate(&results[i]) - base_rate) / base_rate * 100.0;
+        bool slower = change < -BENCH_REGRESSION_PERCENT || results[i].p99_us > 2 * base_p99 + 1;
+        printf("%-12s %+8.1f%% records/s, p99 %lu us (baseline %.0f)%s\n", key, change,
+               (unsigned long)results[i].p99_us, base_p99, slower ? "  REGRESSION" : "");
+        regressions += slower;
+    }
+    exit(regressions ? 1 : 0);
+}
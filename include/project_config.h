@@ -16,10 +16,13 @@
 /* --- I2C for BMP280 & ADXL345 --- */
 #define I2C_PORT_0_SDA_PIN 21
 #define I2C_PORT_0_SCL_PIN 22
+// Fast mode needs the breakout boards' 10k pull-ups, the internal ones only hold 100 kHz
+#define I2C_BUS_0_MAX_SPEED_HZ 400000
 
 /* --- I2C for VEML7700 --- */
 #define I2C_PORT_1_SDA_PIN 25
 #define I2C_PORT_1_SCL_PIN 26
+#define I2C_BUS_1_MAX_SPEED_HZ 400000
 
 /* --- SPI for MAX6675 and SDcard Adapter --- */
 #define SPI_HOST_USED      SPI2_HOST 
@@ -30,6 +33,58 @@
 #define CS_MAX6675_PIN     15
 #define CS_SD_CARD_PIN      5
 
+/* --- SD card log writer --- */
+// FAT allocation unit of the card, the writer task fills one block per write
+#define STORAGE_BLOCK_SIZE (16 * 1024)
+// Ring buffer between storage_write_line callers and the writer task, one block being written plus one filling
+#define STORAGE_QUEUE_SIZE (2 * STORAGE_BLOCK_SIZE)
+// Longest a record stays in RAM before it is written and fsync'ed
+#define STORAGE_FLUSH_AGE_MS 1000
+// Writes stop below this much free space
+#define STORAGE_MIN_FREE_BYTES 512
+// Segment files the log rotates through, a multiple of the block size; the unit of upload and retention
+#define STORAGE_SEGMENT_SIZE (256 * 1024)
+// Retention: oldest segments (uploaded ones first) are deleted below this free space. The manifest keeps
+// 36 bytes of RAM per segment (144 KB per GB of log) and grows in steps of this many entries
+#define STORAGE_RETENTION_MIN_FREE_BYTES (4 * STORAGE_SEGMENT_SIZE)
+#define STORAGE_SEGMENT_TABLE_STEP 64
+// Slots of the index file, one per segment id modulo this; a segment whose slot was taken over is
+// queried as a whole
+#define STORAGE_INDEX_SLOTS 1024
+// Granularity of the block index of a segment, a time query reads at least this much of a segment
+#define STORAGE_INDEX_STRIDE 4096
+// Sealed segments are recompressed (LZSS) in blocks of STORAGE_INDEX_STRIDE raw bytes with this
+// window; every log reader carries one window for decoding
+#define STORAGE_LZ_WINDOW 1024
+// Without a card the writer logs its blocks to this data partition (raw sectors, no file system) and
+// retries the card this often; the log moves to the card once it is mounted
+#define STORAGE_FLASH_PARTITION "storage"
+#define STORAGE_CARD_RETRY_MS (10 * 1000)
+// Capture sessions write their samples in blocks of whole 512-byte sectors, one DMA-capable block per session
+#define STORAGE_CAPTURE_BLOCK 4096
+// Chunk buffer of the log readers (console, MQTT upload), longer records are skipped
+#define STORAGE_READER_BUF_SIZE 512
+// Rollups: min/max/mean of every sensor over these periods (s), one ring file per period holding this
+// many 20-byte records (7 sensors: a day of 10 s, a week of 1 min, two years of 1 h - 5 MB in all)
+#define STORAGE_ROLLUP_PERIODS_S {10, 60, 3600}
+#define STORAGE_ROLLUP_CAPACITY {7 * 8640, 7 * 7 * 1440, 7 * 2 * 8760}
+// Uploaded raw segments are deleted once their newest record is this much older than the newest
+// record of the log, history beyond it comes from the rollups
+#define STORAGE_RAW_MAX_AGE_S (14 * 24 * 3600)
+
+// Upper bound for a single I2C transaction (a 24-byte burst at 100 kHz takes ~3 ms)
+#define I2C_TRANSACTION_TIMEOUT_MS 50
+// Upper bound for waiting on the bus manager before a transaction gives up
+#define I2C_BUS_ACQUIRE_TIMEOUT_MS 200
+// Transfers the I2C driver may queue per bus, > 0 makes transfers complete from the ISR (async reads), 0 blocks in the driver
+#define I2C_BUS_TRANS_QUEUE_DEPTH 4
+// Raw sensor transactions recorded by the "trace start" console command, replayed on the host
+#define SENSOR_HAL_TRACE_PATH "/sdcard/trace.bin"
+// Transactions wait here for the trace writer task, dropped (and counted) when it falls behind
+#define SENSOR_HAL_TRACE_BUFFER_SIZE (8 * 1024)
+// Input length of the "bench" console command, 20 bytes of heap per sample
+#define KERNEL_BENCH_TARGET_SAMPLES 2048
+
 /* --- Measurement timing config --- */ // TODO INCONSISTENT NAMING
 #define STARTUP_DELAY_MS 500
 #define BMP280_MEASUREMENT_INTERVAL_MS 1 * 1000
@@ -38,6 +93,9 @@
 #define MAX6675_PROFILE_INTERVAL_MS 500
 #define FREQUENT_MEASUREMENT_INTERVAL_MS 1000
 #define SENSOR_MEASUREMENT_FAIL_INTERVAL_MS 2000
+// Sensor fault supervisor: failures before a device is taken offline, backoff ceiling
+#define SENSOR_HEALTH_OFFLINE_THRESHOLD 3
+#define SENSOR_HEALTH_MAX_BACKOFF_MS (5 * 60 * 1000)
 
 #define HCSR04_SLOWMODE_INTERVAL_MS 5000
 #define HCSR04_FASTMODE_INTERVAL_MS 500
@@ -45,12 +103,60 @@
 
 #define MAX6675_PROFILE_SAMPLES_COUNT 100
 
+/* --- Adaptive sampling (interval bounds, deadband in sensor units, rate threshold in units/s) --- */
+#define ADAPTIVE_STABLE_SAMPLES 5
+
+#define BMP280_MIN_INTERVAL_MS (500)
+#define BMP280_MAX_INTERVAL_MS (30 * 1000)
+#define BMP280_DEADBAND 0.1f       // °C
+#define BMP280_RATE_THRESHOLD 0.2f // °C/s
+
+#define VEML7700_MIN_INTERVAL_MS (250)
+#define VEML7700_MAX_INTERVAL_MS (10 * 1000)
+#define VEML7700_DEADBAND 5.0f        // lux
+#define VEML7700_RATE_THRESHOLD 50.0f // lux/s
+
+#define MAX6675_MIN_INTERVAL_MS (250) // MAX6675 conversion time is ~220 ms
+#define MAX6675_MAX_INTERVAL_MS (60 * 1000)
+#define MAX6675_DEADBAND 0.5f       // °C
+#define MAX6675_RATE_THRESHOLD 2.0f // °C/s, one 0.25 °C LSB per 250 ms is only 1 °C/s
+
+#define ADXL345_MIN_INTERVAL_MS (100)
+#define ADXL345_MAX_INTERVAL_MS (10 * 1000)
+#define ADXL345_DEADBAND 0.3f       // m/s2
+#define ADXL345_RATE_THRESHOLD 3.0f // m/s2 per s
+
 // Experiment: save-first-N samples to persistent storage (drop-new policy)
 #define ADXL_SAVE_LIMIT 20
 #define MAX6675_SAVE_LIMIT 20
 
 // MQTT broker used for flushing stored samples (change as needed)
 #define MQTT_BROKER_URI "mqtt://10.87.216.41:1883"
+// Stored samples go up in binary batches of at most this many bytes per packet (topic included),
+// not above the client's buffer (1024 by default) nor the broker's maximum packet size
+#define MQTT_UPLOAD_MAX_PACKET 1024
+// QUERY / ROLLUP answers stop after this many lines, the done message then ends in ";truncated"
+#define MQTT_QUERY_MAX_RESULTS 1000
+// The upload waits while the client's outbox holds more than this
+#define MQTT_UPLOAD_OUTBOX_BYTES (8 * 1024)
+// Batches sent as QoS 1 and not acknowledged yet, the upload waits when all are taken
+#define MQTT_UPLOAD_INFLIGHT 16
+// The resume point of the upload goes to the manifest after this many acknowledged batches
+#define MQTT_UPLOAD_CURSOR_SAVE_EVERY 16
+// Live telemetry on user/<mac>/live: every tick the sensors that are due go out in one message,
+// a sensor is due after its interval once it moved by its deadband, after the heartbeat anyway
+#define MQTT_LIVE_TICK_MS 1000
+#define MQTT_LIVE_HEARTBEAT_MS (60 * 1000)
+// Ticks waiting for the connection, the oldest are dropped beyond this
+#define MQTT_LIVE_QUEUE_LEN 8
+#define BMP280_LIVE_INTERVAL_MS (10 * 1000)
+#define VEML7700_LIVE_INTERVAL_MS (5 * 1000)
+#define MAX6675_LIVE_INTERVAL_MS (2 * 1000)
+#define ADXL345_LIVE_INTERVAL_MS 1000
+#define HCSR04_LIVE_INTERVAL_MS 1000
+#define HCSR04_LIVE_DEADBAND 2.0f // cm
+// Period of the task CPU / stack report published on user/<mac>/stats/tasks
+#define TASK_STATS_PUBLISH_INTERVAL_MS (60 * 1000)
 
 
 #define HCSR04_TRIGGER_COUNT 3
@@ -9,14 +9,13 @@
 #include "esp_log.h"   // logowanie wiadomosci
 #include "nvs_flash.h" // pamiec flash
 
-#include "driver/i2c_master.h" // Required for i2c_config_t, I2C_MODE_MASTER, i2c_driver_install
 #include "driver/gpio.h"       // Required for GPIO_PULLUP_ENABLE
 #include "driver/spi_master.h" // <--- Add this include at the top
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 
-// #include "i2c_master_bus.h"
+#include "i2c_master_bus.h"
 // #include "spi_master_bus.h"
 
 #include "storage_manager.h"
@@ -37,6 +36,14 @@
 #include "mqtt_client_app.h"
 
 #include "buzzer.h"
+#include "metrics.h"
+#include "task_plan.h"
+#include "task_stats.h"
+#include "bus_stats.h"
+#include "sensor_hal.h"
+#include "kernel_bench.h"
+#include "storage_bench.h"
+#include "esp_cpu.h"
 
 // Console tag
 static const char *TAG = "app_main";
@@ -52,36 +59,6 @@ typedef struct
 
 
 
-i2c_master_bus_handle_t i2c_initialize_master(int sda, int scl)
-{
-  i2c_master_bus_handle_t bus_handle = NULL;
-
-  i2c_master_bus_config_t i2c_bus_config = {
-      .i2c_port = -1, // Use -1 for auto-assignment
-      .sda_io_num = sda,
-      .scl_io_num = scl,
-      .clk_source = I2C_CLK_SRC_DEFAULT,
-      .glitch_ignore_cnt = 7,
-      .flags.enable_internal_pullup = true,
-  };
-
-  printf("Attempting Init: SDA=%d SCL=%d\n", sda, scl);
-  fflush(stdout);
-
-  esp_err_t err = i2c_new_master_bus(&i2c_bus_config, &bus_handle);
-
-  if (err != ESP_OK)
-  {
-    printf("ERROR: I2C Init Failed: %s\n", esp_err_to_name(err));
-    fflush(stdout);
-    abort(); // Reset so we see the error
-  }
-
-  printf("I2C Init Success. Handle: %p\n", bus_handle);
-  fflush(stdout);
-  return bus_handle;
-}
-
 esp_err_t spi_initialize_master(int miso, int mosi, int sck)
 {
   spi_bus_config_t buscfg = {
@@ -97,7 +74,7 @@ esp_err_t spi_initialize_master(int miso, int mosi, int sck)
   return ESP_OK;
 }
 
-void initialize_devices_test(i2c_master_bus_handle_t bus_handle_0, i2c_master_bus_handle_t bus_handle_1)
+void initialize_devices_test(i2c_bus_handle_t bus_handle_0, i2c_bus_handle_t bus_handle_1)
 {
   if (bus_handle_0 == NULL || bus_handle_1 == NULL)
   {
@@ -127,11 +104,16 @@ void initialize_devices_test(i2c_master_bus_handle_t bus_handle_0, i2c_master_bu
   ESP_LOGI(TAG, "Devices initialized.");
 }
 
+static uint32_t bench_cycle_count(void)
+{
+  return esp_cpu_get_cycle_count();
+}
+
 void configure_device_defaults(void)
 {
   bmp280_configure();
   adxl345_configure();
-  veml7700_wake_up(NULL);
+  veml7700_wake_up();
   ESP_LOGI(TAG, "Devices configured with default settings.");
 }
 
@@ -183,8 +165,9 @@ void get_line_from_console(char *buffer, size_t max_len)
 
 void app_main(void)
 {
-  i2c_master_bus_handle_t i2c_bus_0 = i2c_initialize_master(I2C_PORT_0_SDA_PIN, I2C_PORT_0_SCL_PIN);
-  i2c_master_bus_handle_t i2c_bus_1 = i2c_initialize_master(I2C_PORT_1_SDA_PIN, I2C_PORT_1_SCL_PIN);
+  i2c_bus_manager_init();
+  i2c_bus_handle_t i2c_bus_0 = i2c_bus_get(I2C_BUS_0);
+  i2c_bus_handle_t i2c_bus_1 = i2c_bus_get(I2C_BUS_1);
   spi_initialize_master(SPI_MISO_PIN, SPI_MOSI_PIN, SPI_SCK_PIN);
   
   init_nvs();
@@ -208,11 +191,21 @@ void app_main(void)
   hcsr04_start_task(&hcsr04_distance);
   max6675_start_profile_task(&max6675_engine_temp);
 
-  mqtt_client_start();
+  // Live telemetry: the latest values the sensor tasks write above, deadbands of the adaptive sampling
+  const mqtt_live_sensor_t live_sensors[] = {
+      {"BMP280", &bmp280_temp, BMP280_LIVE_INTERVAL_MS, BMP280_DEADBAND},
+      {"VEML7700", &veml7700_illuminance, VEML7700_LIVE_INTERVAL_MS, VEML7700_DEADBAND},
+      {"MAX6675_NORMAL", &max6675_engine_temp, MAX6675_LIVE_INTERVAL_MS, MAX6675_DEADBAND},
+      {"ADXL345", &adxl345_acceleration, ADXL345_LIVE_INTERVAL_MS, ADXL345_DEADBAND},
+      {"HC-SR04", &hcsr04_distance, HCSR04_LIVE_INTERVAL_MS, HCSR04_LIVE_DEADBAND},
+  };
+  mqtt_client_start(live_sensors, sizeof(live_sensors) / sizeof(live_sensors[0]));
 
   buzzer_init(GPIO_NUM_18);
   buzzer_beep(500);
   button_init();
+  task_stats_start();
+  task_plan_report();
 
   // bool wifi_credentials = wifi_check_credentials();
   // if (wifi_credentials){
@@ -234,22 +227,124 @@ void app_main(void)
 
     if (strcmp(input_line, "read") == 0)
     {
-      // Używamy funkcji z modułu
-      char *content = storage_read_all();
-      if (content)
+      // Strumieniowo, po jednej linii - log może być większy niż wolna pamięć
+      static char read_buf[STORAGE_READER_BUF_SIZE];
+      static storage_reader_t reader;
+      char *line;
+      unsigned lines = 0;
+      storage_sync();
+      storage_reader_open(&reader, read_buf, sizeof(read_buf), STORAGE_CURSOR_OLDEST, STORAGE_READ_TO_HEAD, true);
+      while (storage_reader_next(&reader, &line, NULL))
       {
-        printf("\n--- NOTATKI ---\n%s\n---------------\n", content);
-        free(content);
+        if (lines++ == 0)
+          printf("\n--- NOTATKI ---\n");
+        printf("%s\n", line);
       }
+      storage_reader_close(&reader);
+      if (lines > 0)
+        printf("---------------\n");
       else
-      {
         printf(">> Pusto.\n");
-      }
     }
     else if (strcmp(input_line, "free") == 0)
     {
       printf(">> Wolne: %zu bajtów\n", storage_get_free_space());
     }
+    else if (strcmp(input_line, "storage") == 0)
+    {
+      storage_stats_t st;
+      storage_get_stats(&st);
+      printf(">> records %lu, dropped %lu, queued %lu B, blocks %lu, fsync %lu, errors %lu, written %llu B, slowest write %lu us\n",
+             (unsigned long)st.records, (unsigned long)st.dropped, (unsigned long)st.queued, (unsigned long)st.blocks,
+             (unsigned long)st.syncs, (unsigned long)st.write_errors, (unsigned long long)st.bytes,
+             (unsigned long)st.max_write_us);
+      static const char *const tiers[] = {"RAM", "flash", "SD"};
+      printf(">> writing to %s, %lu B on flash waiting for the card, flash sectors erased up to %lu times\n",
+             tiers[st.tier], (unsigned long)st.flash_pending, (unsigned long)st.flash_erases);
+      if (st.packed_segments > 0)
+        printf(">> compressed %lu segments, %llu -> %llu B (%.1f%%)\n", (unsigned long)st.packed_segments,
+               (unsigned long long)st.packed_raw, (unsigned long long)st.packed_bytes,
+               100.0 * st.packed_bytes / st.packed_raw);
+    }
+    else if (strncmp(input_line, "storage bench", 13) == 0)
+    {
+      // storage bench LINIE ROZMIAR CZĘSTOTLIWOŚĆ SYNC - linie "BENCH" trafiają do logu
+      storage_bench_config_t cfg = {.records = 2000, .record_size = 32, .rate_hz = 0, .sync_every = 0};
+      unsigned long records, size, rate, sync_every;
+      int n = sscanf(input_line, "storage bench %lu %lu %lu %lu", &records, &size, &rate, &sync_every);
+      if (n >= 1)
+        cfg.records = records;
+      if (n >= 2)
+        cfg.record_size = size;
+      if (n >= 3)
+        cfg.rate_hz = rate;
+      if (n >= 4)
+        cfg.sync_every = sync_every;
+      storage_bench_result_t result;
+      if (storage_bench_run(&cfg, &result))
+        storage_bench_print(&result, 1);
+      else
+        printf(">> Usage: storage bench [RECORDS [SIZE %d..%d [RATE_HZ [SYNC_EVERY]]]]\n", STORAGE_BENCH_MIN_RECORD,
+               STORAGE_BENCH_MAX_RECORD);
+    }
+    else if (strncmp(input_line, "query ", 6) == 0)
+    {
+      // query SENSOR T1 T2 - znaczniki czasu jak w zapisanych liniach
+      static char query_buf[STORAGE_READER_BUF_SIZE];
+      static storage_query_t query;
+      char sensor[32];
+      unsigned long from_ts, to_ts;
+      if (sscanf(input_line, "query %31s %lu %lu", sensor, &from_ts, &to_ts) != 3)
+      {
+        printf(">> Usage: query SENSOR T1 T2\n");
+        continue;
+      }
+      // Nieznana nazwa dałaby STORAGE_SENSOR_OTHER, czyli wszystkie linie note/BENCH
+      uint32_t sensors = storage_sensor_mask(sensor, strlen(sensor));
+      if (sensors == STORAGE_SENSOR_OTHER)
+      {
+        printf(">> Unknown sensor %s\n", sensor);
+        continue;
+      }
+      char *line;
+      storage_sync();
+      storage_query_open(&query, query_buf, sizeof(query_buf), sensors, from_ts, to_ts);
+      while (storage_query_next(&query, &line, NULL))
+        printf("%s\n", line);
+      storage_query_close(&query);
+      printf(">> %lu matched, %lu records read in %lu block runs of %lu segments%s\n", (unsigned long)query.matched,
+             (unsigned long)query.records, (unsigned long)query.runs, (unsigned long)query.segments,
+             query.error ? ", read error" : "");
+    }
+    else if (strncmp(input_line, "rollup ", 7) == 0)
+    {
+      // rollup OKRES SENSOR T1 T2 - OKRES w sekundach, jeden z STORAGE_ROLLUP_PERIODS_S
+      static storage_rollup_query_t rollup;
+      char sensor[32];
+      unsigned long period, from_ts, to_ts;
+      if (sscanf(input_line, "rollup %lu %31s %lu %lu", &period, sensor, &from_ts, &to_ts) != 4)
+      {
+        printf(">> Usage: rollup PERIOD SENSOR T1 T2\n");
+        continue;
+      }
+      uint32_t sensors = storage_sensor_mask(sensor, strlen(sensor));
+      if (sensors == STORAGE_SENSOR_OTHER)
+      {
+        printf(">> Unknown sensor %s\n", sensor);
+        continue;
+      }
+      storage_sync();
+      if (!storage_rollup_query_open(&rollup, period, sensors, from_ts, to_ts))
+      {
+        printf(">> No %lu s rollups\n", period);
+        continue;
+      }
+      storage_rollup_t r;
+      while (storage_rollup_query_next(&rollup, &r))
+        printf("%lu;%u;%.3f;%.3f;%.3f\n", (unsigned long)r.start, r.count, r.min, r.max, r.mean);
+      printf(">> %lu matched, %lu rollups read%s\n", (unsigned long)rollup.matched, (unsigned long)rollup.records,
+             rollup.error ? ", read error" : "");
+    }
     else if (strcmp(input_line, "clear") == 0)
     {
       storage_clear_all();
@@ -260,6 +355,50 @@ void app_main(void)
       print_all_sensors(bmp280_temp, veml7700_illuminance, max6675_engine_temp, hcsr04_distance, adxl345_acceleration);
       save_all_sensors(bmp280_temp, veml7700_illuminance, max6675_engine_temp, hcsr04_distance, adxl345_acceleration);
     }
+    else if (strcmp(input_line, "metrics") == 0)
+    {
+      metrics_print();
+    }
+    else if (strcmp(input_line, "tasks") == 0)
+    {
+      task_stats_print();
+    }
+    else if (strcmp(input_line, "bus") == 0)
+    {
+      bus_stats_print();
+      i2c_bus_print();
+    }
+    else if (strcmp(input_line, "bus reset") == 0)
+    {
+      bus_stats_reset();
+      printf(">> Bus statistics cleared.\n");
+    }
+    else if (strcmp(input_line, "bench") == 0)
+    {
+      kernel_bench_result_t results[KERNEL_BENCH_MAX_KERNELS];
+      size_t count = kernel_bench_run(results, KERNEL_BENCH_MAX_KERNELS, KERNEL_BENCH_TARGET_SAMPLES, bench_cycle_count);
+      if (count > 0)
+        kernel_bench_print(results, count, "cycles");
+      else
+        printf(">> Not enough memory for the benchmark.\n");
+    }
+    else if (strcmp(input_line, "trace start") == 0)
+    {
+      if (sensor_hal_record_start(SENSOR_HAL_TRACE_PATH) == ESP_OK)
+      {
+        // Re-run the configuration so the trace carries the calibration reads replay needs
+        configure_device_defaults();
+        printf(">> Recording sensor trace to %s\n", SENSOR_HAL_TRACE_PATH);
+      }
+      else
+      {
+        printf(">> Cannot start trace.\n");
+      }
+    }
+    else if (strcmp(input_line, "trace stop") == 0)
+    {
+      printf(">> Trace stopped, %lu transactions.\n", (unsigned long)sensor_hal_record_stop());
+    }
     else
     {
       printf(">> Unknkown command: %s\n", input_line);
@@ -0,0 +1,80 @@
+#include "adaptive_rate.h"
+#include <math.h>
+#include <stdio.h>
+#include "esp_timer.h"
+#include "esp_log.h"
+
+static const char *TAG = "ADAPTIVE_RATE";
+
+static uint32_t clamp_interval(const adaptive_rate_config_t *cfg, uint32_t interval_ms)
+{
+    if (interval_ms < cfg->min_interval_ms)
+        return cfg->min_interval_ms;
+    if (interval_ms > cfg->max_interval_ms)
+        return cfg->max_interval_ms;
+    return interval_ms;
+}
+
+void adaptive_rate_init(adaptive_rate_t *ar, const adaptive_rate_config_t *cfg)
+{
+    ar->cfg = *cfg;
+    ar->interval_ms = clamp_interval(cfg, cfg->initial_interval_ms);
+    ar->reference = 0.0f;
+    ar->last_value = 0.0f;
+    ar->last_time_us = 0;
+    ar->stable_count = 0;
+    ar->primed = false;
+
+    // A deadband-sized step taken at the fastest rate must not already count as a transient
+    if (cfg->rate_threshold * (float)cfg->min_interval_ms / 1000.0f < cfg->deadband)
+        ESP_LOGW(TAG, "%s: rate threshold %.3f/s is below deadband %.3f per %u ms", cfg->name,
+                 cfg->rate_threshold, cfg->deadband, (unsigned)cfg->min_interval_ms);
+
+    char metric_name[METRICS_NAME_LEN];
+    snprintf(metric_name, sizeof(metric_name), "%s_interval_ms", cfg->name);
+    ar->metric = metrics_register(metric_name, "ms");
+    metrics_set(ar->metric, (int32_t)ar->interval_ms);
+}
+
+uint32_t adaptive_rate_update(adaptive_rate_t *ar, float value)
+{
+    int64_t now_us = esp_timer_get_time();
+
+    if (!ar->primed)
+    {
+        ar->primed = true;
+        ar->reference = value;
+        ar->last_value = value;
+        ar->last_time_us = now_us;
+        return ar->interval_ms;
+    }
+
+    float dt_s = (float)(now_us - ar->last_time_us) / 1e6f;
+    float rate = dt_s > 0.0f ? fabsf(value - ar->last_value) / dt_s : 0.0f;
+    ar->last_value = value;
+    ar->last_time_us = now_us;
+
+    // Changes inside the deadband (LSB jitter) never count, however short the interval
+    if (fabsf(value - ar->reference) > ar->cfg.deadband)
+    {
+        if (rate >= ar->cfg.rate_threshold)
+            ar->interval_ms = ar->cfg.min_interval_ms; // transient (e.g. engine warm-up): sample as fast as allowed
+        else
+            ar->interval_ms = clamp_interval(&ar->cfg, ar->interval_ms / 2); // slow drift: speed up gradually
+        ar->reference = value;
+        ar->stable_count = 0;
+    }
+    else if (++ar->stable_count >= ar->cfg.stable_samples)
+    {
+        ar->interval_ms = clamp_interval(&ar->cfg, ar->interval_ms * 2);
+        ar->stable_count = 0;
+    }
+
+    metrics_set(ar->metric, (int32_t)ar->interval_ms);
+    return ar->interval_ms;
+}
+
+uint32_t adaptive_rate_interval_ms(const adaptive_rate_t *ar)
+{
+    return ar->interval_ms;
+}
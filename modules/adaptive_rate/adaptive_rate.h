@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "metrics.h"
+
+/**
+ * @brief Static tuning of one adaptive sampling controller.
+ *
+ * - min_interval_ms / max_interval_ms bound the effective sampling interval
+ * - deadband: changes smaller than this (in sensor units) count as a stable signal
+ * - rate_threshold: rate of change (sensor units per second) that forces the fastest rate once
+ *   the value has left the deadband; keep rate_threshold * min_interval >= deadband
+ * - stable_samples: consecutive stable samples needed before the interval is doubled
+ */
+typedef struct
+{
+    const char *name;
+    uint32_t initial_interval_ms;
+    uint32_t min_interval_ms;
+    uint32_t max_interval_ms;
+    float deadband;
+    float rate_threshold;
+    uint8_t stable_samples;
+} adaptive_rate_config_t;
+
+typedef struct
+{
+    adaptive_rate_config_t cfg;
+    uint32_t interval_ms;
+    float reference;
+    float last_value;
+    int64_t last_time_us;
+    uint8_t stable_count;
+    bool primed;
+    metrics_id_t metric;
+} adaptive_rate_t;
+
+/**
+ * @brief Initialize a controller and register its "<name>_interval_ms" gauge.
+ */
+void adaptive_rate_init(adaptive_rate_t *ar, const adaptive_rate_config_t *cfg);
+
+/**
+ * @brief Feed a new sample and get the delay until the next one.
+ *
+ * The interval is halved when the value leaves the deadband, dropped straight to
+ * the minimum when it leaves it faster than the rate threshold and doubled after
+ * stable_samples consecutive samples inside the deadband.
+ *
+ * @param ar Controller
+ * @param value Latest valid sample
+ * @return **uint32_t** - Interval to wait before the next sample in ms
+ */
+uint32_t adaptive_rate_update(adaptive_rate_t *ar, float value);
+
+/**
+ * @brief Current effective sampling interval in ms.
+ */
+uint32_t adaptive_rate_interval_ms(const adaptive_rate_t *ar);
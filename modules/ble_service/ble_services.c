@@ -13,6 +13,7 @@
 #include "esp_wifi.h"
 #include "storage_manager.h"
 #include "wifi_station.h"
+#include "task_plan.h"
 
 // Zmienne statyczne na uchwyty (Handles)
 static uint16_t s_service_handle;
@@ -98,7 +99,7 @@ static void ble_wifi_start_task(void* arg)
     }
 
     vPortFree(creds);
-    vTaskDelete(NULL);
+    task_plan_exit(TASK_ID_BLE_WIFI_START);
 }
 
 // ------------------- MAX6675 Notify Task -------------------
@@ -442,7 +443,7 @@ else if (param->write.handle == s_char_wifi_switch_handle)
         strncpy(arg->pass, pass, sizeof(arg->pass));
 
         // Start task — non-blocking
-        xTaskCreate(ble_wifi_start_task, "ble_wifi_start", 4096, arg, 5, NULL);
+        task_plan_create(TASK_ID_BLE_WIFI_START, ble_wifi_start_task, arg, NULL);
     } else if (command == '0') {
         ESP_LOGI(TAG, "Stopping WiFi...");
         esp_wifi_stop();
@@ -0,0 +1,123 @@
+#include "bus_stats.h"
+#include <stdio.h>
+#include "freertos/FreeRTOS.h"
+
+static bus_stats_t *s_head = NULL;
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+
+void bus_stats_register(bus_stats_t *stats)
+{
+    taskENTER_CRITICAL(&s_lock);
+    bus_stats_t *it = s_head;
+    while (it != NULL && it != stats)
+        it = it->next;
+    if (it == NULL)
+    {
+        stats->next = s_head;
+        s_head = stats;
+    }
+    taskEXIT_CRITICAL(&s_lock);
+}
+
+static inline int bucket_index(uint32_t us)
+{
+    if (us < 2)
+        return 0;
+    int idx = 31 - __builtin_clz(us);
+    return idx < BUS_STATS_BUCKETS ? idx : BUS_STATS_BUCKETS - 1;
+}
+
+void bus_stats_record(bus_stats_t *stats, int64_t start_us, esp_err_t err)
+{
+    uint32_t elapsed = (uint32_t)(esp_timer_get_time() - start_us);
+
+    atomic_fetch_add_explicit(&stats->buckets[bucket_index(elapsed)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&stats->count, 1, memory_order_relaxed);
+    if (err != ESP_OK)
+    {
+        atomic_fetch_add_explicit(&stats->errors, 1, memory_order_relaxed);
+        if (err == ESP_ERR_TIMEOUT)
+            atomic_fetch_add_explicit(&stats->timeouts, 1, memory_order_relaxed);
+    }
+
+    uint32_t max = atomic_load_explicit(&stats->max_us, memory_order_relaxed);
+    while (elapsed > max &&
+           !atomic_compare_exchange_weak_explicit(&stats->max_us, &max, elapsed,
+                                                  memory_order_relaxed, memory_order_relaxed))
+    {
+    }
+}
+
+bool bus_stats_should_retry(bus_stats_t *stats, esp_err_t err, int *attempt)
+{
+    if (err != ESP_ERR_TIMEOUT && err != ESP_FAIL)
+        return false;
+    if (*attempt >= BUS_STATS_MAX_RETRIES)
+        return false;
+
+    (*attempt)++;
+    atomic_fetch_add_explicit(&stats->retries, 1, memory_order_relaxed);
+    return true;
+}
+
+// Upper bound (in us) of the bucket holding the given percentile
+static uint32_t percentile_us(const uint32_t *buckets, uint32_t total, uint32_t percent)
+{
+    uint32_t target = (uint32_t)(((uint64_t)total * percent + 99) / 100);
+    uint32_t seen = 0;
+    for (int i = 0; i < BUS_STATS_BUCKETS; i++)
+    {
+        seen += buckets[i];
+        if (seen >= target)
+            return 2u << i;
+    }
+    return 2u << (BUS_STATS_BUCKETS - 1);
+}
+
+void bus_stats_print(void)
+{
+    if (s_head == NULL)
+    {
+        printf(">> No bus devices registered.\n");
+        return;
+    }
+
+    printf("%-10s %8s %6s %6s %6s %8s %8s %8s\n",
+           "device", "count", "errors", "tmout", "retry", "p50<us", "p99<us", "max_us");
+    for (bus_stats_t *s = s_head; s != NULL; s = s->next)
+    {
+        uint32_t buckets[BUS_STATS_BUCKETS];
+        uint32_t total = 0;
+        for (int i = 0; i < BUS_STATS_BUCKETS; i++)
+        {
+            buckets[i] = atomic_load_explicit(&s->buckets[i], memory_order_relaxed);
+            total += buckets[i];
+        }
+
+        printf("%-10s %8lu %6lu %6lu %6lu %8lu %8lu %8lu\n", s->name,
+               (unsigned long)atomic_load(&s->count), (unsigned long)atomic_load(&s->errors),
+               (unsigned long)atomic_load(&s->timeouts), (unsigned long)atomic_load(&s->retries),
+               (unsigned long)(total ? percentile_us(buckets, total, 50) : 0),
+               (unsigned long)(total ? percentile_us(buckets, total, 99) : 0),
+               (unsigned long)atomic_load(&s->max_us));
+
+        printf("           hist:");
+        for (int i = 0; i < BUS_STATS_BUCKETS; i++)
+            printf(" %lu", (unsigned long)buckets[i]);
+        printf("\n");
+    }
+}
+
+void bus_stats_reset(void)
+{
+    for (bus_stats_t *s = s_head; s != NULL; s = s->next)
+    {
+        for (int i = 0; i < BUS_STATS_BUCKETS; i++)
+            atomic_store_explicit(&s->buckets[i], 0, memory_order_relaxed);
+        atomic_store(&s->count, 0);
+        atomic_store(&s->errors, 0);
+        atomic_store(&s->timeouts, 0);
+        atomic_store(&s->retries, 0);
+        atomic_store(&s->max_us, 0);
+    }
+}
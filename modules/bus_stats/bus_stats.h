@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_timer.h"
+
+/*
+ * Per-device bus transaction statistics. All counters are relaxed atomics, so
+ * recording a transaction costs one esp_timer_get_time() call and a few atomic
+ * increments - cheap enough to stay enabled in production builds.
+ *
+ * Latency histogram bucket i counts transactions that took [2^i, 2^(i+1)) us,
+ * bucket 0 also holds sub-microsecond ones and the last bucket everything slower.
+ */
+#define BUS_STATS_BUCKETS     16
+#define BUS_STATS_MAX_RETRIES 1
+
+typedef struct bus_stats
+{
+    const char *name;
+    _Atomic uint32_t buckets[BUS_STATS_BUCKETS];
+    _Atomic uint32_t count;
+    _Atomic uint32_t errors;
+    _Atomic uint32_t timeouts;
+    _Atomic uint32_t retries;
+    _Atomic uint32_t max_us;
+    struct bus_stats *next;
+} bus_stats_t;
+
+#define BUS_STATS_INIT(device_name) {.name = (device_name)}
+
+/**
+ * @brief Add device statistics to the list printed by bus_stats_print(). Idempotent.
+ */
+void bus_stats_register(bus_stats_t *stats);
+
+/**
+ * @brief Record one finished transaction.
+ *
+ * @param stats Device statistics
+ * @param start_us esp_timer_get_time() taken right before the transaction
+ * @param err Result of the transaction
+ */
+void bus_stats_record(bus_stats_t *stats, int64_t start_us, esp_err_t err);
+
+/**
+ * @brief Decide whether a failed transaction should be retried and count the retry.
+ * Only transient errors (timeout, NACK / generic failure) are retried.
+ *
+ * @param stats Device statistics
+ * @param err Result of the last attempt
+ * @param attempt Retry counter of the caller, starts at 0
+ * @return true if the caller should repeat the transaction
+ */
+bool bus_stats_should_retry(bus_stats_t *stats, esp_err_t err, int *attempt);
+
+/**
+ * @brief Print counters, estimated p50/p99 and the histogram of every registered device.
+ */
+void bus_stats_print(void);
+
+/**
+ * @brief Zero the counters of every registered device.
+ */
+void bus_stats_reset(void);
@@ -4,6 +4,7 @@
 #include "ble_server.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "task_plan.h"
 
 
 // External button on GPIO4 (recommended wiring: button shorts GPIO4 to GND, use internal pull-up)
@@ -70,5 +71,5 @@ void button_init(void)
     gpio_install_isr_service(0);
     gpio_isr_handler_add(BUTTON_GPIO, button_isr, NULL);
 
-    xTaskCreate(button_task, "button_task", 4096, NULL, 5, NULL);
+    task_plan_create(TASK_ID_BUTTON, button_task, NULL, NULL);
 }
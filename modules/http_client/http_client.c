@@ -7,6 +7,7 @@
 #include "freertos/task.h"
 #include "esp_system.h"
 #include "esp_log.h"
+#include "task_plan.h"
 
 #include "lwip/err.h"
 #include "lwip/sockets.h"
@@ -143,5 +144,5 @@ static void http_get_task(void* arg)
 
 void http_client_start_task(void)
 {
-    xTaskCreate(http_get_task, "http_get_task", 4096, NULL, 5, NULL);
+    task_plan_create(TASK_ID_HTTP, http_get_task, NULL, NULL);
 }
@@ -1,49 +1,190 @@
 #include "i2c_master_bus.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include "project_config.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
 
-const char *TAG = "I2C_MASTER_BUS";
+static const char *TAG = "I2C_MASTER_BUS";
 
-i2c_master_bus_handle_t i2c_initialize_master(i2c_port_t port, int sda, int scl)
+typedef struct
+{
+    i2c_bus_handle_t handle;
+    uint32_t max_speed_hz;
+    SemaphoreHandle_t state_lock;               // guards busy and waiting
+    SemaphoreHandle_t wake[I2C_BUS_PRIO_COUNT]; // one token per grant to a waiter of that priority
+    bool busy;
+    uint16_t waiting[I2C_BUS_PRIO_COUNT];
+    uint32_t grants;
+    uint32_t contended; // grants that had to wait
+} i2c_bus_arbiter_t;
+
+static i2c_bus_arbiter_t s_buses[I2C_BUS_COUNT];
+static bool s_initialized = false;
+
+static const struct
+{
+    int sda;
+    int scl;
+    uint32_t max_speed_hz;
+} bus_config[I2C_BUS_COUNT] = {
+    [I2C_BUS_0] = {I2C_PORT_0_SDA_PIN, I2C_PORT_0_SCL_PIN, I2C_BUS_0_MAX_SPEED_HZ},
+    [I2C_BUS_1] = {I2C_PORT_1_SDA_PIN, I2C_PORT_1_SCL_PIN, I2C_BUS_1_MAX_SPEED_HZ},
+};
+
+static esp_err_t arbiter_init(i2c_bus_arbiter_t *bus)
+{
+    bus->state_lock = xSemaphoreCreateMutex();
+    if (bus->state_lock == NULL)
+        return ESP_ERR_NO_MEM;
+    for (int p = 0; p < I2C_BUS_PRIO_COUNT; p++)
+    {
+        bus->wake[p] = xSemaphoreCreateCounting(UINT16_MAX, 0);
+        if (bus->wake[p] == NULL)
+            return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+#if !CONFIG_IDF_TARGET_LINUX
+static esp_err_t bus_create(i2c_bus_id_t id)
 {
     i2c_master_bus_config_t i2c_bus_config = {
-        .i2c_port = port,
-        .sda_io_num = sda,
-        .scl_io_num = scl,
+        .i2c_port = -1, // Use -1 for auto-assignment
+        .sda_io_num = bus_config[id].sda,
+        .scl_io_num = bus_config[id].scl,
         .clk_source = I2C_CLK_SRC_DEFAULT,
         .glitch_ignore_cnt = 7,
+        .trans_queue_depth = I2C_BUS_TRANS_QUEUE_DEPTH,
         .flags.enable_internal_pullup = true,
     };
 
-    i2c_master_bus_handle_t bus_handle = NULL;
-    printf("Attempting I2C Init on SDA=%d, SCL=%d\n", sda, scl);
-    fflush(stdout); // FORCE PRINT
+    esp_err_t err = i2c_new_master_bus(&i2c_bus_config, &s_buses[id].handle);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "I2C bus %d init failed (SDA=%d SCL=%d): %s", id, bus_config[id].sda, bus_config[id].scl,
+                 esp_err_to_name(err));
+        s_buses[id].handle = NULL;
+        return err;
+    }
+    ESP_LOGI(TAG, "I2C bus %d up on SDA=%d SCL=%d, up to %lu Hz", id, bus_config[id].sda, bus_config[id].scl,
+             (unsigned long)bus_config[id].max_speed_hz);
+    return ESP_OK;
+}
+#endif
 
-    esp_err_t err = i2c_new_master_bus(&i2c_bus_config, &bus_handle);
+esp_err_t i2c_bus_manager_init(void)
+{
+    esp_err_t result = ESP_OK;
+    for (int id = 0; id < I2C_BUS_COUNT; id++)
+    {
+        s_buses[id].max_speed_hz = bus_config[id].max_speed_hz;
+        esp_err_t err = arbiter_init(&s_buses[id]);
+#if !CONFIG_IDF_TARGET_LINUX
+        if (err == ESP_OK)
+            err = bus_create(id);
+#endif
+        if (err != ESP_OK && result == ESP_OK)
+            result = err;
+    }
+    s_initialized = true;
+    return result;
+}
 
-    // 2. CHECK THE ERROR
-    if (err != ESP_OK)
+i2c_bus_handle_t i2c_bus_get(i2c_bus_id_t id)
+{
+    return id < I2C_BUS_COUNT ? s_buses[id].handle : NULL;
+}
+
+static i2c_bus_arbiter_t *find_bus(i2c_bus_handle_t handle)
+{
+    for (int id = 0; id < I2C_BUS_COUNT; id++)
     {
-        printf("CRITICAL ERROR: I2C Init failed: %s\n", esp_err_to_name(err));
-        fflush(stdout); // FORCE PRINT
-        abort();        // Stop execution here so you can read the error
+        if (s_buses[id].handle == handle)
+            return &s_buses[id];
     }
+    return &s_buses[I2C_BUS_0];
+}
 
-    printf("I2C Bus Init Success. Handle: %p\n", bus_handle);
-    fflush(stdout);
+uint32_t i2c_bus_negotiate_speed(i2c_bus_handle_t bus, uint32_t device_max_hz)
+{
+    uint32_t bus_max = find_bus(bus)->max_speed_hz;
+    if (bus_max == 0)
+        return device_max_hz;
+    return device_max_hz < bus_max ? device_max_hz : bus_max;
+}
 
-    return bus_handle;
+static bool higher_or_equal_waiting(const i2c_bus_arbiter_t *bus, i2c_bus_prio_t prio)
+{
+    for (int p = prio; p < I2C_BUS_PRIO_COUNT; p++)
+    {
+        if (bus->waiting[p] > 0)
+            return true;
+    }
+    return false;
 }
 
-// esp_err_t init_i2c_bus(i2c_port_t port, int sda, int scl, uint32_t freq)
-// {
-//     i2c_config_t conf = {
-//         .mode = I2C_MODE_MASTER,
-//         .sda_io_num = sda,
-//         .scl_io_num = scl,
-//         .sda_pullup_en = GPIO_PULLUP_ENABLE,
-//         .scl_pullup_en = GPIO_PULLUP_ENABLE,
-//         .master.clk_speed = freq,
-//     };
+esp_err_t i2c_bus_acquire(i2c_bus_handle_t handle, i2c_bus_prio_t prio, int timeout_ms)
+{
+    if (!s_initialized)
+        return ESP_OK; // no arbitration before the manager exists (e.g. host tools)
+
+    i2c_bus_arbiter_t *bus = find_bus(handle);
+    xSemaphoreTake(bus->state_lock, portMAX_DELAY);
+    if (!bus->busy && !higher_or_equal_waiting(bus, prio))
+    {
+        bus->busy = true;
+        bus->grants++;
+        xSemaphoreGive(bus->state_lock);
+        return ESP_OK;
+    }
+    bus->waiting[prio]++;
+    xSemaphoreGive(bus->state_lock);
+
+    // Ownership is handed over directly by i2c_bus_release, busy never drops in between
+    if (xSemaphoreTake(bus->wake[prio], pdMS_TO_TICKS(timeout_ms)) == pdTRUE)
+        return ESP_OK;
 
-//     ESP_ERROR_CHECK(i2c_param_config(port, &conf));
-//     return i2c_driver_install(port, conf.mode, 0, 0, 0);
-// }
\ No newline at end of file
+    xSemaphoreTake(bus->state_lock, portMAX_DELAY);
+    // The grant may have been issued between the timeout and taking the lock
+    if (xSemaphoreTake(bus->wake[prio], 0) == pdTRUE)
+    {
+        xSemaphoreGive(bus->state_lock);
+        return ESP_OK;
+    }
+    bus->waiting[prio]--;
+    xSemaphoreGive(bus->state_lock);
+    return ESP_ERR_TIMEOUT;
+}
+
+void i2c_bus_release(i2c_bus_handle_t handle)
+{
+    if (!s_initialized)
+        return;
+
+    i2c_bus_arbiter_t *bus = find_bus(handle);
+    xSemaphoreTake(bus->state_lock, portMAX_DELAY);
+    for (int p = I2C_BUS_PRIO_COUNT - 1; p >= 0; p--)
+    {
+        if (bus->waiting[p] > 0)
+        {
+            bus->waiting[p]--;
+            bus->grants++;
+            bus->contended++;
+            xSemaphoreGive(bus->wake[p]);
+            xSemaphoreGive(bus->state_lock);
+            return;
+        }
+    }
+    bus->busy = false;
+    xSemaphoreGive(bus->state_lock);
+}
+
+void i2c_bus_print(void)
+{
+    printf("%-6s %10s %10s %10s\n", "bus", "max_hz", "grants", "contended");
+    for (int id = 0; id < I2C_BUS_COUNT; id++)
+        printf("i2c%-3d %10lu %10lu %10lu\n", id, (unsigned long)s_buses[id].max_speed_hz,
+               (unsigned long)s_buses[id].grants, (unsigned long)s_buses[id].contended);
+}
@@ -1,14 +1,78 @@
+#pragma once
+
+#include <stdint.h>
+#include "esp_err.h"
+
+/*
+ * I2C bus manager.
+ *
+ * Owns both I2C buses, picks the clock for each device and arbitrates access. Devices
+ * on the same bus run in different tasks; without arbitration whichever task gets the
+ * driver's internal lock next wins. Here waiting transactions are granted by priority,
+ * so the accelerometer FIFO drain is never stuck behind a BMP280 calibration burst.
+ */
+
+#if CONFIG_IDF_TARGET_LINUX
+typedef void *i2c_bus_handle_t;
+#else
 #include "driver/i2c_master.h"
-#include "esp_log.h"
+typedef i2c_master_bus_handle_t i2c_bus_handle_t;
+#endif
+
+typedef enum
+{
+    I2C_BUS_0 = 0, /*!< BMP280, ADXL345 */
+    I2C_BUS_1,     /*!< VEML7700 */
+    I2C_BUS_COUNT
+} i2c_bus_id_t;
+
+typedef enum
+{
+    I2C_BUS_PRIO_LOW = 0,
+    I2C_BUS_PRIO_NORMAL,
+    I2C_BUS_PRIO_HIGH,
+    I2C_BUS_PRIO_COUNT
+} i2c_bus_prio_t;
+
+/**
+ * @brief Create both buses (pins and clock limits from project_config.h) and their arbiters.
+ * On the linux target only the arbiters are created.
+ *
+ * @return **esp_err_t** - ESP_OK if every bus came up, the first error otherwise
+ */
+esp_err_t i2c_bus_manager_init(void);
+
+/**
+ * @brief Handle of a managed bus, NULL if it failed to initialize.
+ */
+i2c_bus_handle_t i2c_bus_get(i2c_bus_id_t id);
 
-/* --- I2C for BMP280 & ADXL345 --- */
-#define I2C_PORT_0_SDA_PIN 21
-#define I2C_PORT_0_SCL_PIN 22
+/**
+ * @brief Fastest clock both the bus and the device support.
+ *
+ * @param bus Bus the device is attached to
+ * @param device_max_hz Highest SCL frequency from the device datasheet
+ * @return **uint32_t** - SCL frequency to configure for the device
+ */
+uint32_t i2c_bus_negotiate_speed(i2c_bus_handle_t bus, uint32_t device_max_hz);
 
-/* --- I2C for VEML7700 --- */
-#define I2C_PORT_1_SDA_PIN 25
-#define I2C_PORT_1_SCL_PIN 26
+/**
+ * @brief Take exclusive use of a bus. When the bus is released it goes to the highest
+ * priority waiter; equal priorities are served in order of arrival.
+ *
+ * Buses the manager does not own (e.g. NULL on the host) share one arbiter.
+ *
+ * @param timeout_ms Maximum wait
+ * @return **esp_err_t** - ESP_OK when the bus is ours, ESP_ERR_TIMEOUT otherwise
+ */
+esp_err_t i2c_bus_acquire(i2c_bus_handle_t bus, i2c_bus_prio_t prio, int timeout_ms);
 
-i2c_master_bus_handle_t i2c_initialize_master(i2c_port_t port, int sda, int scl);
+/**
+ * @brief Hand the bus to the next waiter.
+ */
+void i2c_bus_release(i2c_bus_handle_t bus);
 
-// esp_err_t init_i2c_bus(i2c_port_t port, int sda, int scl, uint32_t freq);
\ No newline at end of file
+/**
+ * @brief Print per-bus clock limit, grants and contention counters.
+ */
+void i2c_bus_print(void);
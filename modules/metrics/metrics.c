@@ -0,0 +1,103 @@
+#include "metrics.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#include "freertos/FreeRTOS.h"
+
+typedef struct
+{
+    char name[METRICS_NAME_LEN];
+    char unit[METRICS_UNIT_LEN];
+    _Atomic int32_t value;
+} metrics_entry_t;
+
+static metrics_entry_t s_entries[METRICS_MAX_ENTRIES];
+static _Atomic int s_count = 0;
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+
+metrics_id_t metrics_register(const char *name, const char *unit)
+{
+    metrics_id_t id = METRICS_INVALID_ID;
+
+    taskENTER_CRITICAL(&s_lock);
+    int count = atomic_load(&s_count);
+    for (int i = 0; i < count; i++)
+    {
+        if (strncmp(s_entries[i].name, name, METRICS_NAME_LEN - 1) == 0)
+        {
+            id = i;
+            break;
+        }
+    }
+    if (id == METRICS_INVALID_ID && count < METRICS_MAX_ENTRIES)
+    {
+        id = count;
+        snprintf(s_entries[id].name, sizeof(s_entries[id].name), "%s", name);
+        snprintf(s_entries[id].unit, sizeof(s_entries[id].unit), "%s", unit ? unit : "");
+        atomic_store(&s_entries[id].value, 0);
+        // Publish the entry only after it is fully written
+        atomic_store(&s_count, count + 1);
+    }
+    taskEXIT_CRITICAL(&s_lock);
+
+    return id;
+}
+
+void metrics_set(metrics_id_t id, int32_t value)
+{
+    if (id < 0 || id >= atomic_load(&s_count))
+        return;
+    atomic_store_explicit(&s_entries[id].value, value, memory_order_relaxed);
+}
+
+int32_t metrics_get(metrics_id_t id)
+{
+    if (id < 0 || id >= atomic_load(&s_count))
+        return 0;
+    return atomic_load_explicit(&s_entries[id].value, memory_order_relaxed);
+}
+
+void metrics_print(void)
+{
+    int count = atomic_load(&s_count);
+    if (count == 0)
+    {
+        printf(">> No metrics registered.\n");
+        return;
+    }
+    for (int i = 0; i < count; i++)
+    {
+        printf("%-*s %ld %s\n", METRICS_NAME_LEN, s_entries[i].name,
+               (long)atomic_load(&s_entries[i].value), s_entries[i].unit);
+    }
+}
+
+size_t metrics_format_json(char *buf, size_t len)
+{
+    if (len < 3)
+    {
+        if (len)
+            buf[0] = '\0';
+        return 0;
+    }
+
+    int count = atomic_load(&s_count);
+    size_t pos = 1;
+    buf[0] = '{';
+
+    for (int i = 0; i < count; i++)
+    {
+        // Leave room for the closing brace
+        size_t room = len - pos - 1;
+        int n = snprintf(buf + pos, room, "%s\"%s\":%ld", i ? "," : "",
+                         s_entries[i].name, (long)atomic_load(&s_entries[i].value));
+        if (n < 0 || (size_t)n >= room)
+            break; // keep the entries that fit
+        pos += n;
+    }
+
+    buf[pos++] = '}';
+    buf[pos] = '\0';
+    return pos;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define METRICS_MAX_ENTRIES 48
+#define METRICS_NAME_LEN    32
+#define METRICS_UNIT_LEN    8
+
+#define METRICS_INVALID_ID  (-1)
+
+typedef int metrics_id_t;
+
+/**
+ * @brief Register a named integer gauge (e.g. "bmp280_interval_ms").
+ * Registering an existing name returns the already assigned id.
+ *
+ * @param name Gauge name, truncated to METRICS_NAME_LEN - 1 characters
+ * @param unit Short unit string shown next to the value
+ * @return **metrics_id_t** - Gauge id, METRICS_INVALID_ID when the table is full
+ */
+metrics_id_t metrics_register(const char *name, const char *unit);
+
+/**
+ * @brief Update a gauge. Safe to call from any task, ignores invalid ids.
+ */
+void metrics_set(metrics_id_t id, int32_t value);
+
+/**
+ * @brief Read the current value of a gauge (0 for invalid ids).
+ */
+int32_t metrics_get(metrics_id_t id);
+
+/**
+ * @brief Print all registered gauges to stdout (console "metrics" command).
+ */
+void metrics_print(void);
+
+/**
+ * @brief Serialize all gauges as a flat JSON object: {"name":value,...}
+ *
+ * @return **size_t** - Number of characters written (without the terminator)
+ */
+size_t metrics_format_json(char *buf, size_t len);
@@ -7,19 +7,43 @@
 #include "nvs.h"
 #include "nvs_flash.h"
 #include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
 
 #include "storage_manager.h"
+#include "upload_batch.h"
 #include "wifi_station.h"
 #include "ble_internal.h"
 #include "buzzer.h"
+#include "task_plan.h"
+#include "task_stats.h"
 
+#include <math.h>
 #include <string.h>
 #include <stdlib.h>
+#include <time.h>
 
 
 static volatile bool mqtt_exit_requested = false;
 static const char *user = "user";
 static volatile bool mqtt_connected = false;
+// Message ids of acknowledged QoS 1 publishes (MQTT_EVENT_PUBLISHED), consumed by the upload
+static QueueHandle_t s_ack_queue;
+// The client dropped an unacknowledged upload batch from its outbox (MQTT_EVENT_DELETED)
+static volatile bool s_upload_lost = false;
+// Set on every connect, cleared once the stored data is uploaded completely
+static volatile bool s_upload_pending = true;
+
+static void publish_live(esp_mqtt_client_handle_t client);
+
+// QUERY SENSOR T1 T2 or ROLLUP PERIOD SENSOR T1 T2 received on the alerts topic, answered from mqtt_task
+static struct {
+    char sensor[32];
+    uint32_t period; // 0 = raw records
+    uint32_t from_ts;
+    uint32_t to_ts;
+    volatile bool pending;
+} s_query_request;
 
 
 
@@ -48,11 +72,19 @@ static void mqtt_event_handler(void *arg, esp_event_base_t base,
             esp_mqtt_client_subscribe(event->client, topic, 0);
             ESP_LOGI(TAG, "Subscribed to %s", topic);
         }
+        s_upload_pending = true;
         break;
     case MQTT_EVENT_DISCONNECTED:
         mqtt_connected = false;
         ESP_LOGW(TAG, "MQTT disconnected");
         break;
+    case MQTT_EVENT_PUBLISHED:
+        xQueueSend(s_ack_queue, &event->msg_id, 0);
+        break;
+    case MQTT_EVENT_DELETED:
+        s_upload_lost = true;
+        ESP_LOGW(TAG, "Message %d expired in the outbox", event->msg_id);
+        break;
     case MQTT_EVENT_DATA:
         if (event->topic_len && event->data_len) {
             char topic[128];
@@ -72,6 +104,15 @@ static void mqtt_event_handler(void *arg, esp_event_base_t base,
                 if (strcmp(payload, "EXIT") == 0) {
                         mqtt_exit_requested = true;
                 }
+                unsigned long period = 0, from_ts, to_ts;
+                if (!s_query_request.pending &&
+                    (sscanf(payload, "QUERY %31s %lu %lu", s_query_request.sensor, &from_ts, &to_ts) == 3 ||
+                     sscanf(payload, "ROLLUP %lu %31s %lu %lu", &period, s_query_request.sensor, &from_ts, &to_ts) == 4)) {
+                    s_query_request.period = period;
+                    s_query_request.from_ts = from_ts;
+                    s_query_request.to_ts = to_ts;
+                    s_query_request.pending = true;
+                }
             }
         }
         break;
@@ -94,61 +135,475 @@ static void publish_hello(esp_mqtt_client_handle_t client,
     ESP_LOGI(TAG, "Sent hello to %s", topic);
 }
 
-static void publish_storage_via_mqtt(esp_mqtt_client_handle_t client,
+// One stored line TYPE;TIMESTAMP;VALUE to <user>/<mac>/<kind>/TYPE, false if the client could not take it
+static bool publish_line(esp_mqtt_client_handle_t client,
+                         const char *user,
+                         const char *mac,
+                         const char *kind,
+                         char *line)
+{
+    char *tok_ctx = NULL;
+    char *type = strtok_r(line, ";", &tok_ctx);
+    char *ts   = strtok_r(NULL, ";", &tok_ctx);
+    char *val  = strtok_r(NULL, ";", &tok_ctx);
+
+    if (!type || !ts || !val)
+        return true; // not a sample, nothing to send
+
+    char topic[128];
+    snprintf(topic, sizeof(topic),
+             "%s/%s/%s/%s", user, mac, kind, type);
+
+    char payload[64];
+    snprintf(payload, sizeof(payload),
+             "%s;%s", ts, val);
+
+    //send via MQTT
+    int msg_id = esp_mqtt_client_publish(
+        client,
+        topic,
+        payload,
+        0, // auto length
+        0, // QoS 0
+        0  // no retain
+    );
+    if (msg_id < 0)
+        return false;
+
+    ESP_LOGI(TAG, "MQTT -> %s : %s", topic, payload);
+    return true;
+}
+
+/*
+ * Stored samples go up in batches, one upload_batch frame per sensor on <user>/<mac>/batch/TYPE.
+ * Frames are put into the client's outbox as QoS 1; the upload only waits while the outbox holds
+ * more than MQTT_UPLOAD_OUTBOX_BYTES or MQTT_UPLOAD_INFLIGHT frames are not acknowledged yet, so
+ * it runs at the pace of the connection. A segment (or flash sector) is released only when all
+ * of its frames are acknowledged. The point before which everything is acknowledged is kept in
+ * the manifest, after a reconnect or a reboot the upload resumes there (samples past it may come
+ * twice); it goes with the card and is cleared with its segment.
+ */
+// Frames handed to the client and not acknowledged yet
+static struct {
+    int msg_id; // 0 = free
+    storage_cursor_t first;
+} s_inflight[MQTT_UPLOAD_INFLIGHT];
+static size_t s_inflight_count;
+static uint32_t s_acked;
+
+static bool upload_usable(void)
+{
+    return mqtt_connected && !s_upload_lost;
+}
+
+// Apply the acknowledgements received so far, waiting up to `wait` for the first one
+static void inflight_drain(TickType_t wait)
+{
+    int msg_id;
+    while (xQueueReceive(s_ack_queue, &msg_id, wait) == pdTRUE) {
+        wait = 0;
+        for (size_t i = 0; i < MQTT_UPLOAD_INFLIGHT; i++) {
+            if (s_inflight[i].msg_id == msg_id) {
+                s_inflight[i].msg_id = 0;
+                s_inflight_count--;
+                s_acked++;
+                break;
+            }
+        }
+    }
+}
+
+// Wait until every frame handed to the client is acknowledged, false if the connection went away
+static bool wait_acked(esp_mqtt_client_handle_t client)
+{
+    while (s_inflight_count > 0 && upload_usable()) {
+        publish_live(client);
+        inflight_drain(pdMS_TO_TICKS(10));
+    }
+    return s_inflight_count == 0;
+}
+
+// Back pressure: wait for the outbox to drain and an in-flight slot, false if the connection went away
+static bool wait_outbox(esp_mqtt_client_handle_t client)
+{
+    // Live values go out between the batches, the upload does not hold them back
+    publish_live(client);
+    inflight_drain(0);
+    while (upload_usable() && (s_inflight_count == MQTT_UPLOAD_INFLIGHT ||
+                               esp_mqtt_client_get_outbox_size(client) > MQTT_UPLOAD_OUTBOX_BYTES))
+        inflight_drain(pdMS_TO_TICKS(10));
+    return upload_usable();
+}
+
+// upload_batch transport: one frame into the client's outbox as QoS 1
+static bool enqueue_frame(const char *topic, const uint8_t *frame, size_t len, uint16_t count,
+                          storage_cursor_t first, void *ctx)
+{
+    esp_mqtt_client_handle_t client = ctx;
+    if (!wait_outbox(client))
+        return false;
+    int msg_id = esp_mqtt_client_enqueue(client, topic, (const char *)frame, len, 1, 0, true);
+    if (msg_id <= 0)
+        return false;
+    for (size_t i = 0; i < MQTT_UPLOAD_INFLIGHT; i++) {
+        if (s_inflight[i].msg_id == 0) {
+            s_inflight[i].msg_id = msg_id;
+            s_inflight[i].first = first;
+            s_inflight_count++;
+            break;
+        }
+    }
+    ESP_LOGD(TAG, "MQTT -> %s : %u samples, %u bytes", topic, count, (unsigned)len);
+    return true;
+}
+
+// Everything before the returned position is acknowledged, `at` is the next line to be read
+static storage_cursor_t upload_acked_until(storage_cursor_t at)
+{
+    at = upload_batch_oldest_unsent(at);
+    for (size_t i = 0; i < MQTT_UPLOAD_INFLIGHT; i++) {
+        if (s_inflight[i].msg_id != 0 && s_inflight[i].first.segment == at.segment &&
+            s_inflight[i].first.offset < at.offset)
+            at = s_inflight[i].first;
+    }
+    return at;
+}
+
+// Unsent and unacknowledged frames are forgotten, their samples are read again from the stored data
+static void upload_reset(void)
+{
+    upload_batch_reset();
+    for (size_t i = 0; i < MQTT_UPLOAD_INFLIGHT; i++)
+        s_inflight[i].msg_id = 0;
+    s_inflight_count = 0;
+    s_upload_lost = false;
+}
+
+// Frames of this upload go to the client's outbox on <user>/<mac>/batch/TYPE
+static void upload_begin(esp_mqtt_client_handle_t client, const char *user, const char *mac)
+{
+    char prefix[64];
+    snprintf(prefix, sizeof(prefix), "%s/%s", user, mac);
+    upload_batch_begin(prefix, enqueue_frame, client);
+}
+
+static char s_upload_buf[STORAGE_READER_BUF_SIZE];
+
+static bool publish_storage_via_mqtt(esp_mqtt_client_handle_t client,
                                      const char *user,
                                      const char *mac)
 {
-    char *data = storage_read_all();
-    if (data == NULL) {
-        ESP_LOGI(TAG, "No stored data to send");
-        return;
+    // Close the head so everything logged so far is in sealed segments, then drain them oldest first
+    storage_seal();
+    upload_reset();
+    upload_begin(client, user, mac);
+
+    storage_segment_t seg;
+    int sent = 0;
+    while (storage_segment_next_pending(&seg)) {
+        // Where an interrupted upload stopped, kept in the manifest of the card holding the segment
+        storage_cursor_t from = storage_segment_upload_cursor();
+        if (from.segment != seg.id)
+            from = (storage_cursor_t){.segment = seg.id, .offset = 0};
+        ESP_LOGI(TAG, "Sending segment %lu (%lu records, from byte %lu) via MQTT...",
+                 (unsigned long)seg.id, (unsigned long)seg.records, (unsigned long)from.offset);
+
+        // Streamed in chunks of one small buffer, segments never need to fit in RAM
+        static storage_reader_t reader;
+        storage_reader_open(&reader, s_upload_buf, sizeof(s_upload_buf), from, seg.id, false);
+        bool interrupted = false;
+        char *line;
+        size_t len;
+        storage_cursor_t at = storage_reader_tell(&reader);
+        uint32_t saved_acked = s_acked;
+        while (storage_reader_next(&reader, &line, &len)) {
+            if (reader.skipped > 0 && from.offset != 0 && at.offset == from.offset) {
+                // The cursor is not where a record starts, the segment goes again from its beginning
+                ESP_LOGW(TAG, "Upload cursor %lu/%lu is not at a record, segment sent whole",
+                         (unsigned long)from.segment, (unsigned long)from.offset);
+                storage_reader_close(&reader);
+                from.offset = 0;
+                at = from;
+                storage_reader_open(&reader, s_upload_buf, sizeof(s_upload_buf), from, seg.id, false);
+                continue;
+            }
+            if (!upload_batch_add(line, len, at)) {
+                interrupted = true;
+                break;
+            }
+            at = storage_reader_tell(&reader);
+            if (s_acked - saved_acked >= MQTT_UPLOAD_CURSOR_SAVE_EVERY) {
+                storage_segment_set_upload_cursor(upload_acked_until(at));
+                saved_acked = s_acked;
+            }
+        }
+        storage_reader_close(&reader);
+        // The segment is done once the broker acknowledged the last frames holding its samples
+        if (!interrupted && !reader.error && (!upload_batch_flush_all() || !wait_acked(client)))
+            interrupted = true;
+
+        if (interrupted || reader.error) {
+            // Stays pending, the next flush resumes at the first line not acknowledged
+            at = upload_acked_until(at);
+            storage_segment_set_upload_cursor(at);
+            upload_reset();
+            ESP_LOGW(TAG, "Upload of segment %lu stopped at byte %lu", (unsigned long)seg.id,
+                     (unsigned long)at.offset);
+            return false;
+        }
+        // Clears the cursor as well, the next segment starts at its beginning
+        storage_segment_mark_uploaded(seg.id);
+        sent++;
     }
 
-    ESP_LOGI(TAG, "Sending stored data via MQTT...");
-
-    char *line_ctx = NULL;
-    char *line = strtok_r(data, "\n", &line_ctx);
-    
-    // For each line: TYPE;TIMESTAMP;VALUE
-    while (line) { 
-        char *tok_ctx = NULL;
-        char *type = strtok_r(line, ";", &tok_ctx);
-        char *ts   = strtok_r(NULL, ";", &tok_ctx);
-        char *val  = strtok_r(NULL, ";", &tok_ctx);
+    if (sent == 0)
+        ESP_LOGI(TAG, "No stored data to send");
+    else
+        ESP_LOGI(TAG, "All stored data acknowledged, %d segments marked uploaded", sent);
+    return true;
+}
 
-        if (type && ts && val) {
-            char topic[128];
-            snprintf(topic, sizeof(topic),
-                     "%s/%s/sensor/%s", user, mac, type);
 
-            char payload[64];
-            snprintf(payload, sizeof(payload),
-                     "%s;%s", ts, val);
+// Lines still on the internal flash (no card), batched straight from the mapped partition
+static bool publish_flash_via_mqtt(esp_mqtt_client_handle_t client,
+                                   const char *user,
+                                   const char *mac)
+{
+    storage_sync();
+    upload_begin(client, user, mac);
+    storage_flash_cursor_t cursor = {0};
+    int sent = 0;
+    while (storage_flash_next_unsent(&cursor)) {
+        const char *line;
+        size_t len;
+        bool interrupted = false;
+        // Sectors are sent as a whole, the position of a sample inside one does not matter
+        storage_cursor_t at = {0};
+        while (storage_flash_read_line(&cursor, &line, &len)) {
+            if (!upload_batch_add(line, len, at)) {
+                interrupted = true;
+                break;
+            }
+        }
+        if (!interrupted && (!upload_batch_flush_all() || !wait_acked(client)))
+            interrupted = true;
+        // A sector is marked as a whole once acknowledged, an interrupted one is sent again next time
+        if (interrupted) {
+            storage_flash_release();
+            upload_reset();
+            return false;
+        }
+        if (!storage_flash_mark_uploaded(&cursor)) {
+            storage_flash_release();
+            return false;
+        }
+        sent++;
+    }
+    if (sent > 0)
+        ESP_LOGI(TAG, "%d flash sectors sent", sent);
+    return true;
+}
 
-            //send via MQTT
-            esp_mqtt_client_publish( 
-                client,
-                topic,
-                payload,
-                0, // auto length
-                0, // QoS 0
-                0  // no retain
-            );
+// Sensor mask of a QUERY / ROLLUP, 0 after answering "error;unknown sensor" on <user>/<mac>/KIND/done
+static uint32_t query_sensors(esp_mqtt_client_handle_t client,
+                              const char *user,
+                              const char *mac,
+                              const char *kind)
+{
+    uint32_t sensors = storage_sensor_mask(s_query_request.sensor, strlen(s_query_request.sensor));
+    if (sensors != STORAGE_SENSOR_OTHER)
+        return sensors;
 
-            ESP_LOGI(TAG, "MQTT -> %s : %s", topic, payload);
+    char topic[128];
+    snprintf(topic, sizeof(topic), "%s/%s/%s/done", user, mac, kind);
+    esp_mqtt_client_publish(client, topic, "error;unknown sensor", 0, 0, 0);
+    ESP_LOGW(TAG, "%s for unknown sensor %s rejected", kind, s_query_request.sensor);
+    s_query_request.pending = false;
+    return 0;
+}
 
-            vTaskDelay(pdMS_TO_TICKS(20));
+// Answer a QUERY from the segment index, the matching lines go to <user>/<mac>/query/TYPE
+static void publish_query(esp_mqtt_client_handle_t client,
+                          const char *user,
+                          const char *mac)
+{
+    static storage_query_t query;
+    uint32_t sensors = query_sensors(client, user, mac, "query");
+    if (sensors == 0)
+        return;
+    storage_sync();
+    storage_query_open(&query, s_upload_buf, sizeof(s_upload_buf), sensors,
+                       s_query_request.from_ts, s_query_request.to_ts);
+    char *line;
+    uint32_t sent = 0;
+    bool truncated = false;
+    while (storage_query_next(&query, &line, NULL)) {
+        if (sent == MQTT_QUERY_MAX_RESULTS) {
+            truncated = true;
+            break;
         }
+        if (!publish_line(client, user, mac, "query", line))
+            break;
+        sent++;
+    }
+    storage_query_close(&query);
+
+    char topic[128];
+    char payload[64];
+    snprintf(topic, sizeof(topic), "%s/%s/query/done", user, mac);
+    snprintf(payload, sizeof(payload), "%lu;%lu%s", (unsigned long)sent, (unsigned long)query.records,
+             truncated ? ";truncated" : "");
+    esp_mqtt_client_publish(client, topic, payload, 0, 0, 0);
+    ESP_LOGI(TAG, "Query %s: %lu sent%s, %lu records read in %lu block runs", s_query_request.sensor,
+             (unsigned long)sent, truncated ? " (truncated)" : "", (unsigned long)query.records,
+             (unsigned long)query.runs);
+    s_query_request.pending = false;
+}
 
-        line = strtok_r(NULL, "\n", &line_ctx);
+// Answer a ROLLUP, one START;COUNT;MIN;MAX;MEAN per bucket to <user>/<mac>/rollup/PERIOD/TYPE
+static void publish_rollup(esp_mqtt_client_handle_t client,
+                           const char *user,
+                           const char *mac)
+{
+    static storage_rollup_query_t rollup;
+    char topic[128];
+    char payload[96];
+    uint32_t sensors = query_sensors(client, user, mac, "rollup");
+    if (sensors == 0)
+        return;
+    storage_sync();
+    storage_rollup_query_open(&rollup, s_query_request.period, sensors,
+                              s_query_request.from_ts, s_query_request.to_ts);
+    snprintf(topic, sizeof(topic), "%s/%s/rollup/%lu/%s", user, mac,
+             (unsigned long)s_query_request.period, s_query_request.sensor);
+    storage_rollup_t r;
+    uint32_t sent = 0;
+    bool truncated = false;
+    while (storage_rollup_query_next(&rollup, &r)) {
+        if (sent == MQTT_QUERY_MAX_RESULTS) {
+            truncated = true;
+            break;
+        }
+        int len = snprintf(payload, sizeof(payload), "%lu;%u;%.3f;%.3f;%.3f",
+                           (unsigned long)r.start, r.count, r.min, r.max, r.mean);
+        if (esp_mqtt_client_publish(client, topic, payload, len, 0, 0) < 0)
+            break;
+        sent++;
     }
 
-    free(data);
+    snprintf(topic, sizeof(topic), "%s/%s/rollup/done", user, mac);
+    snprintf(payload, sizeof(payload), "%lu;%lu%s", (unsigned long)sent, (unsigned long)rollup.records,
+             truncated ? ";truncated" : "");
+    esp_mqtt_client_publish(client, topic, payload, 0, 0, 0);
+    ESP_LOGI(TAG, "Rollup %lu s %s: %lu sent%s, %lu read", (unsigned long)s_query_request.period,
+             s_query_request.sensor, (unsigned long)sent, truncated ? " (truncated)" : "",
+             (unsigned long)rollup.records);
+    s_query_request.pending = false;
+}
+
+static void publish_task_stats(esp_mqtt_client_handle_t client, const char *topic)
+{
+    static char payload[2048]; // every planned task, the client sends it in several chunks
+    size_t len = task_stats_format_json(payload, sizeof(payload));
+    if (len == 0)
+        return;
 
-    ESP_LOGI(TAG, "All stored data sent, clearing SPIFFS");
-    storage_clear_all();
+    esp_mqtt_client_publish(client, topic, payload, len, 0, 0);
 }
 
+/*
+ * Live telemetry: every MQTT_LIVE_TICK_MS a timer takes the sensors that are due into one snapshot,
+ * whatever mqtt_task is busy with. Snapshots wait in a small ring until mqtt_task sends them as
+ * {"ts":T,"NAME":VALUE,...} on <user>/<mac>/live; when the ring is full the oldest one is dropped,
+ * the next message carries "dropped":N.
+ */
+typedef struct {
+    uint32_t ts;
+    uint32_t sensors; // bit i: s_live[i] is in the snapshot
+    float values[MQTT_LIVE_MAX_SENSORS];
+} live_snapshot_t;
+
+static mqtt_live_sensor_t s_live[MQTT_LIVE_MAX_SENSORS];
+static size_t s_live_count;
+static struct {
+    float value;     // last value taken
+    int64_t when_us; // 0 = never
+} s_live_last[MQTT_LIVE_MAX_SENSORS];
+static live_snapshot_t s_live_queue[MQTT_LIVE_QUEUE_LEN];
+static size_t s_live_head;
+static size_t s_live_len;
+static uint32_t s_live_dropped;
+static portMUX_TYPE s_live_lock = portMUX_INITIALIZER_UNLOCKED;
+static char s_live_topic[64];
+
+static void live_tick(void *arg)
+{
+    int64_t now = esp_timer_get_time();
+    live_snapshot_t snap = {.ts = (uint32_t)time(NULL)};
+    for (size_t i = 0; i < s_live_count; i++) {
+        float value = *s_live[i].value;
+        int64_t since = now - s_live_last[i].when_us;
+        bool due = s_live_last[i].when_us == 0 || since >= (int64_t)MQTT_LIVE_HEARTBEAT_MS * 1000 ||
+                   (since >= (int64_t)s_live[i].interval_ms * 1000 &&
+                    fabsf(value - s_live_last[i].value) >= s_live[i].deadband);
+        if (!due)
+            continue;
+        s_live_last[i].value = value;
+        s_live_last[i].when_us = now;
+        snap.sensors |= 1u << i;
+        snap.values[i] = value;
+    }
+    if (snap.sensors == 0)
+        return;
+
+    taskENTER_CRITICAL(&s_live_lock);
+    if (s_live_len == MQTT_LIVE_QUEUE_LEN) {
+        s_live_head = (s_live_head + 1) % MQTT_LIVE_QUEUE_LEN;
+        s_live_len--;
+        s_live_dropped++;
+    }
+    s_live_queue[(s_live_head + s_live_len) % MQTT_LIVE_QUEUE_LEN] = snap;
+    s_live_len++;
+    taskEXIT_CRITICAL(&s_live_lock);
+}
+
+static void publish_live(esp_mqtt_client_handle_t client)
+{
+    while (mqtt_connected) {
+        live_snapshot_t snap;
+        uint32_t dropped = 0;
+        bool queued = false;
+        taskENTER_CRITICAL(&s_live_lock);
+        if (s_live_len > 0) {
+            snap = s_live_queue[s_live_head];
+            s_live_head = (s_live_head + 1) % MQTT_LIVE_QUEUE_LEN;
+            s_live_len--;
+            dropped = s_live_dropped;
+            s_live_dropped = 0;
+            queued = true;
+        }
+        taskEXIT_CRITICAL(&s_live_lock);
+        if (!queued)
+            return;
+
+        char payload[384];
+        size_t len = snprintf(payload, sizeof(payload), "{\"ts\":%lu", (unsigned long)snap.ts);
+        for (size_t i = 0; i < s_live_count && len < sizeof(payload); i++) {
+            if (snap.sensors & (1u << i))
+                len += snprintf(payload + len, sizeof(payload) - len, ",\"%s\":%.3f", s_live[i].name, snap.values[i]);
+        }
+        if (dropped > 0 && len < sizeof(payload))
+            len += snprintf(payload + len, sizeof(payload) - len, ",\"dropped\":%lu", (unsigned long)dropped);
+        if (len < sizeof(payload))
+            len += snprintf(payload + len, sizeof(payload) - len, "}");
+        if (len >= sizeof(payload) || esp_mqtt_client_publish(client, s_live_topic, payload, len, 0, 0) < 0) {
+            taskENTER_CRITICAL(&s_live_lock);
+            s_live_dropped += dropped + 1;
+            taskEXIT_CRITICAL(&s_live_lock);
+            return;
+        }
+    }
+}
 
 static void mqtt_task(void *arg)
 {
@@ -163,6 +618,17 @@ static void mqtt_task(void *arg)
         .broker.address.uri = MQTT_BROKER_URI,
     };
 
+    s_ack_queue = xQueueCreate(MQTT_UPLOAD_INFLIGHT * 2, sizeof(int));
+
+    snprintf(s_live_topic, sizeof(s_live_topic), "%s/%s/live", user, mac);
+    const esp_timer_create_args_t live_timer_args = {
+        .callback = live_tick,
+        .name = "mqtt_live",
+    };
+    esp_timer_handle_t live_timer = NULL;
+    if (s_live_count > 0 && esp_timer_create(&live_timer_args, &live_timer) == ESP_OK)
+        esp_timer_start_periodic(live_timer, (uint64_t)MQTT_LIVE_TICK_MS * 1000);
+
     esp_mqtt_client_handle_t client = esp_mqtt_client_init(&cfg);
     esp_mqtt_client_register_event(client, ESP_EVENT_ANY_ID,
                                    mqtt_event_handler, NULL);
@@ -176,23 +642,48 @@ static void mqtt_task(void *arg)
     publish_hello(client, user, mac, "MAX6675_NORMAL");
     publish_hello(client, user, mac, "MAX6675_PROFILE");
 
-    publish_storage_via_mqtt(client, user, mac);
-
-    ESP_LOGI(TAG, "All MQTT data sent");
+    char stats_topic[64];
+    snprintf(stats_topic, sizeof(stats_topic), "%s/%s/stats/tasks", user, mac);
+    int64_t next_stats_us = esp_timer_get_time();
 
     while (!mqtt_exit_requested) {
+        if (mqtt_connected && esp_timer_get_time() >= next_stats_us) {
+            publish_task_stats(client, stats_topic);
+            next_stats_us = esp_timer_get_time() + (int64_t)TASK_STATS_PUBLISH_INTERVAL_MS * 1000;
+        }
+        // Again after every reconnect, from where the last upload stopped
+        if (mqtt_connected && s_upload_pending) {
+            s_upload_pending = false;
+            if (publish_storage_via_mqtt(client, user, mac) && publish_flash_via_mqtt(client, user, mac))
+                ESP_LOGI(TAG, "All MQTT data sent");
+            else
+                s_upload_pending = true;
+        }
+        publish_live(client);
+        if (mqtt_connected && s_query_request.pending) {
+            if (s_query_request.period != 0)
+                publish_rollup(client, user, mac);
+            else
+                publish_query(client, user, mac);
+        }
         vTaskDelay(pdMS_TO_TICKS(200));
     }
 
     ESP_LOGI(TAG, "EXIT received, stopping MQTT...");
 
+    if (live_timer != NULL) {
+        esp_timer_stop(live_timer);
+        esp_timer_delete(live_timer);
+    }
     esp_mqtt_client_stop(client);
     esp_mqtt_client_destroy(client);
-    vTaskDelete(NULL);
+    task_plan_exit(TASK_ID_MQTT);
 }
 
 
-void mqtt_client_start(void)
+void mqtt_client_start(const mqtt_live_sensor_t *live, size_t count)
 {
-    xTaskCreate(mqtt_task, "mqtt_hello", 4096, NULL, 5, NULL);
+    s_live_count = count < MQTT_LIVE_MAX_SENSORS ? count : MQTT_LIVE_MAX_SENSORS;
+    memcpy(s_live, live, s_live_count * sizeof(*live));
+    task_plan_create(TASK_ID_MQTT, mqtt_task, NULL, NULL);
 }
@@ -1,5 +1,18 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
-void mqtt_client_start(void);
+#define MQTT_LIVE_MAX_SENSORS 8
+
+// One sensor of the live stream on <user>/<mac>/live
+typedef struct {
+    const char *name;
+    const float *value;   // latest reading, written by the sensor task
+    uint32_t interval_ms; // not sent more often than this
+    float deadband;       // nor when it moved less than this since the last value sent (heartbeat aside)
+} mqtt_live_sensor_t;
+
+// Starts the client; the sensor table is copied, the values it points to must stay valid
+void mqtt_client_start(const mqtt_live_sensor_t *live, size_t count);
@@ -0,0 +1,343 @@
+#include "sensor_hal.h"
+#include "sensor_hal_priv.h"
+#include "esp_timer.h"
+#include "project_config.h"
+#include <string.h>
+
+#if CONFIG_IDF_TARGET_LINUX
+static const sensor_hal_backend_t *s_backend = &sensor_hal_replay_backend;
+#else
+static const sensor_hal_backend_t *s_backend = &sensor_hal_hw_backend;
+#endif
+
+void sensor_hal_set_backend(const sensor_hal_backend_t *backend)
+{
+    if (backend != NULL)
+        s_backend = backend;
+}
+
+const char *sensor_hal_backend_name(void)
+{
+    return s_backend->name;
+}
+
+int64_t sensor_hal_time_us(void)
+{
+    if (s_backend == &sensor_hal_replay_backend)
+        return sensor_hal_replay_time_us();
+    return esp_timer_get_time();
+}
+
+// Bus access priority per device: the accelerometer FIFO overflows first, it drains before anything else
+static const i2c_bus_prio_t dev_priority[SENSOR_HAL_DEV_COUNT] = {
+    [SENSOR_HAL_DEV_BMP280] = I2C_BUS_PRIO_NORMAL,
+    [SENSOR_HAL_DEV_ADXL345] = I2C_BUS_PRIO_HIGH,
+    [SENSOR_HAL_DEV_VEML7700] = I2C_BUS_PRIO_NORMAL,
+    [SENSOR_HAL_DEV_MAX6675] = I2C_BUS_PRIO_NORMAL,
+    [SENSOR_HAL_DEV_HCSR04] = I2C_BUS_PRIO_NORMAL,
+};
+
+// Read queued by sensor_hal_i2c_read_start, collected by sensor_hal_i2c_read_wait
+typedef struct
+{
+    bool active;
+    uint8_t tx[SENSOR_HAL_ASYNC_TX_MAX];
+    size_t tx_len;
+    uint8_t *rx;
+    size_t rx_len;
+    esp_err_t err; // Result of a backend without async support, known at start
+    bool stale;    // The wait timed out, the transfer may still complete into the device's completion
+} async_read_t;
+
+static async_read_t s_async[SENSOR_HAL_DEV_COUNT];
+
+esp_err_t sensor_hal_i2c_attach(sensor_hal_dev_t *dev, sensor_hal_i2c_bus_t bus, uint8_t address, uint32_t speed_hz)
+{
+    if (s_backend->i2c_attach == NULL)
+        return ESP_ERR_NOT_SUPPORTED;
+
+    // Probing puts an address on the wire, it needs the bus like any other transaction
+    esp_err_t err = i2c_bus_acquire(bus, dev_priority[dev->id], I2C_BUS_ACQUIRE_TIMEOUT_MS);
+    if (err == ESP_OK)
+    {
+        err = s_backend->i2c_attach(dev, bus, address, i2c_bus_negotiate_speed(bus, speed_hz));
+        i2c_bus_release(bus);
+    }
+    if (err == ESP_OK)
+        dev->bus = bus;
+    sensor_hal_trace_append(dev->id, SENSOR_HAL_OP_ATTACH, err, &address, 1, NULL, 0);
+    return err;
+}
+
+esp_err_t sensor_hal_i2c_detach(sensor_hal_dev_t *dev)
+{
+    if (!sensor_hal_is_attached(dev))
+        return ESP_ERR_INVALID_STATE;
+    esp_err_t err = s_backend->i2c_detach ? s_backend->i2c_detach(dev) : ESP_OK;
+    dev->handle = NULL;
+    s_async[dev->id].active = false;
+    s_async[dev->id].stale = false;
+    sensor_hal_trace_append(dev->id, SENSOR_HAL_OP_DETACH, err, NULL, 0, NULL, 0);
+    return err;
+}
+
+esp_err_t sensor_hal_i2c_bus_reset(sensor_hal_i2c_bus_t bus)
+{
+    if (s_backend->i2c_bus_reset == NULL)
+        return ESP_ERR_NOT_SUPPORTED;
+
+    esp_err_t err = i2c_bus_acquire(bus, I2C_BUS_PRIO_NORMAL, I2C_BUS_ACQUIRE_TIMEOUT_MS);
+    if (err == ESP_OK)
+    {
+        err = s_backend->i2c_bus_reset(bus);
+        i2c_bus_release(bus);
+    }
+    sensor_hal_trace_append(SENSOR_HAL_TRACE_NO_DEV, SENSOR_HAL_OP_BUS_RESET, err, NULL, 0, NULL, 0);
+    return err;
+}
+
+// A late completion would be taken for the next transfer's (and its rx may still be written), so the
+// next transfer of the device waits for it first. Still outstanding: the device needs recovery.
+static esp_err_t drain_stale(sensor_hal_dev_t *dev)
+{
+    async_read_t *rd = &s_async[dev->id];
+    if (!rd->stale)
+        return ESP_OK;
+    if (s_backend->i2c_read_wait(dev, I2C_TRANSACTION_TIMEOUT_MS) == ESP_ERR_TIMEOUT)
+        return ESP_ERR_INVALID_STATE;
+    rd->stale = false;
+    return ESP_OK;
+}
+
+// Caller holds the bus
+static esp_err_t i2c_transfer(sensor_hal_dev_t *dev, const uint8_t *tx, size_t tx_len,
+                              uint8_t *rx, size_t rx_len, int timeout_ms)
+{
+    // The device's completion is spoken for by the read in flight
+    if (s_async[dev->id].active)
+        return ESP_ERR_INVALID_STATE;
+
+    esp_err_t err = drain_stale(dev);
+    if (err != ESP_OK)
+        return err;
+    if (rx == NULL)
+    {
+        err = s_backend->i2c_write(dev, tx, tx_len, timeout_ms);
+        sensor_hal_trace_append(dev->id, SENSOR_HAL_OP_I2C_WRITE, err, tx, tx_len, NULL, 0);
+    }
+    else
+    {
+        err = s_backend->i2c_write_read(dev, tx, tx_len, rx, rx_len, timeout_ms);
+        sensor_hal_trace_append(dev->id, SENSOR_HAL_OP_I2C_WRITE_READ, err, tx, tx_len, rx, rx_len);
+    }
+    // Synchronous calls queue and wait as well when the backend is async
+    if (err == ESP_ERR_TIMEOUT && s_backend->i2c_read_start != NULL)
+        s_async[dev->id].stale = true;
+    return err;
+}
+
+esp_err_t sensor_hal_i2c_write(sensor_hal_dev_t *dev, const uint8_t *data, size_t len, int timeout_ms)
+{
+    if (!sensor_hal_is_attached(dev))
+        return ESP_ERR_INVALID_STATE;
+
+    esp_err_t err = i2c_bus_acquire(dev->bus, dev_priority[dev->id], I2C_BUS_ACQUIRE_TIMEOUT_MS);
+    if (err != ESP_OK)
+        return err;
+    err = i2c_transfer(dev, data, len, NULL, 0, timeout_ms);
+    i2c_bus_release(dev->bus);
+    return err;
+}
+
+esp_err_t sensor_hal_i2c_write_read(sensor_hal_dev_t *dev, const uint8_t *tx, size_t tx_len,
+                                    uint8_t *rx, size_t rx_len, int timeout_ms)
+{
+    if (!sensor_hal_is_attached(dev))
+        return ESP_ERR_INVALID_STATE;
+
+    esp_err_t err = i2c_bus_acquire(dev->bus, dev_priority[dev->id], I2C_BUS_ACQUIRE_TIMEOUT_MS);
+    if (err != ESP_OK)
+        return err;
+    err = i2c_transfer(dev, tx, tx_len, rx, rx_len, timeout_ms);
+    i2c_bus_release(dev->bus);
+    return err;
+}
+
+esp_err_t sensor_hal_i2c_batch(sensor_hal_i2c_op_t *ops, size_t count, int timeout_ms)
+{
+    if (count == 0)
+        return ESP_OK;
+
+    sensor_hal_i2c_bus_t bus = ops[0].dev->bus;
+    i2c_bus_prio_t prio = I2C_BUS_PRIO_LOW;
+    for (size_t i = 0; i < count; i++)
+    {
+        ops[i].err = ESP_ERR_NOT_FINISHED;
+        if (!sensor_hal_is_attached(ops[i].dev) || ops[i].dev->bus != bus)
+            return ESP_ERR_INVALID_ARG;
+        if (dev_priority[ops[i].dev->id] > prio)
+            prio = dev_priority[ops[i].dev->id];
+    }
+
+    esp_err_t err = i2c_bus_acquire(bus, prio, I2C_BUS_ACQUIRE_TIMEOUT_MS);
+    if (err != ESP_OK)
+        return err;
+    for (size_t i = 0; i < count && err == ESP_OK; i++)
+    {
+        sensor_hal_i2c_op_t *op = &ops[i];
+        op->err = i2c_transfer(op->dev, op->tx, op->tx_len, op->rx, op->rx_len, timeout_ms);
+        err = op->err;
+    }
+    i2c_bus_release(bus);
+    return err;
+}
+
+esp_err_t sensor_hal_i2c_read_start(sensor_hal_dev_t *dev, const uint8_t *tx, size_t tx_len, uint8_t *rx, size_t rx_len)
+{
+    if (!sensor_hal_is_attached(dev) || s_async[dev->id].active)
+        return ESP_ERR_INVALID_STATE;
+    if (tx_len > SENSOR_HAL_ASYNC_TX_MAX)
+        return ESP_ERR_INVALID_SIZE;
+
+    async_read_t *rd = &s_async[dev->id];
+    memcpy(rd->tx, tx, tx_len);
+    rd->tx_len = tx_len;
+    rd->rx = rx;
+    rd->rx_len = rx_len;
+
+    esp_err_t err = i2c_bus_acquire(dev->bus, dev_priority[dev->id], I2C_BUS_ACQUIRE_TIMEOUT_MS);
+    if (err != ESP_OK)
+        return err;
+    err = drain_stale(dev);
+    if (err == ESP_OK && s_backend->i2c_read_start != NULL)
+    {
+        err = s_backend->i2c_read_start(dev, rd->tx, tx_len, rx, rx_len);
+    }
+    else if (err == ESP_OK)
+    {
+        rd->err = s_backend->i2c_write_read(dev, rd->tx, tx_len, rx, rx_len, I2C_TRANSACTION_TIMEOUT_MS);
+        err = ESP_OK;
+    }
+    i2c_bus_release(dev->bus);
+
+    if (err != ESP_OK)
+    {
+        sensor_hal_trace_append(dev->id, SENSOR_HAL_OP_I2C_WRITE_READ, err, tx, tx_len, NULL, 0);
+        return err;
+    }
+    rd->active = true;
+    return ESP_OK;
+}
+
+esp_err_t sensor_hal_i2c_read_wait(sensor_hal_dev_t *dev, int timeout_ms)
+{
+    async_read_t *rd = &s_async[dev->id];
+    if (!rd->active)
+        return ESP_ERR_INVALID_STATE;
+
+    esp_err_t err = s_backend->i2c_read_start != NULL ? s_backend->i2c_read_wait(dev, timeout_ms) : rd->err;
+    rd->active = false;
+    if (err == ESP_ERR_TIMEOUT && s_backend->i2c_read_start != NULL)
+        rd->stale = true;
+    sensor_hal_trace_append(dev->id, SENSOR_HAL_OP_I2C_WRITE_READ, err, rd->tx, rd->tx_len, rd->rx, rd->rx_len);
+    return err;
+}
+
+esp_err_t sensor_hal_spi_attach(sensor_hal_dev_t *dev, int cs_pin, uint32_t clock_hz)
+{
+    if (s_backend->spi_attach == NULL)
+        return ESP_ERR_NOT_SUPPORTED;
+    esp_err_t err = s_backend->spi_attach(dev, cs_pin, clock_hz);
+    sensor_hal_trace_append(dev->id, SENSOR_HAL_OP_ATTACH, err, NULL, 0, NULL, 0);
+    return err;
+}
+
+esp_err_t sensor_hal_spi_detach(sensor_hal_dev_t *dev)
+{
+    if (!sensor_hal_is_attached(dev))
+        return ESP_ERR_INVALID_STATE;
+    esp_err_t err = s_backend->spi_detach ? s_backend->spi_detach(dev) : ESP_OK;
+    dev->handle = NULL;
+    sensor_hal_trace_append(dev->id, SENSOR_HAL_OP_DETACH, err, NULL, 0, NULL, 0);
+    return err;
+}
+
+esp_err_t sensor_hal_spi_read(sensor_hal_dev_t *dev, uint8_t *rx, size_t len)
+{
+    if (!sensor_hal_is_attached(dev))
+        return ESP_ERR_INVALID_STATE;
+    if (len > 4)
+        return ESP_ERR_INVALID_SIZE;
+    esp_err_t err = s_backend->spi_read(dev, rx, len);
+    sensor_hal_trace_append(dev->id, SENSOR_HAL_OP_SPI_READ, err, NULL, 0, rx, len);
+    return err;
+}
+
+typedef enum
+{
+    RETRY_I2C_WRITE,
+    RETRY_I2C_WRITE_READ,
+    RETRY_SPI_READ,
+} retry_op_t;
+
+static esp_err_t run_with_retry(retry_op_t op, bus_stats_t *stats, sensor_hal_dev_t *dev, const uint8_t *tx,
+                                size_t tx_len, uint8_t *rx, size_t rx_len, int timeout_ms)
+{
+    esp_err_t err;
+    int attempt = 0;
+    do
+    {
+        int64_t start = esp_timer_get_time();
+        switch (op)
+        {
+        case RETRY_I2C_WRITE:
+            err = sensor_hal_i2c_write(dev, tx, tx_len, timeout_ms);
+            break;
+        case RETRY_I2C_WRITE_READ:
+            err = sensor_hal_i2c_write_read(dev, tx, tx_len, rx, rx_len, timeout_ms);
+            break;
+        default:
+            err = sensor_hal_spi_read(dev, rx, rx_len);
+            break;
+        }
+        if (stats != NULL)
+            bus_stats_record(stats, start, err);
+    } while (err != ESP_OK && stats != NULL && bus_stats_should_retry(stats, err, &attempt));
+    return err;
+}
+
+esp_err_t sensor_hal_i2c_write_retry(bus_stats_t *stats, sensor_hal_dev_t *dev, const uint8_t *data, size_t len,
+                                     int timeout_ms)
+{
+    return run_with_retry(RETRY_I2C_WRITE, stats, dev, data, len, NULL, 0, timeout_ms);
+}
+
+esp_err_t sensor_hal_i2c_write_read_retry(bus_stats_t *stats, sensor_hal_dev_t *dev, const uint8_t *tx,
+                                          size_t tx_len, uint8_t *rx, size_t rx_len, int timeout_ms)
+{
+    return run_with_retry(RETRY_I2C_WRITE_READ, stats, dev, tx, tx_len, rx, rx_len, timeout_ms);
+}
+
+esp_err_t sensor_hal_spi_read_retry(bus_stats_t *stats, sensor_hal_dev_t *dev, uint8_t *rx, size_t len)
+{
+    return run_with_retry(RETRY_SPI_READ, stats, dev, NULL, 0, rx, len, 0);
+}
+
+esp_err_t sensor_hal_ultrasonic_init(sensor_hal_dev_t *dev)
+{
+    if (s_backend->ultrasonic_init == NULL)
+        return ESP_ERR_NOT_SUPPORTED;
+    esp_err_t err = s_backend->ultrasonic_init(dev);
+    sensor_hal_trace_append(dev->id, SENSOR_HAL_OP_ATTACH, err, NULL, 0, NULL, 0);
+    return err;
+}
+
+esp_err_t sensor_hal_ultrasonic_measure(sensor_hal_dev_t *dev, uint32_t max_cm, uint32_t *distance_cm)
+{
+    if (!sensor_hal_is_attached(dev))
+        return ESP_ERR_INVALID_STATE;
+    esp_err_t err = s_backend->ultrasonic_measure(dev, max_cm, distance_cm);
+    sensor_hal_trace_append(dev->id, SENSOR_HAL_OP_ULTRASONIC_MEASURE, err,
+                            (const uint8_t *)&max_cm, sizeof(max_cm), (const uint8_t *)distance_cm, sizeof(*distance_cm));
+    return err;
+}
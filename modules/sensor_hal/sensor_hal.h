@@ -0,0 +1,274 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+/*
+ * Sensor hardware abstraction layer.
+ *
+ * Drivers in modules/sensors talk to their device only through this seam. The active
+ * backend decides what is behind it:
+ * - hardware (default on target): ESP-IDF i2c_master / spi_master / HC-SR04 driver
+ * - replay (linux target): raw transactions served from a trace recorded on the device
+ * - emulator (linux target): register-level models of the sensors
+ *
+ * Independently of the backend every transaction can be recorded to a trace file
+ * (sensor_hal_record_start), which is how replay traces are captured in the field.
+ */
+
+#include "i2c_master_bus.h"
+#include "bus_stats.h"
+
+typedef i2c_bus_handle_t sensor_hal_i2c_bus_t;
+
+typedef enum
+{
+    SENSOR_HAL_DEV_BMP280 = 0,
+    SENSOR_HAL_DEV_ADXL345,
+    SENSOR_HAL_DEV_VEML7700,
+    SENSOR_HAL_DEV_MAX6675,
+    SENSOR_HAL_DEV_HCSR04,
+    SENSOR_HAL_DEV_COUNT
+} sensor_hal_dev_id_t;
+
+typedef struct
+{
+    sensor_hal_dev_id_t id;
+    void *handle;             /*!< Backend specific device handle, NULL while detached */
+    sensor_hal_i2c_bus_t bus; /*!< I2C bus the device was attached to */
+} sensor_hal_dev_t;
+
+#define SENSOR_HAL_DEV_INIT(dev_id) {.id = (dev_id), .handle = NULL, .bus = NULL}
+
+/**
+ * @brief One entry of a batched I2C transaction list, see sensor_hal_i2c_batch.
+ */
+typedef struct
+{
+    sensor_hal_dev_t *dev;
+    const uint8_t *tx;
+    size_t tx_len;
+    uint8_t *rx;    /*!< NULL for a plain write */
+    size_t rx_len;
+    esp_err_t err;  /*!< Result, ESP_ERR_NOT_FINISHED if an earlier entry failed */
+} sensor_hal_i2c_op_t;
+
+typedef struct
+{
+    const char *name;
+    esp_err_t (*i2c_attach)(sensor_hal_dev_t *dev, sensor_hal_i2c_bus_t bus, uint8_t address, uint32_t speed_hz);
+    esp_err_t (*i2c_detach)(sensor_hal_dev_t *dev);
+    esp_err_t (*i2c_bus_reset)(sensor_hal_i2c_bus_t bus);
+    esp_err_t (*i2c_write)(sensor_hal_dev_t *dev, const uint8_t *data, size_t len, int timeout_ms);
+    esp_err_t (*i2c_write_read)(sensor_hal_dev_t *dev, const uint8_t *tx, size_t tx_len,
+                                uint8_t *rx, size_t rx_len, int timeout_ms);
+    /* Optional, NULL runs async reads synchronously in sensor_hal_i2c_read_start */
+    esp_err_t (*i2c_read_start)(sensor_hal_dev_t *dev, const uint8_t *tx, size_t tx_len, uint8_t *rx, size_t rx_len);
+    esp_err_t (*i2c_read_wait)(sensor_hal_dev_t *dev, int timeout_ms);
+    esp_err_t (*spi_attach)(sensor_hal_dev_t *dev, int cs_pin, uint32_t clock_hz);
+    esp_err_t (*spi_detach)(sensor_hal_dev_t *dev);
+    esp_err_t (*spi_read)(sensor_hal_dev_t *dev, uint8_t *rx, size_t len);
+    esp_err_t (*ultrasonic_init)(sensor_hal_dev_t *dev);
+    esp_err_t (*ultrasonic_measure)(sensor_hal_dev_t *dev, uint32_t max_cm, uint32_t *distance_cm);
+} sensor_hal_backend_t;
+
+/**
+ * @brief Replace the active backend. Must be called before any driver is initialized.
+ */
+void sensor_hal_set_backend(const sensor_hal_backend_t *backend);
+
+/**
+ * @brief Name of the active backend ("hardware", "replay", ...).
+ */
+const char *sensor_hal_backend_name(void);
+
+static inline bool sensor_hal_is_attached(const sensor_hal_dev_t *dev)
+{
+    return dev->handle != NULL;
+}
+
+/**
+ * @brief Probe the address and add the device to the I2C bus.
+ *
+ * The clock is negotiated with the bus manager: the device maximum, capped by the bus.
+ *
+ * @param speed_hz Fastest SCL frequency the device supports
+ * @return ESP_OK on success, ESP_ERR_NOT_FOUND if nothing answers at the address
+ */
+esp_err_t sensor_hal_i2c_attach(sensor_hal_dev_t *dev, sensor_hal_i2c_bus_t bus, uint8_t address, uint32_t speed_hz);
+esp_err_t sensor_hal_i2c_detach(sensor_hal_dev_t *dev);
+/**
+ * @brief Clock out a slave holding SDA low and bring the bus back to idle.
+ */
+esp_err_t sensor_hal_i2c_bus_reset(sensor_hal_i2c_bus_t bus);
+esp_err_t sensor_hal_i2c_write(sensor_hal_dev_t *dev, const uint8_t *data, size_t len, int timeout_ms);
+esp_err_t sensor_hal_i2c_write_read(sensor_hal_dev_t *dev, const uint8_t *tx, size_t tx_len,
+                                    uint8_t *rx, size_t rx_len, int timeout_ms);
+
+/**
+ * @brief Run a list of transactions, possibly for several devices, under a single bus grant.
+ *
+ * All devices must sit on the same bus. The list is granted at the highest priority of its
+ * devices and runs back to back; it stops at the first failing entry.
+ *
+ * @return ESP_OK if every entry succeeded, the first error otherwise
+ */
+esp_err_t sensor_hal_i2c_batch(sensor_hal_i2c_op_t *ops, size_t count, int timeout_ms);
+
+#define SENSOR_HAL_ASYNC_TX_MAX 4 // Register address bytes an async read can carry
+
+/**
+ * @brief Queue a register read and return while it runs on the bus.
+ *
+ * On hardware the transfer completes from the I2C ISR (bus created with a transaction queue), the
+ * caller is free to work on the previous sample meanwhile. The bus grant only covers queueing: the
+ * driver runs queued transfers in order, so nothing can cut in, and sensor_hal_i2c_bus_reset lets
+ * queued transfers finish first. One read per device may be in flight, other transactions of that
+ * device fail with ESP_ERR_INVALID_STATE until it is collected.
+ *
+ * @param tx Register address, copied (at most SENSOR_HAL_ASYNC_TX_MAX bytes)
+ * @param rx Destination, must stay valid until sensor_hal_i2c_read_wait returns
+ * @return ESP_OK if the read was queued
+ */
+esp_err_t sensor_hal_i2c_read_start(sensor_hal_dev_t *dev, const uint8_t *tx, size_t tx_len, uint8_t *rx, size_t rx_len);
+
+/**
+ * @brief Wait for the read queued with sensor_hal_i2c_read_start.
+ *
+ * @return Result of the transfer, ESP_ERR_TIMEOUT if it did not complete in time (rx may still be
+ *         written later: the next transaction of the device waits for it first and fails with
+ *         ESP_ERR_INVALID_STATE while it is outstanding, recover the device then), ESP_ERR_INVALID_STATE
+ *         if no read is in flight
+ */
+esp_err_t sensor_hal_i2c_read_wait(sensor_hal_dev_t *dev, int timeout_ms);
+
+esp_err_t sensor_hal_spi_attach(sensor_hal_dev_t *dev, int cs_pin, uint32_t clock_hz);
+esp_err_t sensor_hal_spi_detach(sensor_hal_dev_t *dev);
+/**
+ * @brief Clock in len bytes (len <= 4) from a read-only SPI device.
+ */
+esp_err_t sensor_hal_spi_read(sensor_hal_dev_t *dev, uint8_t *rx, size_t len);
+
+/**
+ * @brief The plain transactions above, repeated on transient errors as bus_stats_should_retry
+ * decides. Every attempt is recorded in stats; with stats NULL the transaction runs once, unrecorded.
+ */
+esp_err_t sensor_hal_i2c_write_retry(bus_stats_t *stats, sensor_hal_dev_t *dev, const uint8_t *data, size_t len,
+                                     int timeout_ms);
+esp_err_t sensor_hal_i2c_write_read_retry(bus_stats_t *stats, sensor_hal_dev_t *dev, const uint8_t *tx,
+                                          size_t tx_len, uint8_t *rx, size_t rx_len, int timeout_ms);
+esp_err_t sensor_hal_spi_read_retry(bus_stats_t *stats, sensor_hal_dev_t *dev, uint8_t *rx, size_t len);
+
+esp_err_t sensor_hal_ultrasonic_init(sensor_hal_dev_t *dev);
+esp_err_t sensor_hal_ultrasonic_measure(sensor_hal_dev_t *dev, uint32_t max_cm, uint32_t *distance_cm);
+
+/**
+ * @brief Monotonic time in us. Under replay this is the timestamp of the last replayed
+ * transaction, so a replay run sees the recorded timeline however fast it executes.
+ */
+int64_t sensor_hal_time_us(void);
+
+/* --- Trace recorder --- */
+
+/**
+ * @brief Start recording every transaction (with its result and data) to a trace file.
+ *
+ * @param path Trace file, truncated if it exists
+ * @return ESP_OK on success
+ */
+esp_err_t sensor_hal_record_start(const char *path);
+
+/**
+ * @brief Flush and close the trace file.
+ *
+ * @return **uint32_t** - Number of recorded transactions
+ */
+uint32_t sensor_hal_record_stop(void);
+
+bool sensor_hal_is_recording(void);
+
+/* --- Replay backend --- */
+
+/**
+ * @brief Load a trace and make the replay backend active.
+ *
+ * Reads are answered with the next recorded transaction of the same device and type
+ * (for I2C also the same register address), writes and bus management always succeed.
+ *
+ * @param path Trace file recorded with sensor_hal_record_start
+ * @param loop Restart a device's trace from the beginning when it runs out instead of failing
+ * @return ESP_OK on success
+ */
+esp_err_t sensor_hal_replay_open(const char *path, bool loop);
+
+/**
+ * @brief Release the loaded trace.
+ */
+void sensor_hal_replay_close(void);
+
+/**
+ * @brief true once a read found no more recorded data (never set in loop mode).
+ */
+bool sensor_hal_replay_finished(void);
+
+/**
+ * @brief Recorded time span of the loaded trace in us.
+ */
+int64_t sensor_hal_replay_duration_us(void);
+
+#if CONFIG_IDF_TARGET_LINUX
+/* --- Emulator backend --- */
+
+/**
+ * @brief Physical conditions seen by the emulated sensors.
+ */
+typedef struct
+{
+    bool present[SENSOR_HAL_DEV_COUNT]; /*!< false makes the device ignore its address */
+    float temperature_c;                /*!< BMP280 */
+    float pressure_hpa;                 /*!< BMP280 */
+    float accel_ms2[3];                 /*!< ADXL345 x, y, z */
+    float lux;                          /*!< VEML7700 */
+    float thermocouple_c;               /*!< MAX6675 */
+    bool thermocouple_open;             /*!< MAX6675 open-circuit flag */
+    uint32_t distance_cm;               /*!< HC-SR04, beyond max_cm means no echo */
+} sensor_hal_emu_env_t;
+
+/**
+ * @brief Per-device transaction counters kept by the emulator.
+ */
+typedef struct
+{
+    uint32_t attaches;
+    uint32_t transactions; /*!< reads + writes */
+    uint32_t writes;
+    uint32_t reads;
+    uint32_t bytes;       /*!< bytes on the wire, I2C address bytes included */
+    uint32_t stale_reads; /*!< result reads that returned no new conversion */
+} sensor_hal_emu_stats_t;
+
+/**
+ * @brief Reset the device models and make the emulator backend active.
+ *
+ * The models follow the datasheets closely enough to exercise driver timing:
+ * - BMP280: datasheet calibration constants, forced/normal mode, 'measuring' status bit for the
+ *   oversampling dependent conversion time
+ * - ADXL345: output data rate, 32 entry FIFO (bypass/FIFO/stream), DATA_READY/watermark/overrun
+ *   in INT_SOURCE
+ * - VEML7700: gain and integration time, results only after a full integration period
+ * - MAX6675: 220 ms conversion restarted by every read
+ *
+ * @param env Initial conditions, NULL for room-temperature defaults with every device present
+ */
+void sensor_hal_emu_start(const sensor_hal_emu_env_t *env);
+
+/**
+ * @brief Change the conditions, picked up by the next conversion of each device.
+ */
+void sensor_hal_emu_set_env(const sensor_hal_emu_env_t *env);
+
+void sensor_hal_emu_get_stats(sensor_hal_dev_id_t id, sensor_hal_emu_stats_t *stats);
+void sensor_hal_emu_reset_stats(void);
+#endif
@@ -0,0 +1,632 @@
+#include "sensor_hal_priv.h"
+#include <math.h>
+#include <string.h>
+#include "esp_timer.h"
+#include "esp_log.h"
+
+static const char *TAG = "SENSOR_HAL_EMU";
+
+#define EMU_BMP280_ADDR 0x77
+#define EMU_ADXL345_ADDR 0x53
+#define EMU_VEML7700_ADDR 0x10
+
+#define EMU_ADXL345_FIFO_DEPTH 32
+#define EMU_MAX6675_CONVERSION_US 220000
+
+static sensor_hal_emu_env_t s_env;
+static sensor_hal_emu_stats_t s_stats[SENSOR_HAL_DEV_COUNT];
+static int s_attached_tag[SENSOR_HAL_DEV_COUNT];
+
+static int64_t now_us(void)
+{
+    return esp_timer_get_time();
+}
+
+/* --- BMP280 --- */
+
+// Calibration words of the datasheet example (BST-BMP280-DS001 section 3.12), stored LSB first at 0x88
+static const int32_t bmp280_calib[12] = {27504, 26435, -1000, 36477, -10685, 3024, 2855, 140, -7, 15500, -14600, 6000};
+
+static struct
+{
+    uint8_t regs[256];
+    int64_t conversion_done_us; // 'measuring' stays set until this time
+    bool conversion_pending;    // data registers are updated when the conversion completes
+    bool data_read_since_update;
+} s_bmp280;
+
+static void bmp280_reset(void)
+{
+    memset(&s_bmp280, 0, sizeof(s_bmp280));
+    s_bmp280.regs[0xD0] = 0x58; // chip id
+    for (int i = 0; i < 12; i++)
+    {
+        s_bmp280.regs[0x88 + 2 * i] = (uint8_t)(bmp280_calib[i] & 0xFF);
+        s_bmp280.regs[0x89 + 2 * i] = (uint8_t)((bmp280_calib[i] >> 8) & 0xFF);
+    }
+    // Data registers read 0x80000 until the first conversion
+    s_bmp280.regs[0xF7] = 0x80;
+    s_bmp280.regs[0xFA] = 0x80;
+}
+
+// Bosch integer compensation, used backwards to turn the environment into ADC counts
+static int32_t bmp280_t_fine(int32_t adc_t)
+{
+    int32_t t1 = bmp280_calib[0], t2 = bmp280_calib[1], t3 = bmp280_calib[2];
+    int32_t var1 = ((((adc_t >> 3) - (t1 << 1))) * t2) >> 11;
+    int32_t var2 = (((((adc_t >> 4) - t1) * ((adc_t >> 4) - t1)) >> 12) * t3) >> 14;
+    return var1 + var2;
+}
+
+static uint32_t bmp280_pressure_pa_q8(int32_t adc_p, int32_t t_fine)
+{
+    const int32_t *c = bmp280_calib;
+    int64_t var1 = ((int64_t)t_fine) - 128000;
+    int64_t var2 = var1 * var1 * (int64_t)c[8];
+    var2 = var2 + ((var1 * (int64_t)c[7]) << 17);
+    var2 = var2 + (((int64_t)c[6]) << 35);
+    var1 = ((var1 * var1 * (int64_t)c[5]) >> 8) + ((var1 * (int64_t)c[4]) << 12);
+    var1 = (((((int64_t)1) << 47) + var1) * (int64_t)c[3]) >> 33;
+    if (var1 == 0)
+        return 0;
+    int64_t p = 1048576 - adc_p;
+    p = (((p << 31) - var2) * 3125) / var1;
+    var1 = (((int64_t)c[11]) * (p >> 13) * (p >> 13)) >> 25;
+    var2 = (((int64_t)c[10]) * p) >> 19;
+    return (uint32_t)(((p + var1 + var2) >> 8) + (((int64_t)c[9]) << 4));
+}
+
+static void bmp280_convert(void)
+{
+    // Temperature rises with the ADC value, pressure falls: bisect both over the 20-bit range
+    int32_t target_t = (int32_t)lroundf(s_env.temperature_c * 100.0f);
+    int32_t lo = 0, hi = (1 << 20) - 1;
+    while (lo < hi)
+    {
+        int32_t mid = (lo + hi) / 2;
+        if (((bmp280_t_fine(mid) * 5 + 128) >> 8) < target_t)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    int32_t adc_t = lo;
+    int32_t t_fine = bmp280_t_fine(adc_t);
+
+    uint32_t target_p = (uint32_t)lroundf(s_env.pressure_hpa * 100.0f * 256.0f);
+    lo = 0;
+    hi = (1 << 20) - 1;
+    while (lo < hi)
+    {
+        int32_t mid = (lo + hi) / 2;
+        if (bmp280_pressure_pa_q8(mid, t_fine) > target_p)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    int32_t adc_p = lo;
+
+    s_bmp280.regs[0xF7] = (uint8_t)(adc_p >> 12);
+    s_bmp280.regs[0xF8] = (uint8_t)(adc_p >> 4);
+    s_bmp280.regs[0xF9] = (uint8_t)((adc_p & 0x0F) << 4);
+    s_bmp280.regs[0xFA] = (uint8_t)(adc_t >> 12);
+    s_bmp280.regs[0xFB] = (uint8_t)(adc_t >> 4);
+    s_bmp280.regs[0xFC] = (uint8_t)((adc_t & 0x0F) << 4);
+    s_bmp280.data_read_since_update = false;
+}
+
+// Typical measurement time from datasheet table 13: 1.25 ms + 2.3 ms per oversampling step (+0.575 ms for pressure)
+static int64_t bmp280_measurement_us(uint8_t ctrl_meas)
+{
+    uint8_t osrs_t = (ctrl_meas >> 5) & 0x07;
+    uint8_t osrs_p = (ctrl_meas >> 2) & 0x07;
+    int samples_t = osrs_t ? 1 << ((osrs_t > 5 ? 5 : osrs_t) - 1) : 0;
+    int samples_p = osrs_p ? 1 << ((osrs_p > 5 ? 5 : osrs_p) - 1) : 0;
+    return 1250 + 2300 * samples_t + (samples_p ? 2300 * samples_p + 575 : 0);
+}
+
+static void bmp280_update(void)
+{
+    uint8_t mode = s_bmp280.regs[0xF4] & 0x03;
+    if (s_bmp280.conversion_pending && now_us() >= s_bmp280.conversion_done_us)
+    {
+        bmp280_convert();
+        s_bmp280.conversion_pending = false;
+        if (mode == 1 || mode == 2)
+            s_bmp280.regs[0xF4] &= ~0x03; // forced mode falls back to sleep
+    }
+    if (mode == 3 && !s_bmp280.conversion_pending)
+    {
+        // Normal mode: next cycle after the standby time
+        static const int64_t standby_us[8] = {500, 62500, 125000, 250000, 500000, 1000000, 2000000, 4000000};
+        s_bmp280.conversion_pending = true;
+        s_bmp280.conversion_done_us = now_us() + bmp280_measurement_us(s_bmp280.regs[0xF4]) +
+                                      standby_us[(s_bmp280.regs[0xF5] >> 5) & 0x07];
+    }
+}
+
+static void bmp280_write(uint8_t reg, uint8_t value)
+{
+    if (reg == 0xE0)
+    {
+        if (value == 0xB6)
+            bmp280_reset();
+        return;
+    }
+    if (reg != 0xF4 && reg != 0xF5)
+        return; // everything else is read-only
+
+    s_bmp280.regs[reg] = value;
+    uint8_t mode = value & 0x03;
+    if (reg == 0xF4 && (mode == 1 || mode == 2))
+    {
+        s_bmp280.conversion_pending = true;
+        s_bmp280.conversion_done_us = now_us() + bmp280_measurement_us(value);
+    }
+}
+
+static void bmp280_read(uint8_t reg, uint8_t *rx, size_t len, sensor_hal_emu_stats_t *stats)
+{
+    bmp280_update();
+    if (reg == 0xF3)
+        s_bmp280.regs[0xF3] = s_bmp280.conversion_pending && now_us() < s_bmp280.conversion_done_us ? 0x08 : 0x00;
+
+    bool data_read = reg <= 0xFC && reg + len > 0xF7;
+    if (data_read)
+    {
+        if (s_bmp280.data_read_since_update || s_bmp280.conversion_pending)
+            stats->stale_reads++;
+        s_bmp280.data_read_since_update = true;
+    }
+
+    // Burst reads auto-increment through the register map
+    for (size_t i = 0; i < len; i++)
+        rx[i] = s_bmp280.regs[(uint8_t)(reg + i)];
+}
+
+/* --- ADXL345 --- */
+
+typedef struct
+{
+    int16_t x, y, z;
+} adxl345_sample_t;
+
+static struct
+{
+    uint8_t regs[64];
+    adxl345_sample_t fifo[EMU_ADXL345_FIFO_DEPTH];
+    uint8_t fifo_head;
+    uint8_t fifo_count;
+    bool overrun;
+    int64_t next_sample_us;
+    adxl345_sample_t latest;
+    bool latest_fresh; // a sample arrived since the data registers were last read
+} s_adxl345;
+
+static void adxl345_reset(void)
+{
+    memset(&s_adxl345, 0, sizeof(s_adxl345));
+    s_adxl345.regs[0x00] = 0xE5; // DEVID
+    s_adxl345.regs[0x2C] = 0x0A; // BW_RATE 100 Hz
+}
+
+static int64_t adxl345_period_us(void)
+{
+    uint8_t power_ctl = s_adxl345.regs[0x2D];
+    if (power_ctl & 0x04)
+        return 1000000 / (8 >> (power_ctl & 0x03)); // sleep: wake-up frequency 8/4/2/1 Hz
+
+    uint8_t rate = s_adxl345.regs[0x2C] & 0x0F;
+    // 3200 Hz at code 0xF, halving per step
+    return (int64_t)1000000 * (1 << (0x0F - rate)) / 3200;
+}
+
+static adxl345_sample_t adxl345_make_sample(void)
+{
+    uint8_t format = s_adxl345.regs[0x31];
+    // Full resolution keeps 4 mg/LSB, otherwise 10 bits span the selected range
+    float mg_per_lsb = (format & 0x08) ? 3.9f : 3.9f * (1 << (format & 0x03));
+    float scale = 1000.0f / 9.80665f / mg_per_lsb;
+    adxl345_sample_t sample = {
+        .x = (int16_t)lroundf(s_env.accel_ms2[0] * scale),
+        .y = (int16_t)lroundf(s_env.accel_ms2[1] * scale),
+        .z = (int16_t)lroundf(s_env.accel_ms2[2] * scale),
+    };
+    return sample;
+}
+
+static void adxl345_update(void)
+{
+    if ((s_adxl345.regs[0x2D] & 0x08) == 0)
+        return; // standby
+
+    int64_t now = now_us();
+    if (s_adxl345.next_sample_us == 0)
+        s_adxl345.next_sample_us = now;
+
+    uint8_t fifo_mode = s_adxl345.regs[0x38] >> 6;
+    int produced = 0;
+    while (s_adxl345.next_sample_us <= now && produced < EMU_ADXL345_FIFO_DEPTH)
+    {
+        adxl345_sample_t sample = adxl345_make_sample();
+        s_adxl345.latest = sample;
+        s_adxl345.latest_fresh = true;
+
+        bool full = s_adxl345.fifo_count == EMU_ADXL345_FIFO_DEPTH;
+        if (full)
+            s_adxl345.overrun = true;
+
+        // FIFO mode stops collecting when full, stream and trigger modes drop the oldest entry
+        if (fifo_mode != 0 && !(full && fifo_mode == 1))
+        {
+            if (full)
+            {
+                s_adxl345.fifo_head = (s_adxl345.fifo_head + 1) % EMU_ADXL345_FIFO_DEPTH;
+                s_adxl345.fifo_count--;
+            }
+            uint8_t tail = (s_adxl345.fifo_head + s_adxl345.fifo_count) % EMU_ADXL345_FIFO_DEPTH;
+            s_adxl345.fifo[tail] = sample;
+            s_adxl345.fifo_count++;
+        }
+        s_adxl345.next_sample_us += adxl345_period_us();
+        produced++;
+    }
+    // Skip samples the FIFO could not hold anyway
+    if (s_adxl345.next_sample_us <= now)
+        s_adxl345.next_sample_us = now + adxl345_period_us();
+}
+
+static uint8_t adxl345_int_source(void)
+{
+    uint8_t fifo_mode = s_adxl345.regs[0x38] >> 6;
+    uint8_t watermark = s_adxl345.regs[0x38] & 0x1F;
+    uint8_t source = 0;
+
+    bool data_ready = fifo_mode != 0 ? s_adxl345.fifo_count > 0 : s_adxl345.latest_fresh;
+    if (data_ready)
+        source |= 0x80;
+    if (fifo_mode != 0 && watermark > 0 && s_adxl345.fifo_count >= watermark)
+        source |= 0x02;
+    if (s_adxl345.overrun)
+        source |= 0x01;
+    return source;
+}
+
+static void adxl345_pop_data(sensor_hal_emu_stats_t *stats)
+{
+    adxl345_sample_t sample = s_adxl345.latest;
+    uint8_t fifo_mode = s_adxl345.regs[0x38] >> 6;
+    if (fifo_mode != 0 && s_adxl345.fifo_count > 0)
+    {
+        sample = s_adxl345.fifo[s_adxl345.fifo_head];
+        s_adxl345.fifo_head = (s_adxl345.fifo_head + 1) % EMU_ADXL345_FIFO_DEPTH;
+        s_adxl345.fifo_count--;
+        s_adxl345.overrun = false;
+    }
+    else if (!s_adxl345.latest_fresh)
+    {
+        stats->stale_reads++;
+    }
+    s_adxl345.latest_fresh = false;
+
+    s_adxl345.regs[0x32] = (uint8_t)sample.x;
+    s_adxl345.regs[0x33] = (uint8_t)(sample.x >> 8);
+    s_adxl345.regs[0x34] = (uint8_t)sample.y;
+    s_adxl345.regs[0x35] = (uint8_t)(sample.y >> 8);
+    s_adxl345.regs[0x36] = (uint8_t)sample.z;
+    s_adxl345.regs[0x37] = (uint8_t)(sample.z >> 8);
+}
+
+static void adxl345_write(uint8_t reg, uint8_t value)
+{
+    if (reg == 0x00 || (reg >= 0x30 && reg <= 0x37) || reg == 0x39 || reg >= 0x40)
+        return; // read-only or reserved
+
+    adxl345_update();
+    if (reg == 0x38 && (value >> 6) == 0)
+    {
+        // Bypass mode clears the FIFO
+        s_adxl345.fifo_count = 0;
+        s_adxl345.overrun = false;
+    }
+    s_adxl345.regs[reg] = value;
+}
+
+static void adxl345_read(uint8_t reg, uint8_t *rx, size_t len, sensor_hal_emu_stats_t *stats)
+{
+    adxl345_update();
+
+    // A burst starting in the data registers pops one sample, all six bytes come from it
+    if (reg >= 0x32 && reg <= 0x37)
+        adxl345_pop_data(stats);
+    s_adxl345.regs[0x30] = adxl345_int_source();
+    s_adxl345.regs[0x39] = s_adxl345.fifo_count;
+
+    for (size_t i = 0; i < len; i++)
+        rx[i] = (reg + i) < sizeof(s_adxl345.regs) ? s_adxl345.regs[reg + i] : 0;
+}
+
+/* --- VEML7700 --- */
+
+static struct
+{
+    uint16_t regs[8];
+    int64_t config_us; // power-on or configuration change, integration restarts here
+    int64_t last_result_us;
+} s_veml7700;
+
+static void veml7700_reset(void)
+{
+    memset(&s_veml7700, 0, sizeof(s_veml7700));
+    s_veml7700.regs[0x00] = 0x0001; // shut down after power-up
+    s_veml7700.regs[0x07] = 0xC481; // device id
+}
+
+static int64_t veml7700_integration_us(uint16_t conf)
+{
+    switch ((conf >> 6) & 0x0F)
+    {
+    case 0x0C: return 25000;
+    case 0x08: return 50000;
+    case 0x01: return 200000;
+    case 0x02: return 400000;
+    case 0x03: return 800000;
+    default: return 100000;
+    }
+}
+
+// Datasheet resolution: 0.0042 lx/count at gain x2 and 800 ms, scaled by gain and integration time
+static float veml7700_lux_per_count(uint16_t conf)
+{
+    static const float gain[4] = {1.0f, 2.0f, 0.125f, 0.25f};
+    return 0.0042f * (2.0f / gain[(conf >> 11) & 0x03]) * (800000.0f / veml7700_integration_us(conf));
+}
+
+static void veml7700_update(void)
+{
+    uint16_t conf = s_veml7700.regs[0x00];
+    if (conf & 0x0001)
+        return; // shut down, the last result stays
+
+    int64_t it = veml7700_integration_us(conf);
+    int64_t now = now_us();
+    if (now - s_veml7700.config_us < it)
+        return; // first integration still running
+
+    int64_t completed = s_veml7700.config_us + ((now - s_veml7700.config_us) / it) * it;
+    if (completed == s_veml7700.last_result_us)
+        return;
+    s_veml7700.last_result_us = completed;
+
+    float counts = s_env.lux / veml7700_lux_per_count(conf);
+    s_veml7700.regs[0x04] = counts > 65535.0f ? 0xFFFF : (uint16_t)lroundf(counts);
+    s_veml7700.regs[0x05] = s_veml7700.regs[0x04]; // white channel tracks ALS
+}
+
+static void veml7700_write(uint8_t reg, uint16_t value)
+{
+    if (reg > 0x03)
+        return;
+    if (reg == 0x00 && value != s_veml7700.regs[0x00])
+        s_veml7700.config_us = now_us();
+    s_veml7700.regs[reg] = value;
+}
+
+static void veml7700_read(uint8_t reg, uint8_t *rx, size_t len, sensor_hal_emu_stats_t *stats)
+{
+    int64_t previous = s_veml7700.last_result_us;
+    veml7700_update();
+    if ((reg == 0x04 || reg == 0x05) && s_veml7700.last_result_us == previous)
+        stats->stale_reads++;
+
+    uint16_t value = reg < 8 ? s_veml7700.regs[reg] : 0;
+    if (len > 0)
+        rx[0] = (uint8_t)(value & 0xFF);
+    if (len > 1)
+        rx[1] = (uint8_t)(value >> 8);
+    for (size_t i = 2; i < len; i++)
+        rx[i] = 0;
+}
+
+/* --- MAX6675 --- */
+
+static struct
+{
+    int64_t conversion_start_us; // CS high starts a conversion, pulling CS low aborts it
+    uint16_t result;
+} s_max6675;
+
+static void max6675_read(uint8_t *rx, size_t len, sensor_hal_emu_stats_t *stats)
+{
+    int64_t now = now_us();
+    if (now - s_max6675.conversion_start_us >= EMU_MAX6675_CONVERSION_US)
+    {
+        float temp = s_env.thermocouple_c < 0.0f ? 0.0f : s_env.thermocouple_c;
+        uint16_t counts = (uint16_t)lroundf(temp * 4.0f);
+        s_max6675.result = (uint16_t)((counts > 0x0FFF ? 0x0FFF : counts) << 3);
+        if (s_env.thermocouple_open)
+            s_max6675.result |= 0x04;
+    }
+    else
+    {
+        stats->stale_reads++;
+    }
+    s_max6675.conversion_start_us = now;
+
+    uint8_t frame[2] = {(uint8_t)(s_max6675.result >> 8), (uint8_t)(s_max6675.result & 0xFF)};
+    for (size_t i = 0; i < len; i++)
+        rx[i] = i < sizeof(frame) ? frame[i] : 0;
+}
+
+/* --- Backend --- */
+
+static sensor_hal_emu_stats_t *count(sensor_hal_dev_t *dev, bool write, size_t bytes)
+{
+    sensor_hal_emu_stats_t *stats = &s_stats[dev->id];
+    stats->transactions++;
+    if (write)
+        stats->writes++;
+    else
+        stats->reads++;
+    stats->bytes += bytes;
+    return stats;
+}
+
+static esp_err_t emu_i2c_attach(sensor_hal_dev_t *dev, sensor_hal_i2c_bus_t bus, uint8_t address, uint32_t speed_hz)
+{
+    static const uint8_t addresses[SENSOR_HAL_DEV_COUNT] = {
+        [SENSOR_HAL_DEV_BMP280] = EMU_BMP280_ADDR,
+        [SENSOR_HAL_DEV_ADXL345] = EMU_ADXL345_ADDR,
+        [SENSOR_HAL_DEV_VEML7700] = EMU_VEML7700_ADDR,
+    };
+    if (!s_env.present[dev->id] || addresses[dev->id] != address)
+        return ESP_ERR_NOT_FOUND;
+
+    s_stats[dev->id].attaches++;
+    dev->handle = &s_attached_tag[dev->id];
+    return ESP_OK;
+}
+
+static esp_err_t emu_detach(sensor_hal_dev_t *dev)
+{
+    return ESP_OK;
+}
+
+static esp_err_t emu_i2c_bus_reset(sensor_hal_i2c_bus_t bus)
+{
+    return ESP_OK;
+}
+
+static esp_err_t emu_i2c_write(sensor_hal_dev_t *dev, const uint8_t *data, size_t len, int timeout_ms)
+{
+    count(dev, true, len + 1);
+    if (len == 0)
+        return ESP_OK;
+
+    switch (dev->id)
+    {
+    case SENSOR_HAL_DEV_BMP280:
+        // Writes are register/value pairs, no auto-increment
+        for (size_t i = 0; i + 1 < len; i += 2)
+            bmp280_write(data[i], data[i + 1]);
+        break;
+    case SENSOR_HAL_DEV_ADXL345:
+        for (size_t i = 1; i < len; i++)
+            adxl345_write((uint8_t)(data[0] + i - 1), data[i]);
+        break;
+    case SENSOR_HAL_DEV_VEML7700:
+        if (len >= 3)
+            veml7700_write(data[0], (uint16_t)(data[1] | (data[2] << 8)));
+        break;
+    default:
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t emu_i2c_write_read(sensor_hal_dev_t *dev, const uint8_t *tx, size_t tx_len,
+                                    uint8_t *rx, size_t rx_len, int timeout_ms)
+{
+    sensor_hal_emu_stats_t *stats = count(dev, false, tx_len + rx_len + 2);
+    if (tx_len == 0)
+        return ESP_ERR_INVALID_ARG;
+
+    switch (dev->id)
+    {
+    case SENSOR_HAL_DEV_BMP280:
+        bmp280_read(tx[0], rx, rx_len, stats);
+        break;
+    case SENSOR_HAL_DEV_ADXL345:
+        adxl345_read(tx[0], rx, rx_len, stats);
+        break;
+    case SENSOR_HAL_DEV_VEML7700:
+        veml7700_read(tx[0], rx, rx_len, stats);
+        break;
+    default:
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t emu_spi_attach(sensor_hal_dev_t *dev, int cs_pin, uint32_t clock_hz)
+{
+    if (dev->id != SENSOR_HAL_DEV_MAX6675 || !s_env.present[dev->id])
+        return ESP_ERR_NOT_FOUND;
+    s_stats[dev->id].attaches++;
+    dev->handle = &s_attached_tag[dev->id];
+    return ESP_OK;
+}
+
+static esp_err_t emu_spi_read(sensor_hal_dev_t *dev, uint8_t *rx, size_t len)
+{
+    max6675_read(rx, len, count(dev, false, len));
+    return ESP_OK;
+}
+
+static esp_err_t emu_ultrasonic_init(sensor_hal_dev_t *dev)
+{
+    s_stats[dev->id].attaches++;
+    dev->handle = &s_attached_tag[dev->id];
+    return ESP_OK;
+}
+
+static esp_err_t emu_ultrasonic_measure(sensor_hal_dev_t *dev, uint32_t max_cm, uint32_t *distance_cm)
+{
+    count(dev, false, 0);
+    if (!s_env.present[dev->id] || s_env.distance_cm > max_cm)
+        return ESP_ERR_TIMEOUT; // no echo within the range
+    *distance_cm = s_env.distance_cm;
+    return ESP_OK;
+}
+
+static const sensor_hal_backend_t sensor_hal_emu_backend = {
+    .name = "emulator",
+    .i2c_attach = emu_i2c_attach,
+    .i2c_detach = emu_detach,
+    .i2c_bus_reset = emu_i2c_bus_reset,
+    .i2c_write = emu_i2c_write,
+    .i2c_write_read = emu_i2c_write_read,
+    .spi_attach = emu_spi_attach,
+    .spi_detach = emu_detach,
+    .spi_read = emu_spi_read,
+    .ultrasonic_init = emu_ultrasonic_init,
+    .ultrasonic_measure = emu_ultrasonic_measure,
+};
+
+void sensor_hal_emu_start(const sensor_hal_emu_env_t *env)
+{
+    static const sensor_hal_emu_env_t defaults = {
+        .present = {true, true, true, true, true},
+        .temperature_c = 21.5f,
+        .pressure_hpa = 1013.25f,
+        .accel_ms2 = {0.0f, 0.0f, 9.80665f},
+        .lux = 320.0f,
+        .thermocouple_c = 85.0f,
+        .thermocouple_open = false,
+        .distance_cm = 120,
+    };
+    s_env = env != NULL ? *env : defaults;
+
+    bmp280_reset();
+    adxl345_reset();
+    veml7700_reset();
+    memset(&s_max6675, 0, sizeof(s_max6675));
+    sensor_hal_emu_reset_stats();
+
+    sensor_hal_set_backend(&sensor_hal_emu_backend);
+    ESP_LOGI(TAG, "Emulated sensors active");
+}
+
+void sensor_hal_emu_set_env(const sensor_hal_emu_env_t *env)
+{
+    s_env = *env;
+}
+
+void sensor_hal_emu_get_stats(sensor_hal_dev_id_t id, sensor_hal_emu_stats_t *stats)
+{
+    *stats = s_stats[id];
+}
+
+void sensor_hal_emu_reset_stats(void)
+{
+    memset(s_stats, 0, sizeof(s_stats));
+}
@@ -0,0 +1,210 @@
+#include "sensor_hal_priv.h"
+#include "project_config.h"
+#include "driver/i2c_master.h"
+#include "driver/spi_master.h"
+#include "hcsr04_driver.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_attr.h"
+#include <string.h>
+
+static int s_ultrasonic_tag;
+
+#if I2C_BUS_TRANS_QUEUE_DEPTH > 0
+/*
+ * The buses are created with a transaction queue, so i2c_master_transmit* only queue the transfer
+ * and the result arrives in on_trans_done (ISR). Each device gets a completion semaphore; the
+ * synchronous calls are queue + wait, async reads split the two.
+ */
+typedef struct
+{
+    SemaphoreHandle_t done;
+    volatile esp_err_t result;
+} hw_i2c_completion_t;
+
+static hw_i2c_completion_t s_completion[SENSOR_HAL_DEV_COUNT];
+
+static bool IRAM_ATTR hw_on_trans_done(i2c_master_dev_handle_t i2c_dev, const i2c_master_event_data_t *evt_data, void *arg)
+{
+    hw_i2c_completion_t *completion = arg;
+    switch (evt_data->event)
+    {
+    case I2C_EVENT_DONE:
+        completion->result = ESP_OK;
+        break;
+    case I2C_EVENT_TIMEOUT:
+        completion->result = ESP_ERR_TIMEOUT;
+        break;
+    default: // NACK
+        completion->result = ESP_FAIL;
+        break;
+    }
+    BaseType_t woken = pdFALSE;
+    xSemaphoreGiveFromISR(completion->done, &woken);
+    return woken == pdTRUE;
+}
+
+static esp_err_t hw_register_completion(sensor_hal_dev_t *dev, i2c_master_dev_handle_t handle)
+{
+    hw_i2c_completion_t *completion = &s_completion[dev->id];
+    if (completion->done == NULL)
+    {
+        completion->done = xSemaphoreCreateBinary();
+        if (completion->done == NULL)
+            return ESP_ERR_NO_MEM;
+    }
+    i2c_master_event_callbacks_t cbs = {
+        .on_trans_done = hw_on_trans_done,
+    };
+    return i2c_master_register_event_callbacks(handle, &cbs, completion);
+}
+
+// A completion left over from a transfer whose wait timed out must not satisfy the next one
+static inline void hw_arm_completion(sensor_hal_dev_t *dev)
+{
+    xSemaphoreTake(s_completion[dev->id].done, 0);
+}
+
+static esp_err_t hw_i2c_read_wait(sensor_hal_dev_t *dev, int timeout_ms)
+{
+    hw_i2c_completion_t *completion = &s_completion[dev->id];
+    if (xSemaphoreTake(completion->done, pdMS_TO_TICKS(timeout_ms)) != pdTRUE)
+        return ESP_ERR_TIMEOUT;
+    return completion->result;
+}
+
+static esp_err_t hw_i2c_read_start(sensor_hal_dev_t *dev, const uint8_t *tx, size_t tx_len, uint8_t *rx, size_t rx_len)
+{
+    hw_arm_completion(dev);
+    return i2c_master_transmit_receive((i2c_master_dev_handle_t)dev->handle, tx, tx_len, rx, rx_len,
+                                       I2C_TRANSACTION_TIMEOUT_MS);
+}
+#endif
+
+static esp_err_t hw_i2c_attach(sensor_hal_dev_t *dev, sensor_hal_i2c_bus_t bus, uint8_t address, uint32_t speed_hz)
+{
+    // Adding a device never touches the bus, probe first so a missing sensor is reported here
+    esp_err_t err = i2c_master_probe(bus, address, I2C_TRANSACTION_TIMEOUT_MS);
+    if (err != ESP_OK)
+        return err;
+
+    i2c_device_config_t dev_config = {
+        .dev_addr_length = I2C_ADDR_BIT_LEN_7,
+        .device_address = address,
+        .scl_speed_hz = speed_hz,
+    };
+    i2c_master_dev_handle_t handle = NULL;
+    err = i2c_master_bus_add_device(bus, &dev_config, &handle);
+    if (err != ESP_OK)
+        return err;
+#if I2C_BUS_TRANS_QUEUE_DEPTH > 0
+    err = hw_register_completion(dev, handle);
+    if (err != ESP_OK)
+    {
+        i2c_master_bus_rm_device(handle);
+        return err;
+    }
+#endif
+    dev->handle = handle;
+    return ESP_OK;
+}
+
+static esp_err_t hw_i2c_detach(sensor_hal_dev_t *dev)
+{
+    return i2c_master_bus_rm_device((i2c_master_dev_handle_t)dev->handle);
+}
+
+static esp_err_t hw_i2c_bus_reset(sensor_hal_i2c_bus_t bus)
+{
+#if I2C_BUS_TRANS_QUEUE_DEPTH > 0
+    // Async reads give the grant back once queued, let them finish rather than cut them off. A
+    // transfer still running after this is what hangs the bus, the reset goes ahead anyway.
+    i2c_master_bus_wait_all_done(bus, I2C_TRANSACTION_TIMEOUT_MS);
+#endif
+    return i2c_master_bus_reset(bus);
+}
+
+static esp_err_t hw_i2c_write(sensor_hal_dev_t *dev, const uint8_t *data, size_t len, int timeout_ms)
+{
+#if I2C_BUS_TRANS_QUEUE_DEPTH > 0
+    hw_arm_completion(dev);
+    esp_err_t err = i2c_master_transmit((i2c_master_dev_handle_t)dev->handle, data, len, timeout_ms);
+    return err == ESP_OK ? hw_i2c_read_wait(dev, timeout_ms) : err;
+#else
+    return i2c_master_transmit((i2c_master_dev_handle_t)dev->handle, data, len, timeout_ms);
+#endif
+}
+
+static esp_err_t hw_i2c_write_read(sensor_hal_dev_t *dev, const uint8_t *tx, size_t tx_len,
+                                   uint8_t *rx, size_t rx_len, int timeout_ms)
+{
+#if I2C_BUS_TRANS_QUEUE_DEPTH > 0
+    esp_err_t err = hw_i2c_read_start(dev, tx, tx_len, rx, rx_len);
+    return err == ESP_OK ? hw_i2c_read_wait(dev, timeout_ms) : err;
+#else
+    return i2c_master_transmit_receive((i2c_master_dev_handle_t)dev->handle, tx, tx_len, rx, rx_len, timeout_ms);
+#endif
+}
+
+static esp_err_t hw_spi_attach(sensor_hal_dev_t *dev, int cs_pin, uint32_t clock_hz)
+{
+    spi_device_interface_config_t devcfg = {
+        .clock_speed_hz = clock_hz,
+        .mode = 0, // SPI Mode 0: CPOL=0, CPHA=0
+        .spics_io_num = cs_pin,
+        .queue_size = 1,
+    };
+    spi_device_handle_t handle = NULL;
+    esp_err_t err = spi_bus_add_device(SPI_HOST_USED, &devcfg, &handle);
+    if (err == ESP_OK)
+        dev->handle = handle;
+    return err;
+}
+
+static esp_err_t hw_spi_detach(sensor_hal_dev_t *dev)
+{
+    return spi_bus_remove_device((spi_device_handle_t)dev->handle);
+}
+
+static esp_err_t hw_spi_read(sensor_hal_dev_t *dev, uint8_t *rx, size_t len)
+{
+    spi_transaction_t t = {
+        .flags = SPI_TRANS_USE_RXDATA,
+        .length = len * 8,
+        .rxlength = len * 8,
+    };
+    esp_err_t err = spi_device_transmit((spi_device_handle_t)dev->handle, &t);
+    if (err == ESP_OK)
+        memcpy(rx, t.rx_data, len);
+    return err;
+}
+
+static esp_err_t hw_ultrasonic_init(sensor_hal_dev_t *dev)
+{
+    UltrasonicInit();
+    dev->handle = &s_ultrasonic_tag;
+    return ESP_OK;
+}
+
+static esp_err_t hw_ultrasonic_measure(sensor_hal_dev_t *dev, uint32_t max_cm, uint32_t *distance_cm)
+{
+    return UltrasonicMeasure(max_cm, distance_cm);
+}
+
+const sensor_hal_backend_t sensor_hal_hw_backend = {
+    .name = "hardware",
+    .i2c_attach = hw_i2c_attach,
+    .i2c_detach = hw_i2c_detach,
+    .i2c_bus_reset = hw_i2c_bus_reset,
+    .i2c_write = hw_i2c_write,
+    .i2c_write_read = hw_i2c_write_read,
+#if I2C_BUS_TRANS_QUEUE_DEPTH > 0
+    .i2c_read_start = hw_i2c_read_start,
+    .i2c_read_wait = hw_i2c_read_wait,
+#endif
+    .spi_attach = hw_spi_attach,
+    .spi_detach = hw_spi_detach,
+    .spi_read = hw_spi_read,
+    .ultrasonic_init = hw_ultrasonic_init,
+    .ultrasonic_measure = hw_ultrasonic_measure,
+};
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stdint.h>
+#include "sensor_hal.h"
+
+/*
+ * Trace file layout (little endian):
+ *   sensor_hal_trace_header_t
+ *   { sensor_hal_trace_record_t, tx[tx_len], rx[rx_len] } ...
+ */
+#define SENSOR_HAL_TRACE_MAGIC   0x31544853 // "SHT1"
+#define SENSOR_HAL_TRACE_VERSION 1
+#define SENSOR_HAL_TRACE_NO_DEV  0xFF // bus level operations
+
+typedef enum
+{
+    SENSOR_HAL_OP_ATTACH = 0,
+    SENSOR_HAL_OP_DETACH,
+    SENSOR_HAL_OP_BUS_RESET,
+    SENSOR_HAL_OP_I2C_WRITE,
+    SENSOR_HAL_OP_I2C_WRITE_READ,
+    SENSOR_HAL_OP_SPI_READ,
+    SENSOR_HAL_OP_ULTRASONIC_MEASURE,
+} sensor_hal_op_t;
+
+typedef struct __attribute__((packed))
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t reserved;
+} sensor_hal_trace_header_t;
+
+typedef struct __attribute__((packed))
+{
+    int64_t timestamp_us;
+    int32_t err;
+    uint8_t dev;
+    uint8_t op;
+    uint8_t tx_len;
+    uint8_t rx_len;
+} sensor_hal_trace_record_t;
+
+extern const sensor_hal_backend_t sensor_hal_replay_backend;
+#if !CONFIG_IDF_TARGET_LINUX
+extern const sensor_hal_backend_t sensor_hal_hw_backend;
+#endif
+
+/**
+ * @brief Append one transaction to the trace if recording is active (cheap no-op otherwise).
+ */
+void sensor_hal_trace_append(uint8_t dev, sensor_hal_op_t op, esp_err_t err,
+                             const uint8_t *tx, size_t tx_len, const uint8_t *rx, size_t rx_len);
+
+/**
+ * @brief Timestamp of the last replayed transaction.
+ */
+int64_t sensor_hal_replay_time_us(void);
@@ -0,0 +1,270 @@
+#include "sensor_hal_priv.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_log.h"
+
+static const char *TAG = "SENSOR_HAL_REPLAY";
+
+// How far ahead of its cursor a device may skip records that the driver no longer issues
+#define REPLAY_LOOKAHEAD 32
+
+typedef struct
+{
+    uint32_t *offsets; // record offsets into s_trace, in recorded order
+    uint32_t count;
+    uint32_t cursor;
+} replay_stream_t;
+
+static uint8_t *s_trace = NULL;
+static size_t s_trace_size = 0;
+static replay_stream_t s_streams[SENSOR_HAL_DEV_COUNT];
+static bool s_loop = false;
+static bool s_finished = false;
+static int64_t s_first_us = 0;
+static int64_t s_last_us = 0;
+static int64_t s_now_us = 0;
+static int s_attached_tag[SENSOR_HAL_DEV_COUNT];
+
+static bool read_record(uint32_t offset, sensor_hal_trace_record_t *record)
+{
+    if (offset + sizeof(*record) > s_trace_size)
+        return false;
+    memcpy(record, s_trace + offset, sizeof(*record));
+    return offset + sizeof(*record) + record->tx_len + record->rx_len <= s_trace_size;
+}
+
+void sensor_hal_replay_close(void)
+{
+    for (int i = 0; i < SENSOR_HAL_DEV_COUNT; i++)
+    {
+        free(s_streams[i].offsets);
+        memset(&s_streams[i], 0, sizeof(s_streams[i]));
+    }
+    free(s_trace);
+    s_trace = NULL;
+    s_trace_size = 0;
+    s_finished = false;
+}
+
+esp_err_t sensor_hal_replay_open(const char *path, bool loop)
+{
+    sensor_hal_replay_close();
+
+    FILE *f = fopen(path, "rb");
+    if (f == NULL)
+    {
+        ESP_LOGE(TAG, "Cannot open trace %s", path);
+        return ESP_ERR_NOT_FOUND;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    rewind(f);
+
+    sensor_hal_trace_header_t header;
+    if (size < (long)sizeof(header) || fread(&header, sizeof(header), 1, f) != 1 ||
+        header.magic != SENSOR_HAL_TRACE_MAGIC || header.version != SENSOR_HAL_TRACE_VERSION)
+    {
+        ESP_LOGE(TAG, "%s is not a sensor trace", path);
+        fclose(f);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    s_trace_size = size - sizeof(header);
+    s_trace = malloc(s_trace_size ? s_trace_size : 1);
+    if (s_trace == NULL || fread(s_trace, 1, s_trace_size, f) != s_trace_size)
+    {
+        fclose(f);
+        sensor_hal_replay_close();
+        return ESP_ERR_NO_MEM;
+    }
+    fclose(f);
+
+    // Two passes: count records per device, then index them
+    for (int pass = 0; pass < 2; pass++)
+    {
+        uint32_t offset = 0;
+        sensor_hal_trace_record_t record;
+        while (read_record(offset, &record))
+        {
+            if (record.dev < SENSOR_HAL_DEV_COUNT)
+            {
+                replay_stream_t *stream = &s_streams[record.dev];
+                if (pass == 0)
+                    stream->count++;
+                else
+                    stream->offsets[stream->cursor++] = offset;
+            }
+            if (pass == 1)
+            {
+                if (offset == 0)
+                    s_first_us = record.timestamp_us;
+                s_last_us = record.timestamp_us;
+            }
+            offset += sizeof(record) + record.tx_len + record.rx_len;
+        }
+
+        for (int i = 0; pass == 0 && i < SENSOR_HAL_DEV_COUNT; i++)
+        {
+            s_streams[i].offsets = malloc((s_streams[i].count ? s_streams[i].count : 1) * sizeof(uint32_t));
+            if (s_streams[i].offsets == NULL)
+            {
+                sensor_hal_replay_close();
+                return ESP_ERR_NO_MEM;
+            }
+        }
+    }
+    for (int i = 0; i < SENSOR_HAL_DEV_COUNT; i++)
+        s_streams[i].cursor = 0;
+
+    s_loop = loop;
+    s_now_us = s_first_us;
+    sensor_hal_set_backend(&sensor_hal_replay_backend);
+
+    ESP_LOGI(TAG, "Loaded %s: bmp280=%lu adxl345=%lu veml7700=%lu max6675=%lu hcsr04=%lu records, %.1f s",
+             path, (unsigned long)s_streams[SENSOR_HAL_DEV_BMP280].count,
+             (unsigned long)s_streams[SENSOR_HAL_DEV_ADXL345].count,
+             (unsigned long)s_streams[SENSOR_HAL_DEV_VEML7700].count,
+             (unsigned long)s_streams[SENSOR_HAL_DEV_MAX6675].count,
+             (unsigned long)s_streams[SENSOR_HAL_DEV_HCSR04].count,
+             (s_last_us - s_first_us) / 1e6);
+    return ESP_OK;
+}
+
+bool sensor_hal_replay_finished(void)
+{
+    return s_finished;
+}
+
+int64_t sensor_hal_replay_duration_us(void)
+{
+    return s_last_us - s_first_us;
+}
+
+int64_t sensor_hal_replay_time_us(void)
+{
+    return s_now_us;
+}
+
+// Find the next record of the device with the same operation (and request bytes, if given)
+static const uint8_t *next_record(sensor_hal_dev_id_t dev, sensor_hal_op_t op, const uint8_t *tx, size_t tx_len,
+                                  sensor_hal_trace_record_t *record)
+{
+    replay_stream_t *stream = &s_streams[dev];
+    if (stream->count == 0)
+        return NULL;
+
+    for (uint32_t i = 0; i < REPLAY_LOOKAHEAD; i++)
+    {
+        uint32_t idx = stream->cursor + i;
+        if (idx >= stream->count)
+        {
+            if (!s_loop)
+            {
+                s_finished = true;
+                return NULL;
+            }
+            idx %= stream->count;
+        }
+
+        uint32_t offset = stream->offsets[idx];
+        read_record(offset, record);
+        const uint8_t *payload = s_trace + offset + sizeof(*record);
+
+        if (record->op != op)
+            continue;
+        if (tx != NULL && (record->tx_len != tx_len || memcmp(payload, tx, tx_len) != 0))
+            continue;
+
+        stream->cursor = idx + 1;
+        s_now_us = record->timestamp_us;
+        return payload + record->tx_len;
+    }
+    return NULL;
+}
+
+static esp_err_t replay_result(const uint8_t *rx_data, const sensor_hal_trace_record_t *record,
+                               uint8_t *rx, size_t rx_len)
+{
+    if (rx_data == NULL)
+        return ESP_ERR_NOT_FOUND;
+
+    size_t n = record->rx_len < rx_len ? record->rx_len : rx_len;
+    memcpy(rx, rx_data, n);
+    memset(rx + n, 0, rx_len - n);
+    return record->err;
+}
+
+static esp_err_t replay_i2c_attach(sensor_hal_dev_t *dev, sensor_hal_i2c_bus_t bus, uint8_t address, uint32_t speed_hz)
+{
+    // A device missing from the trace behaves like a device that does not answer
+    if (s_streams[dev->id].count == 0)
+        return ESP_ERR_NOT_FOUND;
+    dev->handle = &s_attached_tag[dev->id];
+    return ESP_OK;
+}
+
+static esp_err_t replay_detach(sensor_hal_dev_t *dev)
+{
+    return ESP_OK;
+}
+
+static esp_err_t replay_i2c_bus_reset(sensor_hal_i2c_bus_t bus)
+{
+    return ESP_OK;
+}
+
+static esp_err_t replay_i2c_write(sensor_hal_dev_t *dev, const uint8_t *data, size_t len, int timeout_ms)
+{
+    return ESP_OK;
+}
+
+static esp_err_t replay_i2c_write_read(sensor_hal_dev_t *dev, const uint8_t *tx, size_t tx_len,
+                                       uint8_t *rx, size_t rx_len, int timeout_ms)
+{
+    sensor_hal_trace_record_t record;
+    const uint8_t *data = next_record(dev->id, SENSOR_HAL_OP_I2C_WRITE_READ, tx, tx_len, &record);
+    return replay_result(data, &record, rx, rx_len);
+}
+
+static esp_err_t replay_spi_attach(sensor_hal_dev_t *dev, int cs_pin, uint32_t clock_hz)
+{
+    if (s_streams[dev->id].count == 0)
+        return ESP_ERR_NOT_FOUND;
+    dev->handle = &s_attached_tag[dev->id];
+    return ESP_OK;
+}
+
+static esp_err_t replay_spi_read(sensor_hal_dev_t *dev, uint8_t *rx, size_t len)
+{
+    sensor_hal_trace_record_t record;
+    const uint8_t *data = next_record(dev->id, SENSOR_HAL_OP_SPI_READ, NULL, 0, &record);
+    return replay_result(data, &record, rx, len);
+}
+
+static esp_err_t replay_ultrasonic_init(sensor_hal_dev_t *dev)
+{
+    dev->handle = &s_attached_tag[dev->id];
+    return ESP_OK;
+}
+
+static esp_err_t replay_ultrasonic_measure(sensor_hal_dev_t *dev, uint32_t max_cm, uint32_t *distance_cm)
+{
+    sensor_hal_trace_record_t record;
+    const uint8_t *data = next_record(dev->id, SENSOR_HAL_OP_ULTRASONIC_MEASURE, NULL, 0, &record);
+    return replay_result(data, &record, (uint8_t *)distance_cm, sizeof(*distance_cm));
+}
+
+const sensor_hal_backend_t sensor_hal_replay_backend = {
+    .name = "replay",
+    .i2c_attach = replay_i2c_attach,
+    .i2c_detach = replay_detach,
+    .i2c_bus_reset = replay_i2c_bus_reset,
+    .i2c_write = replay_i2c_write,
+    .i2c_write_read = replay_i2c_write_read,
+    .spi_attach = replay_spi_attach,
+    .spi_detach = replay_detach,
+    .spi_read = replay_spi_read,
+    .ultrasonic_init = replay_ultrasonic_init,
+    .ultrasonic_measure = replay_ultrasonic_measure,
+};
@@ -0,0 +1,168 @@
+#include "sensor_hal_priv.h"
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/ringbuf.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "project_config.h"
+#include "task_plan.h"
+
+static const char *TAG = "SENSOR_HAL";
+
+#define TRACE_STDIO_BUFFER_SIZE 4096
+
+/*
+ * Sensor tasks only copy their transactions into a ring buffer; the trace writer task (network
+ * core) puts them in the file, so a card write never stalls a measurement. When the writer falls
+ * behind, transactions are dropped and counted rather than waited for.
+ */
+static _Atomic bool s_recording = false;
+static _Atomic bool s_stopping = false;
+static FILE *s_trace_file = NULL;
+static RingbufHandle_t s_ring = NULL;
+static SemaphoreHandle_t s_trace_lock = NULL;
+static SemaphoreHandle_t s_writer_done = NULL;
+static uint32_t s_record_count = 0;
+static _Atomic uint32_t s_dropped = 0;
+
+static void trace_writer_task(void *arg)
+{
+    for (;;)
+    {
+        size_t len;
+        void *item = xRingbufferReceive(s_ring, &len, pdMS_TO_TICKS(100));
+        if (item == NULL)
+        {
+            // Nothing is added once stopping is set, an empty ring means everything is written
+            if (atomic_load(&s_stopping))
+                break;
+            continue;
+        }
+        fwrite(item, 1, len, s_trace_file);
+        vRingbufferReturnItem(s_ring, item);
+        s_record_count++;
+    }
+    fclose(s_trace_file);
+    s_trace_file = NULL;
+    xSemaphoreGive(s_writer_done);
+    task_plan_exit(TASK_ID_SENSOR_TRACE);
+}
+
+esp_err_t sensor_hal_record_start(const char *path)
+{
+    if (s_trace_lock == NULL)
+    {
+        s_trace_lock = xSemaphoreCreateMutex();
+        s_writer_done = xSemaphoreCreateBinary();
+    }
+    if (s_trace_lock == NULL || s_writer_done == NULL)
+        return ESP_ERR_NO_MEM;
+    if (atomic_load(&s_recording))
+        return ESP_ERR_INVALID_STATE;
+
+    RingbufHandle_t ring = xRingbufferCreate(SENSOR_HAL_TRACE_BUFFER_SIZE, RINGBUF_TYPE_NOSPLIT);
+    if (ring == NULL)
+        return ESP_ERR_NO_MEM;
+    FILE *f = fopen(path, "wb");
+    if (f == NULL)
+    {
+        ESP_LOGE(TAG, "Failed to create trace %s", path);
+        vRingbufferDelete(ring);
+        return ESP_FAIL;
+    }
+    // Keep transactions in RAM and hit the card in 4 KB writes
+    setvbuf(f, NULL, _IOFBF, TRACE_STDIO_BUFFER_SIZE);
+
+    sensor_hal_trace_header_t header = {
+        .magic = SENSOR_HAL_TRACE_MAGIC,
+        .version = SENSOR_HAL_TRACE_VERSION,
+        .reserved = 0,
+    };
+    fwrite(&header, sizeof(header), 1, f);
+
+    s_trace_file = f;
+    s_ring = ring;
+    s_record_count = 0;
+    atomic_store(&s_dropped, 0);
+    atomic_store(&s_stopping, false);
+    if (task_plan_create(TASK_ID_SENSOR_TRACE, trace_writer_task, NULL, NULL) != pdPASS)
+    {
+        fclose(f);
+        s_trace_file = NULL;
+        s_ring = NULL;
+        vRingbufferDelete(ring);
+        return ESP_ERR_NO_MEM;
+    }
+    atomic_store(&s_recording, true);
+
+    ESP_LOGI(TAG, "Recording sensor trace to %s", path);
+    return ESP_OK;
+}
+
+uint32_t sensor_hal_record_stop(void)
+{
+    if (!atomic_load(&s_recording))
+        return 0;
+
+    // After this no sensor task adds to the ring, the writer drains it and closes the file
+    xSemaphoreTake(s_trace_lock, portMAX_DELAY);
+    atomic_store(&s_recording, false);
+    xSemaphoreGive(s_trace_lock);
+    atomic_store(&s_stopping, true);
+    xSemaphoreTake(s_writer_done, portMAX_DELAY);
+    vRingbufferDelete(s_ring);
+    s_ring = NULL;
+
+    uint32_t count = s_record_count;
+    uint32_t dropped = atomic_load(&s_dropped);
+    if (dropped > 0)
+        ESP_LOGW(TAG, "Trace closed, %lu transactions recorded, %lu dropped (writer too slow)",
+                 (unsigned long)count, (unsigned long)dropped);
+    else
+        ESP_LOGI(TAG, "Trace closed, %lu transactions recorded", (unsigned long)count);
+    return count;
+}
+
+bool sensor_hal_is_recording(void)
+{
+    return atomic_load(&s_recording);
+}
+
+void sensor_hal_trace_append(uint8_t dev, sensor_hal_op_t op, esp_err_t err,
+                             const uint8_t *tx, size_t tx_len, const uint8_t *rx, size_t rx_len)
+{
+    if (!atomic_load_explicit(&s_recording, memory_order_relaxed))
+        return;
+
+    sensor_hal_trace_record_t record = {
+        .timestamp_us = esp_timer_get_time(),
+        .err = err,
+        .dev = dev,
+        .op = (uint8_t)op,
+        .tx_len = (uint8_t)(tx ? tx_len : 0),
+        .rx_len = (uint8_t)(rx ? rx_len : 0),
+    };
+
+    // The lock only covers the copy, it keeps record_stop from closing the ring under it
+    xSemaphoreTake(s_trace_lock, portMAX_DELAY);
+    uint8_t *slot = NULL;
+    if (atomic_load(&s_recording) &&
+        xRingbufferSendAcquire(s_ring, (void **)&slot, sizeof(record) + record.tx_len + record.rx_len, 0) == pdTRUE &&
+        slot != NULL)
+    {
+        memcpy(slot, &record, sizeof(record));
+        if (record.tx_len)
+            memcpy(slot + sizeof(record), tx, record.tx_len);
+        if (record.rx_len)
+            memcpy(slot + sizeof(record) + record.tx_len, rx, record.rx_len);
+        xRingbufferSendComplete(s_ring, slot);
+    }
+    else if (atomic_load(&s_recording))
+    {
+        atomic_fetch_add(&s_dropped, 1);
+    }
+    xSemaphoreGive(s_trace_lock);
+}
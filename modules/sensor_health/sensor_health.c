@@ -0,0 +1,95 @@
+#include "sensor_health.h"
+#include <stdio.h>
+#include "esp_log.h"
+#include "project_config.h"
+
+static const char *TAG = "SENSOR_HEALTH";
+
+static const char *state_name(sensor_health_state_t state)
+{
+    switch (state)
+    {
+    case SENSOR_HEALTHY:
+        return "healthy";
+    case SENSOR_DEGRADED:
+        return "degraded";
+    default:
+        return "offline";
+    }
+}
+
+static void set_state(sensor_health_t *health, sensor_health_state_t state)
+{
+    if (health->state == state)
+        return;
+
+    if (state == SENSOR_HEALTHY)
+        ESP_LOGI(TAG, "%s: %s -> healthy", health->name, state_name(health->state));
+    else
+        ESP_LOGW(TAG, "%s: %s -> %s after %lu failures", health->name, state_name(health->state),
+                 state_name(state), (unsigned long)health->consecutive_failures);
+
+    health->state = state;
+    metrics_set(health->metric, (int32_t)state);
+}
+
+static uint32_t next_backoff(uint32_t backoff_ms)
+{
+    uint32_t next = backoff_ms * 2;
+    return next > SENSOR_HEALTH_MAX_BACKOFF_MS ? SENSOR_HEALTH_MAX_BACKOFF_MS : next;
+}
+
+void sensor_health_init(sensor_health_t *health, const char *name, sensor_recover_fn_t recover, bool online)
+{
+    health->name = name;
+    health->recover = recover;
+    health->state = online ? SENSOR_HEALTHY : SENSOR_OFFLINE;
+    health->consecutive_failures = 0;
+    health->backoff_ms = SENSOR_MEASUREMENT_FAIL_INTERVAL_MS;
+    health->recoveries = 0;
+
+    char metric_name[METRICS_NAME_LEN];
+    snprintf(metric_name, sizeof(metric_name), "%s_health", name);
+    health->metric = metrics_register(metric_name, "state");
+    metrics_set(health->metric, (int32_t)health->state);
+
+    if (!online)
+        ESP_LOGW(TAG, "%s: not initialized, starting offline", name);
+}
+
+void sensor_health_report_success(sensor_health_t *health)
+{
+    health->consecutive_failures = 0;
+    health->backoff_ms = SENSOR_MEASUREMENT_FAIL_INTERVAL_MS;
+    set_state(health, SENSOR_HEALTHY);
+}
+
+uint32_t sensor_health_report_failure(sensor_health_t *health)
+{
+    health->consecutive_failures++;
+
+    if (health->consecutive_failures >= SENSOR_HEALTH_OFFLINE_THRESHOLD)
+    {
+        set_state(health, SENSOR_OFFLINE);
+        return health->backoff_ms;
+    }
+
+    set_state(health, SENSOR_DEGRADED);
+    uint32_t delay_ms = health->backoff_ms;
+    health->backoff_ms = next_backoff(health->backoff_ms);
+    return delay_ms;
+}
+
+uint32_t sensor_health_try_recover(sensor_health_t *health)
+{
+    if (health->recover != NULL && health->recover() == ESP_OK)
+    {
+        health->recoveries++;
+        ESP_LOGI(TAG, "%s: recovered (%lu recoveries so far)", health->name, (unsigned long)health->recoveries);
+        sensor_health_report_success(health);
+        return 0;
+    }
+
+    health->backoff_ms = next_backoff(health->backoff_ms);
+    return health->backoff_ms;
+}
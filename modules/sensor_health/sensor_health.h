@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "metrics.h"
+
+/*
+ * Per-device fault supervisor used by the sensor tasks.
+ *
+ * HEALTHY  -> DEGRADED  on the first failed read, retried with exponential backoff
+ * DEGRADED -> OFFLINE   after SENSOR_HEALTH_OFFLINE_THRESHOLD consecutive failures
+ * OFFLINE  -> HEALTHY   once the recover callback (bus reset, device re-add, re-configure) succeeds
+ *
+ * While offline the task only runs the recover callback, with the backoff doubling up to
+ * SENSOR_HEALTH_MAX_BACKOFF_MS, so a dead sensor stops using bus time and log bandwidth.
+ * Only state transitions are logged.
+ */
+typedef enum
+{
+    SENSOR_HEALTHY = 0,
+    SENSOR_DEGRADED,
+    SENSOR_OFFLINE,
+} sensor_health_state_t;
+
+typedef esp_err_t (*sensor_recover_fn_t)(void);
+
+typedef struct
+{
+    const char *name;
+    sensor_recover_fn_t recover;
+    volatile sensor_health_state_t state;
+    uint32_t consecutive_failures;
+    uint32_t backoff_ms;
+    uint32_t recoveries;
+    metrics_id_t metric;
+} sensor_health_t;
+
+/**
+ * @brief Initialize the supervisor of one device.
+ *
+ * @param health Supervisor state
+ * @param name Device name used in logs and in the "<name>_health" gauge
+ * @param recover Callback bringing the device back (may be NULL)
+ * @param online false if the device failed to initialize - it then starts OFFLINE
+ */
+void sensor_health_init(sensor_health_t *health, const char *name, sensor_recover_fn_t recover, bool online);
+
+/**
+ * @brief Record a successful read.
+ */
+void sensor_health_report_success(sensor_health_t *health);
+
+/**
+ * @brief Record a failed read.
+ *
+ * @return **uint32_t** - Delay in ms before the next attempt
+ */
+uint32_t sensor_health_report_failure(sensor_health_t *health);
+
+/**
+ * @brief Run one recovery attempt of an OFFLINE device.
+ *
+ * @return **uint32_t** - 0 if the device is back, otherwise delay in ms before the next attempt
+ */
+uint32_t sensor_health_try_recover(sensor_health_t *health);
+
+static inline bool sensor_health_is_offline(const sensor_health_t *health)
+{
+    return health->state == SENSOR_OFFLINE;
+}
@@ -0,0 +1,146 @@
+#include "kernel_bench.h"
+#include "sensor_kernels.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+// Calibration of the BMP280 datasheet example, realistic magnitudes for the compensation math
+static const bmp280_calib_data_t bench_calib = {
+    27504, 26435, -1000, 36477, -10685, 3024, 2855, 140, -7, 15500, -14600, 6000};
+
+// Results land here so the compiler cannot drop the timed loops
+static volatile float s_sink_f;
+static volatile uint32_t s_sink_u;
+
+typedef struct
+{
+    int32_t *raw_temp;
+    int32_t *raw_pres;
+    uint16_t *als;
+    int16_t *accel; // x, y, z per sample
+    uint32_t *distance;
+    uint32_t samples;
+} bench_input_t;
+
+static uint32_t lcg_next(uint32_t *state)
+{
+    *state = *state * 1664525u + 1013904223u;
+    return *state >> 8;
+}
+
+static void fill_input(bench_input_t *in)
+{
+    uint32_t state = 0x5EED;
+    for (uint32_t i = 0; i < in->samples; i++)
+    {
+        in->raw_temp[i] = 480000 + lcg_next(&state) % 80000; // about -10..50 C
+        in->raw_pres[i] = 300000 + lcg_next(&state) % 150000;
+        in->als[i] = (uint16_t)lcg_next(&state);             // full range, half of it above 1000 lx
+        in->accel[3 * i] = (int16_t)(lcg_next(&state) % 1024) - 512;
+        in->accel[3 * i + 1] = (int16_t)(lcg_next(&state) % 1024) - 512;
+        in->accel[3 * i + 2] = (int16_t)(lcg_next(&state) % 1024) - 512;
+        in->distance[i] = lcg_next(&state) % 250;
+    }
+}
+
+static void run_bmp280_temperature(const bench_input_t *in)
+{
+    float acc = 0.0f;
+    int32_t t_fine;
+    for (uint32_t i = 0; i < in->samples; i++)
+        acc += bmp280_compensate_temperature(&bench_calib, in->raw_temp[i], &t_fine);
+    s_sink_f = acc;
+}
+
+static void run_bmp280_pressure(const bench_input_t *in)
+{
+    float acc = 0.0f;
+    int32_t t_fine;
+    for (uint32_t i = 0; i < in->samples; i++)
+    {
+        // Every pressure reading needs the temperature of the same measurement
+        bmp280_compensate_temperature(&bench_calib, in->raw_temp[i], &t_fine);
+        acc += bmp280_compensate_pressure(&bench_calib, in->raw_pres[i], t_fine);
+    }
+    s_sink_f = acc;
+}
+
+static void run_veml7700_lux(const bench_input_t *in)
+{
+    float acc = 0.0f;
+    for (uint32_t i = 0; i < in->samples; i++)
+        acc += veml7700_counts_to_lux(in->als[i]);
+    s_sink_f = acc;
+}
+
+static void run_adxl345_acceleration(const bench_input_t *in)
+{
+    float acc = 0.0f;
+    for (uint32_t i = 0; i < in->samples; i++)
+        acc += adxl345_net_acceleration(in->accel[3 * i], in->accel[3 * i + 1], in->accel[3 * i + 2]);
+    s_sink_f = acc;
+}
+
+static void run_buzzer_interval(const bench_input_t *in)
+{
+    uint32_t acc = 0;
+    for (uint32_t i = 0; i < in->samples; i++)
+        acc += buzzer_interval_ms(in->distance[i]);
+    s_sink_u = acc;
+}
+
+static const struct
+{
+    const char *name;
+    void (*run)(const bench_input_t *in);
+} kernels[] = {
+    {"bmp280_temperature", run_bmp280_temperature},
+    {"bmp280_pressure", run_bmp280_pressure},
+    {"veml7700_lux", run_veml7700_lux},
+    {"adxl345_acceleration", run_adxl345_acceleration},
+    {"buzzer_interval", run_buzzer_interval},
+};
+
+size_t kernel_bench_run(kernel_bench_result_t *results, size_t max_results, uint32_t samples, kernel_bench_clock_t clock)
+{
+    bench_input_t in = {
+        .raw_temp = malloc(samples * sizeof(int32_t)),
+        .raw_pres = malloc(samples * sizeof(int32_t)),
+        .als = malloc(samples * sizeof(uint16_t)),
+        .accel = malloc(samples * 3 * sizeof(int16_t)),
+        .distance = malloc(samples * sizeof(uint32_t)),
+        .samples = samples,
+    };
+
+    size_t count = 0;
+    if (in.raw_temp && in.raw_pres && in.als && in.accel && in.distance)
+    {
+        fill_input(&in);
+        for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]) && count < max_results; k++)
+        {
+            kernels[k].run(&in); // warm-up
+
+            uint32_t start = clock();
+            kernels[k].run(&in);
+            uint32_t ticks = clock() - start;
+
+            results[count++] = (kernel_bench_result_t){.name = kernels[k].name, .samples = samples, .ticks = ticks};
+        }
+    }
+
+    free(in.raw_temp);
+    free(in.raw_pres);
+    free(in.als);
+    free(in.accel);
+    free(in.distance);
+    return count;
+}
+
+void kernel_bench_print(const kernel_bench_result_t *results, size_t count, const char *unit)
+{
+    char column[24];
+    snprintf(column, sizeof(column), "%s/sample", unit);
+    printf("%-22s %10s %14s\n", "kernel", "samples", column);
+    for (size_t i = 0; i < count; i++)
+        printf("%-22s %10lu %14.2f\n", results[i].name, (unsigned long)results[i].samples,
+               kernel_bench_per_sample(&results[i]));
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define KERNEL_BENCH_MAX_KERNELS 8
+
+/**
+ * @brief Free running counter used for timing: nanoseconds on the host, CPU cycles on target.
+ * Only differences are used, a single kernel run must not span a wrap of the 32-bit value.
+ */
+typedef uint32_t (*kernel_bench_clock_t)(void);
+
+typedef struct
+{
+    const char *name;
+    uint32_t samples;
+    uint32_t ticks; /*!< clock ticks for all samples */
+} kernel_bench_result_t;
+
+/**
+ * @brief Run every kernel over the same deterministic synthetic input arrays.
+ *
+ * Each kernel gets one untimed warm-up pass (caches, branch predictors) before the timed pass.
+ *
+ * @param results Receives one entry per kernel
+ * @param max_results Capacity of results, KERNEL_BENCH_MAX_KERNELS is always enough
+ * @param samples Length of the input arrays
+ * @param clock Timing source
+ * @return **size_t** - Number of results written, 0 if the input arrays could not be allocated
+ */
+size_t kernel_bench_run(kernel_bench_result_t *results, size_t max_results, uint32_t samples, kernel_bench_clock_t clock);
+
+/**
+ * @brief Ticks per sample of one result.
+ */
+static inline double kernel_bench_per_sample(const kernel_bench_result_t *result)
+{
+    return result->samples ? (double)result->ticks / result->samples : 0.0;
+}
+
+/**
+ * @brief Print a table of ticks per sample.
+ *
+ * @param unit Name of a clock tick ("ns", "cycles")
+ */
+void kernel_bench_print(const kernel_bench_result_t *results, size_t count, const char *unit);
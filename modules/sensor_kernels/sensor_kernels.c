@@ -0,0 +1,78 @@
+#include "sensor_kernels.h"
+#include <math.h>
+
+float bmp280_compensate_temperature(const bmp280_calib_data_t *cal, int32_t raw_temp, int32_t *t_fine)
+{
+    int32_t var1, var2;
+    var1 = ((((raw_temp >> 3) - ((int32_t)cal->dig_T1 << 1))) * ((int32_t)cal->dig_T2)) >> 11;
+    var2 = (((((raw_temp >> 4) - ((int32_t)cal->dig_T1)) * ((raw_temp >> 4) - ((int32_t)cal->dig_T1))) >> 12) * ((int32_t)cal->dig_T3)) >> 14;
+    *t_fine = var1 + var2;
+    int32_t T = (*t_fine * 5 + 128) >> 8;
+    return (float)T / 100.0;
+}
+
+float bmp280_compensate_pressure(const bmp280_calib_data_t *cal, int32_t raw_pres, int32_t t_fine)
+{
+    int64_t var1, var2, p;
+    var1 = ((int64_t)t_fine) - 128000;
+    var2 = var1 * var1 * (int64_t)cal->dig_P6;
+    var2 = var2 + ((var1 * (int64_t)cal->dig_P5) << 17);
+    var2 = var2 + ((int64_t)cal->dig_P4 << 35);
+    var1 = ((var1 * var1 * (int64_t)cal->dig_P3) >> 8) + ((var1 * (int64_t)cal->dig_P2) << 12);
+    var1 = (((((int64_t)1) << 47) + var1) * (int64_t)cal->dig_P1) >> 33;
+    if (var1 == 0)
+    {
+        return 0; // avoid exception caused by division by zero
+    }
+    p = 1048576 - raw_pres;
+    p = (((p << 31) - var2) * 3125) / var1;
+    var1 = (((int64_t)cal->dig_P9) * (p >> 13) * (p >> 13)) >> 25;
+    var2 = (((int64_t)cal->dig_P8) * p) >> 19;
+    p = ((p + var1 + var2) >> 8) + (((int64_t)cal->dig_P7) << 4);
+    return (float)p / 256.0 / 100.0;
+}
+
+float veml7700_counts_to_lux(uint16_t raw_counts)
+{
+    float lux = raw_counts * LUX_RESOLUTION;
+
+    if (lux > 1000.0f)
+    {
+        lux = (COEF_A * powf(lux, 4)) +
+              (COEF_B * powf(lux, 3)) +
+              (COEF_C * powf(lux, 2)) +
+              (COEF_D * lux);
+    }
+
+    return lux;
+}
+
+float adxl345_net_acceleration(int16_t rx, int16_t ry, int16_t rz)
+{
+    float x = rx * ADXL345_LSB_TO_MS2 - ADXL345_X_AXIS_CORRECTION;
+    float y = ry * ADXL345_LSB_TO_MS2 - ADXL345_Y_AXIS_CORRECTION;
+    float z = rz * ADXL345_LSB_TO_MS2 - ADXL345_EARTH_GRAVITY_MS2;
+
+    return sqrtf(x * x + y * y + z * z);
+}
+
+uint32_t buzzer_interval_ms(uint32_t distance_cm)
+{
+    if (distance_cm >= 200)
+        return 0;
+    if (distance_cm > 120)
+        return 800;
+    if (distance_cm > 90)
+        return 500;
+    if (distance_cm > 70)
+        return 400;
+    if (distance_cm > 50)
+        return 300;
+    if (distance_cm > 30)
+        return 200;
+    if (distance_cm > 20)
+        return 120;
+    if (distance_cm > 12)
+        return 60;
+    return 25;
+}
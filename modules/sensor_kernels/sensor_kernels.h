@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * Numeric kernels shared by the sensor drivers and the buzzer.
+ *
+ * Everything here is plain C without ESP-IDF headers so the same code can be benchmarked
+ * on the host (host/bench) and on target (console "bench").
+ */
+
+#define ADXL345_LSB_TO_MS2 (0.004f * 9.80665f)
+#define ADXL345_X_AXIS_CORRECTION -0.039f
+#define ADXL345_Y_AXIS_CORRECTION -2.760f
+#define ADXL345_EARTH_GRAVITY_MS2 8.318f
+
+#define LUX_RESOLUTION 0.576f
+
+#define COEF_A 6.0135e-13
+#define COEF_B -9.3924e-9
+#define COEF_C 8.1488e-5
+#define COEF_D 1.0023
+
+typedef struct
+{
+    uint16_t dig_T1;
+    int16_t dig_T2;
+    int16_t dig_T3;
+    uint16_t dig_P1;
+    int16_t dig_P2;
+    int16_t dig_P3;
+    int16_t dig_P4;
+    int16_t dig_P5;
+    int16_t dig_P6;
+    int16_t dig_P7;
+    int16_t dig_P8;
+    int16_t dig_P9;
+} bmp280_calib_data_t;
+
+/**
+ * @brief Bosch integer temperature compensation.
+ *
+ * @param cal Calibration words read from 0x88
+ * @param raw_temp 20-bit temperature ADC value
+ * @param t_fine Receives the fine temperature needed by the pressure compensation
+ * @return **float** - Temperature in Celsius
+ */
+float bmp280_compensate_temperature(const bmp280_calib_data_t *cal, int32_t raw_temp, int32_t *t_fine);
+
+/**
+ * @brief Bosch 64-bit integer pressure compensation.
+ *
+ * @param cal Calibration words read from 0x88
+ * @param raw_pres 20-bit pressure ADC value
+ * @param t_fine Fine temperature of the same measurement
+ * @return **float** - Pressure in hPa
+ */
+float bmp280_compensate_pressure(const bmp280_calib_data_t *cal, int32_t raw_pres, int32_t t_fine);
+
+/**
+ * @brief Convert ALS counts to lux, with the non-linearity correction above 1000 lx.
+ */
+float veml7700_counts_to_lux(uint16_t raw_counts);
+
+/**
+ * @brief Magnitude of the acceleration left after removing the board offsets and gravity.
+ *
+ * @return **float** - Acceleration in m/s^2
+ */
+float adxl345_net_acceleration(int16_t rx, int16_t ry, int16_t rz);
+
+/**
+ * @brief Parking sensor beep interval for a distance, 0 when out of range (no beeping).
+ */
+uint32_t buzzer_interval_ms(uint32_t distance_cm);
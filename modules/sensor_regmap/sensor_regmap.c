@@ -0,0 +1,172 @@
+#include "sensor_regmap.h"
+#include "project_config.h"
+
+#define REG_BIT(index) (1ULL << (index))
+
+static bool reg_index(const sensor_regmap_t *map, uint8_t reg, int *index)
+{
+    if (reg < map->base || reg - map->base >= map->count)
+        return false;
+    *index = reg - map->base;
+    return true;
+}
+
+static esp_err_t read_with_retry(sensor_regmap_t *map, uint8_t reg, uint8_t *value)
+{
+    return sensor_hal_i2c_write_read_retry(map->stats, map->dev, &reg, 1, value, 1, I2C_TRANSACTION_TIMEOUT_MS);
+}
+
+void sensor_regmap_set_volatile(sensor_regmap_t *map, uint8_t reg)
+{
+    int i;
+    if (reg_index(map, reg, &i))
+        map->volatile_regs |= REG_BIT(i);
+}
+
+esp_err_t sensor_regmap_set(sensor_regmap_t *map, uint8_t reg, uint8_t value)
+{
+    int i;
+    if (!reg_index(map, reg, &i))
+        return ESP_ERR_INVALID_ARG;
+
+    if ((map->valid & REG_BIT(i)) && map->cache[i] == value && !(map->volatile_regs & REG_BIT(i)))
+    {
+        if (!(map->dirty & REG_BIT(i)))
+            map->skipped++;
+        return ESP_OK;
+    }
+    map->cache[i] = value;
+    map->valid |= REG_BIT(i);
+    map->dirty |= REG_BIT(i);
+    return ESP_OK;
+}
+
+esp_err_t sensor_regmap_update_bits(sensor_regmap_t *map, uint8_t reg, uint8_t mask, uint8_t value)
+{
+    uint8_t current;
+    esp_err_t err = sensor_regmap_read(map, reg, &current);
+    if (err != ESP_OK)
+        return err;
+    return sensor_regmap_set(map, reg, (current & ~mask) | (value & mask));
+}
+
+// Build the next write transaction from a dirty set, returns its length and the registers it covers
+static size_t next_burst(const sensor_regmap_t *map, uint64_t dirty, uint8_t *buf, uint64_t *covered)
+{
+    int first = __builtin_ctzll(dirty);
+    size_t len = 0;
+    *covered = 0;
+
+    switch (map->burst)
+    {
+    case SENSOR_REGMAP_BURST_INCREMENT:
+        // Adjacent dirty registers only, a gap would rewrite a register that did not change
+        buf[len++] = map->base + first;
+        for (int i = first; i < map->count && (dirty & REG_BIT(i)) && len <= SENSOR_REGMAP_MAX_BURST; i++)
+        {
+            buf[len++] = map->cache[i];
+            *covered |= REG_BIT(i);
+        }
+        break;
+    case SENSOR_REGMAP_BURST_PAIRS:
+        for (int i = first; i < map->count && len < 2 * SENSOR_REGMAP_MAX_BURST; i++)
+        {
+            if (!(dirty & REG_BIT(i)))
+                continue;
+            buf[len++] = map->base + i;
+            buf[len++] = map->cache[i];
+            *covered |= REG_BIT(i);
+        }
+        break;
+    default:
+        buf[len++] = map->base + first;
+        buf[len++] = map->cache[first];
+        *covered = REG_BIT(first);
+        break;
+    }
+    return len;
+}
+
+esp_err_t sensor_regmap_sync(sensor_regmap_t *map)
+{
+    if (map->dirty == 0)
+        return ESP_OK;
+    if (!sensor_hal_is_attached(map->dev))
+        return ESP_ERR_INVALID_STATE;
+
+    // Bursts that cannot be merged still share one bus grant as a batch
+    uint8_t buf[SENSOR_REGMAP_MAX_OPS][2 * SENSOR_REGMAP_MAX_BURST];
+    sensor_hal_i2c_op_t ops[SENSOR_REGMAP_MAX_OPS];
+    uint64_t covered[SENSOR_REGMAP_MAX_OPS];
+    int attempt = 0;
+    while (map->dirty != 0)
+    {
+        uint64_t remaining = map->dirty;
+        size_t count = 0;
+        while (remaining != 0 && count < SENSOR_REGMAP_MAX_OPS)
+        {
+            size_t len = next_burst(map, remaining, buf[count], &covered[count]);
+            remaining &= ~covered[count];
+            ops[count] = (sensor_hal_i2c_op_t){.dev = map->dev, .tx = buf[count], .tx_len = len};
+            count++;
+        }
+
+        int64_t start = esp_timer_get_time();
+        esp_err_t err = sensor_hal_i2c_batch(ops, count, I2C_TRANSACTION_TIMEOUT_MS);
+        if (map->stats != NULL)
+            bus_stats_record(map->stats, start, err);
+        for (size_t i = 0; i < count; i++)
+        {
+            if (ops[i].err == ESP_OK)
+                map->dirty &= ~covered[i];
+            if (ops[i].err != ESP_ERR_NOT_FINISHED)
+                map->writes++;
+        }
+        // Registers of a failed entry stay dirty for the retry or the next sync
+        if (err != ESP_OK && !(map->stats != NULL && bus_stats_should_retry(map->stats, err, &attempt)))
+            return err;
+    }
+    return ESP_OK;
+}
+
+esp_err_t sensor_regmap_write(sensor_regmap_t *map, uint8_t reg, uint8_t value)
+{
+    esp_err_t err = sensor_regmap_set(map, reg, value);
+    if (err != ESP_OK)
+        return err;
+    return sensor_regmap_sync(map);
+}
+
+esp_err_t sensor_regmap_read(sensor_regmap_t *map, uint8_t reg, uint8_t *value)
+{
+    int i;
+    if (!reg_index(map, reg, &i))
+        return ESP_ERR_INVALID_ARG;
+
+    if ((map->valid & REG_BIT(i)) && !(map->volatile_regs & REG_BIT(i)))
+    {
+        *value = map->cache[i];
+        return ESP_OK;
+    }
+    if (!sensor_hal_is_attached(map->dev))
+        return ESP_ERR_INVALID_STATE;
+
+    esp_err_t err = read_with_retry(map, reg, value);
+    if (err != ESP_OK)
+        return err;
+    map->cache[i] = *value;
+    map->valid |= REG_BIT(i);
+    return ESP_OK;
+}
+
+void sensor_regmap_invalidate(sensor_regmap_t *map)
+{
+    map->valid = 0;
+    map->dirty = 0;
+}
+
+esp_err_t sensor_regmap_resync(sensor_regmap_t *map)
+{
+    map->dirty |= map->valid;
+    return sensor_regmap_sync(map);
+}
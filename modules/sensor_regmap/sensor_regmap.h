@@ -0,0 +1,91 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "sensor_hal.h"
+#include "bus_stats.h"
+
+/*
+ * Shadow copy of a device's writable registers.
+ *
+ * Writes land in the cache and only mark a register dirty when its value changes;
+ * sensor_regmap_sync sends the dirty registers in as few transactions as the device's write
+ * format allows. Cached registers are read without touching the bus. Registers the device
+ * changes by itself (e.g. a mode field that falls back after a one-shot conversion) are declared
+ * volatile: their writes always go out and their reads always hit the bus.
+ *
+ * The cache survives a detach, so after a device reset sensor_regmap_resync pushes the last
+ * configuration again.
+ */
+#define SENSOR_REGMAP_MAX_REGS  64
+#define SENSOR_REGMAP_MAX_BURST 8 // registers per write transaction
+#define SENSOR_REGMAP_MAX_OPS   4 // write transactions per bus grant
+
+typedef enum
+{
+    SENSOR_REGMAP_BURST_NONE,      /*!< reg, value - one register per transaction */
+    SENSOR_REGMAP_BURST_INCREMENT, /*!< reg, v0, v1, ... - address auto-increment (ADXL345) */
+    SENSOR_REGMAP_BURST_PAIRS,     /*!< reg0, v0, reg1, v1, ... (BMP280) */
+} sensor_regmap_burst_t;
+
+typedef struct
+{
+    sensor_hal_dev_t *dev;
+    bus_stats_t *stats; /*!< Transaction accounting and retries, NULL for neither */
+    uint8_t base;       /*!< Address of cache[0] */
+    uint8_t count;
+    sensor_regmap_burst_t burst;
+    uint64_t valid;         /*!< Cache entry holds what the device has or is about to get */
+    uint64_t dirty;         /*!< Cache entry not written to the device yet */
+    uint64_t volatile_regs;
+    uint32_t writes;        /*!< Write transactions sent, retries included */
+    uint32_t skipped;       /*!< Register writes dropped because the device already had the value */
+    uint8_t cache[SENSOR_REGMAP_MAX_REGS];
+} sensor_regmap_t;
+
+/**
+ * @brief Empty cache for the registers first .. first + n - 1 of a device, n <= SENSOR_REGMAP_MAX_REGS.
+ */
+#define SENSOR_REGMAP_INIT(device, bus_stats, first, n, burst_mode) \
+    {.dev = (device), .stats = (bus_stats), .base = (first), .count = (n), .burst = (burst_mode)}
+
+void sensor_regmap_set_volatile(sensor_regmap_t *map, uint8_t reg);
+
+/**
+ * @brief Stage a register value, written by the next sensor_regmap_sync if it changed.
+ */
+esp_err_t sensor_regmap_set(sensor_regmap_t *map, uint8_t reg, uint8_t value);
+
+/**
+ * @brief Stage a read-modify-write of the bits in mask. Reads the device only if the register
+ * is not cached yet.
+ */
+esp_err_t sensor_regmap_update_bits(sensor_regmap_t *map, uint8_t reg, uint8_t mask, uint8_t value);
+
+/**
+ * @brief Write every dirty register, as one batch under a single bus grant when they need more
+ * than one transaction. Registers of a failed transaction stay dirty.
+ */
+esp_err_t sensor_regmap_sync(sensor_regmap_t *map);
+
+/**
+ * @brief sensor_regmap_set followed by sensor_regmap_sync.
+ */
+esp_err_t sensor_regmap_write(sensor_regmap_t *map, uint8_t reg, uint8_t value);
+
+/**
+ * @brief Read a register from the cache, or from the device (and cache it) if not cached or volatile.
+ */
+esp_err_t sensor_regmap_read(sensor_regmap_t *map, uint8_t reg, uint8_t *value);
+
+/**
+ * @brief Forget the cached values, e.g. when a different device was attached.
+ */
+void sensor_regmap_invalidate(sensor_regmap_t *map);
+
+/**
+ * @brief Write every cached register again, after the device lost its configuration (reset,
+ * power cycle, bus recovery).
+ */
+esp_err_t sensor_regmap_resync(sensor_regmap_t *map);
@@ -1,24 +1,49 @@
 #include "adxl345_task.h"
+#include "adaptive_rate.h"
+#include "task_plan.h"
+#include "sensor_health.h"
 
 void adxl345_task(void *arg)
 {
+    adaptive_rate_t rate;
+    const adaptive_rate_config_t rate_cfg = {
+        .name = "adxl345",
+        .initial_interval_ms = FREQUENT_MEASUREMENT_INTERVAL_MS,
+        .min_interval_ms = ADXL345_MIN_INTERVAL_MS,
+        .max_interval_ms = ADXL345_MAX_INTERVAL_MS,
+        .deadband = ADXL345_DEADBAND,
+        .rate_threshold = ADXL345_RATE_THRESHOLD,
+        .stable_samples = ADAPTIVE_STABLE_SAMPLES,
+    };
+    adaptive_rate_init(&rate, &rate_cfg);
+
+    sensor_health_t health;
+    sensor_health_init(&health, "adxl345", adxl345_recover, adxl345_is_ready());
+
     while (1)
     {
+        if (sensor_health_is_offline(&health))
+        {
+            vTaskDelay(pdMS_TO_TICKS(sensor_health_try_recover(&health)));
+            continue;
+        }
+
+        // One 6-byte burst per interval: a plain read, the async split is for FIFO drains
         float acceleration = adxl345_read_data();
         if (acceleration != -1.0f)
         {
+            sensor_health_report_success(&health);
             *(float *)arg = acceleration;
-            vTaskDelay(FREQUENT_MEASUREMENT_INTERVAL_MS);
+            vTaskDelay(pdMS_TO_TICKS(adaptive_rate_update(&rate, acceleration)));
         }
         else
         {
-            printf("Failed to read ADXL345 data");
-            vTaskDelay(SENSOR_MEASUREMENT_FAIL_INTERVAL_MS);
+            vTaskDelay(pdMS_TO_TICKS(sensor_health_report_failure(&health)));
         }
     }
 }
 
 void adxl345_start_task(float *parameter)
 {
-    xTaskCreate(adxl345_task, "adxl345_task", 4096, parameter, 5, NULL);
+    task_plan_create(TASK_ID_ADXL345, adxl345_task, parameter, NULL);
 }
\ No newline at end of file
@@ -1,6 +1,9 @@
 #include "bmp280_task.h"
 #include "ble_server.h"
 #include "esp_log.h"
+#include "adaptive_rate.h"
+#include "task_plan.h"
+#include "sensor_health.h"
 
 #define BMP280_TEMP_MIN 26.0f
 #define BMP280_TEMP_MAX 28.0f
@@ -8,13 +11,35 @@
 void bmp280_task(void *arg)
 {
     float temp;
+    adaptive_rate_t rate;
+    const adaptive_rate_config_t rate_cfg = {
+        .name = "bmp280",
+        .initial_interval_ms = BMP280_MEASUREMENT_INTERVAL_MS,
+        .min_interval_ms = BMP280_MIN_INTERVAL_MS,
+        .max_interval_ms = BMP280_MAX_INTERVAL_MS,
+        .deadband = BMP280_DEADBAND,
+        .rate_threshold = BMP280_RATE_THRESHOLD,
+        .stable_samples = ADAPTIVE_STABLE_SAMPLES,
+    };
+    adaptive_rate_init(&rate, &rate_cfg);
+
+    sensor_health_t health;
+    sensor_health_init(&health, "bmp280", bmp280_recover, bmp280_is_ready());
+
     while (1)
     {
+        if (sensor_health_is_offline(&health))
+        {
+            vTaskDelay(pdMS_TO_TICKS(sensor_health_try_recover(&health)));
+            continue;
+        }
+
         bmp280_trigger_forced_mode();
         vTaskDelay(100 / portTICK_PERIOD_MS);
         temp = bmp280_read_temp();
         if (temp != -100.0f)
         {
+            sensor_health_report_success(&health);
             *(float *)arg = temp;
             
             if (temp < BMP280_TEMP_MIN || temp > BMP280_TEMP_MAX) {
@@ -23,17 +48,16 @@ void bmp280_task(void *arg)
                 ble_send_alert("BMP280", alert_msg);
             }
             
-            vTaskDelay(BMP280_MEASUREMENT_INTERVAL_MS);
+            vTaskDelay(pdMS_TO_TICKS(adaptive_rate_update(&rate, temp)));
         }
         else
         {
-            printf("Failed to read temperature");
-            vTaskDelay(SENSOR_MEASUREMENT_FAIL_INTERVAL_MS);
+            vTaskDelay(pdMS_TO_TICKS(sensor_health_report_failure(&health)));
         }
     }
 }
 
 void bmp280_start_task(float *temperature)
 {
-    xTaskCreate(bmp280_task, "bmp280_task", 4096, temperature, 5, NULL);
+    task_plan_create(TASK_ID_BMP280, bmp280_task, temperature, NULL);
 }
\ No newline at end of file
@@ -2,21 +2,49 @@
 #include "utils.h"
 #include "ble_server.h"
 #include "esp_timer.h"
+#include "adaptive_rate.h"
+#include "task_plan.h"
+#include "sensor_health.h"
+#include "storage_manager.h"
 
 
 #define MAX6675_PROFILE_TEMP_TRIGGER  50.0f
 #define MAX6675_PROFILE_DURATION_MS   (4 * 60 * 1000) // 4 minutes
+// Planned length of the capture file: warm-up to the trigger plus the timed part
+#define MAX6675_PROFILE_CAPTURE_MS    (MAX6675_PROFILE_DURATION_MS + 6 * 60 * 1000)
+
+// Owned by max6675_task, the profile task only checks whether the sensor is offline
+static sensor_health_t s_health;
 
 
 void max6675_task(void *arg)
 {
+    adaptive_rate_t rate;
+    const adaptive_rate_config_t rate_cfg = {
+        .name = "max6675",
+        .initial_interval_ms = MAX6675_MEASUREMENT_INTERVAL_MS,
+        .min_interval_ms = MAX6675_MIN_INTERVAL_MS,
+        .max_interval_ms = MAX6675_MAX_INTERVAL_MS,
+        .deadband = MAX6675_DEADBAND,
+        .rate_threshold = MAX6675_RATE_THRESHOLD,
+        .stable_samples = ADAPTIVE_STABLE_SAMPLES,
+    };
+    adaptive_rate_init(&rate, &rate_cfg);
+
     while (1)
     {
+        if (sensor_health_is_offline(&s_health))
+        {
+            vTaskDelay(pdMS_TO_TICKS(sensor_health_try_recover(&s_health)));
+            continue;
+        }
+
         float engine_temp = max6675_read_celsius();
         if (engine_temp != -1.0f)
         {
+            sensor_health_report_success(&s_health);
             *(float *)arg = engine_temp;
-            vTaskDelay(MAX6675_MEASUREMENT_INTERVAL_MS); // 5 minutes
+            vTaskDelay(pdMS_TO_TICKS(adaptive_rate_update(&rate, engine_temp)));
 
             char alert_msg[32];
             snprintf(alert_msg, sizeof(alert_msg), "%.1f", engine_temp);
@@ -25,15 +53,15 @@ void max6675_task(void *arg)
         }
         else
         {
-            printf("Error reading MAX6675 temperature.\n");
-            vTaskDelay(SENSOR_MEASUREMENT_FAIL_INTERVAL_MS);
+            vTaskDelay(pdMS_TO_TICKS(sensor_health_report_failure(&s_health)));
         }
     }
 }
 
 void max6675_start_task(float *engine_temp)
 {
-    xTaskCreate(max6675_task, "max6675_task", 2048, engine_temp, 5, NULL);
+    sensor_health_init(&s_health, "max6675", max6675_recover, max6675_is_ready());
+    task_plan_create(TASK_ID_MAX6675, max6675_task, engine_temp, NULL);
 }
 
 void max6675_profile_task(void *arg)
@@ -43,12 +71,21 @@ void max6675_profile_task(void *arg)
  
     bool threshold_reached = false;
     int64_t threshold_time_us = 0;
+    // The profile also goes to a preallocated capture file, next to the log lines
+    static const storage_capture_channel_t channel = {"MAX6675", 1000.0f / MAX6675_PROFILE_INTERVAL_MS};
+    storage_capture_t *capture = NULL;
+    bool capture_tried = false; // once per profile, without a card the profile runs without it
 
     while (1)
     {
         if (!ble_max6675_profile_requested())
         {
-  
+            if (capture != NULL)
+            {
+                storage_capture_finish(capture, NULL); // cancelled over BLE
+                capture = NULL;
+            }
+            capture_tried = false;
             threshold_reached = false;
             vTaskDelay(pdMS_TO_TICKS(500));
             continue;
@@ -56,6 +93,12 @@ void max6675_profile_task(void *arg)
 
   
 
+        if (sensor_health_is_offline(&s_health))
+        {
+            vTaskDelay(pdMS_TO_TICKS(500));
+            continue;
+        }
+
         float temp = max6675_read_celsius();
         if (temp < 0)
         {
@@ -65,6 +108,13 @@ void max6675_profile_task(void *arg)
 
         *shared_temp = temp;
 
+        if (!capture_tried)
+        {
+            capture = storage_capture_open("MAX6675_PROFILE", &channel, 1, MAX6675_PROFILE_CAPTURE_MS);
+            capture_tried = true;
+        }
+        if (capture != NULL)
+            storage_capture_add(capture, 0, temp);
         save_sensor_to_storage("MAX6675_PROFILE", temp);
         ble_notify_max6675_profile(temp);
 
@@ -87,6 +137,12 @@ void max6675_profile_task(void *arg)
             if (elapsed_ms >= MAX6675_PROFILE_DURATION_MS)
             {
                 ESP_LOGI("MAX6675_PROFILE", "Profiling finished (4 minutes)");
+                if (capture != NULL)
+                {
+                    storage_capture_finish(capture, NULL);
+                    capture = NULL;
+                }
+                capture_tried = false;
 
                 ble_max6675_clear_profile_request(); // require new BLE '1'
                 threshold_reached = false;
@@ -96,18 +152,12 @@ void max6675_profile_task(void *arg)
             }
         }
 
-        vTaskDelay(MAX6675_PROFILE_INTERVAL_MS);
+        vTaskDelay(pdMS_TO_TICKS(MAX6675_PROFILE_INTERVAL_MS));
     }
 }
 
 
 void max6675_start_profile_task(float *engine_temp)
 {
-    xTaskCreate(
-        max6675_profile_task,
-        "max6675_profile_task",
-        2048,
-        engine_temp,
-        5,
-        NULL);
+    task_plan_create(TASK_ID_MAX6675_PROFILE, max6675_profile_task, engine_temp, NULL);
 }
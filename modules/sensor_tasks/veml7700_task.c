@@ -1,16 +1,41 @@
 #include "veml7700_task.h"
 #include "ble_server.h"
 #include "esp_log.h"
+#include "adaptive_rate.h"
+#include "task_plan.h"
+#include "sensor_health.h"
 
 #define VEML7700_LUX_THRESHOLD 10.0f
 
 void veml7700_task(void *arg)
 {
+    adaptive_rate_t rate;
+    const adaptive_rate_config_t rate_cfg = {
+        .name = "veml7700",
+        .initial_interval_ms = VEML7700_MEASUREMENT_INTERVAL_MS,
+        .min_interval_ms = VEML7700_MIN_INTERVAL_MS,
+        .max_interval_ms = VEML7700_MAX_INTERVAL_MS,
+        .deadband = VEML7700_DEADBAND,
+        .rate_threshold = VEML7700_RATE_THRESHOLD,
+        .stable_samples = ADAPTIVE_STABLE_SAMPLES,
+    };
+    adaptive_rate_init(&rate, &rate_cfg);
+
+    sensor_health_t health;
+    sensor_health_init(&health, "veml7700", veml7700_recover, veml7700_is_ready());
+
     while (1)
     {
+        if (sensor_health_is_offline(&health))
+        {
+            vTaskDelay(pdMS_TO_TICKS(sensor_health_try_recover(&health)));
+            continue;
+        }
+
         float lux = veml7700_read_lux();
         if (lux >= 0.0f)
         {
+            sensor_health_report_success(&health);
             *(float *)arg = lux;
             
             // Check lux threshold and send BLE alert if below threshold
@@ -20,18 +45,17 @@ void veml7700_task(void *arg)
                 ble_send_alert("VEML7700", alert_msg);
             }
             
-            vTaskDelay(VEML7700_MEASUREMENT_INTERVAL_MS);
+            vTaskDelay(pdMS_TO_TICKS(adaptive_rate_update(&rate, lux)));
             printf("VEML7700: Lux = %.2f\n", lux);
         }
         else
         {
-            printf("Failed to read sensor");
-            vTaskDelay(SENSOR_MEASUREMENT_FAIL_INTERVAL_MS);
+            vTaskDelay(pdMS_TO_TICKS(sensor_health_report_failure(&health)));
         }
     }
 }
 
 void veml7700_start_task(float *parameter)
 {
-    xTaskCreate(veml7700_task, "VEML7700_Task", 2048, parameter, 5, NULL);
+    task_plan_create(TASK_ID_VEML7700, veml7700_task, parameter, NULL);
 }
\ No newline at end of file
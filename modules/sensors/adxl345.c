@@ -1,4 +1,7 @@
 #include "adxl345.h"
+#include "project_config.h"
+#include "bus_stats.h"
+#include "sensor_regmap.h"
 
 static const char *TAG = "ADXL345";
 
@@ -13,68 +16,97 @@ uint64_t activity_threshold = 0;
 uint64_t inactivity_threshold = 0;
 uint64_t inactivity_time = 60;
 
-static i2c_master_dev_handle_t adxl345_handle;
+static sensor_hal_i2c_bus_t adxl345_bus;
+static sensor_hal_dev_t adxl345_dev = SENSOR_HAL_DEV_INIT(SENSOR_HAL_DEV_ADXL345);
+static bus_stats_t s_bus_stats = BUS_STATS_INIT("adxl345");
+// Writable configuration registers THRESH_TAP (0x1D) .. FIFO_CTL (0x38), multi-byte writes auto-increment
+static sensor_regmap_t s_regmap = SENSOR_REGMAP_INIT(&adxl345_dev, &s_bus_stats, 0x1D, 0x38 - 0x1D + 1, SENSOR_REGMAP_BURST_INCREMENT);
 
 static esp_err_t read_register_adxl345(uint8_t reg_addr, uint8_t *data, size_t len);
-static esp_err_t write_register_adxl345(uint8_t reg_addr, uint8_t value);
 static esp_err_t configure_power_ctrl();
 static esp_err_t cofigure_bw_rate();
-static void convert_raw_data_to_ms2(int16_t rx, int16_t ry, int16_t rz, float *x, float *y, float *z);
-static float calculate_acceleration(float x, float y, float z);
 
-esp_err_t adxl345_init(i2c_master_bus_handle_t bus_handle)
+esp_err_t adxl345_init(sensor_hal_i2c_bus_t bus_handle)
 {
-    i2c_device_config_t dev_config = {
-        .dev_addr_length = I2C_ADDR_BIT_LEN_7,
-        .device_address = ADXL345_ADDR,
-        .scl_speed_hz = ADXL345_SPEED_HZ,
-    };
+    adxl345_bus = bus_handle;
 
-    ESP_ERROR_CHECK(i2c_master_bus_add_device(bus_handle, &dev_config, &adxl345_handle));
+    esp_err_t err = sensor_hal_i2c_attach(&adxl345_dev, bus_handle, ADXL345_ADDR, ADXL345_MAX_SPEED_HZ);
+    if (err != ESP_OK)
+    {
+        ESP_LOGW(TAG, "No ADXL345 answering at 0x%02X: %s", ADXL345_ADDR, esp_err_to_name(err));
+        return err;
+    }
+    bus_stats_register(&s_bus_stats);
+    // Re-attached after a reset or bus recovery: push the cached configuration again
+    err = sensor_regmap_resync(&s_regmap);
+    if (err != ESP_OK)
+        ESP_LOGW(TAG, "Failed to restore configuration: %s", esp_err_to_name(err));
     ESP_LOGI(TAG, "ADXL345 initialized on I2C address 0x%02X", ADXL345_ADDR);
     return ESP_OK;
 }
 
 esp_err_t adxl345_delete()
 {
-    return i2c_master_bus_rm_device(adxl345_handle);
+    if (!sensor_hal_is_attached(&adxl345_dev))
+        return ESP_ERR_INVALID_STATE;
+    return sensor_hal_i2c_detach(&adxl345_dev);
 }
 
-static esp_err_t read_register_adxl345(uint8_t reg_addr, uint8_t *data, size_t len)
+bool adxl345_is_ready()
 {
-    return i2c_master_transmit_receive(adxl345_handle, &reg_addr, 1, data, len, 1000);
+    return sensor_hal_is_attached(&adxl345_dev);
+}
+
+esp_err_t adxl345_recover()
+{
+    if (adxl345_bus == NULL)
+        return ESP_ERR_INVALID_STATE;
+
+    if (sensor_hal_is_attached(&adxl345_dev))
+        adxl345_delete();
+
+    esp_err_t err = sensor_hal_i2c_bus_reset(adxl345_bus);
+    if (err != ESP_OK)
+        return err;
+
+    err = adxl345_init(adxl345_bus);
+    if (err != ESP_OK)
+        return err;
+
+    return adxl345_configure();
 }
 
-static esp_err_t write_register_adxl345(uint8_t reg_addr, uint8_t value)
+static esp_err_t read_register_adxl345(uint8_t reg_addr, uint8_t *data, size_t len)
 {
-    uint8_t buf[2] = {reg_addr, value};
-    return i2c_master_transmit(adxl345_handle, buf, sizeof(buf), 1000);
+    if (!sensor_hal_is_attached(&adxl345_dev))
+        return ESP_ERR_INVALID_STATE;
+
+    return sensor_hal_i2c_write_read_retry(&s_bus_stats, &adxl345_dev, &reg_addr, 1, data, len,
+                                           I2C_TRANSACTION_TIMEOUT_MS);
 }
 
 static esp_err_t configure_power_ctrl()
 {
     uint8_t power_ctl = (link << 5) | (auto_sleep << 4) | (measure_bit << 3) | (sleep_bit << 2) | sleep_mode_frequency;
-    return write_register_adxl345(REG_POWER_CTL, power_ctl);
+    return sensor_regmap_write(&s_regmap, REG_POWER_CTL, power_ctl);
 }
 
 static esp_err_t cofigure_bw_rate()
 {
     uint8_t bw_rate = (low_power << 4) | low_power_frequency;
-    return write_register_adxl345(BW_RATE, bw_rate);
+    return sensor_regmap_write(&s_regmap, BW_RATE, bw_rate);
 }
 
 esp_err_t adxl345_configure()
 {
-    esp_err_t err = configure_power_ctrl();
-    if (err != ESP_OK)
-    {
-        ESP_LOGE(TAG, "Failed to configure power control: %s", esp_err_to_name(err));
-        return err;
-    }
-    err = cofigure_bw_rate();
+    // BW_RATE (0x2C) and POWER_CTL (0x2D) are adjacent: one burst, rate set before measuring starts
+    sensor_regmap_set(&s_regmap, BW_RATE, (low_power << 4) | low_power_frequency);
+    sensor_regmap_set(&s_regmap, REG_POWER_CTL,
+                      (link << 5) | (auto_sleep << 4) | (measure_bit << 3) | (sleep_bit << 2) | sleep_mode_frequency);
+    esp_err_t err = sensor_regmap_sync(&s_regmap);
     if (err != ESP_OK)
     {
-        ESP_LOGE(TAG, "Failed to configure bandwidth rate: %s", esp_err_to_name(err));
+        ESP_LOGE(TAG, "Failed to configure power control and bandwidth rate: %s", esp_err_to_name(err));
         return err;
     }
     return ESP_OK;
@@ -148,19 +180,19 @@ esp_err_t adxl345_set_low_power_rate(uint8_t rate)
 esp_err_t adxl345_set_activity_threshold(uint8_t threshold)
 {
     activity_threshold = threshold;
-    return write_register_adxl345(THRESH_ACT, activity_threshold);
+    return sensor_regmap_write(&s_regmap, THRESH_ACT, activity_threshold);
 }
 
 esp_err_t adxl345_set_inactivity_threshold(uint8_t threshold)
 {
     inactivity_threshold = threshold;
-    return write_register_adxl345(THRESH_INACT, inactivity_threshold);
+    return sensor_regmap_write(&s_regmap, THRESH_INACT, inactivity_threshold);
 }
 
 esp_err_t adxl345_set_inactivity_time(uint8_t time)
 {
     inactivity_time = time;
-    return write_register_adxl345(TIME_INACT, inactivity_time);
+    return sensor_regmap_write(&s_regmap, TIME_INACT, inactivity_time);
 }
 
 esp_err_t adxl345_set_frequency_in_sleep_mode(uint8_t frequency)
@@ -197,47 +229,52 @@ esp_err_t adxl345_enable_auto_sleep(bool enable)
 
 esp_err_t adxl345_enable_all_axis_activity_detection()
 {
-    uint8_t act_inact_ctl;
-    esp_err_t err = read_register_adxl345(ACT_INACT_CTL, &act_inact_ctl, 1);
+    // Set bits for X, Y, Z axes, the register is read from the device only the first time
+    esp_err_t err = sensor_regmap_update_bits(&s_regmap, ACT_INACT_CTL, 0x07, 0x07);
     if (err != ESP_OK)
-    {
         return err;
-    }
-    act_inact_ctl |= 0x07; // Set bits for X, Y, Z axes
-    return write_register_adxl345(ACT_INACT_CTL, act_inact_ctl);
+    return sensor_regmap_sync(&s_regmap);
 }
 
-static void convert_raw_data_to_ms2(int16_t rx, int16_t ry, int16_t rz, float *x, float *y, float *z)
+float adxl345_read_data()
 {
-    *x = rx * ADXL345_LSB_TO_MS2;
-    *y = ry * ADXL345_LSB_TO_MS2;
-    *z = rz * ADXL345_LSB_TO_MS2;
-}
+    uint8_t raw[6];
+    esp_err_t err = read_register_adxl345(REG_DATAX0, raw, 6);
 
-static float calculate_acceleration(float x, float y, float z)
-{
-    x = x - ADXL345_X_AXIS_CORRECTION;
-    y = y - ADXL345_Y_AXIS_CORRECTION;
-    z = z - ADXL345_EARTH_GRAVITY_MS2;
+    if (err != ESP_OK)
+        return -1.0f;
 
-    float combined_acceleration = sqrtf(x * x + y * y + z * z);
-    return combined_acceleration;
+    return adxl345_raw_to_acceleration(raw);
 }
 
-float adxl345_read_data()
+static int64_t s_async_start;
+
+esp_err_t adxl345_read_raw_start(uint8_t raw[6])
 {
-    uint8_t raw[6];
-    esp_err_t err = read_register_adxl345(REG_DATAX0, raw, 6);
+    if (!sensor_hal_is_attached(&adxl345_dev))
+        return ESP_ERR_INVALID_STATE;
 
+    const uint8_t reg_addr = REG_DATAX0;
+    s_async_start = esp_timer_get_time();
+    esp_err_t err = sensor_hal_i2c_read_start(&adxl345_dev, &reg_addr, 1, raw, 6);
     if (err != ESP_OK)
-        return -1.0f;
+        bus_stats_record(&s_bus_stats, s_async_start, err);
+    return err;
+}
 
+// No retry here: the caller already moved on, a failed sample is reported to sensor_health instead
+esp_err_t adxl345_read_raw_wait(void)
+{
+    esp_err_t err = sensor_hal_i2c_read_wait(&adxl345_dev, I2C_TRANSACTION_TIMEOUT_MS);
+    bus_stats_record(&s_bus_stats, s_async_start, err);
+    return err;
+}
+
+float adxl345_raw_to_acceleration(const uint8_t raw[6])
+{
     int16_t rx = (int16_t)(raw[1] << 8 | raw[0]);
     int16_t ry = (int16_t)(raw[3] << 8 | raw[2]);
     int16_t rz = (int16_t)(raw[5] << 8 | raw[4]);
 
-    float x, y, z;
-    convert_raw_data_to_ms2(rx, ry, rz, &x, &y, &z);
-
-    return calculate_acceleration(x, y, z);
+    return adxl345_net_acceleration(rx, ry, rz);
 }
\ No newline at end of file
@@ -1,12 +1,13 @@
 #include <stdint.h>
 #include <math.h>
 #include "esp_err.h"
-#include "driver/i2c_master.h"
+#include "sensor_hal.h"
+#include "sensor_kernels.h"
 #include "esp_log.h"
 
 // ADXL345 I2C Address (Assumes ALT ADDRESS pin is Grounded)
 #define ADXL345_PORT I2C_NUM_0
-#define ADXL345_SPEED_HZ 100000 // I2C Speed (100kHz)
+#define ADXL345_MAX_SPEED_HZ 400000 // Fastest I2C clock of the device, the bus manager may pick less
 #define ADXL345_ADDR 0x53
 // #define I2C_SCL_IO 22      // ESP32 GPIO for SCL
 // #define I2C_SDA_IO 21      // ESP32 GPIO for SDA
@@ -26,13 +27,12 @@
 #define TIME_INACT 0x26    // Inactivity Time
 #define ACT_INACT_CTL 0x27 // Activity/Inactivity Control
 
-#define ADXL345_LSB_TO_MS2 (0.004f * 9.80665f)
-#define ADXL345_X_AXIS_CORRECTION -0.039f
-#define ADXL345_Y_AXIS_CORRECTION -2.760f
-#define ADXL345_EARTH_GRAVITY_MS2 8.318f
 
-esp_err_t adxl345_init(i2c_master_bus_handle_t bus_handle);
+esp_err_t adxl345_init(sensor_hal_i2c_bus_t bus_handle);
 esp_err_t adxl345_delete();
+bool adxl345_is_ready();
+// Remove the device, reset the bus (clears a stuck SDA line), add it again and re-configure
+esp_err_t adxl345_recover();
 esp_err_t adxl345_configure();
 
 esp_err_t adxl345_set_measurement_mode();
@@ -49,4 +49,14 @@ esp_err_t adxl345_set_frequency_in_sleep_mode(uint8_t frequency);
 esp_err_t adxl345_enable_auto_sleep(bool enable);
 esp_err_t adxl345_enable_all_axis_activity_detection();
 
-float adxl345_read_data();
\ No newline at end of file
+float adxl345_read_data();
+
+/*
+ * Async read of the output registers, lets the caller work on data already read (a FIFO batch)
+ * while the transfer runs. raw must stay valid until adxl345_read_raw_wait returns. The bus
+ * latency is recorded from start to wait, so call the wait right after that work, never after
+ * sleeping.
+ */
+esp_err_t adxl345_read_raw_start(uint8_t raw[6]);
+esp_err_t adxl345_read_raw_wait(void);
+float adxl345_raw_to_acceleration(const uint8_t raw[6]);
\ No newline at end of file
@@ -1,20 +1,7 @@
 #include "bmp280.h"
-
-typedef struct
-{
-    uint16_t dig_T1;
-    int16_t dig_T2;
-    int16_t dig_T3;
-    uint16_t dig_P1;
-    int16_t dig_P2;
-    int16_t dig_P3;
-    int16_t dig_P4;
-    int16_t dig_P5;
-    int16_t dig_P6;
-    int16_t dig_P7;
-    int16_t dig_P8;
-    int16_t dig_P9;
-} bmp280_calib_data_t;
+#include "project_config.h"
+#include "bus_stats.h"
+#include "sensor_regmap.h"
 
 bmp280_calib_data_t cal_data; // Global instance
 static int32_t t_fine;
@@ -28,61 +15,88 @@ uint8_t standby = 0;      // Default standby time 1000ms
 uint8_t mode = 0;         // Default mode sleep
 uint8_t spi = 0;          // Default SPI disabled
 
-static i2c_master_dev_handle_t bmp280_handle;
+static sensor_hal_i2c_bus_t bmp280_bus;
+static uint8_t bmp280_address = BMP280_ADDR;
+static sensor_hal_dev_t bmp280_dev = SENSOR_HAL_DEV_INIT(SENSOR_HAL_DEV_BMP280);
+static bus_stats_t s_bus_stats = BUS_STATS_INIT("bmp280");
+// CTRL_MEAS and CONFIG. Writes are register/value pairs, CTRL_MEAS is volatile: a forced
+// conversion drops the mode back to sleep, so every trigger has to reach the device.
+static sensor_regmap_t s_regmap = SENSOR_REGMAP_INIT(&bmp280_dev, &s_bus_stats, REG_CTRL_MEAS, 2, SENSOR_REGMAP_BURST_PAIRS);
 
 static esp_err_t read_register_bmp280(uint8_t reg_addr, uint8_t *data, size_t len);
-static esp_err_t write_register_bmp280(uint8_t reg_addr, uint8_t value);
 
-static void read_calibration_data();
+static void parse_calibration_data(const uint8_t *raw_data);
 static esp_err_t configure_ctrl_meas();
 static esp_err_t configure_config();
 
-static float convert_temperature(int32_t raw_temp);
-static float convert_pressure(int32_t raw_pres);
+static esp_err_t wait_for_measurement();
 
-esp_err_t bmp280_init(i2c_master_bus_handle_t bus_handle, uint8_t address)
+esp_err_t bmp280_init(sensor_hal_i2c_bus_t bus_handle, uint8_t address)
 {
-    i2c_device_config_t dev_config = {
-        .dev_addr_length = I2C_ADDR_BIT_LEN_7,
-        .device_address = address,
-        .scl_speed_hz = BMP280_SPEED_HZ,
-    };
+    bmp280_bus = bus_handle;
 
-    esp_err_t err = i2c_master_bus_add_device(bus_handle, &dev_config, &bmp280_handle);
+    esp_err_t err = sensor_hal_i2c_attach(&bmp280_dev, bus_handle, address, BMP280_MAX_SPEED_HZ);
     if (err != ESP_OK)
     {
-        ESP_LOGE(TAG, "Failed to add BMP280 device to I2C bus: %s", esp_err_to_name(err));
+        ESP_LOGW(TAG, "No BMP280 answering at 0x%02X: %s", address, esp_err_to_name(err));
         return err;
     }
+    bmp280_address = address;
+    bus_stats_register(&s_bus_stats);
+    sensor_regmap_set_volatile(&s_regmap, REG_CTRL_MEAS);
+    // Re-attached after a reset or bus recovery: push the cached configuration again
+    err = sensor_regmap_resync(&s_regmap);
+    if (err != ESP_OK)
+        ESP_LOGW(TAG, "Failed to restore configuration: %s", esp_err_to_name(err));
     ESP_LOGI(TAG, "BMP280 initialized on I2C address 0x%02X", address);
     return ESP_OK;
 }
 
-esp_err_t bmp280_delete(i2c_master_dev_handle_t dev_handle)
+esp_err_t bmp280_delete()
 {
-    return i2c_master_bus_rm_device(bmp280_handle);
+    if (!sensor_hal_is_attached(&bmp280_dev))
+        return ESP_ERR_INVALID_STATE;
+    return sensor_hal_i2c_detach(&bmp280_dev);
 }
 
-static esp_err_t read_register_bmp280(uint8_t reg_addr, uint8_t *data, size_t len)
+bool bmp280_is_ready()
 {
-    return i2c_master_transmit_receive(bmp280_handle, &reg_addr, 1, data, len, 1000);
+    return sensor_hal_is_attached(&bmp280_dev);
 }
 
-static esp_err_t write_register_bmp280(uint8_t reg_addr, uint8_t value)
+esp_err_t bmp280_recover()
 {
-    uint8_t buf[2] = {reg_addr, value};
-    return i2c_master_transmit(bmp280_handle, buf, sizeof(buf), 1000);
+    if (bmp280_bus == NULL)
+        return ESP_ERR_INVALID_STATE;
+
+    if (sensor_hal_is_attached(&bmp280_dev))
+        bmp280_delete();
+
+    // Clock out a slave that may be holding SDA low
+    esp_err_t err = sensor_hal_i2c_bus_reset(bmp280_bus);
+    if (err != ESP_OK)
+        return err;
+
+    err = bmp280_init(bmp280_bus, bmp280_address);
+    if (err != ESP_OK)
+        err = bmp280_init(bmp280_bus, bmp280_address == BMP280_ADDR ? BMP280_ADDR_ALT : BMP280_ADDR);
+    if (err != ESP_OK)
+        return err;
+
+    return bmp280_configure();
 }
 
-static void read_calibration_data()
+static esp_err_t read_register_bmp280(uint8_t reg_addr, uint8_t *data, size_t len)
 {
-    uint8_t reg_addr = 0x88;
-    uint8_t raw_data[24];
+    if (!sensor_hal_is_attached(&bmp280_dev))
+        return ESP_ERR_INVALID_STATE;
 
-    // Write register address 0x88, then read 24 bytes
-    write_register_bmp280(reg_addr, 0);
-    read_register_bmp280(reg_addr, raw_data, 24);
+    return sensor_hal_i2c_write_read_retry(&s_bus_stats, &bmp280_dev, &reg_addr, 1, data, len,
+                                           I2C_TRANSACTION_TIMEOUT_MS);
+}
 
+static void parse_calibration_data(const uint8_t *raw_data)
+{
     // Parse data (LSB first)
     cal_data.dig_T1 = (raw_data[1] << 8) | raw_data[0];
     cal_data.dig_T2 = (int16_t)((raw_data[3] << 8) | raw_data[2]);
@@ -102,28 +116,36 @@ static void read_calibration_data()
 static esp_err_t configure_ctrl_meas()
 {
     uint8_t ctrl_meas = (osrs_t << 5) | (osrs_p << 2) | mode;
-    return write_register_bmp280(REG_CTRL_MEAS, ctrl_meas);
+    return sensor_regmap_write(&s_regmap, REG_CTRL_MEAS, ctrl_meas);
 }
 
 static esp_err_t configure_config()
 {
     uint8_t config = (standby << 5) | (filter_value << 2) | spi;
-    return write_register_bmp280(REG_CONFIG, config);
+    return sensor_regmap_write(&s_regmap, REG_CONFIG, config);
 }
 
 esp_err_t bmp280_configure()
 {
-    read_calibration_data();
-    esp_err_t err = configure_ctrl_meas();
+    if (!sensor_hal_is_attached(&bmp280_dev))
+        return ESP_ERR_INVALID_STATE;
+
+    uint8_t raw_calib[24];
+    esp_err_t err = read_register_bmp280(BMP280_REG_CALIB, raw_calib, sizeof(raw_calib));
     if (err != ESP_OK)
     {
-        ESP_LOGE(TAG, "Failed to write ctrl_meas: %s", esp_err_to_name(err));
+        ESP_LOGE(TAG, "Failed to read calibration: %s", esp_err_to_name(err));
         return err;
     }
-    err = configure_config();
+    parse_calibration_data(raw_calib);
+
+    // Both registers go out as one pair write, or not at all if the device already has them
+    sensor_regmap_set(&s_regmap, REG_CTRL_MEAS, (osrs_t << 5) | (osrs_p << 2) | mode);
+    sensor_regmap_set(&s_regmap, REG_CONFIG, (standby << 5) | (filter_value << 2) | spi);
+    err = sensor_regmap_sync(&s_regmap);
     if (err != ESP_OK)
     {
-        ESP_LOGE(TAG, "Failed to write config: %s", esp_err_to_name(err));
+        ESP_LOGE(TAG, "Failed to write configuration: %s", esp_err_to_name(err));
         return err;
     }
     return ESP_OK;
@@ -168,21 +190,32 @@ esp_err_t bmp280_trigger_sleep_mode()
     return ESP_OK;
 }
 
-float bmp280_read_temp()
+static esp_err_t wait_for_measurement()
 {
-    uint8_t data[3];
-    esp_err_t err = read_register_bmp280(BMP280_TEMP_MSB, data, 3);
-
-    while (1)
+    // Forced measurement at x1 oversampling takes ~7 ms, give up well after that
+    for (int i = 0; i < 50; i++)
     {
         uint8_t status;
-        read_register_bmp280(BMP280_REG_STATUS, &status, 1);
+        esp_err_t err = read_register_bmp280(BMP280_REG_STATUS, &status, 1);
+        if (err != ESP_OK)
+            return err;
         if ((status & 0x08) == 0)
-        {          // Bit 3 is 'measuring'
-            break; // Measurement finished
+        {                  // Bit 3 is 'measuring'
+            return ESP_OK; // Measurement finished
         }
         vTaskDelay(2 / portTICK_PERIOD_MS); // Wait a bit
     }
+    return ESP_ERR_TIMEOUT;
+}
+
+float bmp280_read_temp()
+{
+    // Data registers only after the forced conversion is done, before that they hold the previous one
+    uint8_t data[3];
+    esp_err_t err = wait_for_measurement();
+
+    if (err == ESP_OK)
+        err = read_register_bmp280(BMP280_TEMP_MSB, data, 3);
 
     if (err != ESP_OK)
     {
@@ -190,7 +223,7 @@ float bmp280_read_temp()
         return -100.0f;
     }
     int32_t raw_temperature = (int32_t)((data[0] << 12) | (data[1] << 4) | (data[2] >> 4));
-    float temperature = convert_temperature(raw_temperature);
+    float temperature = bmp280_compensate_temperature(&cal_data, raw_temperature, &t_fine);
     // printf("Temperature: %.2f °C\n", temperature);
     // return ESP_OK;
     return temperature;
@@ -199,18 +232,10 @@ float bmp280_read_temp()
 float bmp280_read_pres()
 {
     uint8_t data[6];
-    esp_err_t err = read_register_bmp280(BMP280_PRES_MSB, data, 6);
+    esp_err_t err = wait_for_measurement();
 
-    while (1)
-    {
-        uint8_t status;
-        read_register_bmp280(BMP280_REG_STATUS, &status, 1);
-        if ((status & 0x08) == 0)
-        {          // Bit 3 is 'measuring'
-            break; // Measurement finished
-        }
-        vTaskDelay(2 / portTICK_PERIOD_MS); // Wait a bit
-    }
+    if (err == ESP_OK)
+        err = read_register_bmp280(BMP280_PRES_MSB, data, 6);
 
     if (err != ESP_OK)
     {
@@ -219,8 +244,8 @@ float bmp280_read_pres()
     }
     int32_t raw_pressure = (int32_t)((data[0] << 12) | (data[1] << 4) | (data[2] >> 4));
     int32_t raw_temp = (int32_t)((data[3] << 12) | (data[4] << 4) | (data[5] >> 4));
-    float temperature = convert_temperature(raw_temp);
-    float pressure = convert_pressure(raw_pressure);
+    float temperature = bmp280_compensate_temperature(&cal_data, raw_temp, &t_fine);
+    float pressure = bmp280_compensate_pressure(&cal_data, raw_pressure, t_fine);
     // printf("Pressure: %.2f hPa\n", pressure);
     // return ESP_OK;
     return pressure;
@@ -274,34 +299,3 @@ esp_err_t bmp280_change_standby_time(uint8_t time)
     }
     return ESP_OK;
 }
-
-static float convert_temperature(int32_t raw_temp)
-{
-    int32_t var1, var2;
-    var1 = ((((raw_temp >> 3) - ((int32_t)cal_data.dig_T1 << 1))) * ((int32_t)cal_data.dig_T2)) >> 11;
-    var2 = (((((raw_temp >> 4) - ((int32_t)cal_data.dig_T1)) * ((raw_temp >> 4) - ((int32_t)cal_data.dig_T1))) >> 12) * ((int32_t)cal_data.dig_T3)) >> 14;
-    t_fine = var1 + var2;
-    int32_t T = (t_fine * 5 + 128) >> 8;
-    return (float)T / 100.0;
-}
-
-static float convert_pressure(int32_t raw_pres)
-{
-    int64_t var1, var2, p;
-    var1 = ((int64_t)t_fine) - 128000;
-    var2 = var1 * var1 * (int64_t)cal_data.dig_P6;
-    var2 = var2 + ((var1 * (int64_t)cal_data.dig_P5) << 17);
-    var2 = var2 + ((int64_t)cal_data.dig_P4 << 35);
-    var1 = ((var1 * var1 * (int64_t)cal_data.dig_P3) >> 8) + ((var1 * (int64_t)cal_data.dig_P2) << 12);
-    var1 = (((((int64_t)1) << 47) + var1) * (int64_t)cal_data.dig_P1) >> 33;
-    if (var1 == 0)
-    {
-        return 0; // avoid exception caused by division by zero
-    }
-    p = 1048576 - raw_pres;
-    p = (((p << 31) - var2) * 3125) / var1;
-    var1 = (((int64_t)cal_data.dig_P9) * (p >> 13) * (p >> 13)) >> 25;
-    var2 = (((int64_t)cal_data.dig_P8) * p) >> 19;
-    p = ((p + var1 + var2) >> 8) + (((int64_t)cal_data.dig_P7) << 4);
-    return (float)p / 256.0 / 100.0;
-}
\ No newline at end of file
@@ -1,10 +1,12 @@
 #include <stdio.h>
-#include "driver/i2c_master.h"
-#include "driver/uart.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "sensor_hal.h"
+#include "sensor_kernels.h"
 #include "esp_log.h"
 
 #define BMP280_PORT I2C_NUM_0  /*!< I2C port number for BMP280 sensor */
-#define BMP280_SPEED_HZ 100000 /*!< I2C clock line frequency for BMP280 sensor */
+#define BMP280_MAX_SPEED_HZ 3400000 /*!< Fastest I2C clock of the BMP280 (high-speed mode) */
 #define BMP280_ADDR 0x77       /*!< Address of the BMP280 sensor */
 #define BMP280_ADDR_ALT 0x76   /*!< Alternate address of the BMP280 sensor */
 #define BMP280_TEMP_MSB 0xFA   /*!< Address of the most significant bit temperature register */
@@ -12,6 +14,7 @@
 #define REG_CONFIG 0xF5        /*!< Address of the configuration register */
 #define REG_CTRL_MEAS 0xF4     /*!< Address of the control measurement register */
 #define BMP280_REG_STATUS 0xF3 /*!< Address of the status register */
+#define BMP280_REG_CALIB 0x88  /*!< Address of the first calibration register */
 
 /**
  * @brief Initialize and configure the BMP280 device on I2C bus. Then add the deivce to the bus
@@ -21,15 +24,29 @@
  * @param speed The I2C clock line frequency of this device
  * @return **i2c_master_dev_handle_t**  - The device handle
  */
-esp_err_t bmp280_init(i2c_master_bus_handle_t bus_handle, uint8_t address);
+esp_err_t bmp280_init(sensor_hal_i2c_bus_t bus_handle, uint8_t address);
 /**
  * @brief Delete the BMP280 device from the I2C bus to release the underlying hardware (reccommended to remove all attached
  * devices before deleting the bus).
  *
- * @param dev_handle The device handle
  * @return **esp_err_t** - ESP_OK on success, error code otherwise
  */
-esp_err_t bmp280_delete(i2c_master_dev_handle_t dev_handle);
+esp_err_t bmp280_delete();
+
+/**
+ * @brief Check whether the BMP280 was found and added to the bus.
+ *
+ * @return **bool** - true if the device handle is valid
+ */
+bool bmp280_is_ready();
+
+/**
+ * @brief Bring the BMP280 back after a bus fault: remove the device, reset the bus
+ * (clears a stuck SDA line), add the device again and re-apply the configuration.
+ *
+ * @return **esp_err_t** - ESP_OK on success, error code otherwise
+ */
+esp_err_t bmp280_recover();
 
 /**
  * @brief Read calibration data and configure the BMP280 device with default settings:
@@ -1,6 +1,9 @@
 #include "hcsr04.h"
 #include "ble_server.h"
+#include "task_plan.h"
+#include "sensor_kernels.h"
 
+static sensor_hal_dev_t hcsr04_dev = SENSOR_HAL_DEV_INIT(SENSOR_HAL_DEV_HCSR04);
 static gpio_num_t s_buzzer_pin = GPIO_NUM_NC;
 static _Atomic bool s_park_enabled = false;
 static _Atomic uint32_t s_park_distance_cm = 150;
@@ -10,7 +13,6 @@ static int64_t s_next_buzzer_event_time = 0; // Time in microseconds
 
 static inline void buzzer_hw_on(void);
 static inline void buzzer_hw_off(void);
-static uint32_t buzzer_calc_delay_ms(uint32_t distance_cm);
 static void buzzer_update_tick(void);
 static void vTaskDelay_with_buzzer(uint32_t ms);
 
@@ -26,27 +28,6 @@ static inline void buzzer_hw_off(void)
         gpio_set_level(s_buzzer_pin, 0);
 }
 
-static uint32_t buzzer_calc_delay_ms(uint32_t distance_cm)
-{
-    if (distance_cm >= 200)
-        return 0;
-    if (distance_cm > 120)
-        return 800;
-    if (distance_cm > 90)
-        return 500;
-    if (distance_cm > 70)
-        return 400;
-    if (distance_cm > 50)
-        return 300;
-    if (distance_cm > 30)
-        return 200;
-    if (distance_cm > 20)
-        return 120;
-    if (distance_cm > 12)
-        return 60;
-    return 25;
-}
-
 static void buzzer_update_tick(void)
 {
     // 1. Check if Parking Mode is enabled
@@ -68,7 +49,7 @@ static void buzzer_update_tick(void)
     {
 
         uint32_t dist = atomic_load(&s_park_distance_cm);
-        uint32_t interval_ms = buzzer_calc_delay_ms(dist);
+        uint32_t interval_ms = buzzer_interval_ms(dist);
 
         if (interval_ms == 0)
         {
@@ -118,7 +99,7 @@ void hcsr04_task(void *arg)
     esp_err_t return_value2 = ESP_OK;
     esp_err_t return_value3 = ESP_OK;
 
-    UltrasonicInit();
+    sensor_hal_ultrasonic_init(&hcsr04_dev);
 
     static uint32_t distance1 = 0;
     static uint32_t distance2 = 0;
@@ -139,16 +120,16 @@ void hcsr04_task(void *arg)
             measurement_count = 0;
         }
 
-        return_value1 = UltrasonicMeasure(200, &distance1);
+        return_value1 = sensor_hal_ultrasonic_measure(&hcsr04_dev, 200, &distance1);
         // CRITICAL: Update buzzer immediately after measure (which blocks slightly)
         buzzer_update_tick();
         // Wait 40ms, but keep updating buzzer
         vTaskDelay_with_buzzer(30);
 
-        return_value2 = UltrasonicMeasure(200, &distance2);
+        return_value2 = sensor_hal_ultrasonic_measure(&hcsr04_dev, 200, &distance2);
         buzzer_update_tick();
         vTaskDelay_with_buzzer(30);
-        return_value3 = UltrasonicMeasure(200, &distance3);
+        return_value3 = sensor_hal_ultrasonic_measure(&hcsr04_dev, 200, &distance3);
         buzzer_update_tick();
         vTaskDelay_with_buzzer(30);
 
@@ -216,7 +197,7 @@ void hcsr04_task(void *arg)
 
 void hcsr04_start_task(float *parameter)
 {
-    xTaskCreate(hcsr04_task, "HSRC04_Buzzer", 8192, parameter, 10, NULL);
+    task_plan_create(TASK_ID_HCSR04, hcsr04_task, parameter, NULL);
 }
 
 void buzzer_init(gpio_num_t pin)
@@ -8,7 +8,7 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "esp_log.h"
-#include "hcsr04_driver.h"
+#include "sensor_hal.h"
 #include "esp_timer.h"
 #include "buzzer.h"
 #include "driver/gpio.h"
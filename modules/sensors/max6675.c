@@ -1,26 +1,42 @@
 #include "max6675.h"
 #include "project_config.h"
+#include "bus_stats.h"
 static const char *TAG = "MAX6675";
 
-spi_device_handle_t max6675_handle;
+static sensor_hal_dev_t max6675_dev = SENSOR_HAL_DEV_INIT(SENSOR_HAL_DEV_MAX6675);
+static bus_stats_t s_bus_stats = BUS_STATS_INIT("max6675");
 
 esp_err_t max6675_init()
 {
-    spi_device_interface_config_t devcfg = {
-        .clock_speed_hz = MAX6675_FREQ_HZ,
-        .mode = 0, // SPI Mode 0: CPOL=0, CPHA=0
-        .spics_io_num = CS_MAX6675_PIN,
-        .queue_size = 1,
-    };
-
-    ESP_ERROR_CHECK(spi_bus_add_device(SPI_HOST_USED, &devcfg, &max6675_handle));
+    esp_err_t err = sensor_hal_spi_attach(&max6675_dev, CS_MAX6675_PIN, MAX6675_FREQ_HZ);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to add device to SPI bus: %s", esp_err_to_name(err));
+        return err;
+    }
+    bus_stats_register(&s_bus_stats);
     ESP_LOGI(TAG, "device added to SPI bus");
     return ESP_OK;
 }
 
 esp_err_t max6675_delete()
 {
-    return spi_bus_remove_device(max6675_handle);
+    if (!sensor_hal_is_attached(&max6675_dev))
+        return ESP_ERR_INVALID_STATE;
+    return sensor_hal_spi_detach(&max6675_dev);
+}
+
+bool max6675_is_ready()
+{
+    return sensor_hal_is_attached(&max6675_dev);
+}
+
+esp_err_t max6675_recover()
+{
+    // SPI has no bus state to clear, re-adding the device resets the CS line and the driver queue
+    if (sensor_hal_is_attached(&max6675_dev))
+        max6675_delete();
+    return max6675_init();
 }
 
 static bool check_open_thermocouple(uint16_t value)
@@ -43,21 +59,21 @@ static float convert_raw_data(uint16_t value)
 
 float max6675_read_celsius()
 {
+    if (!sensor_hal_is_attached(&max6675_dev))
+        return -1.0f;
+
     uint8_t raw_data[2] = {0};
 
-    spi_transaction_t t = {
-        .flags = SPI_TRANS_USE_RXDATA,
-        .length = 16, // Read 16 bits
-        .rxlength = 16};
+    esp_err_t err = sensor_hal_spi_read_retry(&s_bus_stats, &max6675_dev, raw_data, sizeof(raw_data)); // Read 16 bits
 
-    if (spi_device_transmit(max6675_handle, &t) != ESP_OK)
+    if (err != ESP_OK)
     {
         return -1.0f;
     }
 
     // Combine bytes (Big Endian)
-    // `t.rx_data` contains the received bytes (big-endian): first byte = high 8 bits
-    uint16_t value = (t.rx_data[0] << 8) | t.rx_data[1];
+    // `raw_data` contains the received bytes (big-endian): first byte = high 8 bits
+    uint16_t value = (raw_data[0] << 8) | raw_data[1];
 
     if (check_open_thermocouple(value))
     {
@@ -1,6 +1,5 @@
 #include <string.h>
-#include "driver/spi_master.h"
-#include "driver/gpio.h"
+#include "sensor_hal.h"
 #include "esp_err.h"
 #include "esp_log.h"
 
@@ -22,6 +21,18 @@ esp_err_t max6675_init();
  * @return esp_err_t ESP_OK on success
  */
 esp_err_t max6675_delete();
+
+/**
+ * @brief Check whether the MAX6675 was added to the SPI bus.
+ */
+bool max6675_is_ready();
+
+/**
+ * @brief Re-add the MAX6675 to the SPI bus after repeated read failures.
+ *
+ * @return esp_err_t ESP_OK on success
+ */
+esp_err_t max6675_recover();
 /**
  * @brief Check if thermocouple is open.
  * The third least-significant bit (bit 2) indicates an open thermocouple.
@@ -1,23 +1,34 @@
 /* veml7700.c */
 #include "veml7700.h"
+#include "project_config.h"
+#include "bus_stats.h"
 
 static const char *TAG = "VEML7700";
 
-static i2c_master_dev_handle_t veml7700_handle;
+static sensor_hal_i2c_bus_t veml7700_bus;
+static sensor_hal_dev_t veml7700_dev = SENSOR_HAL_DEV_INIT(SENSOR_HAL_DEV_VEML7700);
+static bus_stats_t s_bus_stats = BUS_STATS_INIT("veml7700");
 
 static esp_err_t write_reg(uint8_t reg, uint16_t val)
 {
+    if (!sensor_hal_is_attached(&veml7700_dev))
+        return ESP_ERR_INVALID_STATE;
+
     uint8_t data[3];
     data[0] = reg;
     data[1] = (uint8_t)(val & 0xFF);        // LSB
     data[2] = (uint8_t)((val >> 8) & 0xFF); // MSB
-    return i2c_master_transmit(veml7700_handle, data, sizeof(data), 1000);
+    return sensor_hal_i2c_write_retry(&s_bus_stats, &veml7700_dev, data, sizeof(data), I2C_TRANSACTION_TIMEOUT_MS);
 }
 
 static esp_err_t read_reg(uint8_t reg, uint16_t *val)
 {
+    if (!sensor_hal_is_attached(&veml7700_dev))
+        return ESP_ERR_INVALID_STATE;
+
     uint8_t raw[2];
-    esp_err_t ret = i2c_master_transmit_receive(veml7700_handle, &reg, 1, raw, 2, 1000);
+    esp_err_t ret = sensor_hal_i2c_write_read_retry(&s_bus_stats, &veml7700_dev, &reg, 1, raw, 2,
+                                                    I2C_TRANSACTION_TIMEOUT_MS);
     if (ret == ESP_OK)
     {
         *val = (uint16_t)raw[0] | ((uint16_t)raw[1] << 8);
@@ -25,49 +36,66 @@ static esp_err_t read_reg(uint8_t reg, uint16_t *val)
     return ret;
 }
 
-esp_err_t veml7700_init(i2c_master_bus_handle_t bus_handle)
+esp_err_t veml7700_init(sensor_hal_i2c_bus_t bus_handle)
 {
-    i2c_device_config_t dev_config = {
-        .dev_addr_length = I2C_ADDR_BIT_LEN_7,
-        .device_address = VEML7700_ADDR,
-        .scl_speed_hz = VEML7700_SPEED_HZ,
-    };
+    veml7700_bus = bus_handle;
 
-    ESP_ERROR_CHECK(i2c_master_bus_add_device(bus_handle, &dev_config, &veml7700_handle));
+    esp_err_t err = sensor_hal_i2c_attach(&veml7700_dev, bus_handle, VEML7700_ADDR, VEML7700_MAX_SPEED_HZ);
+    if (err != ESP_OK)
+    {
+        ESP_LOGW(TAG, "No VEML7700 answering at 0x%02X: %s", VEML7700_ADDR, esp_err_to_name(err));
+        return err;
+    }
+    bus_stats_register(&s_bus_stats);
     ESP_LOGI(TAG, "VEML7700 initialized on I2C address 0x%02X", VEML7700_ADDR);
     return ESP_OK;
 }
 
 esp_err_t veml7700_delete()
 {
-    return i2c_master_bus_rm_device(veml7700_handle);
+    if (!sensor_hal_is_attached(&veml7700_dev))
+        return ESP_ERR_INVALID_STATE;
+    return sensor_hal_i2c_detach(&veml7700_dev);
 }
 
-void veml7700_wake_up()
+bool veml7700_is_ready()
+{
+    return sensor_hal_is_attached(&veml7700_dev);
+}
+
+esp_err_t veml7700_wake_up()
 {
     // Command 0x00 (ALS_CONF)
     // Data LSB: 0x00
     // Data MSB: 0x00
-    uint8_t write_buf[3] = {0x00, 0x00, 0x00};
-
-    ESP_ERROR_CHECK(i2c_master_transmit(veml7700_handle, write_buf, sizeof(write_buf), -1));
+    esp_err_t err = write_reg(CMD_ALS_CONF, 0x0000);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to power on sensor: %s", esp_err_to_name(err));
+        return err;
+    }
 
     ESP_LOGI("VEML7700", "Sensor powered ON.");
+    return ESP_OK;
 }
 
-static float convert_raw_data(uint16_t raw_counts)
+esp_err_t veml7700_recover()
 {
-    float lux = raw_counts * LUX_RESOLUTION;
+    if (veml7700_bus == NULL)
+        return ESP_ERR_INVALID_STATE;
 
-    if (lux > 1000.0f)
-    {
-        lux = (COEF_A * powf(lux, 4)) +
-              (COEF_B * powf(lux, 3)) +
-              (COEF_C * powf(lux, 2)) +
-              (COEF_D * lux);
-    }
+    if (sensor_hal_is_attached(&veml7700_dev))
+        veml7700_delete();
+
+    esp_err_t err = sensor_hal_i2c_bus_reset(veml7700_bus);
+    if (err != ESP_OK)
+        return err;
 
-    return lux;
+    err = veml7700_init(veml7700_bus);
+    if (err != ESP_OK)
+        return err;
+
+    return veml7700_wake_up();
 }
 
 float veml7700_read_lux()
@@ -78,7 +106,5 @@ float veml7700_read_lux()
     if (ret != ESP_OK)
         return -1.0f;
 
-    float lux = raw_counts * LUX_RESOLUTION;
-
-    return convert_raw_data(raw_counts);
+    return veml7700_counts_to_lux(raw_counts);
 }
\ No newline at end of file
@@ -1,10 +1,11 @@
 #include <esp_err.h>
 #include <math.h>
-#include "driver/i2c_master.h"
+#include "sensor_hal.h"
+#include "sensor_kernels.h"
 #include "esp_log.h"
 
 #define VEML7700_PORT I2C_NUM_1 /*!< I2C port number for VEML7700 sensor */
-#define VEML7700_SPEED_HZ 100000
+#define VEML7700_MAX_SPEED_HZ 400000 // Fastest I2C clock of the device
 #define VEML7700_ADDR 0x10 // Fixed I2C address for VEML7700
 #define CMD_ALS_CONF 0x00  // Configuration Register
 #define CMD_ALS_DATA 0x04  // Ambient Light Data
@@ -13,12 +14,6 @@
 #define CONF_IT_100MS (0x00 << 6)  // Bits 6:9
 #define CONF_SHUTDOWN (0x01)       // Bit 0
 
-#define LUX_RESOLUTION 0.576f
-
-#define COEF_A 6.0135e-13
-#define COEF_B -9.3924e-9
-#define COEF_C 8.1488e-5
-#define COEF_D 1.0023
 
 /**
  * @brief Initialize and add VEML7700 device to I2C bus.
@@ -26,7 +21,7 @@
  * @param bus_handle I2C master bus handle
  * @return esp_err_t ESP_OK on success
  */
-esp_err_t veml7700_init(i2c_master_bus_handle_t bus_handle);
+esp_err_t veml7700_init(sensor_hal_i2c_bus_t bus_handle);
 
 /**
  * @brief Delete the VEML7700 device from the I2C bus to release the underlying hardware.
@@ -36,7 +31,25 @@ esp_err_t veml7700_init(i2c_master_bus_handle_t bus_handle);
  */
 esp_err_t veml7700_delete();
 
-void veml7700_wake_up();
+/**
+ * @brief Check whether the VEML7700 was found and added to the bus.
+ */
+bool veml7700_is_ready();
+
+/**
+ * @brief Power on the sensor (clear the ALS_CONF shutdown bit).
+ *
+ * @return esp_err_t ESP_OK on success
+ */
+esp_err_t veml7700_wake_up();
+
+/**
+ * @brief Bring the sensor back after a bus fault: remove the device, reset the bus,
+ * add the device again and power it on.
+ *
+ * @return esp_err_t ESP_OK on success
+ */
+esp_err_t veml7700_recover();
 
 /**
  * @brief Reads the Ambient Light in Lux.
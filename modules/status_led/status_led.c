@@ -6,6 +6,7 @@
 #include "freertos/task.h"
 #include "driver/gpio.h"
 #include "esp_log.h"
+#include "task_plan.h"
 
 static const char *TAG_LED = "status_led";
 
@@ -31,5 +32,5 @@ static void led_status_task(void* arg)
 // towrzenie nowego watku 
 void status_led_start_task(void)
 {
-    xTaskCreate(led_status_task, "led_status_task", 2048, NULL, 5, NULL);
+    task_plan_create(TASK_ID_STATUS_LED, led_status_task, NULL, NULL);
 }
\ No newline at end of file
@@ -0,0 +1,140 @@
+#include "storage_bench.h"
+#include "storage_manager.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+/*
+ * Latencies go to a log-linear histogram instead of an array, a run of any length costs 1 KB:
+ * exact below 16 us, then 8 buckets per power of two (12.5 % resolution). Percentiles report
+ * the upper edge of their bucket.
+ */
+#define HIST_LINEAR  16
+#define HIST_SUB     8
+#define HIST_BUCKETS (HIST_LINEAR + HIST_SUB * 28)
+
+static uint32_t s_hist[HIST_BUCKETS];
+
+static uint32_t bucket_of(uint32_t us)
+{
+    if (us < HIST_LINEAR)
+        return us;
+    uint32_t msb = 31 - __builtin_clz(us); // >= 4
+    uint32_t b = HIST_LINEAR + (msb - 4) * HIST_SUB + ((us >> (msb - 3)) & (HIST_SUB - 1));
+    return b < HIST_BUCKETS ? b : HIST_BUCKETS - 1;
+}
+
+static uint32_t bucket_top(uint32_t b)
+{
+    if (b < HIST_LINEAR)
+        return b;
+    uint32_t msb = (b - HIST_LINEAR) / HIST_SUB + 4;
+    uint32_t sub = (b - HIST_LINEAR) % HIST_SUB;
+    return ((HIST_SUB + sub + 1) << (msb - 3)) - 1;
+}
+
+static uint32_t percentile(uint32_t total, double p)
+{
+    uint32_t rank = (uint32_t)(total * p);
+    uint32_t seen = 0;
+    for (uint32_t b = 0; b < HIST_BUCKETS; b++)
+    {
+        seen += s_hist[b];
+        if (seen > rank)
+            return bucket_top(b);
+    }
+    return 0;
+}
+
+// "BENCH;<ts>;" followed by digits up to size characters
+static void make_line(char *line, uint32_t size, uint32_t n)
+{
+    int len = snprintf(line, size + 1, "BENCH;%lu;", (unsigned long)time(NULL));
+    for (uint32_t i = len; i < size; i++)
+        line[i] = '0' + (n + i) % 10;
+    line[size] = '\0';
+}
+
+bool storage_bench_run(const storage_bench_config_t *config, storage_bench_result_t *result)
+{
+    if (config->records == 0 || config->record_size < STORAGE_BENCH_MIN_RECORD ||
+        config->record_size > STORAGE_BENCH_MAX_RECORD)
+        return false;
+
+    memset(result, 0, sizeof(*result));
+    memset(s_hist, 0, sizeof(s_hist));
+    result->config = *config;
+    char line[STORAGE_BENCH_MAX_RECORD + 1];
+    storage_stats_t before, after;
+    storage_sync(); // nothing of earlier callers in the queue
+    storage_get_stats(&before);
+
+    int64_t start = esp_timer_get_time();
+    for (uint32_t n = 0; n < config->records; n++)
+    {
+        if (config->rate_hz > 0)
+        {
+            // Paced against the start, a late line does not push the ones after it
+            int64_t due = start + (int64_t)n * 1000000 / config->rate_hz;
+            int64_t ahead_ms = (due - esp_timer_get_time()) / 1000;
+            if (ahead_ms > 0)
+                vTaskDelay(pdMS_TO_TICKS(ahead_ms) > 0 ? pdMS_TO_TICKS(ahead_ms) : 1);
+        }
+        make_line(line, config->record_size, n);
+
+        int64_t t0 = esp_timer_get_time();
+        bool ok = storage_write_line(line);
+        uint32_t us = (uint32_t)(esp_timer_get_time() - t0);
+        s_hist[bucket_of(us)]++;
+        if (us > result->max_us)
+            result->max_us = us;
+        if (ok)
+        {
+            result->appended++;
+            result->bytes += config->record_size + 1;
+        }
+        else
+        {
+            result->rejected++;
+        }
+
+        if (config->sync_every > 0 && (n + 1) % config->sync_every == 0)
+        {
+            t0 = esp_timer_get_time();
+            storage_sync();
+            us = (uint32_t)(esp_timer_get_time() - t0);
+            result->syncs++;
+            if (us > result->sync_max_us)
+                result->sync_max_us = us;
+        }
+    }
+    storage_sync();
+    result->elapsed_us = (uint32_t)(esp_timer_get_time() - start);
+
+    storage_get_stats(&after);
+    result->blocks = after.blocks - before.blocks;
+    result->write_errors = after.write_errors - before.write_errors;
+    result->p50_us = percentile(config->records, 0.50);
+    result->p99_us = percentile(config->records, 0.99);
+    return true;
+}
+
+void storage_bench_print(const storage_bench_result_t *results, size_t count)
+{
+    printf("%8s %5s %6s %5s %9s %10s %10s %7s %7s %8s %9s %7s\n", "records", "size", "rate", "sync", "rejected",
+           "rec/s", "B/s", "p50 us", "p99 us", "max us", "sync max", "blocks");
+    for (size_t i = 0; i < count; i++)
+    {
+        const storage_bench_result_t *r = &results[i];
+        printf("%8lu %5lu %6lu %5lu %9lu %10.0f %10.0f %7lu %7lu %8lu %9lu %7lu%s\n",
+               (unsigned long)r->config.records, (unsigned long)r->config.record_size,
+               (unsigned long)r->config.rate_hz, (unsigned long)r->config.sync_every, (unsigned long)r->rejected,
+               storage_bench_rate(r), r->elapsed_us ? r->bytes * 1e6 / r->elapsed_us : 0.0,
+               (unsigned long)r->p50_us, (unsigned long)r->p99_us, (unsigned long)r->max_us,
+               (unsigned long)r->sync_max_us, (unsigned long)r->blocks, r->write_errors ? "  write errors" : "");
+    }
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "project_config.h"
+
+/*
+ * Throughput and latency of the storage path: storage_write_line driven with synthetic lines
+ * "BENCH;<ts>;<digits>" of a fixed length. The lines go into the log like any other (sensor
+ * "BENCH", the shared last bit of the segment masks), run it on a card that may take them.
+ */
+
+typedef struct
+{
+    uint32_t records;     /*!< lines to append */
+    uint32_t record_size; /*!< characters per line without the '\n', 16..STORAGE_BENCH_MAX_RECORD */
+    uint32_t rate_hz;     /*!< 0 = as fast as the queue takes them */
+    uint32_t sync_every;  /*!< storage_sync after this many lines, 0 = only the writer's own flushes */
+} storage_bench_config_t;
+
+#define STORAGE_BENCH_MIN_RECORD 16
+#define STORAGE_BENCH_MAX_RECORD (STORAGE_READER_BUF_SIZE - 13) // frame header and '\n'
+
+typedef struct
+{
+    storage_bench_config_t config;
+    uint32_t appended;   /*!< lines the queue took */
+    uint32_t rejected;   /*!< queue full or no space, not retried */
+    uint64_t bytes;      /*!< of the appended lines */
+    uint32_t elapsed_us; /*!< first append to the end of the final storage_sync */
+    uint32_t p50_us;     /*!< storage_write_line latency */
+    uint32_t p99_us;
+    uint32_t max_us;
+    uint32_t syncs;
+    uint32_t sync_max_us;
+    uint32_t blocks;       /*!< block writes of the writer task during the run */
+    uint32_t write_errors;
+} storage_bench_result_t;
+
+/**
+ * @brief Run one benchmark, storage_init must have been called.
+ *
+ * The elapsed time ends with a storage_sync, records/s and bytes/s count data on the card.
+ *
+ * @return **bool** - false if the configuration is out of range
+ */
+bool storage_bench_run(const storage_bench_config_t *config, storage_bench_result_t *result);
+
+/**
+ * @brief records/s of a result
+ */
+static inline double storage_bench_rate(const storage_bench_result_t *result)
+{
+    return result->elapsed_us ? result->appended * 1e6 / result->elapsed_us : 0.0;
+}
+
+/**
+ * @brief Print a table of results, one line each.
+ */
+void storage_bench_print(const storage_bench_result_t *results, size_t count);
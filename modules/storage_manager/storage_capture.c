@@ -0,0 +1,385 @@
+#include "storage_priv.h"
+#include <dirent.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#if CONFIG_IDF_TARGET_LINUX
+#include <fcntl.h>
+#else
+#include "esp_heap_caps.h"
+#include "ff.h"
+#endif
+
+static const char *TAG = "STORAGE_CAP";
+
+/*
+ * Capture sessions: a burst of samples goes to its own file instead of the log. The file is
+ * allocated in one contiguous run when the session opens (f_expand), so FAT never looks for a
+ * free cluster while samples come in; samples collect in a block of whole sectors that FatFs
+ * writes straight to the card, without its sector window. The first sector holds the header,
+ * written once at open (data_bytes = 0: unfinished) and again at finish, when the file is cut
+ * down to what was captured. Samples past the planned size are counted as dropped.
+ *
+ * The samples are written by the task that adds them, next to the writer task: FatFs locks the
+ * volume for one block write, the file lock of the log is not taken. Finished captures count
+ * against the card like the log: retention deletes the oldest of them before unsent segments,
+ * storage_clear_all all of them; open sessions (listed under the file lock) stay.
+ */
+
+_Static_assert(sizeof(storage_capture_header_t) <= STORAGE_CAPTURE_HEADER_SIZE, "the header fits one sector");
+_Static_assert(STORAGE_CAPTURE_BLOCK % STORAGE_CAPTURE_HEADER_SIZE == 0, "blocks of whole sectors");
+
+struct storage_capture
+{
+#if CONFIG_IDF_TARGET_LINUX
+    FILE *f;
+#else
+    FIL f;
+#endif
+    storage_capture_header_t header;
+    storage_capture_info_t info;
+    uint8_t *block;
+    size_t block_len;
+    size_t capacity; // data bytes preallocated
+    int64_t start_us;
+    struct storage_capture *next; // open sessions
+};
+
+static storage_capture_t *s_open;
+
+static void untrack(storage_capture_t *c)
+{
+    storage_lock();
+    for (storage_capture_t **p = &s_open; *p != NULL; p = &(*p)->next)
+    {
+        if (*p == c)
+        {
+            *p = c->next;
+            break;
+        }
+    }
+    storage_unlock();
+}
+
+#if CONFIG_IDF_TARGET_LINUX
+
+#define CAPTURE_PATH(name) MOUNT_POINT "/" STORAGE_CAPTURE_DIR "/" name
+
+static bool file_create(storage_capture_t *c, const char *name, size_t size)
+{
+    char path[64];
+    snprintf(path, sizeof(path), CAPTURE_PATH("%s"), name);
+    c->f = fopen(path, "w+b");
+    if (c->f == NULL)
+        return false;
+    if (posix_fallocate(fileno(c->f), 0, size) != 0)
+    {
+        fclose(c->f);
+        unlink(path);
+        return false;
+    }
+    return true;
+}
+
+static bool file_write(storage_capture_t *c, size_t offset, const void *data, size_t len)
+{
+    return fseek(c->f, offset, SEEK_SET) == 0 && fwrite(data, 1, len, c->f) == len;
+}
+
+static bool file_finish(storage_capture_t *c, size_t size)
+{
+    bool ok = fflush(c->f) == 0 && ftruncate(fileno(c->f), size) == 0;
+    return fclose(c->f) == 0 && ok;
+}
+
+static void *block_alloc(void)
+{
+    return malloc(STORAGE_CAPTURE_BLOCK);
+}
+
+#else
+
+// FatFs path of the file on the card (drive 0 is the card mounted at MOUNT_POINT)
+#define CAPTURE_PATH(name) "0:/" STORAGE_CAPTURE_DIR "/" name
+
+static bool file_create(storage_capture_t *c, const char *name, size_t size)
+{
+    char path[32];
+    snprintf(path, sizeof(path), CAPTURE_PATH("%s"), name);
+    FRESULT res = f_open(&c->f, path, FA_CREATE_ALWAYS | FA_READ | FA_WRITE);
+    if (res != FR_OK)
+        return false;
+    // One contiguous run of clusters, allocated now; the directory entry gets the size right away
+    res = f_expand(&c->f, size, 1);
+    if (res == FR_OK)
+        res = f_sync(&c->f);
+    if (res != FR_OK)
+    {
+        ESP_LOGE(TAG, "No contiguous %u bytes on the card (%d)", (unsigned)size, res);
+        f_close(&c->f);
+        f_unlink(path);
+        return false;
+    }
+    return true;
+}
+
+static bool file_write(storage_capture_t *c, size_t offset, const void *data, size_t len)
+{
+    // Blocks follow each other, only the header needs a seek (it follows the cluster chain)
+    UINT written;
+    if (f_tell(&c->f) != offset && f_lseek(&c->f, offset) != FR_OK)
+        return false;
+    return f_write(&c->f, data, len, &written) == FR_OK && written == len;
+}
+
+static bool file_finish(storage_capture_t *c, size_t size)
+{
+    bool ok = f_lseek(&c->f, size) == FR_OK && f_truncate(&c->f) == FR_OK;
+    return f_close(&c->f) == FR_OK && ok;
+}
+
+// DMA capable, the SPI driver sends the block without a bounce buffer
+static void *block_alloc(void)
+{
+    return heap_caps_malloc(STORAGE_CAPTURE_BLOCK, MALLOC_CAP_DMA);
+}
+
+#endif
+
+storage_capture_t *storage_capture_open(const char *name, const storage_capture_channel_t *channels, size_t count,
+                                        uint32_t duration_ms)
+{
+    if (count == 0 || count > STORAGE_CAPTURE_MAX_CHANNELS || !storage_card_in_use())
+        return NULL;
+
+    // Planned samples of every channel, rounded up to whole blocks
+    double samples = 0;
+    for (size_t i = 0; i < count; i++)
+        samples += channels[i].rate_hz * duration_ms / 1000.0;
+    size_t capacity = ((size_t)samples * sizeof(storage_capture_sample_t) + STORAGE_CAPTURE_BLOCK - 1) /
+                      STORAGE_CAPTURE_BLOCK * STORAGE_CAPTURE_BLOCK;
+    if (capacity == 0)
+        capacity = STORAGE_CAPTURE_BLOCK;
+    size_t size = STORAGE_CAPTURE_HEADER_SIZE + capacity;
+    if (storage_free_bytes < size + STORAGE_RETENTION_MIN_FREE_BYTES)
+    {
+        ESP_LOGW(TAG, "Not enough space for a %u byte capture", (unsigned)size);
+        return NULL;
+    }
+
+    storage_capture_t *c = calloc(1, sizeof(*c));
+    if (c != NULL)
+        c->block = block_alloc();
+    if (c == NULL || c->block == NULL)
+    {
+        if (c != NULL)
+            free(c);
+        return NULL;
+    }
+
+    c->header = (storage_capture_header_t){
+        .magic = STORAGE_CAPTURE_MAGIC,
+        .version = 1,
+        .channels = count,
+        .start_ts = (uint32_t)time(NULL),
+        .data_offset = STORAGE_CAPTURE_HEADER_SIZE,
+    };
+    strncpy(c->header.name, name, sizeof(c->header.name) - 1);
+    for (size_t i = 0; i < count; i++)
+    {
+        strncpy(c->header.channel[i].name, channels[i].name, sizeof(c->header.channel[i].name) - 1);
+        c->header.channel[i].rate_hz = channels[i].rate_hz;
+    }
+    c->capacity = capacity;
+
+    // Named after the start time (8.3 names), a second session within the same second takes the next one
+    // Listed before the file exists, retention never takes it
+    mkdir(MOUNT_POINT "/" STORAGE_CAPTURE_DIR, 0755);
+    struct stat st;
+    char path[48];
+    for (uint32_t n = c->header.start_ts;; n++)
+    {
+        snprintf(c->info.file, sizeof(c->info.file), "%08lX.cap", (unsigned long)n);
+        snprintf(path, sizeof(path), MOUNT_POINT "/" STORAGE_CAPTURE_DIR "/%s", c->info.file);
+        if (stat(path, &st) != 0)
+            break;
+    }
+    storage_lock();
+    c->next = s_open;
+    s_open = c;
+    storage_unlock();
+    memset(c->block, 0, STORAGE_CAPTURE_HEADER_SIZE);
+    memcpy(c->block, &c->header, sizeof(c->header));
+    if (!file_create(c, c->info.file, size))
+    {
+        ESP_LOGE(TAG, "Cannot create capture %s", c->info.file);
+        untrack(c);
+        free(c->block);
+        free(c);
+        return NULL;
+    }
+    if (!file_write(c, 0, c->block, STORAGE_CAPTURE_HEADER_SIZE))
+        c->info.error = true;
+    storage_free_bytes -= size;
+    c->start_us = esp_timer_get_time();
+    ESP_LOGI(TAG, "Capture %s (%s): %u channels, %u bytes for %lu ms", c->info.file, name, (unsigned)count,
+             (unsigned)size, (unsigned long)duration_ms);
+    return c;
+}
+
+static void write_block(storage_capture_t *c, size_t len)
+{
+    int64_t start = esp_timer_get_time();
+    if (!c->info.error && !file_write(c, STORAGE_CAPTURE_HEADER_SIZE + c->info.bytes, c->block, len))
+    {
+        ESP_LOGE(TAG, "Failed to write capture %s", c->info.file);
+        c->info.error = true;
+    }
+    uint32_t elapsed = (uint32_t)(esp_timer_get_time() - start);
+    if (elapsed > c->info.max_write_us)
+        c->info.max_write_us = elapsed;
+    c->info.blocks++;
+    c->info.bytes += len;
+}
+
+bool storage_capture_add(storage_capture_t *c, uint32_t channel, float value)
+{
+    if (channel >= c->header.channels || c->info.bytes + c->block_len + sizeof(storage_capture_sample_t) > c->capacity)
+    {
+        c->info.dropped++;
+        return false;
+    }
+    storage_capture_sample_t sample = {
+        .t_us = (uint32_t)(esp_timer_get_time() - c->start_us),
+        .channel = channel,
+        .value = value,
+    };
+    // Samples run across block boundaries, the file is one stream
+    const uint8_t *src = (const uint8_t *)&sample;
+    size_t left = sizeof(sample);
+    while (left > 0)
+    {
+        size_t n = STORAGE_CAPTURE_BLOCK - c->block_len;
+        if (n > left)
+            n = left;
+        memcpy(c->block + c->block_len, src, n);
+        c->block_len += n;
+        src += n;
+        left -= n;
+        if (c->block_len == STORAGE_CAPTURE_BLOCK)
+        {
+            write_block(c, STORAGE_CAPTURE_BLOCK);
+            c->block_len = 0;
+        }
+    }
+    c->header.channel[channel].samples++;
+    c->header.samples++;
+    c->header.duration_us = sample.t_us;
+    c->info.samples++;
+    return true;
+}
+
+bool storage_capture_finish(storage_capture_t *c, storage_capture_info_t *info)
+{
+    // The last block padded to whole sectors, data_bytes tells where the samples end
+    size_t data = c->info.bytes + c->block_len;
+    if (c->block_len > 0)
+    {
+        size_t padded = (c->block_len + STORAGE_CAPTURE_HEADER_SIZE - 1) / STORAGE_CAPTURE_HEADER_SIZE *
+                        STORAGE_CAPTURE_HEADER_SIZE;
+        memset(c->block + c->block_len, 0, padded - c->block_len);
+        write_block(c, padded);
+    }
+    c->header.dropped = c->info.dropped;
+    c->header.data_bytes = data;
+    memset(c->block, 0, STORAGE_CAPTURE_HEADER_SIZE);
+    memcpy(c->block, &c->header, sizeof(c->header));
+    if (!c->info.error && !file_write(c, 0, c->block, STORAGE_CAPTURE_HEADER_SIZE))
+        c->info.error = true;
+    size_t size = STORAGE_CAPTURE_HEADER_SIZE + c->info.bytes;
+    if (!file_finish(c, size))
+        c->info.error = true;
+    storage_free_bytes += c->capacity - c->info.bytes;
+    untrack(c);
+
+    ESP_LOGI(TAG, "Capture %s: %lu samples, %lu dropped, %lu blocks, slowest write %lu us%s", c->info.file,
+             (unsigned long)c->info.samples, (unsigned long)c->info.dropped, (unsigned long)c->info.blocks,
+             (unsigned long)c->info.max_write_us, c->info.error ? ", write errors" : "");
+    bool ok = !c->info.error;
+    if (info != NULL)
+        *info = c->info;
+    free(c->block);
+    free(c);
+    return ok;
+}
+
+static bool is_open(const char *file)
+{
+    for (const storage_capture_t *c = s_open; c != NULL; c = c->next)
+    {
+        if (strcmp(c->info.file, file) == 0)
+            return true;
+    }
+    return false;
+}
+
+// Delete one finished capture (oldest = smallest name) or all of them, returns the files deleted
+static size_t delete_captures(bool all)
+{
+    DIR *dir = opendir(MOUNT_POINT "/" STORAGE_CAPTURE_DIR);
+    if (dir == NULL)
+        return 0;
+    char oldest[16] = "";
+    size_t deleted = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        const char *dot = strrchr(entry->d_name, '.');
+        if (dot == NULL || strcasecmp(dot, ".cap") != 0 || strlen(entry->d_name) >= sizeof(oldest) ||
+            is_open(entry->d_name))
+            continue;
+        if (!all)
+        {
+            if (oldest[0] == '\0' || strcasecmp(entry->d_name, oldest) < 0)
+                strcpy(oldest, entry->d_name);
+            continue;
+        }
+        char path[48];
+        snprintf(path, sizeof(path), MOUNT_POINT "/" STORAGE_CAPTURE_DIR "/%s", entry->d_name);
+        deleted += unlink(path) == 0;
+    }
+    closedir(dir);
+
+    if (oldest[0] != '\0')
+    {
+        char path[48];
+        struct stat st;
+        snprintf(path, sizeof(path), MOUNT_POINT "/" STORAGE_CAPTURE_DIR "/%s", oldest);
+        if (stat(path, &st) == 0 && unlink(path) == 0)
+        {
+            storage_free_bytes += st.st_size; // approximation until the next scan, like the segments
+            ESP_LOGW(TAG, "Retention deletes capture %s (%ld bytes)", oldest, (long)st.st_size);
+            deleted++;
+        }
+    }
+    return deleted;
+}
+
+bool storage_capture_delete_oldest(void)
+{
+    return delete_captures(false) > 0;
+}
+
+void storage_capture_delete_all(void)
+{
+    size_t deleted = delete_captures(true);
+    if (deleted > 0)
+        ESP_LOGI(TAG, "%u captures deleted", (unsigned)deleted);
+}
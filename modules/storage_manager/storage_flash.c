@@ -0,0 +1,455 @@
+#include "storage_priv.h"
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_rom_crc.h"
+
+static const char *TAG = "STORAGE_FL";
+
+/*
+ * Fallback tier while no card is mounted: a circular log written straight to the sectors of the
+ * "storage" partition, no file system in between. Every sector starts with a storage_ring_sector_t
+ * and holds whole framed records; the writer fills the sectors in partition order and wraps around,
+ * so every sector is erased once per lap whatever the traffic (wear spreading). The sector sequence
+ * numbers give the write order after a reset: the newest valid sector is the head, its records up
+ * to the first erased byte are the write position.
+ *
+ * With a card back, the idle writer moves one sector per step to the head segment (straight from
+ * the mapped partition unless the records need renumbering) and clears its "moved" word - NOR
+ * flash turns bits to 0 without an erase. New blocks keep going to flash until nothing is left
+ * there, so the card gets the records in write order. Sectors published from flash
+ * (storage_flash_next_unsent) only feed the rollups on the way. When the sector after the head
+ * still waits for the card, the log is full and new blocks are dropped.
+ */
+#define RING_SECTOR_SIZE 4096 // erase unit of the SPI flash
+#define RING_DATA_SIZE   (RING_SECTOR_SIZE - sizeof(storage_ring_sector_t))
+#define RING_WORD_CLEAR  0xFFFFFFFFu // erased flash
+
+_Static_assert(STORAGE_READER_BUF_SIZE <= RING_DATA_SIZE, "a record has to fit one sector");
+
+typedef struct
+{
+    uint32_t seq;  // 0 = erased or damaged header
+    uint32_t erases;
+    uint16_t used; // bytes of whole records
+    bool moved;
+    bool uploaded;
+} ring_sector_t;
+
+static const esp_partition_t *s_part;
+static const char *s_map; // whole partition, NULL if it could not be mapped
+static esp_partition_mmap_handle_t s_map_handle;
+static ring_sector_t *s_sectors;
+static uint32_t s_count;
+static uint32_t s_head;     // sector being written
+static uint32_t s_head_off; // next record in it, RING_SECTOR_SIZE = sealed
+static uint32_t s_seq;      // sequence number of the head
+static size_t s_pending;    // record bytes not moved yet
+static uint32_t s_last_seq; // newest record in the log
+static uint32_t s_max_erases;
+static uint32_t s_shift;    // added to the sequence numbers up to s_shift_to on the way to the card
+static uint32_t s_shift_to;
+static uint32_t s_peeked;   // sector handed out by storage_flash_peek
+static uint32_t s_pinned = UINT32_MAX; // sector an uploader reads from the mapping, never erased
+
+static uint32_t sector_crc(const storage_ring_sector_t *h)
+{
+    return esp_rom_crc32_le(0, (const uint8_t *)h, offsetof(storage_ring_sector_t, crc));
+}
+
+static size_t sector_addr(uint32_t sector)
+{
+    return (size_t)sector * RING_SECTOR_SIZE;
+}
+
+static bool pending(const ring_sector_t *s)
+{
+    return s->seq != 0 && !s->moved && s->used > 0;
+}
+
+// The sector after the head can be erased
+static bool reusable(const ring_sector_t *s)
+{
+    return !pending(s) || s->uploaded;
+}
+
+// Records of a sector, from the mapping or copied into buf
+static const char *sector_data(uint32_t sector, char *buf)
+{
+    size_t addr = sector_addr(sector) + sizeof(storage_ring_sector_t);
+    if (s_map != NULL)
+        return s_map + addr;
+    if (esp_partition_read(s_part, addr, buf, RING_DATA_SIZE) != ESP_OK)
+        return NULL;
+    return buf;
+}
+
+static void clear_word(uint32_t sector, size_t field)
+{
+    uint32_t zero = 0;
+    if (esp_partition_write(s_part, sector_addr(sector) + field, &zero, sizeof(zero)) != ESP_OK)
+        ESP_LOGE(TAG, "Failed to mark sector %lu", (unsigned long)sector);
+}
+
+static void mark_moved(uint32_t sector)
+{
+    ring_sector_t *s = &s_sectors[sector];
+    if (s->moved || s->seq == 0)
+        return;
+    clear_word(sector, offsetof(storage_ring_sector_t, moved));
+    s->moved = true;
+    s_pending -= s->used;
+    if (sector == s_head)
+        s_head_off = RING_SECTOR_SIZE; // nothing may follow a moved record there
+}
+
+// Header and records of one sector into s_sectors, the head's write position into *end
+static void scan_sector(uint32_t sector, char *buf, uint32_t *end)
+{
+    ring_sector_t *s = &s_sectors[sector];
+    storage_ring_sector_t h;
+    *s = (ring_sector_t){0};
+    *end = RING_SECTOR_SIZE;
+    if (esp_partition_read(s_part, sector_addr(sector), &h, sizeof(h)) != ESP_OK)
+        return;
+    if (h.magic != STORAGE_RING_MAGIC || h.crc != sector_crc(&h) || h.seq == 0)
+    {
+        if (h.magic == STORAGE_RING_MAGIC)
+            s->erases = h.erases; // torn header, the count is still a good guess
+        return;
+    }
+    s->seq = h.seq;
+    s->erases = h.erases;
+    s->moved = h.moved != RING_WORD_CLEAR;
+    s->uploaded = h.uploaded != RING_WORD_CLEAR;
+
+    const char *data = sector_data(sector, buf);
+    size_t pos = 0;
+    while (data != NULL && pos < RING_DATA_SIZE && (uint8_t)data[pos] != 0xFF)
+    {
+        storage_record_t rec;
+        if (storage_record_parse(data + pos, RING_DATA_SIZE - pos, &rec, true, false) != STORAGE_RECORD_OK)
+        {
+            // Torn by a reset, the bytes cannot be written over without an erase
+            ESP_LOGW(TAG, "Damaged record in sector %lu at %u", (unsigned long)sector, (unsigned)pos);
+            s->used = pos;
+            return;
+        }
+        pos += rec.size;
+        if (rec.seq > s_last_seq)
+            s_last_seq = rec.seq;
+    }
+    s->used = pos;
+    *end = sizeof(storage_ring_sector_t) + pos;
+}
+
+bool storage_flash_init(uint32_t *last_seq)
+{
+    *last_seq = 0;
+    s_part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, STORAGE_FLASH_PARTITION);
+    if (s_part == NULL || s_part->size < 2 * RING_SECTOR_SIZE)
+    {
+        ESP_LOGE(TAG, "No \"%s\" partition for the flash log", STORAGE_FLASH_PARTITION);
+        return false;
+    }
+    s_count = s_part->size / RING_SECTOR_SIZE;
+    s_sectors = calloc(s_count, sizeof(ring_sector_t));
+    if (s_sectors == NULL)
+        return false;
+    const void *map;
+    if (esp_partition_mmap(s_part, 0, sector_addr(s_count), ESP_PARTITION_MMAP_DATA, &map, &s_map_handle) == ESP_OK)
+        s_map = map;
+    else
+        ESP_LOGW(TAG, "Flash log not mapped, read through copies");
+
+    char *buf = s_map == NULL ? malloc(RING_DATA_SIZE) : NULL;
+    if (s_map == NULL && buf == NULL)
+        return false;
+    s_head = s_count - 1; // empty log: the first block opens sector 0
+    s_head_off = RING_SECTOR_SIZE;
+    s_seq = 0;
+    for (uint32_t i = 0; i < s_count; i++)
+    {
+        uint32_t end;
+        scan_sector(i, buf, &end);
+        const ring_sector_t *s = &s_sectors[i];
+        if (s->erases > s_max_erases)
+            s_max_erases = s->erases;
+        if (pending(s))
+            s_pending += s->used;
+        if (s->seq > s_seq)
+        {
+            s_seq = s->seq;
+            s_head = i;
+            s_head_off = s->moved ? RING_SECTOR_SIZE : end;
+        }
+    }
+    free(buf);
+    *last_seq = s_last_seq;
+    ESP_LOGI(TAG, "Flash log: %lu sectors, head %lu, %u bytes wait for the card, max %lu erases",
+             (unsigned long)s_count, (unsigned long)s_head, (unsigned)s_pending, (unsigned long)s_max_erases);
+    return true;
+}
+
+// Erase the sector after the head and open it, false when it still waits for the card
+static bool advance(void)
+{
+    uint32_t next = (s_head + 1) % s_count;
+    ring_sector_t *s = &s_sectors[next];
+    if (!reusable(s) || next == s_pinned)
+        return false;
+    if (pending(s))
+        s_pending -= s->used; // published from flash, only the rollups lose it
+    storage_ring_sector_t h = {
+        .magic = STORAGE_RING_MAGIC,
+        .seq = s_seq + 1,
+        .erases = s->erases + 1,
+        .moved = RING_WORD_CLEAR,
+        .uploaded = RING_WORD_CLEAR,
+    };
+    h.crc = sector_crc(&h);
+    *s = (ring_sector_t){.erases = h.erases};
+    if (esp_partition_erase_range(s_part, sector_addr(next), RING_SECTOR_SIZE) != ESP_OK ||
+        esp_partition_write(s_part, sector_addr(next), &h, sizeof(h)) != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to open sector %lu", (unsigned long)next);
+        return false;
+    }
+    if (h.erases > s_max_erases)
+        s_max_erases = h.erases;
+    s->seq = h.seq;
+    s_seq = h.seq;
+    s_head = next;
+    s_head_off = sizeof(h);
+    return true;
+}
+
+size_t storage_flash_append(const char *block, size_t len)
+{
+    if (s_part == NULL)
+        return 0;
+    size_t done = 0;
+    while (done < len)
+    {
+        // One write per run of whole records that fits the head
+        size_t run = 0;
+        storage_record_t rec;
+        bool whole = false;
+        while (done + run < len &&
+               (whole = storage_record_parse(block + done + run, len - done - run, &rec, false, false) == STORAGE_RECORD_OK) &&
+               s_head_off + run + rec.size <= RING_SECTOR_SIZE)
+        {
+            run += rec.size;
+            s_last_seq = rec.seq;
+        }
+        if (run == 0)
+        {
+            if (!whole || !advance())
+                break;
+            continue;
+        }
+        if (esp_partition_write(s_part, sector_addr(s_head) + s_head_off, block + done, run) != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Failed to write %u bytes to sector %lu", (unsigned)run, (unsigned long)s_head);
+            s_head_off = RING_SECTOR_SIZE; // whatever made it there stays unreadable past the tear
+            break;
+        }
+        s_head_off += run;
+        s_sectors[s_head].used += run;
+        s_pending += run;
+        done += run;
+    }
+    return done;
+}
+
+size_t storage_flash_pending(void)
+{
+    return s_pending;
+}
+
+size_t storage_flash_free(void)
+{
+    if (s_part == NULL)
+        return 0;
+    size_t free = RING_SECTOR_SIZE - s_head_off;
+    for (uint32_t i = (s_head + 1) % s_count; i != s_head && i != s_pinned && reusable(&s_sectors[i]); i = (i + 1) % s_count)
+        free += RING_DATA_SIZE;
+    return free;
+}
+
+uint32_t storage_flash_max_erases(void)
+{
+    return s_max_erases;
+}
+
+// Oldest sector still waiting for the card, s_count if none
+static uint32_t oldest_pending(void)
+{
+    if (s_pending == 0)
+        return s_count;
+    for (uint32_t n = 1; n <= s_count; n++)
+    {
+        uint32_t i = (s_head + n) % s_count;
+        if (pending(&s_sectors[i]))
+            return i;
+    }
+    s_pending = 0; // nothing behind the count, the writer must not wait for it
+    return s_count;
+}
+
+uint32_t storage_flash_rebase(uint32_t card_seq)
+{
+    s_shift = 0;
+    uint32_t oldest = oldest_pending();
+    storage_record_hdr_t hdr;
+    if (oldest < s_count &&
+        esp_partition_read(s_part, sector_addr(oldest) + sizeof(storage_ring_sector_t), &hdr, sizeof(hdr)) == ESP_OK &&
+        hdr.magic == STORAGE_RECORD_MAGIC && hdr.seq <= card_seq)
+    {
+        s_shift = card_seq + 1 - hdr.seq;
+        s_shift_to = s_last_seq;
+        ESP_LOGI(TAG, "Flash records %lu.. continue the card as %lu..", (unsigned long)hdr.seq,
+                 (unsigned long)(card_seq + 1));
+    }
+    return s_last_seq + s_shift;
+}
+
+const char *storage_flash_peek(char *scratch, size_t *len, bool *uploaded)
+{
+    *len = 0;
+    s_peeked = oldest_pending();
+    if (s_peeked == s_count)
+        return NULL;
+    const ring_sector_t *s = &s_sectors[s_peeked];
+    const char *data = sector_data(s_peeked, scratch);
+    if (data == NULL)
+    {
+        ESP_LOGE(TAG, "Sector %lu unreadable, %u bytes dropped", (unsigned long)s_peeked, (unsigned)s->used);
+        mark_moved(s_peeked);
+        return NULL;
+    }
+    *len = s->used;
+    *uploaded = s->uploaded;
+    if (s_shift == 0 || s->uploaded)
+        return data;
+
+    // Renumbered on the way, flash keeps the old numbers
+    if (data != scratch)
+        memcpy(scratch, data, s->used);
+    storage_record_t rec;
+    for (size_t pos = 0; storage_record_parse(scratch + pos, s->used - pos, &rec, false, false) == STORAGE_RECORD_OK;
+         pos += rec.size)
+    {
+        if (rec.seq <= s_shift_to)
+            storage_record_renumber(scratch + pos, rec.seq + s_shift);
+    }
+    return scratch;
+}
+
+void storage_flash_consume(void)
+{
+    if (s_peeked >= s_count)
+        return;
+    mark_moved(s_peeked);
+    s_peeked = s_count;
+    if (s_pending == 0)
+    {
+        s_shift = 0;
+        ESP_LOGI(TAG, "Flash log moved to the card");
+    }
+}
+
+void storage_flash_clear(void)
+{
+    for (uint32_t i = 0; i < s_count; i++)
+        mark_moved(i);
+    s_pending = 0;
+    s_shift = 0;
+}
+
+/*
+ * Zero-copy reads for the uploaders: sealed sectors that are neither on the card nor published,
+ * oldest first. The lines point into the mapped partition, so the sector of the cursor is pinned
+ * from storage_flash_next_unsent until the next call or storage_flash_release: the writer stops
+ * in front of it (the blocks go to the card, or wait) instead of erasing it under the reader.
+ */
+
+bool storage_flash_next_unsent(storage_flash_cursor_t *cursor)
+{
+    bool found = false;
+    storage_lock();
+    if (s_map != NULL)
+    {
+        for (uint32_t n = 1; n < s_count; n++)
+        {
+            uint32_t i = (s_head + n) % s_count;
+            const ring_sector_t *s = &s_sectors[i];
+            if (pending(s) && !s->uploaded && s->seq > cursor->seq)
+            {
+                *cursor = (storage_flash_cursor_t){.sector = i, .seq = s->seq, .offset = 0};
+                found = true;
+                break;
+            }
+        }
+    }
+    s_pinned = found ? cursor->sector : UINT32_MAX;
+    storage_unlock();
+    return found;
+}
+
+// Published and released sectors can be erased again, the writer may take lines again
+static void refresh_free(void)
+{
+    if (!storage_card_in_use())
+        storage_free_bytes = storage_flash_free();
+}
+
+void storage_flash_release(void)
+{
+    storage_lock();
+    s_pinned = UINT32_MAX;
+    refresh_free();
+    storage_unlock();
+}
+
+bool storage_flash_read_line(storage_flash_cursor_t *cursor, const char **line, size_t *len)
+{
+    if (s_map == NULL)
+        return false;
+    storage_lock();
+    const ring_sector_t *s = &s_sectors[cursor->sector % s_count];
+    bool ok = s->seq == cursor->seq && cursor->offset < s->used;
+    storage_record_t rec;
+    if (ok)
+    {
+        const char *data = s_map + sector_addr(cursor->sector) + sizeof(storage_ring_sector_t);
+        ok = storage_record_parse(data + cursor->offset, s->used - cursor->offset, &rec, false, false) == STORAGE_RECORD_OK;
+        if (ok)
+        {
+            *line = data + cursor->offset + rec.payload;
+            *len = rec.payload_len;
+            cursor->offset += rec.size;
+        }
+    }
+    storage_unlock();
+    return ok;
+}
+
+bool storage_flash_mark_uploaded(const storage_flash_cursor_t *cursor)
+{
+    if (s_part == NULL)
+        return false;
+    storage_lock();
+    ring_sector_t *s = &s_sectors[cursor->sector % s_count];
+    bool ok = s->seq == cursor->seq && cursor->sector != s_head;
+    if (ok && !s->uploaded)
+    {
+        clear_word(cursor->sector, offsetof(storage_ring_sector_t, uploaded));
+        s->uploaded = true;
+        refresh_free();
+    }
+    storage_unlock();
+    return ok;
+}
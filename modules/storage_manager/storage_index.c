@@ -0,0 +1,201 @@
+#include "storage_priv.h"
+#include <string.h>
+#include <unistd.h>
+
+#include "esp_log.h"
+
+static const char *TAG = "STORAGE_IDX";
+
+static int sensor_slot(uint32_t bit)
+{
+    return bit < STORAGE_INDEX_SENSORS - 1 ? (int)bit : STORAGE_INDEX_SENSORS - 1;
+}
+
+static void widen(uint32_t *first, uint32_t *last, bool empty, uint32_t ts)
+{
+    if (empty || ts < *first)
+        *first = ts;
+    if (empty || ts > *last)
+        *last = ts;
+}
+
+void storage_index_add(storage_index_t *idx, uint32_t offset, uint32_t mask, uint32_t ts)
+{
+    storage_index_sensor_t *sensor = &idx->sensor[sensor_slot(__builtin_ctz(mask))];
+    widen(&sensor->first_ts, &sensor->last_ts, sensor->records == 0, ts);
+    sensor->records++;
+
+    storage_index_block_t *block = idx->blocks > 0 ? &idx->block[idx->blocks - 1] : NULL;
+    if (block == NULL || offset / STORAGE_INDEX_STRIDE != block->offset / STORAGE_INDEX_STRIDE)
+    {
+        if (idx->blocks == STORAGE_INDEX_BLOCKS)
+        {
+            // Only a head grown past STORAGE_SEGMENT_SIZE gets here, its last block just covers more
+            block->sensors |= mask;
+            widen(&block->first_ts, &block->last_ts, false, ts);
+            return;
+        }
+        idx->block[idx->blocks++] = (storage_index_block_t){.offset = offset, .first_ts = ts, .last_ts = ts,
+                                                            .sensors = mask};
+        return;
+    }
+    block->sensors |= mask;
+    widen(&block->first_ts, &block->last_ts, false, ts);
+}
+
+static long slot_offset(uint32_t id)
+{
+    return (long)(id % STORAGE_INDEX_SLOTS) * (long)sizeof(storage_index_t);
+}
+
+bool storage_index_load(uint32_t id, storage_index_t *idx)
+{
+    FILE *f = fopen(INDEX_PATH, "rb");
+    if (f == NULL)
+        return false;
+    bool ok = fseek(f, slot_offset(id), SEEK_SET) == 0 && fread(idx, sizeof(*idx), 1, f) == 1 && idx->id == id &&
+              idx->blocks <= STORAGE_INDEX_BLOCKS;
+    fclose(f);
+    return ok;
+}
+
+void storage_index_store(const storage_index_t *idx)
+{
+    FILE *f = fopen(INDEX_PATH, "r+b");
+    if (f == NULL)
+        f = fopen(INDEX_PATH, "w+b");
+    if (f == NULL || fseek(f, slot_offset(idx->id), SEEK_SET) != 0 || fwrite(idx, sizeof(*idx), 1, f) != 1)
+        ESP_LOGE(TAG, "Failed to store the index of segment %lu", (unsigned long)idx->id);
+    if (f != NULL)
+    {
+        fflush(f);
+        fsync(fileno(f));
+        fclose(f);
+    }
+}
+
+void storage_index_delete_all(void)
+{
+    unlink(INDEX_PATH);
+}
+
+/*
+ * Query: the manifest rules out whole segments by time range and sensor mask, the per-sensor
+ * ranges of the index the rest, then only runs of matching blocks are read. Blocks hold every
+ * sensor, so the records of a run are still filtered one by one.
+ */
+
+static bool overlaps(const storage_query_t *q, uint32_t first_ts, uint32_t last_ts)
+{
+    return first_ts <= q->to_ts && last_ts >= q->from_ts;
+}
+
+static bool block_matches(const storage_query_t *q, const storage_index_block_t *block)
+{
+    return (block->sensors & q->sensors) && overlaps(q, block->first_ts, block->last_ts);
+}
+
+static bool segment_matches(const storage_query_t *q, const storage_index_t *idx)
+{
+    for (uint32_t bits = q->sensors; bits != 0; bits &= bits - 1)
+    {
+        const storage_index_sensor_t *sensor = &idx->sensor[sensor_slot(__builtin_ctz(bits))];
+        if (sensor->records > 0 && overlaps(q, sensor->first_ts, sensor->last_ts))
+            return true;
+    }
+    return false;
+}
+
+// Load the index of the next segment that can hold matching records
+static bool next_segment(storage_query_t *q)
+{
+    bool found = false;
+    storage_segment_t seg;
+    storage_lock();
+    while (!found && storage_seg_find(q->next_segment, &seg))
+    {
+        q->next_segment = seg.id + 1;
+        if (seg.records == 0 || !(seg.sensors & q->sensors) || !overlaps(q, seg.first_ts, seg.last_ts))
+            continue;
+        storage_seg_index(&seg, &q->idx);
+        found = segment_matches(q, &q->idx);
+    }
+    storage_unlock();
+    if (found)
+    {
+        q->next_block = 0;
+        q->segments++;
+    }
+    return found;
+}
+
+// Start reading the next run of matching blocks of the current segment
+static bool next_run(storage_query_t *q)
+{
+    uint32_t i = q->next_block;
+    while (i < q->idx.blocks && !block_matches(q, &q->idx.block[i]))
+        i++;
+    if (i >= q->idx.blocks)
+        return false;
+    uint32_t end = i + 1;
+    while (end < q->idx.blocks && block_matches(q, &q->idx.block[end]))
+        end++;
+
+    q->next_block = end;
+    q->run_end = end < q->idx.blocks ? q->idx.block[end].offset : UINT32_MAX;
+    storage_cursor_t from = {.segment = q->idx.id, .offset = q->idx.block[i].offset};
+    storage_reader_open(&q->reader, q->reader.buf, q->reader.size, from, q->idx.id, false);
+    q->reading = true;
+    q->runs++;
+    return true;
+}
+
+void storage_query_open(storage_query_t *query, char *buf, size_t size, uint32_t sensors, uint32_t from_ts,
+                        uint32_t to_ts)
+{
+    *query = (storage_query_t){
+        .sensors = sensors,
+        .from_ts = from_ts,
+        .to_ts = to_ts,
+    };
+    storage_reader_open(&query->reader, buf, size, STORAGE_CURSOR_OLDEST, 0, false);
+}
+
+bool storage_query_next(storage_query_t *q, char **line, size_t *len)
+{
+    while (!q->error)
+    {
+        if (q->reading)
+        {
+            char *l;
+            size_t n;
+            while (storage_reader_tell(&q->reader).offset < q->run_end && storage_reader_next(&q->reader, &l, &n))
+            {
+                q->records++;
+                uint32_t ts;
+                uint32_t mask = storage_record_key(l, n, &ts);
+                if ((mask & q->sensors) && ts >= q->from_ts && ts <= q->to_ts)
+                {
+                    q->matched++;
+                    *line = l;
+                    if (len != NULL)
+                        *len = n;
+                    return true;
+                }
+            }
+            storage_reader_close(&q->reader);
+            q->reading = false;
+            q->error = q->reader.error;
+            continue;
+        }
+        if (!next_run(q) && !next_segment(q))
+            return false;
+    }
+    return false;
+}
+
+void storage_query_close(storage_query_t *query)
+{
+    storage_reader_close(&query->reader);
+    query->reading = false;
+}
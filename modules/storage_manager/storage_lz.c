@@ -0,0 +1,126 @@
+#include "storage_priv.h"
+#include <string.h>
+
+/*
+ * LZSS: a flag byte announces the next eight items, bit set = literal byte, bit clear = match of
+ * two bytes (distance - 1 in 10 bits, length - 3 in 6 bits). Records repeat their sensor name and
+ * most of the timestamp of a recent line, which is what the small window is for.
+ */
+#define LZ_MIN_MATCH 3
+#define LZ_MAX_MATCH (LZ_MIN_MATCH + 63)
+#define LZ_HASH(p)   ((((uint32_t)(p)[0] << 8) ^ ((uint32_t)(p)[1] << 4) ^ (p)[2]) & (STORAGE_LZ_HASH_SIZE - 1))
+#define LZ_NONE      0xFFFF
+
+_Static_assert((STORAGE_LZ_WINDOW & (STORAGE_LZ_WINDOW - 1)) == 0 && STORAGE_LZ_WINDOW <= 1024,
+               "window must be a power of two addressable in 10 bits");
+_Static_assert(STORAGE_INDEX_STRIDE < LZ_NONE, "block positions are kept in 16 bits");
+
+size_t storage_lz_compress(const uint8_t *src, size_t len, uint8_t *dst, uint16_t *hash)
+{
+    memset(hash, 0xFF, STORAGE_LZ_HASH_SIZE * sizeof(hash[0]));
+    size_t in = 0, out = 0, flag_pos = 0;
+    int bit = 8;
+    while (in < len)
+    {
+        if (bit == 8)
+        {
+            flag_pos = out++;
+            dst[flag_pos] = 0;
+            bit = 0;
+        }
+
+        // One candidate per hash bucket: the most recent position with the same three bytes
+        size_t best_len = 0, dist = 0;
+        if (in + LZ_MIN_MATCH <= len)
+        {
+            uint32_t h = LZ_HASH(src + in);
+            uint16_t cand = hash[h];
+            hash[h] = in;
+            if (cand != LZ_NONE && in - cand <= STORAGE_LZ_WINDOW)
+            {
+                size_t max = len - in < LZ_MAX_MATCH ? len - in : LZ_MAX_MATCH;
+                size_t n = 0;
+                while (n < max && src[cand + n] == src[in + n])
+                    n++;
+                if (n >= LZ_MIN_MATCH)
+                {
+                    best_len = n;
+                    dist = in - cand;
+                }
+            }
+        }
+
+        if (best_len > 0)
+        {
+            dst[out++] = (dist - 1) & 0xFF;
+            dst[out++] = ((dist - 1) >> 8) | ((best_len - LZ_MIN_MATCH) << 2);
+            for (size_t k = in + 1; k < in + best_len && k + LZ_MIN_MATCH <= len; k++)
+                hash[LZ_HASH(src + k)] = k;
+            in += best_len;
+        }
+        else
+        {
+            dst[flag_pos] |= 1 << bit;
+            dst[out++] = src[in++];
+        }
+        bit++;
+    }
+    return out;
+}
+
+void storage_lz_reset(storage_lz_t *lz, uint32_t raw_len)
+{
+    lz->pos = 0;
+    lz->raw_len = raw_len;
+    lz->flags = 0;
+    lz->nflags = 0;
+    lz->match_left = 0;
+}
+
+size_t storage_lz_read(storage_lz_t *lz, FILE *f, char *out, size_t len)
+{
+    size_t n = 0;
+    while (n < len && lz->pos < lz->raw_len)
+    {
+        uint8_t c;
+        if (lz->match_left > 0)
+        {
+            c = lz->window[(lz->pos - lz->match_dist) & (STORAGE_LZ_WINDOW - 1)];
+            lz->match_left--;
+        }
+        else
+        {
+            if (lz->nflags == 0)
+            {
+                int v = fgetc(f);
+                if (v == EOF)
+                    break;
+                lz->flags = v;
+                lz->nflags = 8;
+            }
+            bool literal = lz->flags & 1;
+            lz->flags >>= 1;
+            lz->nflags--;
+            if (!literal)
+            {
+                int b0 = fgetc(f);
+                int b1 = fgetc(f);
+                if (b0 == EOF || b1 == EOF)
+                    break;
+                lz->match_dist = (b0 | (b1 & 0x03) << 8) + 1;
+                lz->match_left = (b1 >> 2) + LZ_MIN_MATCH;
+                continue;
+            }
+            int v = fgetc(f);
+            if (v == EOF)
+                break;
+            c = v;
+        }
+        lz->window[lz->pos & (STORAGE_LZ_WINDOW - 1)] = c;
+        lz->pos++;
+        if (out != NULL)
+            out[n] = c;
+        n++;
+    }
+    return n;
+}
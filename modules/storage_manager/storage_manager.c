@@ -1,34 +1,113 @@
 #include "storage_manager.h"
+#include "storage_priv.h"
 #include "project_config.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <stdatomic.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
 #include "esp_err.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/ringbuf.h"
+#include "task_plan.h"
+
+#if CONFIG_IDF_TARGET_LINUX
+#include <sys/statvfs.h>
+#else
 #include "esp_vfs_fat.h"
 
 #include "driver/spi_master.h"
 #include "driver/sdspi_host.h"
 #include "sdmmc_cmd.h"
+#endif
 
 static const char *TAG = "STORAGE_MGR";
 
-/* Mount point and file */
-#define MOUNT_POINT "/sdcard"
-#define FILE_PATH   "/sdcard/data.txt"
-
 /* SPI pins – ADJUST TO YOUR WIRING */
 #define PIN_NUM_MISO  SPI_MISO_PIN
 #define PIN_NUM_MOSI  SPI_MOSI_PIN
 #define PIN_NUM_CLK   SPI_SCK_PIN
 #define PIN_NUM_CS    CS_SD_CARD_PIN
 
-static sdmmc_card_t *card;
+/*
+ * Writer: storage_write_line only copies the line into a ring buffer (no file system call, safe
+ * from any task). The writer task moves lines into a block of one allocation unit and writes it
+ * with a single call to the head segment it keeps open - when the block is full, when its oldest
+ * line reaches STORAGE_FLUSH_AGE_MS (followed by fsync) or on storage_sync. The ring buffer holds
+ * two blocks, so callers keep appending while a block is being written. Segments and their
+ * manifest are handled in storage_segment.c, the record frames (length, sequence number, CRC32)
+ * in storage_record.c.
+ *
+ * When the queue is empty and the block flushed, the writer compresses sealed segments one
+ * block per step (storage_lz.c), so incoming lines never wait for more than one step.
+ *
+ * Every block written also feeds the rollups (storage_rollup.c), whose closed buckets go to
+ * their files with the next fsync.
+ *
+ * Tiers: without a card the blocks go to a circular log on the internal flash (storage_flash.c)
+ * and the writer retries the card every STORAGE_CARD_RETRY_MS; a card failing a write is unmounted
+ * and retried the same way. Once mounted, the idle writer moves the log to the card a sector at a
+ * time before anything newer goes there. With neither, lines wait in the ring buffer until it is full.
+ *
+ * The free space is scanned once and then decremented by what the writer writes; the scan
+ * (f_getfree walks the FAT) is repeated only after deleting data.
+ */
+static RingbufHandle_t s_queue;
+static SemaphoreHandle_t s_file_lock; // segment files and the manifest
+static SemaphoreHandle_t s_sync_lock; // one storage_sync at a time
+static SemaphoreHandle_t s_sync_done;
+static char *s_block;
+static size_t s_block_len;
+static uint32_t s_last_seq; // sequence number of the newest framed record
+static _Atomic uint32_t s_tier; // storage_tier_t, where flush_block puts the blocks
+static bool s_flash;            // flash log usable
+_Atomic size_t storage_free_bytes;
+
+static struct
+{
+    _Atomic uint32_t records;
+    _Atomic uint32_t dropped;
+    _Atomic uint32_t blocks;
+    _Atomic uint32_t syncs;
+    _Atomic uint32_t write_errors;
+    _Atomic uint32_t max_write_us;
+    _Atomic uint64_t bytes;
+} s_stats;
 
+_Static_assert(STORAGE_BLOCK_SIZE >= STORAGE_LZ_SCRATCH, "the block doubles as compression scratch");
 
-void storage_init(void)
+#if CONFIG_IDF_TARGET_LINUX
+
+// The directory stands in for the card, a card is missing while it cannot be created
+static esp_err_t mount_card(void)
+{
+    struct stat st;
+    mkdir(MOUNT_POINT, 0755);
+    return stat(MOUNT_POINT, &st) == 0 && S_ISDIR(st.st_mode) ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
+
+static void unmount_card(void)
+{
+}
+
+static size_t scan_free_space(void)
+{
+    struct statvfs vfs;
+    if (statvfs(MOUNT_POINT, &vfs) != 0)
+        return 0;
+    return (size_t)vfs.f_bavail * vfs.f_frsize;
+}
+
+#else
+
+static sdmmc_card_t *card;
+
+static esp_err_t mount_card(void)
 {
     esp_err_t ret;
 
@@ -45,7 +124,7 @@ void storage_init(void)
 ret = spi_bus_initialize(SPI_HOST_USED, &bus_cfg, SPI_DMA_CH_AUTO);
     if (ret != ESP_OK && ret != ESP_ERR_INVALID_STATE) {
         ESP_LOGE(TAG, "SPI bus init failed");
-        return;
+        return ret;
     }
 
     sdspi_device_config_t slot_config = SDSPI_DEVICE_CONFIG_DEFAULT();
@@ -55,7 +134,7 @@ ret = spi_bus_initialize(SPI_HOST_USED, &bus_cfg, SPI_DMA_CH_AUTO);
     esp_vfs_fat_sdmmc_mount_config_t mount_config = {
         .format_if_mount_failed = false,
         .max_files = 5,
-        .allocation_unit_size = 16 * 1024
+        .allocation_unit_size = STORAGE_BLOCK_SIZE
     };
 
     ret = esp_vfs_fat_sdspi_mount(
@@ -66,27 +145,22 @@ ret = spi_bus_initialize(SPI_HOST_USED, &bus_cfg, SPI_DMA_CH_AUTO);
         &card
     );
 
-    if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to mount SD card (%s)", esp_err_to_name(ret));
-        return;
-    }
+    if (ret != ESP_OK)
+        return ret;
 
     ESP_LOGI(TAG, "SD card mounted");
-    ESP_LOGI(TAG, "Free space: %u bytes", storage_get_free_space());
-    if (card == NULL)
-    {
-        ESP_LOGE(TAG, "Card pointer is NULL!");
-    }
-    else
-    {
-        sdmmc_card_print_info(stdout, card);
-    }
-
     sdmmc_card_print_info(stdout, card);
+    return ESP_OK;
 }
 
+static void unmount_card(void)
+{
+    esp_vfs_fat_sdcard_unmount(MOUNT_POINT, card);
+    card = NULL;
+}
 
-size_t storage_get_free_space(void)
+
+static size_t scan_free_space(void)
 {
     FATFS *fs;
     DWORD free_clusters;
@@ -100,60 +174,386 @@ size_t storage_get_free_space(void)
     return (size_t)free_clusters * fs->csize * 512;
 }
 
+#endif
 
-void storage_clear_all(void)
+static bool writer_start(void);
+
+// Card just mounted: recover its segments, the writer continues behind its newest record
+static void attach_card(void)
 {
-    struct stat st;
-    if (stat(FILE_PATH, &st) == 0) {
-        unlink(FILE_PATH);
-        ESP_LOGI(TAG, "File deleted");
-    } else {
-        ESP_LOGW(TAG, "File does not exist");
+    storage_lock();
+    storage_free_bytes = scan_free_space();
+    uint32_t last_seq = storage_seg_init();
+    uint32_t flash_seq = storage_flash_rebase(last_seq);
+    if (flash_seq > last_seq)
+        last_seq = flash_seq;
+    storage_rollup_init();
+    if (last_seq > s_last_seq)
+        s_last_seq = last_seq;
+    s_tier = STORAGE_TIER_SD;
+    storage_unlock();
+    ESP_LOGI(TAG, "SD card in use, free space: %zu bytes, %zu bytes to move from flash", storage_get_free_space(),
+             storage_flash_pending());
+}
+
+// A write failed: the card is taken for gone until the next retry mounts it again
+static void detach_card(void)
+{
+    storage_seg_detach();
+    unmount_card();
+    s_tier = s_flash ? STORAGE_TIER_FLASH : STORAGE_TIER_RAM;
+    storage_free_bytes = storage_flash_free();
+    ESP_LOGE(TAG, "SD card lost, writing to %s", s_flash ? "internal flash" : "RAM only");
+}
+
+void storage_init(void)
+{
+    uint32_t flash_seq;
+    s_flash = storage_flash_init(&flash_seq);
+    s_last_seq = flash_seq;
+    esp_err_t ret = mount_card();
+    if (ret == ESP_OK)
+    {
+        // Recovery first, the writer continues the sequence numbers behind the last record
+        attach_card();
+    }
+    else
+    {
+        s_tier = s_flash ? STORAGE_TIER_FLASH : STORAGE_TIER_RAM;
+        storage_free_bytes = storage_flash_free();
+        ESP_LOGE(TAG, "Failed to mount SD card (%s), writing to %s", esp_err_to_name(ret),
+                 s_flash ? "internal flash" : "RAM only");
     }
+    writer_start();
 }
 
-bool storage_write_line(const char *text)
+bool storage_card_in_use(void)
 {
-    if (storage_get_free_space() < 512) {
-        ESP_LOGW(TAG, "Not enough space on SD card");
-        return false;
+    return s_tier == STORAGE_TIER_SD;
+}
+
+size_t storage_get_free_space(void)
+{
+    return storage_free_bytes;
+}
+
+void storage_lock(void)
+{
+    if (s_file_lock != NULL)
+        xSemaphoreTake(s_file_lock, portMAX_DELAY);
+}
+
+void storage_unlock(void)
+{
+    if (s_file_lock != NULL)
+        xSemaphoreGive(s_file_lock);
+}
+
+// Append a block of records to the head segment. ESP_ERR_NO_MEM when the card is full (nothing
+// written, the card stays attached), ESP_FAIL when the card failed the write.
+static esp_err_t write_card(const char *block, size_t len)
+{
+    if (storage_free_bytes < len + STORAGE_MIN_FREE_BYTES)
+    {
+        ESP_LOGW(TAG, "Not enough space on SD card for %u bytes", (unsigned)len);
+        return ESP_ERR_NO_MEM;
+    }
+    FILE *f = storage_seg_head_file(len);
+    if (f == NULL || fwrite(block, 1, len, f) != len)
+    {
+        ESP_LOGE(TAG, "Failed to write %u bytes", (unsigned)len);
+        s_stats.write_errors++;
+        return ESP_FAIL;
+    }
+    storage_seg_commit(block, len);
+    storage_rollup_add_block(block, len);
+    storage_free_bytes -= len;
+    s_stats.bytes += len;
+    s_stats.blocks++;
+    return ESP_OK;
+}
+
+// Bytes of the block the flash log took, the rest did not fit
+static size_t write_flash(const char *block, size_t len)
+{
+    size_t taken = storage_flash_append(block, len);
+    if (taken == 0)
+        return 0;
+    if (s_tier == STORAGE_TIER_FLASH)
+        storage_free_bytes = storage_flash_free();
+    s_stats.bytes += taken;
+    s_stats.blocks++;
+    s_stats.syncs++;
+    return taken;
+}
+
+static void flush_block(bool durable, bool manifest)
+{
+    storage_lock();
+    int64_t start = esp_timer_get_time();
+    if (s_block_len > 0)
+    {
+        // Nothing newer goes to the card before the flash log is moved there
+        bool written = false;
+        size_t taken = 0;
+        if (s_tier == STORAGE_TIER_SD && storage_flash_pending() == 0)
+        {
+            // A full card keeps its place, the block waits in flash until retention or uploads make room
+            esp_err_t err = write_card(s_block, s_block_len);
+            if (err == ESP_FAIL)
+                detach_card();
+            written = err == ESP_OK;
+        }
+        if (!written && s_flash)
+        {
+            taken = write_flash(s_block, s_block_len);
+            written = taken == s_block_len;
+        }
+        if (!written && s_tier == STORAGE_TIER_SD)
+        {
+            // The flash is full of records still waiting for the card: the rest of the block goes ahead
+            // of them rather than being lost, its records keep their newer sequence numbers
+            esp_err_t err = write_card(s_block + taken, s_block_len - taken);
+            if (err == ESP_FAIL)
+                detach_card();
+            written = err == ESP_OK;
+        }
+        if (!written)
+        {
+            ESP_LOGW(TAG, "No storage, %u bytes dropped", (unsigned)(s_block_len - taken));
+            s_stats.write_errors++;
+        }
+        s_block_len = 0;
+    }
+    if (durable && s_tier == STORAGE_TIER_SD)
+    {
+        storage_rollup_flush();
+        storage_seg_sync(manifest);
+        s_stats.syncs++;
+    }
+    uint32_t elapsed = (uint32_t)(esp_timer_get_time() - start);
+    if (elapsed > s_stats.max_write_us)
+        s_stats.max_write_us = elapsed;
+    storage_unlock();
+}
+
+// Move one sector of the flash log to the card, false if the card has no room for it yet
+static bool migrate_step(void)
+{
+    storage_lock();
+    size_t len;
+    bool uploaded;
+    bool moved = true;
+    const char *data = storage_flash_peek(s_block, &len, &uploaded);
+    if (data != NULL && uploaded)
+    {
+        // Already on the server, the card only needs it for the rollups
+        storage_rollup_add_block(data, len);
+        storage_flash_consume();
+    }
+    else if (data != NULL)
+    {
+        // The sector stays pending unless it is on the card for good before the flash lets go of it
+        esp_err_t err = write_card(data, len);
+        if (err == ESP_OK)
+        {
+            storage_rollup_flush();
+            storage_seg_sync(true);
+            storage_flash_consume();
+        }
+        else if (err == ESP_FAIL)
+        {
+            detach_card();
+        }
+        moved = err == ESP_OK;
+    }
+    storage_unlock();
+    return moved;
+}
+
+static void storage_writer_task(void *arg)
+{
+    int64_t oldest_us = 0; // arrival of the first line in the block
+    int64_t retry_us = esp_timer_get_time() + STORAGE_CARD_RETRY_MS * 1000LL; // storage_init has just tried
+    int64_t migrate_us = 0; // a full card is not asked again for the flash log before this
+    while (1)
+    {
+        int64_t now = esp_timer_get_time();
+        if (s_tier != STORAGE_TIER_SD && now >= retry_us)
+        {
+            if (mount_card() == ESP_OK)
+                attach_card();
+            retry_us = now + STORAGE_CARD_RETRY_MS * 1000LL;
+        }
+        if (s_tier == STORAGE_TIER_RAM)
+        {
+            // Nowhere to write, lines stay in the ring buffer
+            vTaskDelay(pdMS_TO_TICKS(STORAGE_CARD_RETRY_MS));
+            continue;
+        }
+
+        TickType_t wait = portMAX_DELAY;
+        if (s_block_len > 0)
+        {
+            int64_t age_ms = (now - oldest_us) / 1000;
+            wait = age_ms >= STORAGE_FLUSH_AGE_MS ? 0 : pdMS_TO_TICKS(STORAGE_FLUSH_AGE_MS - age_ms);
+        }
+        else if (s_tier == STORAGE_TIER_SD &&
+                 ((storage_flash_pending() > 0 && now >= migrate_us) || storage_seg_compress_pending()))
+        {
+            wait = 0;
+        }
+        else if (s_tier == STORAGE_TIER_SD && storage_flash_pending() > 0)
+        {
+            wait = pdMS_TO_TICKS((migrate_us - now) / 1000);
+        }
+        if (s_tier != STORAGE_TIER_SD)
+        {
+            TickType_t retry = retry_us > now ? pdMS_TO_TICKS((retry_us - now) / 1000) : 0;
+            if (retry < wait)
+                wait = retry;
+        }
+
+        size_t len;
+        char *item = xRingbufferReceive(s_queue, &len, wait);
+        if (item == NULL)
+        {
+            if (s_block_len > 0)
+                flush_block(true, false); // aged out
+            else if (s_tier == STORAGE_TIER_SD && storage_flash_pending() > 0 && esp_timer_get_time() >= migrate_us)
+            {
+                // Idle, the block is free as a buffer
+                if (!migrate_step())
+                    migrate_us = esp_timer_get_time() + STORAGE_CARD_RETRY_MS * 1000LL;
+            }
+            else if (s_tier == STORAGE_TIER_SD)
+                storage_seg_compress_step((uint8_t *)s_block); // idle, the block is free as scratch
+            continue;
+        }
+        if (len == 0 || item[0] == '\0')
+        {
+            // Sync marker from storage_sync
+            vRingbufferReturnItem(s_queue, item);
+            flush_block(true, true);
+            xSemaphoreGive(s_sync_done);
+            continue;
+        }
+
+        if (s_block_len + sizeof(storage_record_hdr_t) + len > STORAGE_BLOCK_SIZE)
+            flush_block(false, false);
+        if (s_block_len == 0)
+            oldest_us = esp_timer_get_time();
+        // Framed here rather than in storage_write_line: one task hands out the sequence numbers
+        // in file order and the CRC costs the callers nothing
+        s_block_len += storage_record_frame(s_block + s_block_len, item, len, ++s_last_seq);
+        vRingbufferReturnItem(s_queue, item);
+        if (s_block_len == STORAGE_BLOCK_SIZE)
+            flush_block(false, false);
     }
+}
 
-    FILE *f = fopen(FILE_PATH, "a");
-    if (!f) {
-        ESP_LOGE(TAG, "Failed to open file");
+static bool writer_start(void)
+{
+    if (s_queue != NULL)
+        return true;
+
+    s_block = malloc(STORAGE_BLOCK_SIZE);
+    s_file_lock = xSemaphoreCreateMutex();
+    s_sync_lock = xSemaphoreCreateMutex();
+    s_sync_done = xSemaphoreCreateBinary();
+    RingbufHandle_t queue = xRingbufferCreate(STORAGE_QUEUE_SIZE, RINGBUF_TYPE_NOSPLIT);
+    if (s_block == NULL || s_file_lock == NULL || s_sync_lock == NULL || s_sync_done == NULL || queue == NULL)
+    {
+        ESP_LOGE(TAG, "No memory for the writer");
         return false;
     }
+    s_queue = queue;
+    if (task_plan_create(TASK_ID_STORAGE_WRITER, storage_writer_task, NULL, NULL) != pdPASS)
+    {
+        ESP_LOGE(TAG, "Failed to start the writer task");
+        s_queue = NULL;
+        return false;
+    }
+    return true;
+}
 
-    int res = fprintf(f, "%s\n", text);
-    fclose(f);
+void storage_sync(void)
+{
+    // Without a card or flash the writer waits for one, a sync would too
+    if (s_queue == NULL || s_tier == STORAGE_TIER_RAM)
+        return;
 
-    return (res >= 0);
+    xSemaphoreTake(s_sync_lock, portMAX_DELAY);
+    const char marker = '\0';
+    // Queued behind every line appended so far, so everything before it is on the card once it is seen
+    if (xRingbufferSend(s_queue, &marker, 1, portMAX_DELAY) == pdTRUE)
+        xSemaphoreTake(s_sync_done, portMAX_DELAY);
+    xSemaphoreGive(s_sync_lock);
 }
 
-char *storage_read_all(void)
+void storage_get_stats(storage_stats_t *stats)
 {
-    FILE *f = fopen(FILE_PATH, "r");
-    if (!f) return NULL;
+    stats->records = s_stats.records;
+    stats->dropped = s_stats.dropped;
+    stats->blocks = s_stats.blocks;
+    stats->syncs = s_stats.syncs;
+    stats->write_errors = s_stats.write_errors;
+    stats->max_write_us = s_stats.max_write_us;
+    stats->bytes = s_stats.bytes;
+    stats->queued = s_queue ? STORAGE_QUEUE_SIZE - xRingbufferGetCurFreeSize(s_queue) : 0;
+    stats->tier = s_tier;
+    stats->flash_pending = storage_flash_pending();
+    stats->flash_erases = storage_flash_max_erases();
+    storage_seg_packed_totals(&stats->packed_segments, &stats->packed_raw, &stats->packed_bytes);
+}
 
-    fseek(f, 0, SEEK_END);
-    long size = ftell(f);
-    rewind(f);
+void storage_seal(void)
+{
+    storage_sync();
+    storage_lock();
+    storage_seg_seal_head();
+    storage_unlock();
+}
 
-    if (size <= 0) {
-        fclose(f);
-        return NULL;
+void storage_clear_all(void)
+{
+    storage_sync();
+    storage_lock();
+    if (s_tier == STORAGE_TIER_SD)
+    {
+        storage_seg_delete_all();
+        storage_rollup_delete_all();
+        storage_capture_delete_all();
     }
+    storage_flash_clear();
+    storage_free_bytes = s_tier == STORAGE_TIER_SD ? scan_free_space() : storage_flash_free();
+    storage_unlock();
+    ESP_LOGI(TAG, "All segments deleted");
+}
 
-    char *buf = malloc(size + 1);
-    if (!buf) {
-        fclose(f);
-        return NULL;
+bool storage_write_line(const char *text)
+{
+    if (s_queue == NULL)
+        return false;
+    if (s_tier != STORAGE_TIER_RAM && storage_free_bytes < STORAGE_MIN_FREE_BYTES) {
+        ESP_LOGW(TAG, "Not enough space on SD card");
+        return false;
     }
 
-    fread(buf, 1, size, f);
-    buf[size] = '\0';
-    fclose(f);
+    // A framed record has to fit the buffer of a reader
+    size_t len = strlen(text);
+    if (len == 0 || sizeof(storage_record_hdr_t) + len + 1 > STORAGE_READER_BUF_SIZE)
+        return false;
 
-    return buf;
+    // Never blocks: a full queue means the card cannot keep up, the line is dropped and counted
+    void *slot = NULL;
+    if (xRingbufferSendAcquire(s_queue, &slot, len + 1, 0) != pdTRUE || slot == NULL) {
+        s_stats.dropped++;
+        return false;
+    }
+    memcpy(slot, text, len);
+    ((char *)slot)[len] = '\n';
+    xRingbufferSendComplete(s_queue, slot);
+    s_stats.records++;
+    return true;
 }
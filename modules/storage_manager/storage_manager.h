@@ -2,8 +2,58 @@
 
 #include <stddef.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "project_config.h"
 
-// Inicjalizuje system plików (montuje SPIFFS)
+// Gdzie trafiają zapisywane bloki
+typedef enum
+{
+    STORAGE_TIER_RAM = 0, // ani karty, ani flasha: linie czekają w kolejce
+    STORAGE_TIER_FLASH,   // brak karty, bloki idą do logu na partycji "storage"
+    STORAGE_TIER_SD,      // karta, dane z flasha są na nią przenoszone
+} storage_tier_t;
+
+typedef struct
+{
+    uint32_t records;      // linie przyjęte do kolejki
+    uint32_t dropped;      // linie odrzucone, kolejka pełna
+    uint32_t blocks;       // zapisy bloków na kartę
+    uint32_t syncs;        // fsync
+    uint32_t write_errors;
+    uint32_t max_write_us; // najdłuższy zapis bloku (z fsync)
+    uint32_t queued;       // bajty czekające w kolejce
+    uint64_t bytes;
+    uint32_t packed_segments; // skompresowane segmenty na karcie
+    uint64_t packed_raw;      // ich rozmiar przed kompresją
+    uint64_t packed_bytes;    // i po niej
+    uint32_t tier;            // storage_tier_t
+    uint32_t flash_pending;   // bajty na flashu czekające na przeniesienie na kartę
+    uint32_t flash_erases;    // najwięcej kasowań jednego sektora flasha (zużycie)
+} storage_stats_t;
+
+// Dane trafiają do plików segmentów o stałym rozmiarze, opisanych w manifeście
+typedef enum
+{
+    STORAGE_SEG_OPEN = 0, // głowa, do niej dopisuje zadanie zapisujące
+    STORAGE_SEG_SEALED,   // zamknięty, czeka na wysłanie
+    STORAGE_SEG_UPLOADED, // wysłany, usuwany jako pierwszy gdy brakuje miejsca
+} storage_seg_state_t;
+
+typedef struct
+{
+    uint32_t id;       // plik /sdcard/seg/NNNNNNNN.log
+    uint32_t first_ts; // znaczniki czasu rekordów (unix, s)
+    uint32_t last_ts;
+    uint32_t records;
+    uint32_t bytes;
+    uint32_t sensors;  // maska storage_sensor_mask()
+    uint32_t state;    // storage_seg_state_t
+    uint32_t last_seq; // numer ostatniego rekordu (0 = stary format bez ramek)
+    uint32_t packed;   // rozmiar pliku po kompresji (NNNNNNNN.lzs), 0 = nieskompresowany
+} storage_segment_t;
+
+// Montuje kartę SD i partycję flash "storage" (zapas, gdy karty nie ma), uruchamia zadanie zapisujące
 void storage_init(void);
 
 // Zwraca ilość wolnego miejsca w bajtach
@@ -12,8 +62,266 @@ size_t storage_get_free_space(void);
 // Usuwa plik z notatkami (zwalnia miejsce)
 void storage_clear_all(void);
 
-// Zapisuje linię tekstu (zwraca true jeśli się udało)
+// Dopisuje linię tekstu do kolejki zadania zapisującego, nie czeka na kartę
+// (zwraca false jeśli kolejka jest pełna, brak miejsca lub linia dłuższa niż bufor czytnika)
 bool storage_write_line(const char* text);
 
-// Odczytuje całą zawartość (zwraca wskaźnik, który trzeba zwolnić free!)
-char* storage_read_all(void);
\ No newline at end of file
+// Zapisuje na kartę wszystko co jest w kolejce i robi fsync, wraca po zakończeniu
+void storage_sync(void);
+
+// Statystyki zadania zapisującego
+void storage_get_stats(storage_stats_t *stats);
+
+// Bit czujnika w masce segmentu (nazwa = pierwsze pole linii), nieznane nazwy dzielą ostatni bit
+#define STORAGE_SENSOR_OTHER (1u << 31)
+uint32_t storage_sensor_mask(const char *name, size_t len);
+
+// Kopiuje manifest (od najstarszego segmentu), zwraca liczbę segmentów
+size_t storage_segment_list(storage_segment_t *out, size_t max);
+
+// Zamyka głowę (po storage_sync), żeby jej dane można było wysłać; pusta głowa zostaje otwarta
+void storage_seal(void);
+
+// Najstarszy zamknięty, jeszcze nie wysłany segment (false jeśli nie ma)
+bool storage_segment_next_pending(storage_segment_t *seg);
+
+// Oznacza segment jako wysłany
+bool storage_segment_mark_uploaded(uint32_t id);
+
+// Pozycja w logu: segment i offset początku rekordu w jego pliku
+typedef struct
+{
+    uint32_t segment;
+    uint32_t offset;
+} storage_cursor_t;
+
+// Potwierdzona pozycja wysyłania w najstarszym oczekującym segmencie, trzymana w manifeście na karcie
+// (po oznaczeniu segmentu jako wysłany, jego usunięciu lub storage_clear_all wraca do {0, 0})
+storage_cursor_t storage_segment_upload_cursor(void);
+// Zapamiętuje pozycję wysyłania (zapis manifestu); pozycja spoza oczekującego segmentu jest ignorowana
+void storage_segment_set_upload_cursor(storage_cursor_t cursor);
+
+#define STORAGE_CURSOR_OLDEST ((storage_cursor_t){0, 0})
+#define STORAGE_READ_TO_HEAD  UINT32_MAX
+
+// Stan dekompresji jednego bloku skompresowanego segmentu
+typedef struct
+{
+    uint8_t window[STORAGE_LZ_WINDOW];
+    uint32_t pos;     // bajty bloku już zdekodowane
+    uint32_t raw_len; // rozmiar bloku przed kompresją
+    uint16_t match_dist;
+    uint16_t match_left;
+    uint8_t flags;
+    uint8_t nflags;
+} storage_lz_t;
+
+/*
+ * Czytnik logu ze stałym buforem podanym przez wołającego: zwraca całe rekordy (linie), plik
+ * czyta kawałkami wielkości bufora. Blokada plików jest trzymana tylko na czas jednego fread,
+ * więc zadanie zapisujące działa dalej. Widać dane już zapisane na kartę (storage_sync przed
+ * odczytem, jeśli mają być też te z kolejki). Rekord dłuższy niż bufor lub z błędną sumą
+ * kontrolną jest pomijany: w segmencie z ramkami odczyt wznawia się od następnego bajtu magic,
+ * za którym stoi rekord z poprawną sumą, w starym segmencie od następnej linii.
+ */
+typedef struct
+{
+    char *buf;
+    size_t size;
+    size_t start;          // początek nieoddanych danych w buf
+    size_t len;            // bajty w buf
+    storage_cursor_t pos;  // pozycja buf[start] = następny rekord
+    uint32_t last_segment; // ostatni czytany segment (STORAGE_READ_TO_HEAD = do głowy)
+    bool pending_only;     // pomija segmenty już wysłane
+    bool skipping;         // szukanie początku rekordu (poprzedni za długi lub uszkodzony)
+    bool legacy;           // bieżący segment w starym formacie: gołe linie, bez ramek
+    bool error;            // plik segmentu nie dał się otworzyć, odczyt przerwany
+    uint32_t skipped;      // pominięte rekordy: za długie lub z błędną sumą CRC
+    FILE *file;
+    bool packed;           // file to NNNNNNNN.lzs, dane idą przez lz
+    storage_lz_t lz;
+} storage_reader_t;
+
+// Czytanie od kursora (STORAGE_CURSOR_OLDEST = od najstarszego segmentu) do last_segment włącznie
+void storage_reader_open(storage_reader_t *reader, char *buf, size_t size, storage_cursor_t from,
+                         uint32_t last_segment, bool pending_only);
+
+// Następny poprawny rekord bez '\n', zakończony zerem, ważny do kolejnego wywołania (false = koniec lub błąd)
+bool storage_reader_next(storage_reader_t *reader, char **line, size_t *len);
+
+// Kursor za ostatnio oddanym rekordem, storage_reader_open od niego wznawia odczyt
+storage_cursor_t storage_reader_tell(const storage_reader_t *reader);
+
+void storage_reader_close(storage_reader_t *reader);
+
+/*
+ * Indeks segmentu: zakres czasu każdego czujnika i bloki co STORAGE_INDEX_STRIDE bajtów
+ * (offset pierwszego rekordu, zakres czasu, maska czujników). Zapytanie czyta tylko bloki,
+ * które mogą zawierać szukane rekordy.
+ */
+#define STORAGE_INDEX_SENSORS 8 // bity maski 0..6, ostatni wspólny dla reszty
+#define STORAGE_INDEX_BLOCKS  (STORAGE_SEGMENT_SIZE / STORAGE_INDEX_STRIDE)
+
+typedef struct
+{
+    uint32_t first_ts;
+    uint32_t last_ts;
+    uint32_t records;
+} storage_index_sensor_t;
+
+typedef struct
+{
+    uint32_t offset;  // pierwszy rekord zaczynający się w tym bloku
+    uint32_t first_ts;
+    uint32_t last_ts;
+    uint32_t sensors;
+} storage_index_block_t;
+
+typedef struct
+{
+    uint32_t id;      // segment
+    uint32_t blocks;  // użyte wpisy block[]
+    storage_index_sensor_t sensor[STORAGE_INDEX_SENSORS];
+    storage_index_block_t block[STORAGE_INDEX_BLOCKS];
+} storage_index_t;
+
+// Rekordy wybranych czujników z przedziału czasu [from_ts, to_ts], od najstarszych
+typedef struct
+{
+    uint32_t sensors;      // maska storage_sensor_mask()
+    uint32_t from_ts;
+    uint32_t to_ts;
+    uint32_t next_segment;
+    uint32_t next_block;   // następny wpis idx.block[]
+    uint32_t run_end;      // koniec czytanych bloków w segmencie
+    bool reading;
+    bool error;
+    storage_index_t idx;   // indeks bieżącego segmentu
+    storage_reader_t reader;
+    // statystyki
+    uint32_t segments;     // segmenty, do których zajrzano
+    uint32_t runs;         // odczytane ciągi bloków
+    uint32_t records;      // przeczytane rekordy
+    uint32_t matched;
+} storage_query_t;
+
+void storage_query_open(storage_query_t *query, char *buf, size_t size, uint32_t sensors, uint32_t from_ts,
+                        uint32_t to_ts);
+
+// Następny pasujący rekord, jak storage_reader_next (false = koniec lub błąd odczytu)
+bool storage_query_next(storage_query_t *query, char **line, size_t *len);
+
+void storage_query_close(storage_query_t *query);
+
+/*
+ * Agregaty (rollupy): min/max/średnia każdego czujnika w przedziałach STORAGE_ROLLUP_PERIODS_S,
+ * liczone przez zadanie zapisujące z linii TYP;CZAS;WARTOŚĆ i trzymane w osobnych plikach
+ * o stałej pojemności (najstarsze rekordy są nadpisywane). Dają historię z miesięcy, kiedy
+ * surowe segmenty są już usunięte. Przedział trafia do pliku, gdy przyjdzie pierwsza próbka
+ * po jego końcu; przedziały jeszcze otwarte giną przy resecie.
+ */
+#define STORAGE_ROLLUP_LEVELS 3
+#define STORAGE_ROLLUP_CHUNK  32 // rekordy czytane naraz przez zapytanie
+
+typedef struct
+{
+    uint32_t start;  // początek przedziału (unix, s), wielokrotność okresu
+    uint8_t sensor;  // numer bitu w masce storage_sensor_mask()
+    uint8_t reserved;
+    uint16_t count;  // próbki w przedziale
+    float min;
+    float max;
+    float mean;
+} storage_rollup_t;
+
+// Agregaty wybranych czujników z przedziałów nachodzących na [from_ts, to_ts], od najstarszych
+typedef struct
+{
+    uint32_t level;
+    uint32_t period;
+    uint32_t sensors;      // maska storage_sensor_mask()
+    uint32_t from_ts;
+    uint32_t to_ts;
+    uint32_t next;         // numer następnego rekordu pliku (liczony od pierwszego zapisanego)
+    bool started;
+    bool done;
+    bool error;
+    storage_rollup_t buf[STORAGE_ROLLUP_CHUNK];
+    uint32_t len;
+    uint32_t pos;
+    // statystyki
+    uint32_t records;      // przeczytane rekordy
+    uint32_t matched;
+} storage_rollup_query_t;
+
+// false jeśli żaden poziom nie ma okresu period_s
+bool storage_rollup_query_open(storage_rollup_query_t *query, uint32_t period_s, uint32_t sensors, uint32_t from_ts,
+                               uint32_t to_ts);
+
+// Następny pasujący agregat (false = koniec lub błąd odczytu); storage_sync przed otwarciem, jeśli
+// mają być widoczne przedziały zamknięte przed chwilą
+bool storage_rollup_query_next(storage_rollup_query_t *query, storage_rollup_t *out);
+
+/*
+ * Sesje pomiarowe: seria próbek (np. profil rozgrzewania MAX6675, drgania) do osobnego pliku
+ * /sdcard/cap/XXXXXXXX.cap zamiast do logu. Plik jest rezerwowany w całości przy otwarciu
+ * (ciągły obszar na karcie, rozmiar z czasu trwania i częstotliwości kanałów), próbki idą na
+ * kartę blokami STORAGE_CAPTURE_BLOCK, więc czas zapisu nie skacze przy przydzielaniu klastrów.
+ * Nagłówek z kanałami i częstotliwościami jest zapisywany przy zakończeniu. Sesję obsługuje
+ * jedno zadanie; działa tylko z kartą.
+ */
+#define STORAGE_CAPTURE_MAX_CHANNELS 4
+
+typedef struct
+{
+    const char *name;
+    float rate_hz; // planowana liczba próbek na sekundę
+} storage_capture_channel_t;
+
+typedef struct
+{
+    char file[16];         // nazwa pliku w /sdcard/cap
+    uint32_t samples;
+    uint32_t dropped;      // ponad zarezerwowany rozmiar
+    uint32_t blocks;       // zapisy na kartę
+    uint32_t bytes;
+    uint32_t max_write_us; // najdłuższy zapis bloku
+    bool error;
+} storage_capture_info_t;
+
+typedef struct storage_capture storage_capture_t;
+
+// Otwiera sesję na duration_ms (NULL: brak karty, miejsca lub ciągłego obszaru)
+storage_capture_t *storage_capture_open(const char *name, const storage_capture_channel_t *channels, size_t count,
+                                        uint32_t duration_ms);
+
+// Dopisuje próbkę kanału z bieżącym czasem (false: kanał spoza sesji albo plik pełny)
+bool storage_capture_add(storage_capture_t *capture, uint32_t channel, float value);
+
+// Zapisuje resztę próbek i nagłówek, przycina plik, zwalnia sesję; info może być NULL
+bool storage_capture_finish(storage_capture_t *capture, storage_capture_info_t *info);
+
+/*
+ * Rekordy czekające na flashu (gdy nie ma karty) czytane prosto ze zmapowanej partycji, bez
+ * kopiowania do RAM - linię można od razu podać klientowi MQTT albo BLE. Tylko pełne sektory,
+ * od najstarszego.
+ */
+typedef struct
+{
+    uint32_t sector; // sektor partycji
+    uint32_t seq;    // jego numer kolejny, 0 = zacznij od najstarszego
+    uint32_t offset; // następny rekord w sektorze
+} storage_flash_cursor_t;
+
+// Następny sektor, którego nie ma ani na karcie, ani na serwerze (false jeśli nie ma); sektor jest
+// przypięty (nie zostanie skasowany) do następnego wywołania albo storage_flash_release
+bool storage_flash_next_unsent(storage_flash_cursor_t *cursor);
+
+// Zwalnia sektor przypięty przez storage_flash_next_unsent, gdy czytanie przerwano
+void storage_flash_release(void);
+
+// Następna linia sektora bez '\n' i bez zera na końcu, wskaźnik do pamięci flash
+bool storage_flash_read_line(storage_flash_cursor_t *cursor, const char **line, size_t *len);
+
+// Oznacza sektor jako wysłany, na kartę trafi już tylko do agregatów (false: sektor nadpisany)
+bool storage_flash_mark_uploaded(const storage_flash_cursor_t *cursor);
@@ -0,0 +1,269 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "storage_manager.h"
+
+#if CONFIG_IDF_TARGET_LINUX
+/* Host build: a plain directory below the working directory stands in for the card */
+#define MOUNT_POINT "sdcard"
+#else
+#define MOUNT_POINT "/sdcard"
+#endif
+
+/* Single log file of older firmware, turned into the first segment on boot */
+#define LEGACY_FILE_PATH MOUNT_POINT "/data.txt"
+#define SEGMENT_DIR      MOUNT_POINT "/seg"
+#define MANIFEST_PATH    SEGMENT_DIR "/manifest.bin"
+#define MANIFEST_TMP     SEGMENT_DIR "/manifest.tmp"
+#define INDEX_PATH       SEGMENT_DIR "/index.bin"
+
+/*
+ * Manifest file layout (little endian):
+ *   storage_manifest_header_t
+ *   storage_segment_t[count], oldest first, the last one is the head
+ *   storage_cursor_t, where the upload continues (version 4 on)
+ */
+#define STORAGE_MANIFEST_MAGIC   0x31464D53 // "SMF1"
+// 1: storage_segment_t up to last_seq, 2: up to packed, 3: no upload cursor, 4: index of 64 KB segments
+#define STORAGE_MANIFEST_VERSION 5
+
+typedef struct __attribute__((packed))
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t count;
+} storage_manifest_header_t;
+
+/*
+ * Record frame: storage_record_hdr_t, then len bytes of the line including its '\n'. The CRC
+ * covers the header (crc field zeroed) and the line, a torn or corrupt record never passes as
+ * data. Segments of older firmware hold bare text lines only (last_seq == 0 in the manifest), the
+ * format is a property of the segment, never guessed per record: inside a framed segment a line
+ * that happens to start with the magic, or a stray '\n', cannot pass for a record boundary.
+ */
+#define STORAGE_RECORD_MAGIC 0xA5
+
+typedef struct __attribute__((packed))
+{
+    uint8_t magic;
+    uint8_t flags; // reserved, 0
+    uint16_t len;
+    uint32_t seq;  // consecutive over the whole log, 0 for legacy lines
+    uint32_t crc;
+} storage_record_hdr_t;
+
+typedef enum
+{
+    STORAGE_RECORD_OK,
+    STORAGE_RECORD_SHORT, // the record continues past the available bytes
+    STORAGE_RECORD_BAD,   // CRC mismatch or not a record boundary
+} storage_record_status_t;
+
+typedef struct
+{
+    size_t size;        // whole record
+    size_t payload;     // offset of the line
+    size_t payload_len; // without the '\n'
+    uint32_t seq;
+} storage_record_t;
+
+// Frame a line that already ends with '\n' into out, returns the bytes written
+size_t storage_record_frame(char *out, const char *line, size_t len, uint32_t seq);
+// New sequence number for a framed record, the CRC follows
+void storage_record_renumber(char *record, uint32_t seq);
+// verify = false skips the CRC, for blocks the writer has just framed itself; legacy reads a bare line
+storage_record_status_t storage_record_parse(const char *buf, size_t avail, storage_record_t *rec, bool verify,
+                                             bool legacy);
+// Offset of the next place a record may start behind buf[0] (the byte behind a '\n' in a legacy
+// segment, the next magic byte otherwise), avail if there is none in the buffer
+size_t storage_record_resync(const char *buf, size_t avail, bool legacy);
+// Sensor mask of a line TYPE;TIMESTAMP;VALUE, ts = 0 when it has no timestamp
+uint32_t storage_record_key(const char *line, size_t len, uint32_t *ts);
+
+/*
+ * Segment indexes (storage_index_t) of every segment sit in one file of fixed slots, slot
+ * id % STORAGE_INDEX_SLOTS; the id stored in the slot tells a current entry from a stale one, a
+ * segment whose slot a newer one took over gets the whole-segment index of older firmware. The
+ * head's index lives in RAM and is written together with the manifest.
+ */
+void storage_index_add(storage_index_t *idx, uint32_t offset, uint32_t mask, uint32_t ts);
+bool storage_index_load(uint32_t id, storage_index_t *idx);
+void storage_index_store(const storage_index_t *idx);
+void storage_index_delete_all(void);
+
+extern _Atomic size_t storage_free_bytes;
+
+// The card is mounted and takes the log
+bool storage_card_in_use(void);
+
+// File lock of the writer, no-ops before storage_init
+void storage_lock(void);
+void storage_unlock(void);
+
+/* Segment store, every call with the file lock held */
+// Returns the sequence number of the newest record
+uint32_t storage_seg_init(void);
+/**
+ * @brief File of the head segment, opened for appending. Seals the head and starts a new
+ * segment first if incoming bytes would not fit.
+ */
+FILE *storage_seg_head_file(size_t incoming);
+// Account a block of records just appended to the head file
+void storage_seg_commit(const char *block, size_t len);
+void storage_seg_sync(bool manifest);
+void storage_seg_seal_head(void);
+void storage_seg_delete_all(void);
+// The card is gone: drop open files and the manifest in RAM, storage_seg_init starts over
+void storage_seg_detach(void);
+// First segment with an id of at least min_id
+bool storage_seg_find(uint32_t min_id, storage_segment_t *seg);
+// Index of a segment, built from the manifest entry alone (one block) if none was stored
+void storage_seg_index(const storage_segment_t *seg, storage_index_t *idx);
+size_t storage_seg_path(uint32_t id, char *buf, size_t len);
+
+/*
+ * Compressed segment NNNNNNNN.lzs: storage_lz_header_t, uint32_t offset[blocks + 1] of every
+ * block in the file (the last one is the file size), then the blocks. Block k holds the raw bytes
+ * [k * STORAGE_INDEX_STRIDE, (k + 1) * STORAGE_INDEX_STRIDE) and is decoded on its own, so a
+ * reader seeks to any offset by decoding at most one block ahead of it.
+ */
+#define STORAGE_LZ_MAGIC     0x315A4C53 // "SLZ1"
+#define STORAGE_LZ_HASH_SIZE 1024
+// Scratch of one compression step: raw block, worst case output, match hash table
+#define STORAGE_LZ_BOUND(len) ((len) + (len) / 8 + 1)
+#define STORAGE_LZ_SCRATCH                                                                     \
+    (STORAGE_INDEX_STRIDE + STORAGE_LZ_BOUND(STORAGE_INDEX_STRIDE) + STORAGE_LZ_HASH_SIZE * sizeof(uint16_t))
+
+typedef struct __attribute__((packed))
+{
+    uint32_t magic;
+    uint32_t blocks;
+    storage_segment_t seg; // manifest entry, lets a lost manifest be rebuilt without decoding
+} storage_lz_header_t;
+
+size_t storage_lz_compress(const uint8_t *src, size_t len, uint8_t *dst, uint16_t *hash);
+void storage_lz_reset(storage_lz_t *lz, uint32_t raw_len);
+// Decode up to len bytes of the current block (out = NULL discards them)
+size_t storage_lz_read(storage_lz_t *lz, FILE *f, char *out, size_t len);
+
+size_t storage_seg_lz_path(uint32_t id, char *buf, size_t len);
+// Sealed segment still stored raw, false if there is none or compression pauses after a failure
+bool storage_seg_compress_pending(void);
+/**
+ * @brief Compress one block of the oldest raw sealed segment into scratch (STORAGE_LZ_SCRATCH
+ * bytes); the compressed file replaces the raw one after its last block. Takes the file lock.
+ */
+void storage_seg_compress_step(uint8_t *scratch);
+void storage_seg_packed_totals(uint32_t *segments, uint64_t *raw, uint64_t *packed);
+
+/*
+ * Rollup file seg/rollup_<period>.bin: storage_rollup_header_t, then capacity slots of
+ * storage_rollup_t. Record n, counted from the first one ever written, sits in slot n % capacity,
+ * the last min(total, capacity) are valid. A level closes the buckets of all sensors at once and
+ * never goes back in time, so its records are appended in order of start.
+ */
+#define STORAGE_ROLLUP_MAGIC 0x31555253 // "SRU1"
+
+typedef struct __attribute__((packed))
+{
+    uint32_t magic;
+    uint32_t period;
+    uint32_t capacity;
+    uint32_t total; // records ever written
+} storage_rollup_header_t;
+
+/* Rollup engine, every call with the file lock held */
+void storage_rollup_init(void);
+// Aggregate the records of a block just appended to the log
+void storage_rollup_add_block(const char *block, size_t len);
+// Append the closed buckets to the rollup files
+void storage_rollup_flush(void);
+void storage_rollup_delete_all(void);
+
+/*
+ * Capture file (storage_capture.c), below MOUNT_POINT "/" STORAGE_CAPTURE_DIR:
+ *   storage_capture_header_t in a sector of its own
+ *   storage_capture_sample_t[samples], data_bytes long, padded to whole sectors
+ */
+#define STORAGE_CAPTURE_DIR         "cap"
+#define STORAGE_CAPTURE_MAGIC       0x31504143 // "CAP1"
+#define STORAGE_CAPTURE_HEADER_SIZE 512
+
+typedef struct __attribute__((packed))
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t channels;
+    uint32_t start_ts;    // unix s
+    uint32_t duration_us; // time of the last sample
+    uint32_t samples;
+    uint32_t dropped;     // past the preallocated size
+    uint32_t data_offset; // STORAGE_CAPTURE_HEADER_SIZE
+    uint32_t data_bytes;  // 0 = not finished (reset during the capture), samples end where t_us goes back
+    char name[16];        // of the session
+    struct __attribute__((packed))
+    {
+        char name[16];
+        float rate_hz; // planned
+        uint32_t samples;
+    } channel[STORAGE_CAPTURE_MAX_CHANNELS];
+} storage_capture_header_t;
+
+typedef struct __attribute__((packed))
+{
+    uint32_t t_us; // since the session opened
+    uint16_t channel;
+    uint16_t reserved;
+    float value;
+} storage_capture_sample_t;
+
+// Delete the oldest finished capture for retention, false if there is none (caller holds the file lock)
+bool storage_capture_delete_oldest(void);
+// Every finished capture, for storage_clear_all (caller holds the file lock)
+void storage_capture_delete_all(void);
+
+/*
+ * Flash log (storage_flash.c): a circular log over the sectors of the "storage" partition holding
+ * the framed blocks the writer could not put on a card, in write order. Each sector starts with
+ * this header; moved and uploaded are written from 0xFFFFFFFF to 0 without an erase.
+ */
+#define STORAGE_RING_MAGIC 0x31474C46 // "FLG1"
+
+typedef struct __attribute__((packed))
+{
+    uint32_t magic;
+    uint32_t seq;      // sectors in write order, from 1
+    uint32_t erases;   // erase count of the sector
+    uint32_t crc;      // of the fields above
+    uint32_t moved;    // records on the card
+    uint32_t uploaded; // records published from flash, they only feed the rollups on the way
+} storage_ring_sector_t;
+
+/*
+ * Every call with the file lock held or from the writer task.
+ */
+// False if the partition is unusable; last_seq = newest record in the log
+bool storage_flash_init(uint32_t *last_seq);
+// Bytes of the block taken, whole records from the front; less than len when the log is full
+size_t storage_flash_append(const char *block, size_t len);
+// Bytes not moved to the card yet
+size_t storage_flash_pending(void);
+/**
+ * @brief Continue the numbering of a card whose newest record is card_seq: records framed while the
+ * card was away (numbered from 1 when the unit booted without it) are renumbered as they move.
+ * Returns the newest sequence number of the log afterwards.
+ */
+uint32_t storage_flash_rebase(uint32_t card_seq);
+/**
+ * @brief Records of the oldest sector not on the card yet, NULL if there is none. They point into
+ * the mapped partition, or into scratch (STORAGE_BLOCK_SIZE) when they had to be renumbered or
+ * copied. uploaded: already published, for the rollups only. storage_flash_consume once they are
+ * on the card.
+ */
+const char *storage_flash_peek(char *scratch, size_t *len, bool *uploaded);
+void storage_flash_consume(void);
+size_t storage_flash_free(void);
+uint32_t storage_flash_max_erases(void);
+void storage_flash_clear(void);
@@ -0,0 +1,211 @@
+#include "storage_priv.h"
+#include <string.h>
+
+#include "esp_log.h"
+
+static const char *TAG = "STORAGE_RD";
+
+/*
+ * The reader keeps its own handle of the segment file and takes the file lock for one lookup plus
+ * one fread per chunk. Only bytes the manifest counts as written are read, a line the writer is
+ * still holding in its block is never seen half way. FAT caches the file size in the handle, so a
+ * short read of the head closes it and the next chunk reopens the file. A compressed segment is
+ * decoded from the block holding the cursor; when compression swaps the files of a segment
+ * between two chunks, the manifest lookup notices and the reader reopens.
+ */
+
+static void move_to_segment(storage_reader_t *r, uint32_t id)
+{
+    if (r->file != NULL)
+    {
+        fclose(r->file);
+        r->file = NULL;
+    }
+    r->pos = (storage_cursor_t){.segment = id, .offset = 0};
+    r->start = 0;
+    r->len = 0;
+    r->skipping = false;
+}
+
+// Put the decoder of a compressed segment at raw offset
+static bool lz_seek(storage_reader_t *r, const storage_segment_t *seg, uint32_t offset)
+{
+    uint32_t block = offset / STORAGE_INDEX_STRIDE;
+    uint32_t start = block * STORAGE_INDEX_STRIDE;
+    uint32_t at;
+    if (fseek(r->file, sizeof(storage_lz_header_t) + block * sizeof(uint32_t), SEEK_SET) != 0 ||
+        fread(&at, sizeof(at), 1, r->file) != 1 || fseek(r->file, at, SEEK_SET) != 0)
+        return false;
+    uint32_t raw_len = seg->bytes - start < STORAGE_INDEX_STRIDE ? seg->bytes - start : STORAGE_INDEX_STRIDE;
+    storage_lz_reset(&r->lz, raw_len);
+    return storage_lz_read(&r->lz, r->file, NULL, offset - start) == offset - start;
+}
+
+// Append the next chunk behind the buffered bytes, false at the end of the range or on an error
+static bool fill(storage_reader_t *r)
+{
+    bool added = false;
+    storage_lock();
+    while (!added && !r->error)
+    {
+        storage_segment_t seg;
+        if (!storage_seg_find(r->pos.segment, &seg) || seg.id > r->last_segment)
+            break;
+        if (r->pending_only && seg.state == STORAGE_SEG_UPLOADED)
+        {
+            move_to_segment(r, seg.id + 1);
+            continue;
+        }
+        if (seg.id != r->pos.segment)
+            move_to_segment(r, seg.id); // deleted by retention in the meantime
+        r->legacy = seg.last_seq == 0;
+
+        uint32_t end = r->pos.offset + (r->len - r->start); // file offset of the buffered end
+        if (end >= seg.bytes)
+        {
+            if (seg.state == STORAGE_SEG_OPEN)
+                break; // head, the cursor stays here until more is written
+            move_to_segment(r, seg.id + 1);
+            continue;
+        }
+
+        if (r->file != NULL && r->packed != (seg.packed != 0))
+        {
+            fclose(r->file);
+            r->file = NULL;
+        }
+        bool opened = false;
+        if (r->file == NULL)
+        {
+            char path[48];
+            r->packed = seg.packed != 0;
+            if (r->packed)
+                storage_seg_lz_path(seg.id, path, sizeof(path));
+            else
+                storage_seg_path(seg.id, path, sizeof(path));
+            r->file = fopen(path, "r");
+            if (r->file == NULL || !(r->packed ? lz_seek(r, &seg, end) : fseek(r->file, end, SEEK_SET) == 0))
+            {
+                ESP_LOGE(TAG, "Cannot read %s", path);
+                r->error = true;
+                break;
+            }
+            opened = true;
+        }
+
+        size_t want = r->size - r->len;
+        if (want > seg.bytes - end)
+            want = seg.bytes - end;
+        size_t got;
+        if (r->packed)
+        {
+            // A chunk ends at a block boundary at most, the next block starts at its own file offset
+            got = 0;
+            if (r->lz.pos < r->lz.raw_len || lz_seek(r, &seg, end))
+                got = storage_lz_read(&r->lz, r->file, r->buf + r->len, want);
+            opened = got == 0; // compressed files never grow, a short one is damaged
+        }
+        else
+        {
+            got = fread(r->buf + r->len, 1, want, r->file);
+        }
+        r->len += got;
+        added = got > 0;
+        if (got < want && !(r->packed && got > 0))
+        {
+            fclose(r->file);
+            r->file = NULL;
+            if (got == 0 && opened)
+            {
+                // File shorter than the manifest says (reset during a write), the rest is lost
+                ESP_LOGW(TAG, "Segment %lu truncated at %lu", (unsigned long)seg.id, (unsigned long)end);
+                if (seg.state == STORAGE_SEG_OPEN)
+                    break;
+                move_to_segment(r, seg.id + 1);
+            }
+        }
+    }
+    storage_unlock();
+    return added;
+}
+
+void storage_reader_open(storage_reader_t *reader, char *buf, size_t size, storage_cursor_t from,
+                         uint32_t last_segment, bool pending_only)
+{
+    *reader = (storage_reader_t){
+        .buf = buf,
+        .size = size,
+        .pos = from,
+        .last_segment = last_segment,
+        .pending_only = pending_only,
+    };
+}
+
+// Drop buffered bytes up to the next place a record may start, false if the buffer has none
+static bool resync(storage_reader_t *r)
+{
+    size_t avail = r->len - r->start;
+    size_t n = storage_record_resync(r->buf + r->start, avail, r->legacy);
+    r->start += n;
+    r->pos.offset += n;
+    return n < avail;
+}
+
+bool storage_reader_next(storage_reader_t *r, char **line, size_t *len)
+{
+    while (1)
+    {
+        // A bare line has no header to check, the rest of a skipped one is dropped up to its '\n'. A
+        // framed segment is probed at every magic byte until a record with a valid CRC turns up.
+        if (r->skipping && r->legacy && resync(r))
+            r->skipping = false;
+
+        storage_record_t rec;
+        storage_record_status_t status = r->skipping && r->legacy
+                                             ? STORAGE_RECORD_SHORT
+                                             : storage_record_parse(r->buf + r->start, r->len - r->start, &rec, true, r->legacy);
+        if (status == STORAGE_RECORD_OK)
+        {
+            r->skipping = false;
+            char *payload = r->buf + r->start + rec.payload;
+            r->start += rec.size;
+            r->pos.offset += rec.size;
+            payload[rec.payload_len] = '\0';
+            *line = payload;
+            if (len != NULL)
+                *len = rec.payload_len;
+            return true;
+        }
+        if (status == STORAGE_RECORD_BAD || (r->start == 0 && r->len == r->size))
+        {
+            // Corrupt, or too long for the buffer
+            if (!r->skipping)
+                r->skipped++;
+            r->skipping = true;
+            if (!r->legacy)
+                resync(r);
+            continue;
+        }
+
+        // Partial record to the front, the next chunk completes it
+        memmove(r->buf, r->buf + r->start, r->len - r->start);
+        r->len -= r->start;
+        r->start = 0;
+        if (!fill(r))
+            return false;
+    }
+}
+
+storage_cursor_t storage_reader_tell(const storage_reader_t *reader)
+{
+    return reader->pos;
+}
+
+void storage_reader_close(storage_reader_t *reader)
+{
+    if (reader->file != NULL)
+    {
+        fclose(reader->file);
+        reader->file = NULL;
+    }
+}
@@ -0,0 +1,96 @@
+#include "storage_priv.h"
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_rom_crc.h"
+
+static uint32_t record_crc(const storage_record_hdr_t *hdr, const char *line)
+{
+    storage_record_hdr_t h = *hdr;
+    h.crc = 0;
+    uint32_t crc = esp_rom_crc32_le(0, (const uint8_t *)&h, sizeof(h));
+    return esp_rom_crc32_le(crc, (const uint8_t *)line, hdr->len);
+}
+
+size_t storage_record_frame(char *out, const char *line, size_t len, uint32_t seq)
+{
+    storage_record_hdr_t hdr = {
+        .magic = STORAGE_RECORD_MAGIC,
+        .len = len,
+        .seq = seq,
+    };
+    hdr.crc = record_crc(&hdr, line);
+    memcpy(out, &hdr, sizeof(hdr));
+    memcpy(out + sizeof(hdr), line, len);
+    return sizeof(hdr) + len;
+}
+
+void storage_record_renumber(char *record, uint32_t seq)
+{
+    storage_record_hdr_t hdr;
+    memcpy(&hdr, record, sizeof(hdr));
+    hdr.seq = seq;
+    hdr.crc = record_crc(&hdr, record + sizeof(hdr));
+    memcpy(record, &hdr, sizeof(hdr));
+}
+
+storage_record_status_t storage_record_parse(const char *buf, size_t avail, storage_record_t *rec, bool verify,
+                                             bool legacy)
+{
+    if (avail == 0)
+        return STORAGE_RECORD_SHORT;
+
+    if (legacy)
+    {
+        const char *nl = memchr(buf, '\n', avail);
+        if (nl == NULL)
+            return STORAGE_RECORD_SHORT;
+        *rec = (storage_record_t){.size = nl - buf + 1, .payload = 0, .payload_len = nl - buf};
+        return STORAGE_RECORD_OK;
+    }
+    if ((uint8_t)buf[0] != STORAGE_RECORD_MAGIC)
+        return STORAGE_RECORD_BAD;
+
+    storage_record_hdr_t hdr;
+    if (avail < sizeof(hdr))
+        return STORAGE_RECORD_SHORT;
+    memcpy(&hdr, buf, sizeof(hdr));
+    if (hdr.flags != 0 || hdr.len == 0)
+        return STORAGE_RECORD_BAD;
+    if (avail < sizeof(hdr) + hdr.len)
+        return STORAGE_RECORD_SHORT;
+    const char *line = buf + sizeof(hdr);
+    if (line[hdr.len - 1] != '\n' || (verify && record_crc(&hdr, line) != hdr.crc))
+        return STORAGE_RECORD_BAD;
+
+    *rec = (storage_record_t){
+        .size = sizeof(hdr) + hdr.len,
+        .payload = sizeof(hdr),
+        .payload_len = hdr.len - 1,
+        .seq = hdr.seq,
+    };
+    return STORAGE_RECORD_OK;
+}
+
+size_t storage_record_resync(const char *buf, size_t avail, bool legacy)
+{
+    if (avail <= 1)
+        return avail;
+    if (legacy)
+    {
+        const char *nl = memchr(buf, '\n', avail);
+        return nl != NULL ? (size_t)(nl - buf) + 1 : avail;
+    }
+    // The line of a framed record may hold the magic as well, only the CRC tells a real header
+    const char *magic = memchr(buf + 1, STORAGE_RECORD_MAGIC, avail - 1);
+    return magic != NULL ? (size_t)(magic - buf) : avail;
+}
+
+uint32_t storage_record_key(const char *line, size_t len, uint32_t *ts)
+{
+    // TYPE;TIMESTAMP;VALUE - notes and other free text have no timestamp and count as "other"
+    const char *sep = memchr(line, ';', len);
+    size_t name_len = sep ? (size_t)(sep - line) : len;
+    *ts = sep ? (uint32_t)strtoul(sep + 1, NULL, 10) : 0;
+    return storage_sensor_mask(line, name_len);
+}
@@ -0,0 +1,388 @@
+#include "storage_priv.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "esp_log.h"
+
+static const char *TAG = "STORAGE_RU";
+
+/*
+ * Each level keeps one open bucket per sensor in RAM and closes all of them when a sample of a
+ * later bucket arrives. Closed buckets wait in a small array until the next durable flush of the
+ * writer, which appends them to the ring file of the level. Samples older than the newest stored
+ * bucket (clock set back, late lines) are not aggregated, that keeps every file in time order.
+ */
+#define ROLLUP_SENSORS (STORAGE_INDEX_SENSORS - 1) // named sensors, "other" lines carry no sample
+#define ROLLUP_PENDING (2 * ROLLUP_SENSORS)
+
+_Static_assert(sizeof(storage_rollup_t) == 20, "rollup records are stored as they are in RAM");
+
+typedef struct
+{
+    uint32_t count;
+    float min;
+    float max;
+    double sum;
+} rollup_bucket_t;
+
+static const uint32_t s_periods[STORAGE_ROLLUP_LEVELS] = STORAGE_ROLLUP_PERIODS_S;
+static const uint32_t s_capacity[STORAGE_ROLLUP_LEVELS] = STORAGE_ROLLUP_CAPACITY;
+
+typedef struct
+{
+    uint32_t start; // bucket being filled, valid while open
+    bool open;
+    uint32_t floor; // end of the newest stored bucket
+    rollup_bucket_t bucket[ROLLUP_SENSORS];
+    storage_rollup_t pending[ROLLUP_PENDING];
+    size_t pending_len;
+} rollup_level_t;
+
+static rollup_level_t s_levels[STORAGE_ROLLUP_LEVELS];
+
+static size_t level_path(uint32_t level, char *buf, size_t len)
+{
+    return snprintf(buf, len, SEGMENT_DIR "/rollup_%lu.bin", (unsigned long)s_periods[level]);
+}
+
+static long slot_offset(uint32_t level, uint32_t n)
+{
+    return (long)sizeof(storage_rollup_header_t) + (long)(n % s_capacity[level]) * (long)sizeof(storage_rollup_t);
+}
+
+// Header of a level file, false if it is missing or was written with another configuration
+static bool read_header(uint32_t level, FILE *f, storage_rollup_header_t *header)
+{
+    return fseek(f, 0, SEEK_SET) == 0 && fread(header, sizeof(*header), 1, f) == 1 &&
+           header->magic == STORAGE_ROLLUP_MAGIC && header->period == s_periods[level] &&
+           header->capacity == s_capacity[level];
+}
+
+static bool read_record(uint32_t level, FILE *f, uint32_t n, storage_rollup_t *rec)
+{
+    return fseek(f, slot_offset(level, n), SEEK_SET) == 0 && fread(rec, sizeof(*rec), 1, f) == 1;
+}
+
+static uint32_t stored(const storage_rollup_header_t *header)
+{
+    return header->total < header->capacity ? header->total : header->capacity;
+}
+
+static void flush_level(uint32_t level)
+{
+    rollup_level_t *lv = &s_levels[level];
+    if (lv->pending_len == 0)
+        return;
+
+    char path[48];
+    level_path(level, path, sizeof(path));
+    storage_rollup_header_t header;
+    FILE *f = fopen(path, "r+b");
+    if (f != NULL && !read_header(level, f, &header))
+    {
+        fclose(f);
+        f = NULL;
+    }
+    if (f == NULL)
+    {
+        // New level or a changed configuration, the ring starts over
+        header = (storage_rollup_header_t){
+            .magic = STORAGE_ROLLUP_MAGIC,
+            .period = s_periods[level],
+            .capacity = s_capacity[level],
+        };
+        f = fopen(path, "w+b");
+    }
+    if (f == NULL)
+    {
+        ESP_LOGE(TAG, "Cannot open %s, %u buckets lost", path, (unsigned)lv->pending_len);
+        lv->pending_len = 0;
+        return;
+    }
+
+    uint32_t before = stored(&header);
+    bool ok = true;
+    for (size_t done = 0; ok && done < lv->pending_len;)
+    {
+        // One write per run of slots up to the end of the ring
+        size_t run = lv->pending_len - done;
+        uint32_t room = header.capacity - header.total % header.capacity;
+        if (run > room)
+            run = room;
+        ok = fseek(f, slot_offset(level, header.total), SEEK_SET) == 0 &&
+             fwrite(&lv->pending[done], sizeof(storage_rollup_t), run, f) == run;
+        if (ok)
+        {
+            header.total += run;
+            done += run;
+        }
+    }
+    // Slots first, the header never counts a record that is not written
+    fflush(f);
+    fsync(fileno(f));
+    ok = ok && fseek(f, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, f) == 1;
+    fflush(f);
+    fsync(fileno(f));
+    fclose(f);
+    if (!ok)
+        ESP_LOGE(TAG, "Failed to write %s", path);
+    storage_free_bytes -= (stored(&header) - before) * sizeof(storage_rollup_t);
+    lv->pending_len = 0;
+}
+
+static void close_bucket(uint32_t level)
+{
+    rollup_level_t *lv = &s_levels[level];
+    for (uint32_t bit = 0; bit < ROLLUP_SENSORS; bit++)
+    {
+        rollup_bucket_t *b = &lv->bucket[bit];
+        if (b->count == 0)
+            continue;
+        if (lv->pending_len == ROLLUP_PENDING)
+            flush_level(level);
+        lv->pending[lv->pending_len++] = (storage_rollup_t){
+            .start = lv->start,
+            .sensor = bit,
+            .count = b->count > UINT16_MAX ? UINT16_MAX : b->count,
+            .min = b->min,
+            .max = b->max,
+            .mean = (float)(b->sum / b->count),
+        };
+        *b = (rollup_bucket_t){0};
+    }
+    lv->floor = lv->start + s_periods[level];
+    lv->open = false;
+}
+
+static void add_sample(uint32_t level, uint32_t bit, uint32_t ts, float value)
+{
+    rollup_level_t *lv = &s_levels[level];
+    uint32_t start = ts - ts % s_periods[level];
+    if (ts < lv->floor || (lv->open && start < lv->start))
+        return;
+    if (lv->open && start != lv->start)
+        close_bucket(level);
+    if (!lv->open)
+    {
+        lv->start = start;
+        lv->open = true;
+    }
+
+    rollup_bucket_t *b = &lv->bucket[bit];
+    if (b->count == 0 || value < b->min)
+        b->min = value;
+    if (b->count == 0 || value > b->max)
+        b->max = value;
+    b->sum += value;
+    b->count++;
+}
+
+// Value of a line TYPE;TIMESTAMP;VALUE
+static bool parse_value(const char *line, size_t len, float *value)
+{
+    const char *sep = memchr(line, ';', len);
+    if (sep == NULL)
+        return false;
+    sep = memchr(sep + 1, ';', len - (sep + 1 - line));
+    if (sep == NULL)
+        return false;
+    char *end;
+    *value = strtof(sep + 1, &end); // the line ends with '\n' inside the block, strtof stops there
+    return end != sep + 1 && isfinite(*value);
+}
+
+void storage_rollup_add_block(const char *block, size_t len)
+{
+    storage_record_t rec;
+    for (size_t used = 0; storage_record_parse(block + used, len - used, &rec, false, false) == STORAGE_RECORD_OK;
+         used += rec.size)
+    {
+        const char *line = block + used + rec.payload;
+        uint32_t ts;
+        uint32_t bit = __builtin_ctz(storage_record_key(line, rec.payload_len, &ts));
+        float value;
+        if (bit >= ROLLUP_SENSORS || ts == 0 || !parse_value(line, rec.payload_len, &value))
+            continue;
+        for (uint32_t level = 0; level < STORAGE_ROLLUP_LEVELS; level++)
+            add_sample(level, bit, ts, value);
+    }
+}
+
+void storage_rollup_flush(void)
+{
+    for (uint32_t level = 0; level < STORAGE_ROLLUP_LEVELS; level++)
+        flush_level(level);
+}
+
+// Called on every card attach: buckets aggregated while the card was away stay, unless the card
+// already holds later ones
+void storage_rollup_init(void)
+{
+    for (uint32_t level = 0; level < STORAGE_ROLLUP_LEVELS; level++)
+    {
+        rollup_level_t *lv = &s_levels[level];
+        char path[48];
+        level_path(level, path, sizeof(path));
+        FILE *f = fopen(path, "rb");
+        if (f == NULL)
+            continue;
+        storage_rollup_header_t header;
+        storage_rollup_t last;
+        if (read_header(level, f, &header) && header.total > 0 && read_record(level, f, header.total - 1, &last))
+        {
+            uint32_t floor = last.start + s_periods[level];
+            size_t kept = 0;
+            for (size_t i = 0; i < lv->pending_len; i++)
+            {
+                if (lv->pending[i].start >= floor)
+                    lv->pending[kept++] = lv->pending[i];
+            }
+            if (kept < lv->pending_len)
+                ESP_LOGW(TAG, "%u buckets older than the card's rollups dropped", (unsigned)(lv->pending_len - kept));
+            lv->pending_len = kept;
+            if (lv->open && lv->start < floor)
+            {
+                memset(lv->bucket, 0, sizeof(lv->bucket));
+                lv->open = false;
+            }
+            if (floor > lv->floor)
+                lv->floor = floor;
+            ESP_LOGI(TAG, "%lu s rollups: %lu records up to %lu", (unsigned long)s_periods[level],
+                     (unsigned long)stored(&header), (unsigned long)last.start);
+        }
+        fclose(f);
+    }
+}
+
+void storage_rollup_delete_all(void)
+{
+    for (uint32_t level = 0; level < STORAGE_ROLLUP_LEVELS; level++)
+    {
+        char path[48];
+        level_path(level, path, sizeof(path));
+        unlink(path);
+        s_levels[level] = (rollup_level_t){0};
+    }
+}
+
+/*
+ * Query: the file of a level is in time order, a binary search over the stored records finds the
+ * first bucket that ends after from_ts, chunks are read from there until a bucket starts after
+ * to_ts. The file lock is held for one chunk; records the writer overwrites in between are skipped.
+ */
+
+bool storage_rollup_query_open(storage_rollup_query_t *query, uint32_t period_s, uint32_t sensors, uint32_t from_ts,
+                               uint32_t to_ts)
+{
+    *query = (storage_rollup_query_t){
+        .period = period_s,
+        .sensors = sensors,
+        .from_ts = from_ts,
+        .to_ts = to_ts,
+    };
+    for (uint32_t level = 0; level < STORAGE_ROLLUP_LEVELS; level++)
+    {
+        if (s_periods[level] == period_s)
+        {
+            query->level = level;
+            return true;
+        }
+    }
+    query->done = true;
+    return false;
+}
+
+// First record of [lo, hi) whose bucket ends after ts, hi if none
+static bool search(storage_rollup_query_t *q, FILE *f, uint32_t lo, uint32_t hi, uint32_t ts, uint32_t *found)
+{
+    while (lo < hi)
+    {
+        uint32_t mid = lo + (hi - lo) / 2;
+        storage_rollup_t rec;
+        if (!read_record(q->level, f, mid, &rec))
+            return false;
+        if (rec.start + q->period > ts)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    *found = lo;
+    return true;
+}
+
+static bool fill(storage_rollup_query_t *q)
+{
+    char path[48];
+    level_path(q->level, path, sizeof(path));
+    storage_lock();
+    FILE *f = fopen(path, "rb");
+    storage_rollup_header_t header;
+    if (f == NULL || !read_header(q->level, f, &header))
+    {
+        q->done = true;
+        if (f != NULL)
+            fclose(f);
+        storage_unlock();
+        return false;
+    }
+
+    uint32_t oldest = header.total - stored(&header);
+    if (!q->started)
+    {
+        q->started = true;
+        if (!search(q, f, oldest, header.total, q->from_ts, &q->next))
+            q->error = true;
+    }
+    if (q->next < oldest)
+        q->next = oldest; // overwritten while we were reading
+    uint32_t n = header.total - q->next;
+    if (n > STORAGE_ROLLUP_CHUNK)
+        n = STORAGE_ROLLUP_CHUNK;
+    if (n > header.capacity - q->next % header.capacity)
+        n = header.capacity - q->next % header.capacity;
+    if (!q->error && n > 0 &&
+        (fseek(f, slot_offset(q->level, q->next), SEEK_SET) != 0 || fread(q->buf, sizeof(q->buf[0]), n, f) != n))
+        q->error = true;
+    fclose(f);
+    storage_unlock();
+
+    if (q->error)
+    {
+        ESP_LOGE(TAG, "Cannot read %s", path);
+        return false;
+    }
+    q->next += n;
+    q->len = n;
+    q->pos = 0;
+    q->done = n == 0;
+    return n > 0;
+}
+
+bool storage_rollup_query_next(storage_rollup_query_t *q, storage_rollup_t *out)
+{
+    while (!q->done && !q->error)
+    {
+        while (q->pos < q->len)
+        {
+            const storage_rollup_t *rec = &q->buf[q->pos++];
+            q->records++;
+            if (rec->start > q->to_ts)
+            {
+                q->done = true;
+                return false;
+            }
+            if (rec->sensor < ROLLUP_SENSORS && ((1u << rec->sensor) & q->sensors) &&
+                rec->start + q->period > q->from_ts)
+            {
+                q->matched++;
+                *out = *rec;
+                return true;
+            }
+        }
+        if (!fill(q))
+            return false;
+    }
+    return false;
+}
@@ -0,0 +1,893 @@
+#include "storage_priv.h"
+#include "project_config.h"
+#include <dirent.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+
+static const char *TAG = "STORAGE_SEG";
+
+/*
+ * The manifest lives in RAM and is written back when a segment is sealed, uploaded or deleted and
+ * on storage_sync. Only the head changes between those points; after a reset its entry and its
+ * index are brought up to date from the file itself when the sizes disagree. The table grows with
+ * the log, only the free space of the card limits it.
+ */
+static storage_segment_t *s_segs;
+static size_t s_count;
+static size_t s_capacity;
+static FILE *s_head_file;
+static storage_index_t s_head_idx;
+// Acknowledged upload position inside a pending segment, it belongs to the card like the manifest
+static storage_cursor_t s_upload;
+
+#define PACK_TMP_PATH SEGMENT_DIR "/pack.tmp"
+
+// Segment being compressed by storage_seg_compress_step, one block per call
+static struct
+{
+    uint32_t id; // 0 = none
+    uint32_t block;
+    uint32_t blocks;
+    FILE *in;
+    FILE *out;
+} s_pack;
+// After a failure compression pauses, a card that keeps failing must not keep the writer busy
+static int64_t s_pack_resume_us;
+
+// Sensor name (first field of a line) -> bit of storage_segment_t.sensors
+static const char *const s_sensor_names[] = {
+    "BMP280", "VEML7700", "MAX6675_NORMAL", "MAX6675_PROFILE", "HC-SR04", "ADXL345",
+};
+
+uint32_t storage_sensor_mask(const char *name, size_t len)
+{
+    for (size_t i = 0; i < sizeof(s_sensor_names) / sizeof(s_sensor_names[0]); i++)
+    {
+        if (strlen(s_sensor_names[i]) == len && memcmp(s_sensor_names[i], name, len) == 0)
+            return 1u << i;
+    }
+    return STORAGE_SENSOR_OTHER;
+}
+
+size_t storage_seg_path(uint32_t id, char *buf, size_t len)
+{
+    return snprintf(buf, len, SEGMENT_DIR "/%08lu.log", (unsigned long)id);
+}
+
+size_t storage_seg_lz_path(uint32_t id, char *buf, size_t len)
+{
+    return snprintf(buf, len, SEGMENT_DIR "/%08lu.lzs", (unsigned long)id);
+}
+
+// File of a segment as the manifest describes it
+static size_t segment_file(const storage_segment_t *seg, char *buf, size_t len)
+{
+    return seg->packed ? storage_seg_lz_path(seg->id, buf, len) : storage_seg_path(seg->id, buf, len);
+}
+
+// Room for count entries, false when the heap is out or the manifest header cannot count them
+static bool reserve(size_t count)
+{
+    if (count <= s_capacity)
+        return true;
+    size_t capacity = (count + STORAGE_SEGMENT_TABLE_STEP - 1) / STORAGE_SEGMENT_TABLE_STEP * STORAGE_SEGMENT_TABLE_STEP;
+    if (capacity > UINT16_MAX)
+        capacity = UINT16_MAX;
+    storage_segment_t *segs = count <= capacity ? realloc(s_segs, capacity * sizeof(s_segs[0])) : NULL;
+    if (segs == NULL)
+        return false;
+    s_segs = segs;
+    s_capacity = capacity;
+    return true;
+}
+
+// Bytes a file takes on the card, whole allocation units
+static size_t allocated(uint32_t bytes)
+{
+    return (bytes + STORAGE_BLOCK_SIZE - 1) / STORAGE_BLOCK_SIZE * STORAGE_BLOCK_SIZE;
+}
+
+// Records of a block or of a file scan, merged into their segment afterwards
+typedef struct
+{
+    uint32_t records;
+    uint32_t first_ts;
+    uint32_t last_ts;
+    uint32_t sensors;
+    uint32_t last_seq;
+} storage_seg_delta_t;
+
+static void account_record(storage_seg_delta_t *delta, storage_index_t *idx, uint32_t offset, const char *line,
+                           size_t len, uint32_t seq)
+{
+    // Lines without a timestamp count at arrival time
+    uint32_t ts;
+    uint32_t mask = storage_record_key(line, len, &ts);
+    if (ts == 0)
+        ts = (uint32_t)time(NULL);
+
+    if (delta->records == 0 || ts < delta->first_ts)
+        delta->first_ts = ts;
+    if (delta->records == 0 || ts > delta->last_ts)
+        delta->last_ts = ts;
+    delta->sensors |= mask;
+    delta->records++;
+    if (seq != 0)
+        delta->last_seq = seq;
+    storage_index_add(idx, offset, mask, ts);
+}
+
+static void merge_delta(storage_segment_t *seg, const storage_seg_delta_t *delta)
+{
+    if (delta->records == 0)
+        return;
+    if (seg->records == 0 || delta->first_ts < seg->first_ts)
+        seg->first_ts = delta->first_ts;
+    if (seg->records == 0 || delta->last_ts > seg->last_ts)
+        seg->last_ts = delta->last_ts;
+    seg->sensors |= delta->sensors;
+    seg->records += delta->records;
+    if (delta->last_seq != 0)
+        seg->last_seq = delta->last_seq;
+}
+
+// Segments of older firmware start with a bare text line, framed ones with the record magic
+static bool file_is_legacy(FILE *f)
+{
+    int c = fgetc(f);
+    return c != EOF && c != STORAGE_RECORD_MAGIC;
+}
+
+/*
+ * Count the valid records of a file from offset on, returns the offset behind the last of them.
+ * Stops at the first torn or corrupt record, whatever follows it is not trusted.
+ */
+static uint32_t scan_records(FILE *f, uint32_t offset, bool legacy, storage_seg_delta_t *delta, storage_index_t *idx)
+{
+    char buf[STORAGE_READER_BUF_SIZE];
+    size_t len = 0;
+    if (fseek(f, offset, SEEK_SET) != 0)
+        return offset;
+
+    while (1)
+    {
+        size_t got = fread(buf + len, 1, sizeof(buf) - len, f);
+        len += got;
+        size_t used = 0;
+        storage_record_t rec;
+        storage_record_status_t status;
+        while ((status = storage_record_parse(buf + used, len - used, &rec, true, legacy)) == STORAGE_RECORD_OK)
+        {
+            account_record(delta, idx, offset + used, buf + used + rec.payload, rec.payload_len, rec.seq);
+            used += rec.size;
+        }
+        offset += used;
+        memmove(buf, buf + used, len - used);
+        len -= used;
+        // A record that fills the whole buffer cannot have been written by storage_write_line
+        if (status == STORAGE_RECORD_BAD || got == 0 || len == sizeof(buf))
+            return offset;
+    }
+}
+
+// Rebuild the statistics and the index of a segment from its file
+static bool scan_segment(storage_segment_t *seg, storage_index_t *idx)
+{
+    char path[48];
+    storage_seg_path(seg->id, path, sizeof(path));
+    FILE *f = fopen(path, "r");
+    if (f == NULL)
+        return false;
+
+    storage_seg_delta_t delta = {0};
+    *idx = (storage_index_t){.id = seg->id};
+    seg->bytes = scan_records(f, 0, file_is_legacy(f), &delta, idx);
+    fclose(f);
+
+    seg->records = 0;
+    seg->sensors = 0;
+    seg->last_seq = 0;
+    merge_delta(seg, &delta);
+    return true;
+}
+
+/*
+ * After a reset only the head can end in a torn record: sealed segments, the index and the
+ * manifest are fsync'ed before anything refers to them. Records behind the size the manifest
+ * knows are validated and the file is cut after the last good one, so the work is bounded by
+ * the data written since the last storage_sync, not by the size of the log.
+ */
+static void recover_head(storage_segment_t *seg)
+{
+    char path[48];
+    struct stat st;
+    storage_seg_path(seg->id, path, sizeof(path));
+    if (stat(path, &st) != 0)
+    {
+        s_head_idx = (storage_index_t){.id = seg->id}; // empty head, never written
+        return;
+    }
+    uint32_t file_size = st.st_size;
+    bool indexed = storage_index_load(seg->id, &s_head_idx);
+    if (file_size == seg->bytes && indexed)
+        return;
+
+    FILE *f = fopen(path, "r");
+    if (f == NULL)
+        return;
+    storage_seg_delta_t delta = {0};
+    uint32_t from = seg->bytes;
+    bool legacy = seg->records > 0 && seg->last_seq == 0;
+    if (file_size < seg->bytes || !indexed)
+    {
+        // Shorter than recorded or no index (older firmware): the whole file is scanned
+        from = 0;
+        seg->records = 0;
+        seg->sensors = 0;
+        seg->last_seq = 0;
+        s_head_idx = (storage_index_t){.id = seg->id};
+        legacy = file_is_legacy(f);
+    }
+    uint32_t end = scan_records(f, from, legacy, &delta, &s_head_idx);
+    fclose(f);
+
+    merge_delta(seg, &delta);
+    seg->bytes = end;
+    if (end < file_size)
+    {
+        truncate(path, end);
+        ESP_LOGW(TAG, "Segment %lu: %lu bytes of a torn record cut off", (unsigned long)seg->id,
+                 (unsigned long)(file_size - end));
+    }
+    ESP_LOGI(TAG, "Head %lu recovered, %lu records scanned from byte %lu", (unsigned long)seg->id,
+             (unsigned long)delta.records, (unsigned long)from);
+}
+
+static storage_segment_t *head(void)
+{
+    return s_count > 0 && s_segs[s_count - 1].state == STORAGE_SEG_OPEN ? &s_segs[s_count - 1] : NULL;
+}
+
+static void save_manifest(void)
+{
+    // The index first, the manifest never describes head bytes the index does not cover
+    storage_segment_t *seg = head();
+    if (seg != NULL && s_head_idx.id == seg->id)
+        storage_index_store(&s_head_idx);
+
+    FILE *f = fopen(MANIFEST_TMP, "wb");
+    if (f == NULL)
+    {
+        ESP_LOGE(TAG, "Failed to write manifest");
+        return;
+    }
+    storage_manifest_header_t header = {
+        .magic = STORAGE_MANIFEST_MAGIC,
+        .version = STORAGE_MANIFEST_VERSION,
+        .count = s_count,
+    };
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+              fwrite(s_segs, sizeof(s_segs[0]), s_count, f) == s_count &&
+              fwrite(&s_upload, sizeof(s_upload), 1, f) == 1;
+    fflush(f);
+    fsync(fileno(f));
+    fclose(f);
+    if (!ok)
+    {
+        ESP_LOGE(TAG, "Failed to write manifest");
+        return;
+    }
+    // FAT cannot rename over an existing file, a reset in between leaves only the .tmp
+    unlink(MANIFEST_PATH);
+    rename(MANIFEST_TMP, MANIFEST_PATH);
+}
+
+static bool load_manifest(const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    if (f == NULL)
+        return false;
+    storage_manifest_header_t header;
+    bool ok = fread(&header, sizeof(header), 1, f) == 1 && header.magic == STORAGE_MANIFEST_MAGIC &&
+              header.version >= 1 && header.version <= STORAGE_MANIFEST_VERSION && reserve(header.count);
+    // Older entries are a prefix of the current ones, the fields added since read as 0
+    size_t entry = header.version == 1   ? offsetof(storage_segment_t, last_seq)
+                   : header.version == 2 ? offsetof(storage_segment_t, packed)
+                                         : sizeof(s_segs[0]);
+    for (size_t i = 0; ok && i < header.count; i++)
+    {
+        s_segs[i] = (storage_segment_t){0};
+        ok = fread(&s_segs[i], entry, 1, f) == 1;
+    }
+    s_upload = (storage_cursor_t){0};
+    if (ok && header.version >= 4)
+        ok = fread(&s_upload, sizeof(s_upload), 1, f) == 1;
+    fclose(f);
+    s_count = ok ? header.count : 0;
+    // Slots of another size, the segments fall back to whole-segment indexes and the head is rescanned
+    if (ok && header.version < 5)
+        storage_index_delete_all();
+    return ok;
+}
+
+static int compare_id(const void *a, const void *b)
+{
+    uint32_t x = ((const storage_segment_t *)a)->id, y = ((const storage_segment_t *)b)->id;
+    return x < y ? -1 : x > y;
+}
+
+// Entry of a compressed segment from the copy in its header
+static bool read_lz_header(uint32_t id, storage_segment_t *seg)
+{
+    char path[48];
+    storage_seg_lz_path(id, path, sizeof(path));
+    FILE *f = fopen(path, "rb");
+    if (f == NULL)
+        return false;
+    storage_lz_header_t header;
+    bool ok = fread(&header, sizeof(header), 1, f) == 1 && header.magic == STORAGE_LZ_MAGIC && header.seg.id == id;
+    fclose(f);
+    if (ok)
+        *seg = header.seg;
+    return ok;
+}
+
+// No usable manifest: every segment file in the directory becomes a sealed segment
+static void rebuild_manifest(void)
+{
+    s_count = 0;
+    s_upload = (storage_cursor_t){0};
+    DIR *dir = opendir(SEGMENT_DIR);
+    if (dir == NULL)
+        return;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL && reserve(s_count + 1))
+    {
+        char *end;
+        unsigned long id = strtoul(entry->d_name, &end, 10);
+        if (end == entry->d_name)
+            continue;
+        if (strcasecmp(end, ".lzs") == 0)
+        {
+            // The raw file wins while it is still there, compression had not finished
+            char path[48];
+            struct stat st;
+            storage_seg_path(id, path, sizeof(path));
+            if (stat(path, &st) != 0 && read_lz_header(id, &s_segs[s_count]))
+            {
+                s_segs[s_count].state = STORAGE_SEG_SEALED;
+                s_count++;
+            }
+            continue;
+        }
+        if (strcasecmp(end, ".log") != 0)
+            continue;
+        s_segs[s_count] = (storage_segment_t){.id = id, .state = STORAGE_SEG_SEALED};
+        static storage_index_t idx; // too big for the stack of storage_init's caller
+        if (scan_segment(&s_segs[s_count], &idx))
+        {
+            storage_index_store(&idx);
+            s_count++;
+        }
+    }
+    closedir(dir);
+    qsort(s_segs, s_count, sizeof(s_segs[0]), compare_id);
+    ESP_LOGW(TAG, "Manifest rebuilt from %u segment files", (unsigned)s_count);
+}
+
+static void pack_close(bool keep);
+
+static void delete_segment(size_t index)
+{
+    if (s_segs[index].id == s_pack.id)
+        pack_close(false);
+    if (s_segs[index].id == s_upload.segment)
+        s_upload = (storage_cursor_t){0};
+    char path[48];
+    segment_file(&s_segs[index], path, sizeof(path));
+    unlink(path);
+    // Approximation until the next scan
+    storage_free_bytes += allocated(s_segs[index].packed ? s_segs[index].packed : s_segs[index].bytes);
+    memmove(&s_segs[index], &s_segs[index + 1], (s_count - index - 1) * sizeof(s_segs[0]));
+    s_count--;
+}
+
+// Make room for one more segment: drop uploaded segments first, then finished captures, unsent data
+// only if there is no other way
+static void enforce_retention(void)
+{
+    // Uploaded raw data past STORAGE_RAW_MAX_AGE_S goes early, its history stays in the rollups
+    uint32_t newest = 0;
+    for (size_t i = 0; i < s_count; i++)
+    {
+        if (s_segs[i].records > 0 && s_segs[i].last_ts > newest)
+            newest = s_segs[i].last_ts;
+    }
+    for (size_t i = 0; i < s_count;)
+    {
+        if (s_segs[i].state == STORAGE_SEG_UPLOADED && newest - s_segs[i].last_ts > STORAGE_RAW_MAX_AGE_S)
+            delete_segment(i);
+        else
+            i++;
+    }
+
+    bool room;
+    while (s_count > 0 && (!(room = reserve(s_count + 1)) || storage_free_bytes < STORAGE_RETENTION_MIN_FREE_BYTES))
+    {
+        if (!room)
+            ESP_LOGW(TAG, "No memory for more than %u segments", (unsigned)s_count);
+        size_t victim = s_count;
+        for (size_t i = 0; i < s_count; i++)
+        {
+            if (s_segs[i].state == STORAGE_SEG_UPLOADED)
+            {
+                victim = i;
+                break;
+            }
+        }
+        if (victim == s_count && room && storage_capture_delete_oldest())
+            continue;
+        if (victim == s_count)
+        {
+            if (s_segs[0].state == STORAGE_SEG_OPEN)
+                return;
+            victim = 0;
+            ESP_LOGW(TAG, "Retention drops unsent segment %lu (%lu records)", (unsigned long)s_segs[0].id,
+                     (unsigned long)s_segs[0].records);
+        }
+        delete_segment(victim);
+    }
+}
+
+static void open_new_head(void)
+{
+    enforce_retention();
+    if (!reserve(s_count + 1))
+        return;
+    uint32_t id = s_count > 0 ? s_segs[s_count - 1].id + 1 : 1;
+    s_segs[s_count++] = (storage_segment_t){.id = id, .state = STORAGE_SEG_OPEN};
+    s_head_idx = (storage_index_t){.id = id};
+}
+
+uint32_t storage_seg_init(void)
+{
+    mkdir(SEGMENT_DIR, 0755);
+    if (!load_manifest(MANIFEST_PATH) && !load_manifest(MANIFEST_TMP))
+    {
+        // First boot after the single-file layout: the old log becomes the first segment
+        struct stat st;
+        char path[48];
+        storage_seg_path(1, path, sizeof(path));
+        if (stat(LEGACY_FILE_PATH, &st) == 0 && stat(path, &st) != 0)
+            rename(LEGACY_FILE_PATH, path);
+        rebuild_manifest();
+    }
+
+    // A reset during compression leaves a partial file or both variants of a segment
+    unlink(PACK_TMP_PATH);
+    for (size_t i = 0; i < s_count;)
+    {
+        char path[48];
+        struct stat st;
+        if (s_segs[i].packed)
+            storage_seg_path(s_segs[i].id, path, sizeof(path));
+        else
+            storage_seg_lz_path(s_segs[i].id, path, sizeof(path));
+        unlink(path);
+
+        // Segments deleted behind our back
+        segment_file(&s_segs[i], path, sizeof(path));
+        if (stat(path, &st) != 0 && !(s_segs[i].state == STORAGE_SEG_OPEN && s_segs[i].bytes == 0))
+        {
+            memmove(&s_segs[i], &s_segs[i + 1], (s_count - i - 1) * sizeof(s_segs[0]));
+            s_count--;
+            continue;
+        }
+        i++;
+    }
+
+    if (head() == NULL)
+    {
+        open_new_head();
+    }
+    else
+    {
+        recover_head(head());
+        // A segment is framed or legacy as a whole, new records never go behind bare lines
+        if (head()->records > 0 && head()->last_seq == 0)
+            storage_seg_seal_head();
+    }
+    save_manifest();
+
+    uint32_t last_seq = 0;
+    for (size_t i = 0; i < s_count; i++)
+    {
+        if (s_segs[i].last_seq > last_seq)
+            last_seq = s_segs[i].last_seq;
+    }
+    ESP_LOGI(TAG, "%u segments, head %lu, last record %lu", (unsigned)s_count,
+             (unsigned long)(s_count > 0 ? s_segs[s_count - 1].id : 0), (unsigned long)last_seq);
+    return last_seq;
+}
+
+void storage_seg_seal_head(void)
+{
+    storage_segment_t *seg = head();
+    if (seg == NULL || seg->records == 0)
+        return;
+    if (s_head_file != NULL)
+    {
+        fclose(s_head_file);
+        s_head_file = NULL;
+    }
+    seg->state = STORAGE_SEG_SEALED;
+    storage_index_store(&s_head_idx);
+    open_new_head();
+    save_manifest();
+}
+
+FILE *storage_seg_head_file(size_t incoming)
+{
+    storage_segment_t *seg = head();
+    if (seg != NULL && seg->bytes > 0 && seg->bytes + incoming > STORAGE_SEGMENT_SIZE)
+        storage_seg_seal_head();
+    seg = head();
+    if (seg == NULL)
+    {
+        open_new_head();
+        seg = head();
+        if (seg == NULL)
+            return NULL; // no memory for the entry, the block goes elsewhere
+    }
+
+    if (s_head_file == NULL)
+    {
+        char path[48];
+        storage_seg_path(seg->id, path, sizeof(path));
+        s_head_file = fopen(path, "a");
+        if (s_head_file == NULL)
+        {
+            ESP_LOGE(TAG, "Failed to open %s", path);
+            return NULL;
+        }
+        // Whole blocks are handed over already, a stdio buffer would only add a copy
+        setvbuf(s_head_file, NULL, _IONBF, 0);
+    }
+    return s_head_file;
+}
+
+void storage_seg_commit(const char *block, size_t len)
+{
+    storage_segment_t *seg = head();
+    if (seg == NULL)
+        return;
+    storage_seg_delta_t delta = {0};
+    storage_record_t rec;
+    for (size_t used = 0; storage_record_parse(block + used, len - used, &rec, false, false) == STORAGE_RECORD_OK;
+         used += rec.size)
+        account_record(&delta, &s_head_idx, seg->bytes + used, block + used + rec.payload, rec.payload_len, rec.seq);
+    merge_delta(seg, &delta);
+    seg->bytes += len;
+}
+
+void storage_seg_sync(bool manifest)
+{
+    if (s_head_file != NULL)
+        fsync(fileno(s_head_file));
+    if (manifest)
+        save_manifest();
+}
+
+void storage_seg_delete_all(void)
+{
+    if (s_head_file != NULL)
+    {
+        fclose(s_head_file);
+        s_head_file = NULL;
+    }
+    while (s_count > 0)
+        delete_segment(s_count - 1);
+    // Ids start over at 1, old slots would pass for the new segments
+    storage_index_delete_all();
+    open_new_head();
+    save_manifest();
+}
+
+void storage_seg_detach(void)
+{
+    if (s_head_file != NULL)
+    {
+        fclose(s_head_file);
+        s_head_file = NULL;
+    }
+    if (s_pack.id != 0)
+        pack_close(true); // the temporary file is on the card, init removes it
+    s_count = 0;
+    s_upload = (storage_cursor_t){0};
+}
+
+bool storage_seg_find(uint32_t min_id, storage_segment_t *seg)
+{
+    // Ids ascend, readers look one up per chunk in a table of thousands
+    size_t lo = 0, hi = s_count;
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if (s_segs[mid].id < min_id)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo == s_count)
+        return false;
+    *seg = s_segs[lo];
+    return true;
+}
+
+void storage_seg_index(const storage_segment_t *seg, storage_index_t *idx)
+{
+    storage_segment_t *h = head();
+    if (h != NULL && h->id == seg->id && s_head_idx.id == seg->id)
+    {
+        *idx = s_head_idx;
+        return;
+    }
+    if (storage_index_load(seg->id, idx))
+        return;
+
+    // Segment of older firmware: one block spanning the file, every sensor over the whole segment
+    *idx = (storage_index_t){.id = seg->id, .blocks = 1};
+    idx->block[0] = (storage_index_block_t){.offset = 0, .first_ts = seg->first_ts, .last_ts = seg->last_ts,
+                                            .sensors = seg->sensors};
+    for (int i = 0; i < STORAGE_INDEX_SENSORS; i++)
+        idx->sensor[i] = (storage_index_sensor_t){.first_ts = seg->first_ts, .last_ts = seg->last_ts,
+                                                  .records = seg->records};
+}
+
+size_t storage_segment_list(storage_segment_t *out, size_t max)
+{
+    storage_lock();
+    size_t count = s_count < max ? s_count : max;
+    memcpy(out, s_segs, count * sizeof(s_segs[0]));
+    storage_unlock();
+    return count;
+}
+
+bool storage_segment_next_pending(storage_segment_t *seg)
+{
+    bool found = false;
+    storage_lock();
+    for (size_t i = 0; i < s_count && !found; i++)
+    {
+        if (s_segs[i].state == STORAGE_SEG_SEALED)
+        {
+            *seg = s_segs[i];
+            found = true;
+        }
+    }
+    storage_unlock();
+    return found;
+}
+
+bool storage_segment_mark_uploaded(uint32_t id)
+{
+    bool found = false;
+    storage_lock();
+    for (size_t i = 0; i < s_count; i++)
+    {
+        if (s_segs[i].id == id && s_segs[i].state == STORAGE_SEG_SEALED)
+        {
+            s_segs[i].state = STORAGE_SEG_UPLOADED;
+            if (s_upload.segment == id)
+                s_upload = (storage_cursor_t){0};
+            save_manifest();
+            found = true;
+            break;
+        }
+    }
+    storage_unlock();
+    return found;
+}
+
+static storage_segment_t *find_segment(uint32_t id)
+{
+    for (size_t i = 0; i < s_count; i++)
+    {
+        if (s_segs[i].id == id)
+            return &s_segs[i];
+    }
+    return NULL;
+}
+
+storage_cursor_t storage_segment_upload_cursor(void)
+{
+    storage_lock();
+    storage_cursor_t cursor = s_upload;
+    const storage_segment_t *seg = find_segment(cursor.segment);
+    if (seg == NULL || seg->state != STORAGE_SEG_SEALED || cursor.offset > seg->bytes)
+        cursor = (storage_cursor_t){0};
+    storage_unlock();
+    return cursor;
+}
+
+void storage_segment_set_upload_cursor(storage_cursor_t cursor)
+{
+    storage_lock();
+    const storage_segment_t *seg = find_segment(cursor.segment);
+    if (seg != NULL && seg->state == STORAGE_SEG_SEALED && cursor.offset <= seg->bytes &&
+        (cursor.segment != s_upload.segment || cursor.offset != s_upload.offset))
+    {
+        s_upload = cursor;
+        save_manifest();
+    }
+    storage_unlock();
+}
+
+static storage_segment_t *next_to_pack(void)
+{
+    // Uploaded segments are the first to be deleted, compressing them is wasted work
+    for (size_t i = 0; i < s_count; i++)
+    {
+        if (s_segs[i].state == STORAGE_SEG_SEALED && s_segs[i].packed == 0 && s_segs[i].bytes > 0)
+            return &s_segs[i];
+    }
+    return NULL;
+}
+
+static void pack_close(bool keep)
+{
+    if (s_pack.in != NULL)
+        fclose(s_pack.in);
+    if (s_pack.out != NULL)
+        fclose(s_pack.out);
+    if (!keep)
+        unlink(PACK_TMP_PATH);
+    memset(&s_pack, 0, sizeof(s_pack));
+}
+
+static void pack_fail(const char *what, uint32_t id)
+{
+    ESP_LOGE(TAG, "%s segment %lu, next try in %d ms", what, (unsigned long)id, STORAGE_CARD_RETRY_MS);
+    pack_close(false);
+    s_pack_resume_us = esp_timer_get_time() + STORAGE_CARD_RETRY_MS * 1000LL;
+}
+
+static bool pack_begin(const storage_segment_t *seg)
+{
+    char path[48];
+    storage_seg_path(seg->id, path, sizeof(path));
+    s_pack.id = seg->id;
+    s_pack.blocks = (seg->bytes + STORAGE_INDEX_STRIDE - 1) / STORAGE_INDEX_STRIDE;
+    s_pack.in = fopen(path, "rb");
+    s_pack.out = fopen(PACK_TMP_PATH, "w+b");
+    if (s_pack.in == NULL || s_pack.out == NULL)
+        return false;
+
+    // Header and offset table are rewritten once the sizes are known
+    storage_lz_header_t header = {.magic = STORAGE_LZ_MAGIC, .blocks = s_pack.blocks, .seg = *seg};
+    uint32_t offset = 0;
+    bool ok = fwrite(&header, sizeof(header), 1, s_pack.out) == 1;
+    for (uint32_t i = 0; ok && i <= s_pack.blocks; i++)
+        ok = fwrite(&offset, sizeof(offset), 1, s_pack.out) == 1;
+    return ok;
+}
+
+static bool write_offset(uint32_t block, uint32_t offset)
+{
+    return fseek(s_pack.out, sizeof(storage_lz_header_t) + block * sizeof(uint32_t), SEEK_SET) == 0 &&
+           fwrite(&offset, sizeof(offset), 1, s_pack.out) == 1 && fseek(s_pack.out, 0, SEEK_END) == 0;
+}
+
+static bool pack_block(uint8_t *scratch)
+{
+    uint16_t *hash = (uint16_t *)scratch;
+    uint8_t *raw = scratch + STORAGE_LZ_HASH_SIZE * sizeof(uint16_t);
+    uint8_t *out = raw + STORAGE_INDEX_STRIDE;
+
+    if (fseek(s_pack.in, s_pack.block * STORAGE_INDEX_STRIDE, SEEK_SET) != 0)
+        return false;
+    size_t len = fread(raw, 1, STORAGE_INDEX_STRIDE, s_pack.in);
+    if (len == 0)
+        return false;
+    size_t packed = storage_lz_compress(raw, len, out, hash);
+    long offset = ftell(s_pack.out);
+    return offset > 0 && write_offset(s_pack.block, offset) && fwrite(out, 1, packed, s_pack.out) == packed;
+}
+
+// Swap the compressed file in for the raw one, the manifest decides which of the two is current
+static void pack_finish(storage_segment_t *seg)
+{
+    long size = ftell(s_pack.out);
+    storage_segment_t entry = *seg;
+    entry.packed = size;
+    storage_lz_header_t header = {.magic = STORAGE_LZ_MAGIC, .blocks = s_pack.blocks, .seg = entry};
+    bool ok = size > 0 && write_offset(s_pack.blocks, size) && fseek(s_pack.out, 0, SEEK_SET) == 0 &&
+              fwrite(&header, sizeof(header), 1, s_pack.out) == 1 && fflush(s_pack.out) == 0 &&
+              fsync(fileno(s_pack.out)) == 0;
+    if (!ok)
+    {
+        pack_fail("Failed to compress", entry.id);
+        return;
+    }
+    pack_close(true);
+
+    char lz_path[48], raw_path[48];
+    storage_seg_lz_path(entry.id, lz_path, sizeof(lz_path));
+    storage_seg_path(entry.id, raw_path, sizeof(raw_path));
+    unlink(lz_path);
+    if (rename(PACK_TMP_PATH, lz_path) != 0)
+    {
+        unlink(PACK_TMP_PATH);
+        return;
+    }
+    seg->packed = size;
+    save_manifest();
+    unlink(raw_path);
+    storage_free_bytes += allocated(seg->bytes) - allocated(seg->packed);
+    ESP_LOGI(TAG, "Segment %lu compressed %lu -> %lu bytes", (unsigned long)seg->id, (unsigned long)seg->bytes,
+             (unsigned long)seg->packed);
+}
+
+bool storage_seg_compress_pending(void)
+{
+    storage_lock();
+    bool pending = s_pack.id != 0 || (esp_timer_get_time() >= s_pack_resume_us && next_to_pack() != NULL);
+    storage_unlock();
+    return pending;
+}
+
+void storage_seg_compress_step(uint8_t *scratch)
+{
+    storage_lock();
+    storage_segment_t *seg = s_pack.id != 0 ? find_segment(s_pack.id) : NULL;
+    if (s_pack.id != 0 && (seg == NULL || seg->packed != 0 || seg->state != STORAGE_SEG_SEALED))
+    {
+        // Deleted, uploaded or cleared in the meantime
+        pack_close(false);
+        seg = NULL;
+    }
+    if (s_pack.id == 0 && esp_timer_get_time() >= s_pack_resume_us && (seg = next_to_pack()) != NULL &&
+        !pack_begin(seg))
+    {
+        pack_fail("Cannot start compressing", seg->id);
+        seg = NULL;
+    }
+
+    if (seg != NULL)
+    {
+        if (!pack_block(scratch))
+        {
+            pack_fail("Failed to compress", seg->id);
+        }
+        else if (++s_pack.block == s_pack.blocks)
+        {
+            pack_finish(seg);
+        }
+    }
+    storage_unlock();
+}
+
+void storage_seg_packed_totals(uint32_t *segments, uint64_t *raw, uint64_t *packed)
+{
+    *segments = 0;
+    *raw = 0;
+    *packed = 0;
+    storage_lock();
+    for (size_t i = 0; i < s_count; i++)
+    {
+        if (s_segs[i].packed)
+        {
+            (*segments)++;
+            *raw += s_segs[i].bytes;
+            *packed += s_segs[i].packed;
+        }
+    }
+    storage_unlock();
+}
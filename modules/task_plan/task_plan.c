@@ -0,0 +1,99 @@
+#include "task_plan.h"
+#include <stdatomic.h>
+#include "esp_log.h"
+
+static const char *TAG = "TASK_PLAN";
+
+/*
+ * Priorities: acquisition tasks run above everything the project creates on the
+ * network core, the ultrasonic/buzzer timeline is the most latency sensitive one.
+ * Networking stays below the IDF Wi-Fi (23) and lwIP (18) tasks.
+ */
+static const task_plan_entry_t s_plan[TASK_ID_COUNT] = {
+    /* Acquisition core */
+    [TASK_ID_HCSR04] = {"HSRC04_Buzzer", 8192, 10, TASK_CORE_ACQUISITION, false},
+    [TASK_ID_ADXL345] = {"adxl345_task", 4096, 8, TASK_CORE_ACQUISITION, false},
+    [TASK_ID_MAX6675_PROFILE] = {"max6675_profile_task", 4096, 7, TASK_CORE_ACQUISITION, false},
+    [TASK_ID_BMP280] = {"bmp280_task", 4096, 6, TASK_CORE_ACQUISITION, false},
+    [TASK_ID_VEML7700] = {"VEML7700_Task", 2048, 6, TASK_CORE_ACQUISITION, false},
+    [TASK_ID_MAX6675] = {"max6675_task", 2048, 6, TASK_CORE_ACQUISITION, false},
+    /* Network / storage / UI core */
+    [TASK_ID_MQTT] = {"mqtt_hello", 4096, 5, TASK_CORE_NETWORK, false},
+    [TASK_ID_HTTP] = {"http_get_task", 4096, 4, TASK_CORE_NETWORK, false},
+    [TASK_ID_STORAGE_WRITER] = {"storage_writer", 4096, 4, TASK_CORE_NETWORK, false},
+    [TASK_ID_SENSOR_TRACE] = {"sensor_trace", 4096, 3, TASK_CORE_NETWORK, true},
+    [TASK_ID_BLE_WIFI_START] = {"ble_wifi_start", 4096, 4, TASK_CORE_NETWORK, true},
+    [TASK_ID_BUTTON] = {"button_task", 4096, 3, TASK_CORE_NETWORK, false},
+    [TASK_ID_STATUS_LED] = {"led_status_task", 2048, 2, TASK_CORE_NETWORK, false},
+    [TASK_ID_TASK_STATS] = {"task_stats", 3072, 1, TASK_CORE_NETWORK, false},
+};
+
+static TaskHandle_t s_handles[TASK_ID_COUNT];
+static _Atomic uint32_t s_create_count[TASK_ID_COUNT];
+static _Atomic uint32_t s_exit_count[TASK_ID_COUNT];
+
+BaseType_t task_plan_create(task_id_t id, TaskFunction_t fn, void *arg, TaskHandle_t *out_handle)
+{
+    if (id < 0 || id >= TASK_ID_COUNT)
+        return pdFAIL;
+
+    const task_plan_entry_t *entry = &s_plan[id];
+    TaskHandle_t handle = NULL;
+    BaseType_t ret = xTaskCreatePinnedToCore(fn, entry->name, entry->stack_size, arg,
+                                             entry->priority, &handle, entry->core);
+    if (ret != pdPASS)
+    {
+        ESP_LOGE(TAG, "Failed to create %s (stack %lu, core %d)", entry->name,
+                 (unsigned long)entry->stack_size, (int)entry->core);
+        return ret;
+    }
+
+    atomic_fetch_add(&s_create_count[id], 1);
+    if (!entry->transient)
+        s_handles[id] = handle;
+    if (out_handle)
+        *out_handle = handle;
+    return ret;
+}
+
+void task_plan_exit(task_id_t id)
+{
+    if (id >= 0 && id < TASK_ID_COUNT)
+    {
+        if (s_handles[id] == xTaskGetCurrentTaskHandle())
+            s_handles[id] = NULL;
+        atomic_fetch_add(&s_exit_count[id], 1);
+    }
+    vTaskDelete(NULL);
+}
+
+const task_plan_entry_t *task_plan_get(task_id_t id)
+{
+    if (id < 0 || id >= TASK_ID_COUNT)
+        return NULL;
+    return &s_plan[id];
+}
+
+TaskHandle_t task_plan_handle(task_id_t id)
+{
+    if (id < 0 || id >= TASK_ID_COUNT)
+        return NULL;
+    return s_handles[id];
+}
+
+void task_plan_report(void)
+{
+    ESP_LOGI(TAG, "%-22s %6s %4s %4s %s", "task", "stack", "prio", "core", "state");
+    for (int i = 0; i < TASK_ID_COUNT; i++)
+    {
+        const task_plan_entry_t *entry = &s_plan[i];
+        uint32_t created = atomic_load(&s_create_count[i]);
+        uint32_t running = created - atomic_load(&s_exit_count[i]);
+        const char *state = running ? "running" : created ? "exited" : "not started";
+        if (entry->transient)
+            state = created ? "on demand (started)" : "on demand";
+
+        ESP_LOGI(TAG, "%-22s %6lu %4u %4d %s", entry->name, (unsigned long)entry->stack_size,
+                 (unsigned)entry->priority, (int)entry->core, state);
+    }
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+/*
+ * Core split:
+ * - TASK_CORE_NETWORK (PRO_CPU, core 0) already hosts the Wi-Fi/BT controller and
+ *   lwIP tasks, so MQTT, HTTP, BLE helpers, storage and UI tasks live there too.
+ * - TASK_CORE_ACQUISITION (APP_CPU, core 1) is reserved for sensor sampling and the
+ *   buzzer timeline, so an SD write or an upload never delays a measurement.
+ */
+#if CONFIG_FREERTOS_UNICORE
+#define TASK_CORE_NETWORK     0
+#define TASK_CORE_ACQUISITION 0
+#else
+#define TASK_CORE_NETWORK     0
+#define TASK_CORE_ACQUISITION 1
+#endif
+
+typedef enum
+{
+    TASK_ID_HCSR04 = 0,
+    TASK_ID_ADXL345,
+    TASK_ID_BMP280,
+    TASK_ID_VEML7700,
+    TASK_ID_MAX6675,
+    TASK_ID_MAX6675_PROFILE,
+    TASK_ID_MQTT,
+    TASK_ID_HTTP,
+    TASK_ID_BLE_WIFI_START,
+    TASK_ID_BUTTON,
+    TASK_ID_STATUS_LED,
+    TASK_ID_TASK_STATS,
+    TASK_ID_STORAGE_WRITER,
+    TASK_ID_SENSOR_TRACE,
+    TASK_ID_COUNT
+} task_id_t;
+
+typedef struct
+{
+    const char *name;
+    uint32_t stack_size; /*!< Stack depth in bytes */
+    UBaseType_t priority;
+    BaseType_t core;
+    bool transient; /*!< Task deletes itself when done, may be created many times */
+} task_plan_entry_t;
+
+/**
+ * @brief Create a task with the name, stack size, priority and core assigned in the placement table.
+ *
+ * @param id Task identifier
+ * @param fn Task function
+ * @param arg Task argument
+ * @param out_handle Optional pointer for the created task handle
+ * @return **BaseType_t** - pdPASS on success
+ */
+BaseType_t task_plan_create(task_id_t id, TaskFunction_t fn, void *arg, TaskHandle_t *out_handle);
+
+/**
+ * @brief End the calling task, created with task_plan_create under id. Use instead of
+ * vTaskDelete(NULL): the handle is dropped and the reports show the task as exited.
+ */
+void task_plan_exit(task_id_t id);
+
+/**
+ * @brief Get the placement table entry of a task.
+ */
+const task_plan_entry_t *task_plan_get(task_id_t id);
+
+/**
+ * @brief Handle of a running long-lived task, NULL if not created, exited (or transient).
+ */
+TaskHandle_t task_plan_handle(task_id_t id);
+
+/**
+ * @brief Log the placement table together with the state of every task (boot-time report).
+ */
+void task_plan_report(void);
@@ -0,0 +1,222 @@
+#include "task_stats.h"
+#include <stdio.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "task_plan.h"
+
+static const char *TAG = "TASK_STATS";
+
+#if CONFIG_FREERTOS_USE_TRACE_FACILITY && CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+
+typedef struct
+{
+    TaskHandle_t handle;
+    uint32_t last_runtime;
+    uint16_t cpu_x10[TASK_STATS_HISTORY_LEN]; // CPU share in 0.1 % units
+    uint32_t hwm_bytes;
+} tracked_task_t;
+
+static tracked_task_t s_tracked[TASK_ID_COUNT];
+static TaskStatus_t s_status[TASK_STATS_MAX_TASKS];
+static uint32_t s_last_total_runtime = 0;
+static uint8_t s_history_head = 0;
+static uint32_t s_sample_count = 0;
+static SemaphoreHandle_t s_lock = NULL;
+
+static int find_plan_id(const TaskStatus_t *status)
+{
+    for (int id = 0; id < TASK_ID_COUNT; id++)
+    {
+        TaskHandle_t handle = task_plan_handle(id);
+        if (handle != NULL && handle == status->xHandle)
+            return id;
+        if (handle == NULL && strcmp(task_plan_get(id)->name, status->pcTaskName) == 0)
+            return id; // transient tasks are matched by name
+    }
+    return -1;
+}
+
+static void sample(void)
+{
+    uint32_t total_runtime = 0;
+    UBaseType_t count = uxTaskGetSystemState(s_status, TASK_STATS_MAX_TASKS, &total_runtime);
+    if (count == 0)
+    {
+        ESP_LOGW(TAG, "More than %d tasks, increase TASK_STATS_MAX_TASKS", TASK_STATS_MAX_TASKS);
+        return;
+    }
+
+    // The run-time counter advances on every core at once
+    uint32_t elapsed = (total_runtime - s_last_total_runtime) * portNUM_PROCESSORS;
+    s_last_total_runtime = total_runtime;
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    uint8_t slot = s_history_head;
+    uint32_t seen = 0;
+    for (int id = 0; id < TASK_ID_COUNT; id++)
+        s_tracked[id].cpu_x10[slot] = 0;
+
+    for (UBaseType_t i = 0; i < count; i++)
+    {
+        int id = find_plan_id(&s_status[i]);
+        if (id < 0)
+            continue;
+
+        tracked_task_t *t = &s_tracked[id];
+        seen |= 1u << id;
+        if (t->handle != s_status[i].xHandle)
+        {
+            // First sample of this task instance: no delta yet
+            t->handle = s_status[i].xHandle;
+            t->last_runtime = s_status[i].ulRunTimeCounter;
+        }
+        uint32_t delta = s_status[i].ulRunTimeCounter - t->last_runtime;
+        t->last_runtime = s_status[i].ulRunTimeCounter;
+        t->cpu_x10[slot] = elapsed ? (uint16_t)(((uint64_t)delta * 1000) / elapsed) : 0;
+        t->hwm_bytes = s_status[i].usStackHighWaterMark; // bytes on ESP-IDF
+    }
+    // Tasks that exited (or were deleted) leave the table, their handles may be reused
+    for (int id = 0; id < TASK_ID_COUNT; id++)
+    {
+        if (!(seen & (1u << id)))
+            s_tracked[id].handle = NULL;
+    }
+
+    s_history_head = (slot + 1) % TASK_STATS_HISTORY_LEN;
+    s_sample_count++;
+    xSemaphoreGive(s_lock);
+}
+
+static void task_stats_task(void *arg)
+{
+    while (1)
+    {
+        sample();
+        vTaskDelay(pdMS_TO_TICKS(TASK_STATS_SAMPLE_INTERVAL_MS));
+    }
+}
+
+void task_stats_start(void)
+{
+    if (s_lock != NULL)
+        return;
+    s_lock = xSemaphoreCreateMutex();
+    task_plan_create(TASK_ID_TASK_STATS, task_stats_task, NULL, NULL);
+}
+
+static uint8_t latest_slot(void)
+{
+    return (s_history_head + TASK_STATS_HISTORY_LEN - 1) % TASK_STATS_HISTORY_LEN;
+}
+
+void task_stats_print(void)
+{
+    if (s_lock == NULL || s_sample_count < 2)
+    {
+        printf(">> Task stats not available yet.\n");
+        return;
+    }
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    uint8_t latest = latest_slot();
+    uint32_t history = s_sample_count - 1 < TASK_STATS_HISTORY_LEN ? s_sample_count - 1 : TASK_STATS_HISTORY_LEN;
+
+    printf("%-22s %4s %6s %6s %6s  cpu history (old -> new, %%)\n", "task", "core", "stack", "free", "cpu%");
+    for (int id = 0; id < TASK_ID_COUNT; id++)
+    {
+        const tracked_task_t *t = &s_tracked[id];
+        const task_plan_entry_t *entry = task_plan_get(id);
+        if (t->handle == NULL)
+            continue;
+
+        uint16_t cpu = t->cpu_x10[latest];
+        printf("%-22s %4d %6lu %6lu %3u.%u ", entry->name, (int)entry->core,
+               (unsigned long)entry->stack_size, (unsigned long)t->hwm_bytes, cpu / 10, cpu % 10);
+        for (uint32_t i = history; i > 0; i--)
+        {
+            uint16_t v = t->cpu_x10[(s_history_head + TASK_STATS_HISTORY_LEN - i) % TASK_STATS_HISTORY_LEN];
+            printf(" %u.%u", v / 10, v % 10);
+        }
+        printf("\n");
+    }
+    xSemaphoreGive(s_lock);
+}
+
+// "],\"omitted\":NN}" and the terminator
+#define JSON_TAIL_MAX 18
+
+size_t task_stats_format_json(char *buf, size_t len)
+{
+    if (s_lock == NULL || s_sample_count < 2 || len < 64)
+        return 0;
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    uint8_t latest = latest_slot();
+    int n = snprintf(buf, len, "{\"uptime_s\":%lu,\"tasks\":[",
+                     (unsigned long)(esp_timer_get_time() / 1000000));
+    if (n < 0 || (size_t)n >= len - JSON_TAIL_MAX)
+    {
+        xSemaphoreGive(s_lock);
+        return 0;
+    }
+    size_t pos = n;
+    bool first = true;
+    unsigned omitted = 0;
+
+    for (int id = 0; id < TASK_ID_COUNT; id++)
+    {
+        const tracked_task_t *t = &s_tracked[id];
+        const task_plan_entry_t *entry = task_plan_get(id);
+        if (t->handle == NULL)
+            continue;
+        if (omitted > 0)
+        {
+            omitted++;
+            continue;
+        }
+
+        uint16_t cpu = t->cpu_x10[latest];
+        size_t room = len - pos - JSON_TAIL_MAX; // keep space for the tail
+        n = snprintf(buf + pos, room, "%s{\"name\":\"%s\",\"core\":%d,\"cpu\":\"%u.%u\",\"hwm\":%lu,\"stack\":%lu}",
+                     first ? "" : ",", entry->name, (int)entry->core, cpu / 10, cpu % 10,
+                     (unsigned long)t->hwm_bytes, (unsigned long)entry->stack_size);
+        if (n < 0 || (size_t)n >= room)
+        {
+            omitted = 1;
+            continue;
+        }
+        pos += n;
+        first = false;
+    }
+    xSemaphoreGive(s_lock);
+
+    if (omitted > 0)
+        pos += snprintf(buf + pos, len - pos, "],\"omitted\":%u}", omitted);
+    else
+        pos += snprintf(buf + pos, len - pos, "]}");
+    return pos;
+}
+
+#else
+
+void task_stats_start(void)
+{
+    ESP_LOGW(TAG, "Run-time stats disabled, enable CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS");
+}
+
+void task_stats_print(void)
+{
+    printf(">> Task stats disabled in sdkconfig.\n");
+}
+
+size_t task_stats_format_json(char *buf, size_t len)
+{
+    return 0;
+}
+
+#endif
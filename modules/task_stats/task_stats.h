@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Requires CONFIG_FREERTOS_USE_TRACE_FACILITY and CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+ * (see sdkconfig.defaults). Without them the module compiles to no-ops.
+ */
+
+#define TASK_STATS_MAX_TASKS          32
+#define TASK_STATS_HISTORY_LEN        12
+#define TASK_STATS_SAMPLE_INTERVAL_MS (5 * 1000)
+
+/**
+ * @brief Start the background task that samples run-time counters and stack high-water marks.
+ */
+void task_stats_start(void);
+
+/**
+ * @brief Print the latest snapshot and CPU history of project tasks (console "tasks" command).
+ */
+void task_stats_print(void);
+
+/**
+ * @brief Serialize the latest snapshot of project tasks as JSON.
+ *
+ * Format: {"uptime_s":N,"tasks":[{"name":"...","core":N,"cpu":"x.y","hwm":N,"stack":N},...]}
+ * - cpu: share of total CPU time since the previous sample (all cores), in percent
+ * - hwm: minimum free stack seen so far, in bytes
+ * Tasks that exited are left out. When buf cannot hold every task the list is cut after the
+ * last whole entry and "omitted":N (tasks left out) follows it.
+ *
+ * @return **size_t** - Number of characters written (0 when no sample is available yet)
+ */
+size_t task_stats_format_json(char *buf, size_t len);
@@ -0,0 +1,152 @@
+#include "upload_batch.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "project_config.h"
+
+typedef struct
+{
+    char type[24];
+    char topic[96]; // built once per sensor
+    size_t room;    // payload bytes a packet with this topic allows
+    uint8_t frame[MQTT_UPLOAD_MAX_PACKET];
+    size_t len;
+    uint16_t count;
+    uint32_t base_ts;
+    storage_cursor_t first; // where the oldest sample of the frame is stored
+    uint32_t used;          // for reusing the least recently used slot
+} upload_batch_t;
+
+static upload_batch_t s_batches[UPLOAD_BATCH_SENSORS];
+static uint32_t s_batch_clock;
+static char s_prefix[64];
+static upload_batch_send_fn s_send;
+static void *s_send_ctx;
+
+void upload_batch_begin(const char *prefix, upload_batch_send_fn send, void *ctx)
+{
+    snprintf(s_prefix, sizeof(s_prefix), "%s", prefix);
+    s_send = send;
+    s_send_ctx = ctx;
+    // Topics carry the prefix, every slot is set up again
+    for (size_t i = 0; i < UPLOAD_BATCH_SENSORS; i++)
+    {
+        s_batches[i].type[0] = '\0';
+        s_batches[i].count = 0;
+        s_batches[i].used = 0;
+    }
+}
+
+static bool batch_send(upload_batch_t *b)
+{
+    if (b->count == 0)
+        return true;
+    b->frame[0] = UPLOAD_BATCH_VERSION;
+    b->frame[1] = 0;
+    memcpy(&b->frame[2], &b->count, sizeof(b->count));
+    memcpy(&b->frame[4], &b->base_ts, sizeof(b->base_ts));
+    if (!s_send(b->topic, b->frame, b->len, b->count, b->first, s_send_ctx))
+        return false;
+    b->count = 0;
+    return true;
+}
+
+bool upload_batch_flush_all(void)
+{
+    for (size_t i = 0; i < UPLOAD_BATCH_SENSORS; i++)
+    {
+        if (!batch_send(&s_batches[i]))
+            return false;
+    }
+    return true;
+}
+
+storage_cursor_t upload_batch_oldest_unsent(storage_cursor_t at)
+{
+    for (size_t i = 0; i < UPLOAD_BATCH_SENSORS; i++)
+    {
+        const upload_batch_t *b = &s_batches[i];
+        if (b->count > 0 && b->first.segment == at.segment && b->first.offset < at.offset)
+            at = b->first;
+    }
+    return at;
+}
+
+void upload_batch_reset(void)
+{
+    for (size_t i = 0; i < UPLOAD_BATCH_SENSORS; i++)
+        s_batches[i].count = 0;
+}
+
+static upload_batch_t *batch_for(const char *type, size_t type_len, bool *ok)
+{
+    upload_batch_t *slot = &s_batches[0];
+    for (size_t i = 0; i < UPLOAD_BATCH_SENSORS; i++)
+    {
+        upload_batch_t *b = &s_batches[i];
+        if (b->type[0] != '\0' && strncmp(b->type, type, type_len) == 0 && b->type[type_len] == '\0')
+        {
+            b->used = ++s_batch_clock;
+            return b;
+        }
+        if (b->used < slot->used)
+            slot = b;
+    }
+    if (type_len >= sizeof(slot->type))
+        return NULL; // no sensor has such a name, the line is skipped
+    // More sensors than slots: the least recently used one is sent and taken over
+    if (!batch_send(slot))
+    {
+        *ok = false;
+        return NULL;
+    }
+    memcpy(slot->type, type, type_len);
+    slot->type[type_len] = '\0';
+    int topic_len = snprintf(slot->topic, sizeof(slot->topic), "%s/batch/%s", s_prefix, slot->type);
+    // PUBLISH overhead: fixed header up to 5 bytes, topic length 2 bytes
+    slot->room = MQTT_UPLOAD_MAX_PACKET - 7 - topic_len;
+    if (slot->room > sizeof(slot->frame))
+        slot->room = sizeof(slot->frame);
+    slot->count = 0;
+    slot->used = ++s_batch_clock;
+    return slot;
+}
+
+bool upload_batch_add(const char *line, size_t len, storage_cursor_t at)
+{
+    const char *end = line + len;
+    const char *sep = memchr(line, ';', len);
+    if (sep == NULL)
+        return true; // not a sample, nothing to send
+    char *next;
+    unsigned long ts = strtoul(sep + 1, &next, 10);
+    if (next == sep + 1 || next >= end || *next != ';')
+        return true;
+    char *val_end;
+    float value = strtof(next + 1, &val_end);
+    if (val_end == next + 1 || val_end > end)
+        return true;
+
+    bool ok = true;
+    upload_batch_t *b = batch_for(line, sep - line, &ok);
+    if (b == NULL)
+        return ok;
+    if (b->count > 0 && (ts < b->base_ts || ts - b->base_ts > UINT16_MAX ||
+                         b->len + UPLOAD_BATCH_SAMPLE_SIZE > b->room || b->count == UINT16_MAX))
+    {
+        if (!batch_send(b))
+            return false;
+    }
+    if (b->count == 0)
+    {
+        b->base_ts = ts;
+        b->first = at;
+        b->len = UPLOAD_BATCH_HEADER_SIZE;
+    }
+    uint16_t dt = ts - b->base_ts;
+    memcpy(&b->frame[b->len], &dt, sizeof(dt));
+    memcpy(&b->frame[b->len + 2], &value, sizeof(value));
+    b->len += UPLOAD_BATCH_SAMPLE_SIZE;
+    b->count++;
+    return true;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "storage_manager.h"
+
+/*
+ * Encoder of the stored sample upload: one binary frame per sensor on <prefix>/batch/TYPE,
+ * filled up to MQTT_UPLOAD_MAX_PACKET (little endian):
+ *   uint8 version (1), uint8 reserved, uint16 count, uint32 base_ts
+ *   count x { uint16 dt (timestamp - base_ts), float value }
+ * Up to UPLOAD_BATCH_SENSORS frames are filled at once, a further sensor takes over the least
+ * recently used one. Finished frames go to the transport given to upload_batch_begin(), the MQTT
+ * client on the device and a counter in the host replay.
+ */
+#define UPLOAD_BATCH_VERSION     1
+#define UPLOAD_BATCH_HEADER_SIZE 8
+#define UPLOAD_BATCH_SAMPLE_SIZE 6
+#define UPLOAD_BATCH_SENSORS     8
+
+/**
+ * @brief Transport of finished frames.
+ *
+ * @param topic <prefix>/batch/TYPE
+ * @param frame Header and samples, valid until the call returns
+ * @param len Frame length in bytes
+ * @param count Samples in the frame
+ * @param first Where the oldest sample of the frame is stored
+ * @param ctx Context given to upload_batch_begin()
+ * @return false if the frame could not be sent, it stays in its slot
+ */
+typedef bool (*upload_batch_send_fn)(const char *topic, const uint8_t *frame, size_t len, uint16_t count,
+                                     storage_cursor_t first, void *ctx);
+
+/**
+ * @brief Start an upload: forget every frame and send the next ones with `send`.
+ *
+ * @param prefix Topic prefix, <user>/<mac> on the device
+ */
+void upload_batch_begin(const char *prefix, upload_batch_send_fn send, void *ctx);
+
+/**
+ * @brief Add one stored line TYPE;TIMESTAMP;VALUE to the frame of its sensor.
+ * Lines that are not samples are skipped.
+ *
+ * @param at Storage position of the line
+ * @return false if a full frame could not be sent
+ */
+bool upload_batch_add(const char *line, size_t len, storage_cursor_t at);
+
+/**
+ * @brief Send every frame holding samples, false if one could not be sent.
+ */
+bool upload_batch_flush_all(void);
+
+/**
+ * @brief Oldest position before `at` (same segment) that is in a frame not sent yet, `at` if none.
+ */
+storage_cursor_t upload_batch_oldest_unsent(storage_cursor_t at);
+
+/**
+ * @brief Drop the samples of unsent frames, they are read again from the stored data.
+ */
+void upload_batch_reset(void);